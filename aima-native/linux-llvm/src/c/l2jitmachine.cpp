@@ -1,4 +1,5 @@
 #include "llvm/BasicBlock.h"
+#include "llvm/CallingConv.h"
 #include "llvm/GlobalVariable.h"
 #include "llvm/Module.h"
 #include "llvm/Constants.h"
@@ -11,75 +12,74 @@
 #include "llvm/LinkAllPasses.h"
 #include "llvm/Analysis/Verifier.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/Linker.h"
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetSelect.h"
+#include "llvm/Target/TargetOptions.h"
 #include "llvm/ExecutionEngine/JIT.h"
 #include "llvm/ExecutionEngine/Interpreter.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
 #include "llvm/Support/IRBuilder.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/System/Threading.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 #include <iostream>
 #include <cstdarg>
 #include <cstdlib>
+#include <cstring>
+#include <cstdio>
 #include <fstream>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include "com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine.h"
 #include "trace.h"
+#include "dataarea.h"
+#include "cell.h"
+#include "machinecore.h"
+#include "profile.h"
+#include "jitsymbols.h"
 
 using namespace llvm;
 
-/* Defines the machine instruction types. */
-#define PUT_STRUC 0x01
-#define SET_VAR 0x02
-#define SET_VAL 0x03
-#define GET_STRUC 0x04
-#define UNIFY_VAR 0x05
-#define UNIFY_VAL 0x06
-#define PUT_VAR 0x07
-#define PUT_VAL 0x08
-#define GET_VAR 0x09
-#define GET_VAL 0x0a
-#define CALL 0x0b
-#define PROCEED 0x0c
-#define ALLOCATE 0x0d
-#define DEALLOCATE 0x0e
-
-/* Defines the addressing modes. */
-#define REG_ADDR 0x01
-#define STACK_ADDR 0x02
-
-/* Defines the heap cell marker types. */
-#define REF 0x01
-#define STR 0x02
-
-/* Defines the register capacity for the virtual machine. */
-#define REG_SIZE 10
+/* Defines the regions of the data area, in the order in which they are laid out. */
+#define REG_REGION 0
+#define HEAP_REGION 1
+#define STACK_REGION 2
+#define PDL_REGION 3
+#define REGION_COUNT 4
 
-/* Defines the offset of the first register in the data area. */
-#define REG_BASE 0
+/* Defines the limit of the data area, as far as heap cells can address. */
+#define ADDR_LIMIT CELL_ADDR_LIMIT
 
-/* Defines the heap size to use for the virtual machine. */
-#define HEAP_SIZE 10000
+/* Defines the offset of the first register in the data area. */
+#define REG_BASE (l2jit->area.base[REG_REGION])
 
 /* Defines the offset of the base of the heap in the data area. */
-#define HEAP_BASE REG_SIZE
-
-/* Defines the stack size to use for the virtual machine. */
-#define STACK_SIZE 10000
+#define HEAP_BASE (l2jit->area.base[HEAP_REGION])
 
 /* Defines the offset of the base of the stack in the data area. */
-#define STACK_BASE (HEAP_BASE + HEAP_SIZE)
-
-/* Defines the max unification stack depth for the virtual machine. */
-#define PDL_SIZE 1000
+#define STACK_BASE (l2jit->area.base[STACK_REGION])
 
 /* Defines the offset of the base of the PDL in the data area. */
-#define PDL_BASE (REG_SIZE + HEAP_SIZE + STACK_SIZE)
+#define PDL_BASE (l2jit->area.base[PDL_REGION])
 
 /* Defines the highest address in the data area of the virtual machine. */
-#define TOP (REG_SIZE + HEAP_SIZE + STACK_SIZE + PDL_SIZE)
+#define TOP (l2jit->area.top)
+
+/* Defines the default number of times that an entry point is interpreted, before it is compiled. */
+#define DEFAULT_JIT_THRESHOLD 50
+
+/* Defines the version of the code held in the code cache. This must be changed whenever the generated code changes. */
+#define CODE_CACHE_VERSION 4
 
 #define i32c(n) ConstantInt::get(IntegerType::getInt32Ty(getGlobalContext()), n)
+#define cellc(n) ConstantInt::get(IntegerType::get(getGlobalContext(), CELL_BITS), n)
 #define i8c(n) ConstantInt::get(IntegerType::getInt8Ty(getGlobalContext()), n)
 #define i1c(n) ConstantInt::get(IntegerType::getInt1Ty(getGlobalContext()), n)
 
@@ -97,16 +97,14 @@ typedef struct
      /* Holds the base of the entire state of the machine. All registers, heaps and stacks are held in here. */
      GlobalVariable* l2MachineState;
 
-     /* Holds the set state function, to set the base pointer to the l2 state vector on initialization. */
-     Function* setstateFunction;
+     /* Holds a pointer to the machine instance, that compiled code passes to the call function. */
+     GlobalVariable* instancePtr;
 
-     /* Holds the static unify function. At some point this may get custom generated to fit the callers arguments
-        and/or inlined. */
+     /* Holds the general unify function, generated as IR, which compiled code calls to unify two structures. */
      Function* unifyFunction;
 
-     /* Holds the static deref function. At some point this may get custom generated to fit the callers arguments
-        and/or inlined. */
-     Function* derefFunction;
+     /* Holds the static call function, through which compiled code calls predicates that were not yet compiled. */
+     Function* callFunction;
 
      /* The Printf function for debugging. */
      Function* thePrintf;
@@ -120,16 +118,18 @@ typedef struct
      Function* traceFn1;
      Function* traceConst;
 
+     /* The profile functions, that compiled code counts through when profiling is compiled in. */
+     Function* profileCount;
+     Function* profilePeak;
+     Function* profileCall;
+
      // Unification stack functions.
 } llvmState;
 
-/* Holds the state of the LLVM virtual machine. */
-llvmState* vmState;
-
 typedef struct
 {
      /* Holds pointer to the base of the heap. */
-     int* heapBasePtr;
+     jcell* heapBasePtr;
 
      /* Holds the primary heap pointer. */
      int hp;
@@ -146,22 +146,189 @@ typedef struct
      /* Holds the environment, top-of-stack pointer. */
      int esp;
 
-     /* Holds the write mode flag. */
-     int wm;
+     /* Holds the write mode flag. This is a single byte, as it is an i1 in the compiled code. */
+     jboolean wm;
+
+     /* Holds the highest address in the data area, at which the unification stack starts. */
+     int top;
 } l2jitMachineState;
 
-/* Holds the state vector of the l2 virtual machine. */
-l2jitMachineState* l2state;
+/*
+ * Holds the execution state of the code at an entry point. Code starts out being interpreted, and is compiled once
+ * it has been run a threshold number of times. The entries form a table from code offsets to native entry points,
+ * so that running compiled code takes no lookup by name.
+ */
+typedef struct
+{
+     /* Holds the length of the code at the entry point, or zero if there is no entry point here. */
+     jint length;
+
+     /* Holds the number of times that the code has been run, while it has not been compiled. */
+     jint count;
+
+     /* Flags that the code has been queued to be compiled on the background compiler thread. */
+     jboolean queued;
+
+     /* Holds the compiled code for the entry point, or null if it has not been compiled. This is set from the
+      * compiler thread when compiling in the background, so it is only set once the code is complete. */
+     jint (* volatile compiled)();
+} l2jitEntry;
+
+/*
+ * Holds the state of one instance of the machine. Each instance compiles into its own module and execution engine,
+ * and runs on its own data area, so separate instances may run queries on separate threads at the same time. A single
+ * instance must not be used from more than one thread at once.
+ */
+typedef struct
+{
+     /* Holds the state of the LLVM virtual machine. */
+     llvmState vm;
+
+     /* Holds the data area that all registers, heaps and stacks are held in. */
+     dataArea area;
+
+     /* Holds the state vector of the l2 virtual machine, once the reset function has created it. */
+     l2jitMachineState* l2state;
+
+     /* Holds the code buffer that the entry points are in. */
+     jbyte* code;
+
+     /* Holds the size of the code buffer. */
+     jint codeSize;
+
+     /* Holds the execution state of each entry point, indexed by its offset in the code buffer. */
+     l2jitEntry* entries;
+
+     /* Holds the number of times an entry point is interpreted before it is compiled. Zero compiles on adding. */
+     jint threshold;
+
+     /* Flags that code is compiled on the background compiler thread, rather than on the thread that needs it. */
+     jboolean background;
+
+     /* Holds the directory that compiled code is cached in, or null if it is not cached. */
+     const char* cacheDir;
+
+     /* Holds the profile counters, when profiling is compiled in. */
+     jlong* profile;
+
+     /* Holds the names of the predicates at the entry points, as name/arity, that compiled code is published under. */
+     std::map<jint, std::string>* names;
+
+     /* Holds the symbols published for the compiled code, to profilers and debuggers. */
+     jitSymbols symbols;
 
+     /* Holds the listener that publishes the symbols, as the execution environment emits code. */
+     JITEventListener* listener;
+
+     /* Flags that each top-level query is started from the watermark, so that it leaves nothing behind. */
+     jboolean rollback;
+
+     /* Holds the watermark, as the machine state that top-level queries start from. */
+     l2jitMachineState mark;
+
+     /* Holds the highest heap pointer value reached before a rollback, since the last reset. */
+     jint hpPeak;
+} l2jitInstance;
+
+/*
+ * Serializes all use of LLVM to build, optimize and compile code. All modules share the global LLVM context, which
+ * is not safe to build code in from more than one thread at once. Compiled code is run outside of this lock.
+ */
+static pthread_mutex_t l2jitLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Holds a request to compile the code at an entry point on the background compiler thread.
+ */
+typedef struct l2jitRequest
+{
+     /* Holds the machine instance that the code is in. */
+     l2jitInstance* l2jit;
+
+     /* Holds the start offset of the code to compile. */
+     jint offset;
+
+     /* Holds the length of the code to compile. */
+     jint length;
+
+     /* Holds the next request in the queue. */
+     struct l2jitRequest* next;
+} l2jitRequest;
+
+/*
+ * Guards the queue of requests to the background compiler thread, and the names of the predicates that the symbols
+ * of compiled code are published under. This is only ever held briefly, so that adding code never waits on a compile.
+ */
+static pthread_mutex_t l2jitQueueLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Used to signal the compiler thread that a request has been queued. */
+static pthread_cond_t l2jitQueued = PTHREAD_COND_INITIALIZER;
+
+/* Used to signal that the compiler thread has finished compiling a request. */
+static pthread_cond_t l2jitCompiled = PTHREAD_COND_INITIALIZER;
+
+/* Holds the first and last requests in the queue to the compiler thread. */
+static l2jitRequest* l2jitQueueHead = 0;
+static l2jitRequest* l2jitQueueTail = 0;
+
+/* Holds the machine instance that the compiler thread is compiling code for, if any. */
+static l2jitInstance* l2jitCompiling = 0;
+
+/* Used to start the compiler thread, the first time that code is queued to it. */
+static pthread_once_t l2jitCompilerOnce = PTHREAD_ONCE_INIT;
+
+/* Flags that the compiler thread is running. */
+static bool l2jitCompilerStarted = false;
+
+/* Holds a counter to generate unique names for string constants. Only used with the LLVM lock held. */
 int stringId = 0;
 
-/* Holds the heap cell tag from the most recent dereference. */
-jbyte derefTag;
+/*
+ * Publishes a symbol for every function that the execution environment of a machine instance emits, so that profilers
+ * and debuggers can name compiled code. Functions compiled from an entry point are named f_<offset>, with a suffix
+ * for the body and the stub of a predicate; these are published under the name/arity of the predicate at the entry
+ * point, keeping the suffix. Functions with no predicate name, such as those for queries, keep their own names.
+ */
+class l2jitSymbolListener : public JITEventListener
+{
+public:
+     l2jitSymbolListener(l2jitInstance* l2jit) : l2jit(l2jit)
+     {
+     }
+
+     virtual void NotifyFunctionEmitted(const Function &F, void *Code, size_t Size,
+                                        const EmittedFunctionDetails &Details)
+     {
+          std::string name = F.getName().str();
+          jint offset;
+          int suffix;
+
+          pthread_mutex_lock(&l2jitQueueLock);
+
+          if ((l2jit->names != 0) && (sscanf(name.c_str(), "f_%i%n", &offset, &suffix) == 1))
+          {
+               std::map<jint, std::string>::const_iterator predicate = l2jit->names->find(offset);
+
+               if (predicate != l2jit->names->end())
+               {
+                    name = predicate->second + name.substr(suffix);
+               }
+          }
+
+          pthread_mutex_unlock(&l2jitQueueLock);
+
+          jitSymbolsPublish(&l2jit->symbols, name.c_str(), Code, Size);
+     }
 
-/* Holds the heap cell value from the most recent dereference. */
-jint derefVal;
+     virtual void NotifyFreeingMachineCode(const Function &F, void *OldPtr)
+     {
+          jitSymbolsWithdraw(&l2jit->symbols, OldPtr);
+     }
 
-void verifyBitCode()
+private:
+     l2jitInstance* l2jit;
+};
+
+void verifyBitCode(llvmState* vmState)
 {
      if (verifyModule(*vmState->M))
      {
@@ -170,7 +337,7 @@ void verifyBitCode()
      }
 }
 
-void writeBitCodeToFile()
+void writeBitCodeToFile(llvmState* vmState)
 {
      std::string ErrInfo;
      raw_fd_ostream *out = new raw_fd_ostream("l2.bc", 1, 1, ErrInfo);
@@ -189,8 +356,14 @@ void writeBitCodeToFile()
  */
 void CreateTrace(IRBuilder<>* builder, Module* mod, const std::string &text, Value* optionalArgs, ...)
 {
+     // Only emit trace calls when tracing is compiled in and turned on.
+     if (!TRACE_ENABLED)
+     {
+          return;
+     }
+
      // Create unique name for the string constant.
-     char* sName = (char*)malloc(12 * sizeof(char));
+     char sName[24];
      sprintf(sName, "string%i", stringId++);
 
      // Create global variable on the module initialized with the text.
@@ -221,7 +394,7 @@ void CreateTrace(IRBuilder<>* builder, Module* mod, const std::string &text, Val
      va_end(args);
 
      // Call the printf function with the trace message.
-     builder->CreateCall(vmState->thePrintf, printfArgs.begin(), printfArgs.end());// msgPtr);
+     builder->CreateCall(mod->getFunction("stderrPrintf"), printfArgs.begin(), printfArgs.end());// msgPtr);
 }
 
 /*
@@ -235,8 +408,14 @@ void CreateTrace(IRBuilder<>* builder, Module* mod, const std::string &text, Val
  */
 void CreateTraceFn(IRBuilder<>* builder, Module* mod, Function* traceFn, const std::string &text, Value* optionalArgs, ...)
 {
+     // Only emit trace calls when tracing is compiled in and turned on.
+     if (!TRACE_ENABLED)
+     {
+          return;
+     }
+
      // Create unique name for the string constant.
-     char* sName = (char*)malloc(12 * sizeof(char));
+     char sName[24];
      sprintf(sName, "string%i", stringId++);
 
      // Create global variable on the module initialized with the text.
@@ -269,6 +448,32 @@ void CreateTraceFn(IRBuilder<>* builder, Module* mod, Function* traceFn, const s
      builder->CreateCall(traceFn, printfArgs.begin(), printfArgs.end());// msgPtr);
 }
 
+/*
+ * Makes a call to one of the profile functions from compiled code, when profiling is compiled in.
+ *
+ * @param builder   The IR builder to insert the profile call with.
+ * @param profileFn The profile function to invoke.
+ * @param arg1      The first argument to the profile function.
+ * @param arg2      The second argument to the profile function, or null if it only takes one.
+ */
+void CreateProfileFn(IRBuilder<>* builder, Function* profileFn, Value* arg1, Value* arg2)
+{
+     // Only emit profile calls when profiling is compiled in.
+     if (!PROFILE_ENABLED)
+     {
+          return;
+     }
+
+     if (arg2 == 0)
+     {
+          builder->CreateCall(profileFn, arg1);
+     }
+     else
+     {
+          builder->CreateCall2(profileFn, arg1, arg2);
+     }
+}
+
 /*
  * Creates a getElementPtr instruction at the specified builders current insertion point. Consecutive indexes to the
  * instruction can be specified as varargs, which is not possible through the builder interface.
@@ -302,257 +507,569 @@ Value* CreateGEP(IRBuilder<>* builder, Value *ptr, Value *idx, const Twine &name
 }
 
 /*
- * Pushes a value onto the unification stack.
+ * Creates the code to widen an i32 value, such as an address or a functor, to the width of a heap cell.
  *
- * @param val The value to push onto the stack.
+ * @param builder The IR builder positioned to insert the code.
+ * @param val     The i32 value to widen.
+ *
+ * @return The value as a heap cell.
  */
-void l2jitUPush(l2jitMachineState* l2state, jint val)
+Value* CreateCellFromInt(IRBuilder<>* builder, Value* val)
 {
-     l2state->heapBasePtr[--(l2state->up)] = val;
+     return builder->CreateIntCast(val, IntegerType::get(getGlobalContext(), CELL_BITS), true);
 }
 
 /*
- * Pops a value from the unification stack.
+ * Creates the code to narrow a heap cell that holds a plain value, such as an address or a functor, to an i32.
+ *
+ * @param builder The IR builder positioned to insert the code.
+ * @param cell    The heap cell to narrow.
+ * @param name    The name of the resulting value.
  *
- * @return The top value from the unification stack.
+ * @return The value held in the cell, as an i32.
  */
-jint l2jitUPop(l2jitMachineState* l2state)
+Value* CreateIntFromCell(IRBuilder<>* builder, Value* cell, const Twine &name = "")
 {
-     return l2state->heapBasePtr[(l2state->up)++];
+     return builder->CreateIntCast(cell, Type::getInt32Ty(getGlobalContext()), true, name);
 }
 
 /*
- * Clears the unification stack.
+ * Creates the code to extract the tag of a heap cell.
+ *
+ * @param builder The IR builder positioned to insert the code.
+ * @param cell    The heap cell.
+ * @param name    The name of the resulting value.
+ *
+ * @return The tag of the cell, as an i32.
  */
-void l2jitUClear(l2jitMachineState* l2state)
+Value* CreateCellTag(IRBuilder<>* builder, Value* cell, const Twine &name = "")
 {
-     l2state->up = TOP;
+     Value* tag = (CELL_TAG_SHIFT == 0) ? cell : builder->CreateLShr(cell, cellc(CELL_TAG_SHIFT));
+
+     return CreateIntFromCell(builder, builder->CreateAnd(tag, cellc(CELL_TAG_MASK)), name);
 }
 
 /*
- * Checks if the unification stack is empty.
+ * Creates the code to extract the value, or address, of a heap cell.
+ *
+ * @param builder The IR builder positioned to insert the code.
+ * @param cell    The heap cell.
+ * @param name    The name of the resulting value.
  *
- * @return <tt>true</tt> if the unification stack is empty, <tt>false</tt> otherwise.
+ * @return The value of the cell, as an i32.
  */
-jboolean l2jitUEmpty(l2jitMachineState* l2state)
+Value* CreateCellVal(IRBuilder<>* builder, Value* cell, const Twine &name = "")
 {
-     return l2state->up >= TOP ? JNI_TRUE : JNI_FALSE;
+     Value* val = (CELL_VAL_SHIFT == 0) ? cell : builder->CreateLShr(cell, cellc(CELL_VAL_SHIFT));
+
+     return CreateIntFromCell(builder, builder->CreateAnd(val, cellc(CELL_VAL_MASK)), name);
 }
 
 /*
- * Sets the base pointer to the l2 machine state, to be called on initialization.
+ * Creates the code to make a heap cell from a tag and a value.
+ *
+ * @param builder The IR builder positioned to insert the code.
+ * @param tag     The tag of the cell.
+ * @param val     The i32 value, or address, of the cell.
+ *
+ * @return The heap cell.
  */
-extern void l2jitsetstate(l2jitMachineState* l2stateptr)
+Value* CreateCell(IRBuilder<>* builder, int tag, Value* val)
 {
-     l2state = l2stateptr;
+     Value* masked = builder->CreateAnd(CreateCellFromInt(builder, val), cellc(CELL_VAL_MASK));
+     Value* shifted = (CELL_VAL_SHIFT == 0) ? masked : builder->CreateShl(masked, cellc(CELL_VAL_SHIFT));
+
+     return builder->CreateOr(cellc((uint64_t)tag << CELL_TAG_SHIFT), shifted);
 }
 
 /*
- * Dereferences a heap pointer (or register), returning the address that it refers to after following all
- * reference chains to their conclusion. This method is also side effecting, in that the contents of the
- * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
+ * Creates the code to dereference a heap pointer (or register) inline, following reference chains until a free
+ * variable, or a cell that is not a reference, is reached.
  *
- * @param l2state The address of l2 machine state vector.
- * @param a       The address to dereference, relative to the base of the heap.
+ * @param builder     The IR builder positioned to insert the code.
+ * @param function    The function being built.
+ * @param heapBasePtr A pointer to the base of the heap.
+ * @param a           The address to dereference, relative to the base of the heap.
  *
  * @return The address that the reference refers to.
  */
-extern jint l2jitderef(l2jitMachineState* l2state, jint a)
+Value* CreateDeref(IRBuilder<>* builder, Function* function, Value* heapBasePtr, Value* a)
 {
-     //std::cout << ("extern jint l2jitderef(jint* heapBasePtr, jint a): called.\n");
-
-     jint addr;
-     jint tmp;
-     jbyte derefTag;
-     jint derefVal;
+     BasicBlock* entryBlock = builder->GetInsertBlock();
+     BasicBlock* loopBlock = BasicBlock::Create(getGlobalContext(), "derefLoop", function);
+     BasicBlock* followBlock = BasicBlock::Create(getGlobalContext(), "derefFollow", function);
+     BasicBlock* doneBlock = BasicBlock::Create(getGlobalContext(), "derefDone", function);
 
-     // printf("jint l2deref(jint a = 0x%02x): called\n", a);
+     builder->CreateBr(loopBlock);
 
-     // tag, value <- STORE[a]
-     addr = a;
-     tmp = l2state->heapBasePtr[a];
-     derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-     derefVal = tmp & 0x00FFFFFF;
+     // tag, value <- STORE[addr]
+     builder->SetInsertPoint(loopBlock);
+     PHINode* addr = builder->CreatePHI(Type::getInt32Ty(getGlobalContext()), "derefAddr");
+     addr->addIncoming(a, entryBlock);
 
-     // printf("derefTag = 0x%02x\n", derefTag);
-     // printf("derefVal = 0x%02x\n", derefVal);
-     // printf("addr = 0x%02x\n", addr);
+     Value* cell = builder->CreateLoad(CreateGEP(builder, heapBasePtr, addr), "derefCell");
+     Value* isRef = builder->CreateICmpEQ(CreateCellTag(builder, cell), i32c(REF), "isRef");
+     builder->CreateCondBr(isRef, followBlock, doneBlock);
 
-     // while tag = REF and value != a
-     while ((derefTag == REF))
-     {
-          // printf("while ((derefTag == REF))\n");
-
-          // tag, value <- STORE[a]
-          addr = derefVal;
-          tmp = l2state->heapBasePtr[derefVal];
-          derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-          tmp = tmp & 0x00FFFFFF;
-
-          // Break on free var.
-          if (derefVal == tmp)
-          {
-               break;
-          }
-
-          derefVal = tmp;
-
-          // printf("derefTag = 0x%02x\n", derefTag);
-          // printf("derefVal = 0x%02x\n", derefVal);
-          // printf("addr = 0x%02x\n", addr);
-     }
+     // while tag = REF and value != addr
+     builder->SetInsertPoint(followBlock);
+     Value* val = CreateCellVal(builder, cell, "derefVal");
+     Value* isFree = builder->CreateICmpEQ(val, addr, "isFree");
+     addr->addIncoming(val, followBlock);
+     builder->CreateCondBr(isFree, doneBlock, loopBlock);
 
-     //l2state->derefTag = derefTag;
-     //l2state->derefVal = derefVal;
+     builder->SetInsertPoint(doneBlock);
 
      return addr;
 }
 
 /*
- * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
- * element by element, free references become bound.
+ * Creates the code to bind the variable at one address, to another address.
  *
- * @param a1 The address of the first structure or reference.
- * @param a2 The address of the second structure or reference.
+ * @param builder     The IR builder positioned to insert the code.
+ * @param heapBasePtr A pointer to the base of the heap.
+ * @param from        The address of the variable to bind.
+ * @param to          The address to bind it to.
+ */
+void CreateBind(IRBuilder<>* builder, Value* heapBasePtr, Value* from, Value* to)
+{
+     Value* ref = CreateCell(builder, REF, to);
+     builder->CreateStore(ref, CreateGEP(builder, heapBasePtr, from));
+}
+
+/*
+ * Creates the code to push a value onto the unification stack.
  *
- * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
+ * @param builder     The IR builder positioned to insert the code.
+ * @param heapBasePtr A pointer to the base of the heap.
+ * @param upPtr       A pointer to the unification stack pointer in the machine state.
+ * @param val         The value to push.
  */
-extern jboolean l2jitunify(l2jitMachineState* l2state, jint a1, jint a2)
+void CreateUPush(IRBuilder<>* builder, Value* heapBasePtr, Value* upPtr, Value* val)
 {
-     jboolean fail;
+     Value* up = builder->CreateSub(builder->CreateLoad(upPtr), i32c(1));
+     builder->CreateStore(CreateCellFromInt(builder, val), CreateGEP(builder, heapBasePtr, up));
+     builder->CreateStore(up, upPtr);
+}
 
-     // printf("jboolean unify(jint a1 = 0x%02x, jint a2 = 0x%02x): called\n", a1, a2);
+/*
+ * Creates the general unify function. This works through the pairs of sub-terms of two structures on the unification
+ * stack, held at the top of the data area, and empties the stack again if they fail to unify. Compiled code only
+ * calls this to unify two structures; all simpler cases are handled inline.
+ *
+ * @param mod       The module to create the function in.
+ * @param stateType The type of the machine state.
+ *
+ * @return The unify function, which returns an i1 that is true if the unification succeeded.
+ */
+Function* CreateUnifyFunction(Module* mod, const Type* stateType)
+{
+     std::vector<const Type*> unifyParams;
+     unifyParams.push_back(PointerType::getUnqual(stateType));
+     unifyParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
+     unifyParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
+     FunctionType* unifyType = FunctionType::get(IntegerType::getInt1Ty(mod->getContext()), unifyParams, false);
+     Function* unify = Function::Create(unifyType, GlobalValue::ExternalLinkage, "unify", mod);
+
+     Function::arg_iterator args = unify->arg_begin();
+     Value* statePtr = args++;
+     Value* a1 = args++;
+     Value* a2 = args;
+
+     BasicBlock* entryBlock = BasicBlock::Create(mod->getContext(), "EntryBlock", unify);
+     BasicBlock* loopBlock = BasicBlock::Create(mod->getContext(), "unifyLoop", unify);
+     BasicBlock* popBlock = BasicBlock::Create(mod->getContext(), "unifyPop", unify);
+     BasicBlock* differBlock = BasicBlock::Create(mod->getContext(), "unifyDiffer", unify);
+     BasicBlock* bind1Block = BasicBlock::Create(mod->getContext(), "unifyBind1", unify);
+     BasicBlock* check2Block = BasicBlock::Create(mod->getContext(), "unifyCheck2", unify);
+     BasicBlock* bind2Block = BasicBlock::Create(mod->getContext(), "unifyBind2", unify);
+     BasicBlock* strBlock = BasicBlock::Create(mod->getContext(), "unifyStr", unify);
+     BasicBlock* argsBlock = BasicBlock::Create(mod->getContext(), "unifyArgs", unify);
+     BasicBlock* argLoopBlock = BasicBlock::Create(mod->getContext(), "unifyArgLoop", unify);
+     BasicBlock* argPushBlock = BasicBlock::Create(mod->getContext(), "unifyArgPush", unify);
+     BasicBlock* failBlock = BasicBlock::Create(mod->getContext(), "unifyFail", unify);
+     BasicBlock* succeedBlock = BasicBlock::Create(mod->getContext(), "unifySucceed", unify);
+
+     IRBuilder<> builder(entryBlock);
+
+     Value* heapBasePtr = builder.CreateLoad(CreateGEPRange(&builder, statePtr, i32c(0), i32c(0), (Value*)0));
+     Value* upPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(3), (Value*)0);
+     Value* top = builder.CreateLoad(CreateGEPRange(&builder, statePtr, i32c(0), i32c(7), (Value*)0), "top");
 
      // pdl.push(a1)
      // pdl.push(a2)
-     l2jitUPush(l2state, a1);
-     l2jitUPush(l2state, a2);
+     CreateUPush(&builder, heapBasePtr, upPtr, a1);
+     CreateUPush(&builder, heapBasePtr, upPtr, a2);
+     builder.CreateBr(loopBlock);
+
+     // while !empty(PDL)
+     builder.SetInsertPoint(loopBlock);
+     Value* up = builder.CreateLoad(upPtr, "up");
+     builder.CreateCondBr(builder.CreateICmpSGE(up, top), succeedBlock, popBlock);
+
+     // d1 <- deref(pdl.pop())
+     // d2 <- deref(pdl.pop())
+     builder.SetInsertPoint(popBlock);
+     Value* p1 = CreateIntFromCell(&builder, builder.CreateLoad(CreateGEP(&builder, heapBasePtr, up)));
+     Value* p2 = CreateIntFromCell(&builder,
+                                   builder.CreateLoad(CreateGEP(&builder, heapBasePtr, builder.CreateAdd(up, i32c(1)))));
+     builder.CreateStore(builder.CreateAdd(up, i32c(2)), upPtr);
+
+     Value* d1 = CreateDeref(&builder, unify, heapBasePtr, p1);
+     Value* d2 = CreateDeref(&builder, unify, heapBasePtr, p2);
+
+     // if (d1 != d2)
+     builder.CreateCondBr(builder.CreateICmpEQ(d1, d2), loopBlock, differBlock);
+
+     // if (t1 = REF) bind(d1, d2)
+     builder.SetInsertPoint(differBlock);
+     Value* cell1 = builder.CreateLoad(CreateGEP(&builder, heapBasePtr, d1), "cell1");
+     builder.CreateCondBr(builder.CreateICmpEQ(CreateCellTag(&builder, cell1), i32c(REF)), bind1Block,
+                          check2Block);
+
+     builder.SetInsertPoint(bind1Block);
+     CreateBind(&builder, heapBasePtr, d1, d2);
+     builder.CreateBr(loopBlock);
+
+     // else if (t2 = REF) bind(d2, d1)
+     builder.SetInsertPoint(check2Block);
+     Value* cell2 = builder.CreateLoad(CreateGEP(&builder, heapBasePtr, d2), "cell2");
+     builder.CreateCondBr(builder.CreateICmpEQ(CreateCellTag(&builder, cell2), i32c(REF)), bind2Block,
+                          strBlock);
+
+     builder.SetInsertPoint(bind2Block);
+     CreateBind(&builder, heapBasePtr, d2, d1);
+     builder.CreateBr(loopBlock);
+
+     // f1/n1 <- STORE[v1]
+     // f2/n2 <- STORE[v2]
+     builder.SetInsertPoint(strBlock);
+     Value* v1 = CreateCellVal(&builder, cell1, "v1");
+     Value* v2 = CreateCellVal(&builder, cell2, "v2");
+     Value* f_n1 = builder.CreateLoad(CreateGEP(&builder, heapBasePtr, v1), "f_n1");
+     Value* f_n2 = builder.CreateLoad(CreateGEP(&builder, heapBasePtr, v2), "f_n2");
+
+     // if f1 = f2 and n1 = n2
+     builder.CreateCondBr(builder.CreateICmpEQ(f_n1, f_n2), argsBlock, failBlock);
+
+     // for i <- 1 to n1
+     builder.SetInsertPoint(argsBlock);
+     Value* n1 = builder.CreateAnd(CreateIntFromCell(&builder, f_n1), i32c(0xFF), "n1");
+     builder.CreateBr(argLoopBlock);
+
+     builder.SetInsertPoint(argLoopBlock);
+     PHINode* i = builder.CreatePHI(Type::getInt32Ty(mod->getContext()), "i");
+     i->addIncoming(i32c(1), argsBlock);
+     builder.CreateCondBr(builder.CreateICmpSLE(i, n1), argPushBlock, loopBlock);
+
+     // pdl.push(v1 + i)
+     // pdl.push(v2 + i)
+     builder.SetInsertPoint(argPushBlock);
+     CreateUPush(&builder, heapBasePtr, upPtr, builder.CreateAdd(v1, i));
+     CreateUPush(&builder, heapBasePtr, upPtr, builder.CreateAdd(v2, i));
+     i->addIncoming(builder.CreateAdd(i, i32c(1)), argPushBlock);
+     builder.CreateBr(argLoopBlock);
+
+     // fail <- true
+     builder.SetInsertPoint(failBlock);
+     builder.CreateStore(top, upPtr);
+     builder.CreateRet(i1c(0));
+
+     builder.SetInsertPoint(succeedBlock);
+     builder.CreateRet(i1c(1));
+
+     verifyFunction(*unify);
+
+     return unify;
+}
+
+/*
+ * Creates the code to unify two addresses inline. Where the two sides dereference to the same place, or either one
+ * to a free variable, this comes down to a compare and bind. Only pairs of structures are passed on to the general
+ * unify function. If the first side is known to hold a fresh variable, that nothing has been bound to yet, it is
+ * bound to the second without being examined at all.
+ *
+ * @param builder     The IR builder positioned to insert the code.
+ * @param vmState     The llvm machine state.
+ * @param function    The function being built.
+ * @param statePtr    A pointer to the machine state.
+ * @param heapBasePtr A pointer to the base of the heap.
+ * @param a1          The first address to unify.
+ * @param a2          The second address to unify.
+ * @param fresh1      <tt>true</tt> if the first address is known to hold a fresh variable.
+ *
+ * @return An i1 value that is true if the unification succeeded.
+ */
+Value* CreateUnify(IRBuilder<>* builder, llvmState* vmState, Function* function, Value* statePtr, Value* heapBasePtr,
+                   Value* a1, Value* a2, bool fresh1)
+{
+     CreateProfileFn(builder, vmState->profileCount, i32c(PROFILE_UNIFY), (Value*)0);
 
-     // fail <- false
-     fail = JNI_FALSE;
+     Value* d2 = CreateDeref(builder, function, heapBasePtr, a2);
 
-     // while !empty(PDL) and not failed
-     while (l2jitUEmpty(l2state) == JNI_FALSE && !fail)
+     // bind(a1, d2)
+     if (fresh1)
      {
-          // printf("while (l2jitUEmpty(l2state) == JNI_FALSE && !fail)\n");
+          Value* var = CreateCellVal(builder, builder->CreateLoad(CreateGEP(builder, heapBasePtr, a1)));
+          CreateBind(builder, heapBasePtr, var, d2);
 
-          // d1 <- deref(pdl.pop(l2state))
-          // d2 <- deref(pdl.pop(l2state))
-          // t1, v1 <- STORE[d1]
-          // t2, v2 <- STORE[d2]
-          jint d1 = l2jitderef(l2state, l2jitUPop(l2state));
-          jint tmp1 = l2state->heapBasePtr[d1];
-          jint t1 = (jbyte)((tmp1 & 0xFF000000) >> 24);
-          jint v1 = tmp1 & 0x00FFFFFF;
+          return i1c(1);
+     }
 
-          jint d2 = l2jitderef(l2state, l2jitUPop(l2state));
-          jint tmp2 = l2state->heapBasePtr[d2];
-          jint t2 = (jbyte)((tmp2 & 0xFF000000) >> 24);
-          jint v2 = tmp2 & 0x00FFFFFF;
+     Value* d1 = CreateDeref(builder, function, heapBasePtr, a1);
+
+     BasicBlock* differBlock = BasicBlock::Create(getGlobalContext(), "unifyDiffer", function);
+     BasicBlock* bind1Block = BasicBlock::Create(getGlobalContext(), "unifyBind1", function);
+     BasicBlock* check2Block = BasicBlock::Create(getGlobalContext(), "unifyCheck2", function);
+     BasicBlock* bind2Block = BasicBlock::Create(getGlobalContext(), "unifyBind2", function);
+     BasicBlock* generalBlock = BasicBlock::Create(getGlobalContext(), "unifyGeneral", function);
+     BasicBlock* doneBlock = BasicBlock::Create(getGlobalContext(), "unifyDone", function);
+
+     // if (d1 != d2)
+     BasicBlock* sameBlock = builder->GetInsertBlock();
+     builder->CreateCondBr(builder->CreateICmpEQ(d1, d2), doneBlock, differBlock);
+
+     // if (t1 = REF) bind(d1, d2)
+     builder->SetInsertPoint(differBlock);
+     Value* cell1 = builder->CreateLoad(CreateGEP(builder, heapBasePtr, d1), "cell1");
+     builder->CreateCondBr(builder->CreateICmpEQ(CreateCellTag(builder, cell1), i32c(REF)), bind1Block,
+                           check2Block);
+
+     builder->SetInsertPoint(bind1Block);
+     CreateBind(builder, heapBasePtr, d1, d2);
+     builder->CreateBr(doneBlock);
+
+     // else if (t2 = REF) bind(d2, d1)
+     builder->SetInsertPoint(check2Block);
+     Value* cell2 = builder->CreateLoad(CreateGEP(builder, heapBasePtr, d2), "cell2");
+     builder->CreateCondBr(builder->CreateICmpEQ(CreateCellTag(builder, cell2), i32c(REF)), bind2Block,
+                           generalBlock);
+
+     builder->SetInsertPoint(bind2Block);
+     CreateBind(builder, heapBasePtr, d2, d1);
+     builder->CreateBr(doneBlock);
+
+     // else unify the two structures.
+     builder->SetInsertPoint(generalBlock);
+
+     Value *unifyParams[] = {
+          statePtr,
+          d1,
+          d2
+     };
+
+     Value* unified = builder->CreateCall(vmState->unifyFunction, unifyParams, array_endof(unifyParams));
+     builder->CreateBr(doneBlock);
+
+     builder->SetInsertPoint(doneBlock);
+     PHINode* result = builder->CreatePHI(Type::getInt1Ty(getGlobalContext()), "unified");
+     result->addIncoming(i1c(1), sameBlock);
+     result->addIncoming(i1c(1), bind1Block);
+     result->addIncoming(i1c(1), bind2Block);
+     result->addIncoming(unified, generalBlock);
 
-          // printf("d1 = %i\n", d1);
-          // printf("t1 = %i\n", t1);
-          // printf("v1 = %i\n", v1);
+     return result;
+}
 
-          // printf("d2 = %i\n", d2);
-          // printf("t2 = %i\n", t2);
-          // printf("v2 = %i\n", v2);
+/*
+ * Clears the unification stack.
+ */
+void l2jitUClear(l2jitMachineState* l2state)
+{
+     l2state->up = l2state->top;
+}
 
-          // if (d1 != d2)
-          if (d1 != d2)
-          {
-               // printf("if (d1 != d2)\n");
+/*
+ * Dereferences a heap pointer (or register), returning the address that it refers to after following all
+ * reference chains to their conclusion.
+ *
+ * @param l2state The address of l2 machine state vector.
+ * @param a       The address to dereference, relative to the base of the heap.
+ *
+ * @return The address that the reference refers to.
+ */
+extern jint l2jitderef(l2jitMachineState* l2state, jint a)
+{
+     jcell cell;
 
-               // if (t1 = REF or t2 = REF)
-               // bind(d1, d2)
-               if ((t1 == REF))
-               {
-                    // printf("if ((t1 == REF))\n");
+     return coreDeref(l2state->heapBasePtr, a, &cell);
+}
 
-                    l2state->heapBasePtr[d1] = (REF << 24) | (d2 & 0xFFFFFF);
-               }
-               else if (t2 == REF)
-               {
-                    // printf("else if (t2 == REF)\n");
+/*
+ * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
+ * element by element, free references become bound. The unification stack is held at the top of the data area.
+ *
+ * @param a1 The address of the first structure or reference.
+ * @param a2 The address of the second structure or reference.
+ *
+ * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
+ */
+extern jboolean l2jitunify(l2jitMachineState* l2state, jint a1, jint a2)
+{
+     return coreUnify(l2state->heapBasePtr, l2state->heapBasePtr, l2state->up, a1, a2);
+}
 
-                    l2state->heapBasePtr[d2] = (REF << 24) | (d1 & 0xFFFFFF);
-               }
-               else
-               {
-                    // printf("else\n");
-
-                    // printf("v1 = %i\n", v1);
-                    // printf("v2 = %i\n", v2);
-
-                    // f1/n1 <- STORE[v1]
-                    // f2/n2 <- STORE[v2]
-                    jint f_n1 = l2state->heapBasePtr[v1];
-                    // printf("f_n1 = %i\n", f_n1);
-                    jint f_n2 = l2state->heapBasePtr[v2];
-                    // printf("f_n2 = %i\n", f_n2);
-                    jbyte n1 = (jbyte)(f_n1 & 0xFF);
-                    // printf("n1 = %i\n", n1);
-
-                    // if f1 = f2 and n1 = n2
-                    if (f_n1 == f_n2)
-                    {
-                         // printf("if (f_n1 == f_n2)\n");
-
-                         // for i <- 1 to n1
-                         jint i;
-                         for (i = 1; i <= n1; i++)
-                         {
-                              // printf("for (i = 1; i <= n1; i++)\n");
-
-                              // pdl.push(v1 + i)
-                              // pdl.push(v2 + i)
-                              l2jitUPush(l2state, v1 + i);
-                              l2jitUPush(l2state, v2 + i);
-                         }
-                    }
-                    else
-                    {
-                         // printf("else\n");
+/*
+ * Counts one occurrence of a profile counter, from compiled code. This does nothing if profiling is not compiled in.
+ *
+ * @param counter The position of the counter.
+ */
+extern void l2jitProfileCount(jint counter)
+{
+     PROFILE_COUNT(counter);
+}
 
-                         // fail <- true
-                         fail = JNI_TRUE;
-                    }
-               }
-          }
-     }
+/*
+ * Raises a peak profile counter to a value, from compiled code. This does nothing if profiling is not compiled in.
+ *
+ * @param counter The position of the counter.
+ * @param value   The value to raise the counter to, if it is higher.
+ */
+extern void l2jitProfilePeak(jint counter, jint value)
+{
+     PROFILE_PEAK(counter, value);
+}
+
+/*
+ * Counts one call to a target, from compiled code. This does nothing if profiling is not compiled in.
+ *
+ * @param p_n The entry point that was called.
+ */
+extern void l2jitProfileCall(jint p_n)
+{
+     PROFILE_CALL(p_n);
+}
+
+static jint l2jitRun(l2jitInstance* l2jit, jint offset);
+static void l2jitCancelCompiles(l2jitInstance* l2jit);
 
-     return fail == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+/*
+ * Calls a predicate from compiled code, where the predicate had not been compiled when the calling code was. The
+ * predicate is run in whichever tier it has reached since.
+ *
+ * @param l2jit The machine instance.
+ * @param p_n   The entry point of the predicate to call.
+ *
+ * @return Non-zero if the call succeeded, zero if it failed.
+ */
+extern jint l2jitcall(l2jitInstance* l2jit, jint p_n)
+{
+     return l2jitRun(l2jit, p_n);
 }
 
 /*
  * Resets the machine to its initial state. This clears any programs from the machine, and clears all of its stacks
- * and heaps.
+ * and heaps. The data area is reserved afresh with the requested region sizes. Each machine instance has its own
+ * state, created on its first reset.
  *
  * Class:     com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine
- * Method:    reset
- * Signature: ()V
+ * Method:    nativeReset
+ * Signature: (JIIII)J
+ *
+ * @param env       The native code execution environment.
+ * @param obj       The object that is the context to this native method.
+ * @param state     A handle onto the machine state, or zero if it has not been created yet.
+ * @param regSize   The number of registers.
+ * @param heapSize  The size of the heap in cells.
+ * @param stackSize The size of the stack in cells.
+ * @param pdlSize   The size of the unification stack in cells.
  *
- * @param env     The native code execution environment.
- * @param obj     The object that is the context to this native method.
- * @param offset  The offset within the code buffer of the byte code to execute.
+ * @return A handle onto the machine state.
  */
-JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_nativeReset
-(JNIEnv * env, jobject obj)
+JNIEXPORT jlong JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_nativeReset
+(JNIEnv * env, jobject obj, jlong state, jint regSize, jint heapSize, jint stackSize, jint pdlSize)
 {
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     llvmState* vmState;
+     jint sizes[REGION_COUNT];
+
+     static bool multithreaded = false;
+
      setbuf(stdout, NULL);
 
      /*std::cout << "JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_nativeReset:"
        << "called\n";*/
 
-     // If a previous state of the machine already exists, ensure it is cleaned up before creating a new execution
-     // environment.
-     if (vmState != 0)
+     // Stop the compiler thread from working on the code that is about to be cleared.
+     if (l2jit != 0)
      {
-          delete vmState->EE;
+          l2jitCancelCompiles(l2jit);
      }
 
-     // Allocate space for the machines state.
-     vmState = (llvmState*)malloc(sizeof(llvmState));
+     pthread_mutex_lock(&l2jitLock);
+
+     // Turn on the locking inside of LLVM, which guards functions that the JIT compiles lazily, when they are first
+     // called from running code.
+     if (!multithreaded)
+     {
+          llvm_start_multithreaded();
+          multithreaded = true;
+     }
+
+     // Allocate space for the machines state, or if a previous state of the machine already exists, ensure it is
+     // cleaned up before creating a new execution environment.
+     if (l2jit == 0)
+     {
+          l2jit = (l2jitInstance*)calloc(1, sizeof(l2jitInstance));
+          l2jit->profile = PROFILE_ENABLED ? profileCreate() : 0;
+     }
+     else if (l2jit->vm.EE != 0)
+     {
+          jitSymbolsRelease(&l2jit->symbols);
+          delete l2jit->vm.FPM;
+          delete l2jit->vm.EE;
+          delete l2jit->listener;
+          free(l2jit->l2state);
+          free(l2jit->entries);
+
+          l2jit->vm.FPM = 0;
+          l2jit->vm.EE = 0;
+          l2jit->l2state = 0;
+          l2jit->code = 0;
+          l2jit->codeSize = 0;
+          l2jit->entries = 0;
+          l2jit->listener = 0;
+     }
+
+     // Forget the names of the predicates, as the code is being cleared.
+     if (l2jit->names != 0)
+     {
+          l2jit->names->clear();
+     }
+
+     vmState = &l2jit->vm;
+
+     // Find out how many times an entry point is to be interpreted before it is compiled.
+     const char* threshold = getenv("AIMA_JIT_THRESHOLD");
+     l2jit->threshold = (threshold != NULL) ? atoi(threshold) : DEFAULT_JIT_THRESHOLD;
+
+     if (l2jit->threshold < 0)
+     {
+          l2jit->threshold = 0;
+     }
+
+     // Find out where compiled code is to be cached between runs, if anywhere.
+     l2jit->cacheDir = getenv("AIMA_JIT_CACHE");
+
+     // Find out whether code is to be compiled in the background, which it is unless turned off.
+     const char* background = getenv("AIMA_JIT_BACKGROUND");
+     l2jit->background = ((background == NULL) || (strcmp(background, "0") != 0)) ? JNI_TRUE : JNI_FALSE;
+
+     // Clear the heaps and stacks, keeping the previous ones if they are the same size. These start out zeroed.
+     sizes[REG_REGION] = regSize;
+     sizes[HEAP_REGION] = heapSize;
+     sizes[STACK_REGION] = stackSize;
+     sizes[PDL_REGION] = pdlSize;
+
+     if (dataAreaReset(&l2jit->area, sizes, REGION_COUNT, ADDR_LIMIT, sizeof(jcell), NULL) == JNI_FALSE)
+     {
+          pthread_mutex_unlock(&l2jitLock);
+
+          env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"),
+                        "The data area could not be created with the requested sizes.");
+
+          return (jlong)(intptr_t)l2jit;
+     }
 
      // Create the module to add compiled code to.
      vmState->M = new Module("l2machine", getGlobalContext());
@@ -561,9 +1078,22 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      // Create the JIT.
      //ExistingModuleProvider* MP = new ExistingModuleProvider(mod);
      //vmState->EE = ExecutionEngine::create(MP, false);
+     // Compiled predicates make their last calls as tail calls, so that deep recursion runs in constant stack.
      InitializeNativeTarget();
+     PerformTailCallOpt = true;
      vmState->EE = EngineBuilder(mod).create();
 
+     // Generate all of the code that a function needs as it is compiled, when compiling in the background, so that
+     // running code never has its callees compiled lazily on the machine thread while the compiler thread builds more.
+     if (l2jit->background)
+     {
+          vmState->EE->DisableLazyCompilation();
+     }
+
+     // Publish symbols for the code that is compiled, so that it can be profiled and debugged.
+     l2jit->listener = new l2jitSymbolListener(l2jit);
+     vmState->EE->RegisterJITEventListener(l2jit->listener);
+
      //std::cout << "Created module and execution engine.\n";
 
      // Set up an optimizing pipeline on the module.
@@ -571,7 +1101,12 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      vmState->FPM->add(new TargetData(*vmState->EE->getTargetData()));
      vmState->FPM->add(createVerifierPass());
 
-     int optLevel = 0;
+     // Always promote the local copies of the machine registers in compiled code to SSA values.
+     vmState->FPM->add(createPromoteMemoryToRegisterPass());
+
+     // Only hot code is compiled when running tiered, so it is worth putting it through the full pipeline. Otherwise
+     // all code is compiled as it is added, and the time taken to compile it is kept down.
+     int optLevel = (l2jit->threshold > 0) ? 4 : 0;
 
      if (optLevel > 0)
      {
@@ -648,13 +1183,14 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
      // Create the custom type that holds the machines state.
      std::vector<const Type *> l2StateParams;
-     l2StateParams.push_back(PointerType::getUnqual(IntegerType::getInt32Ty(mod->getContext()))); // Heap base pointer.
+     l2StateParams.push_back(PointerType::getUnqual(IntegerType::get(mod->getContext(), CELL_BITS))); // Heap base pointer.
      l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // hp
      l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // sp
      l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // up
      l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // ep
      l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // esp
      l2StateParams.push_back(IntegerType::getInt1Ty(mod->getContext()));                    // Write mode.
+     l2StateParams.push_back(IntegerType::getInt32Ty(mod->getContext()));                   // top
 
      StructType* l2MachineStateStruc = StructType::get(mod->getContext(), l2StateParams, false);
      mod->addTypeName("l2state", l2MachineStateStruc);
@@ -675,23 +1211,23 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      std::vector<const Type*> traceItParams;
      traceItParams.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
      FunctionType* traceItType = FunctionType::get(Type::getVoidTy(mod->getContext()), traceItParams, false);
-     vmState->traceIt = Function::Create(traceItType, GlobalValue::ExternalLinkage, "traceIt", mod);
-     vmState->EE->addGlobalMapping(vmState->traceIt, (void*) &traceIt);
+     vmState->traceIt = Function::Create(traceItType, GlobalValue::ExternalLinkage, "traceMessage", mod);
+     vmState->EE->addGlobalMapping(vmState->traceIt, (void*) &traceMessage);
 
      std::vector<const Type*> trace0Params;
      trace0Params.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
      trace0Params.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* trace0Type = FunctionType::get(Type::getVoidTy(mod->getContext()), trace0Params, false);
-     vmState->trace0 = Function::Create(trace0Type, GlobalValue::ExternalLinkage, "trace0", mod);
-     vmState->EE->addGlobalMapping(vmState->trace0, (void*) &trace0);
+     vmState->trace0 = Function::Create(trace0Type, GlobalValue::ExternalLinkage, "traceEvent0", mod);
+     vmState->EE->addGlobalMapping(vmState->trace0, (void*) &traceEvent0);
 
      std::vector<const Type*> trace1Params;
      trace1Params.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
      trace1Params.push_back(Type::getInt32Ty(mod->getContext()));
      trace1Params.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* trace1Type = FunctionType::get(Type::getVoidTy(mod->getContext()), trace1Params, false);
-     vmState->trace1 = Function::Create(trace1Type, GlobalValue::ExternalLinkage, "trace1", mod);
-     vmState->EE->addGlobalMapping(vmState->trace1, (void*) &trace1);
+     vmState->trace1 = Function::Create(trace1Type, GlobalValue::ExternalLinkage, "traceEvent1", mod);
+     vmState->EE->addGlobalMapping(vmState->trace1, (void*) &traceEvent1);
 
      std::vector<const Type*> trace2Params;
      trace2Params.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
@@ -701,16 +1237,16 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      trace2Params.push_back(Type::getInt32Ty(mod->getContext()));
      trace2Params.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* trace2Type = FunctionType::get(Type::getVoidTy(mod->getContext()), trace2Params, false);
-     vmState->trace2 = Function::Create(trace2Type, GlobalValue::ExternalLinkage, "trace2", mod);
-     vmState->EE->addGlobalMapping(vmState->trace2, (void*) &trace2);
+     vmState->trace2 = Function::Create(trace2Type, GlobalValue::ExternalLinkage, "traceEvent2", mod);
+     vmState->EE->addGlobalMapping(vmState->trace2, (void*) &traceEvent2);
 
      std::vector<const Type*> traceFn0Params;
      traceFn0Params.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
      traceFn0Params.push_back(Type::getInt32Ty(mod->getContext()));
      traceFn0Params.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* traceFn0Type = FunctionType::get(Type::getVoidTy(mod->getContext()), traceFn0Params, false);
-     vmState->traceFn0 = Function::Create(traceFn0Type, GlobalValue::ExternalLinkage, "traceFn0", mod);
-     vmState->EE->addGlobalMapping(vmState->traceFn0, (void*) &traceFn0);
+     vmState->traceFn0 = Function::Create(traceFn0Type, GlobalValue::ExternalLinkage, "traceEventFn0", mod);
+     vmState->EE->addGlobalMapping(vmState->traceFn0, (void*) &traceEventFn0);
 
      std::vector<const Type*> traceFn1Params;
      traceFn1Params.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
@@ -718,26 +1254,33 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      traceFn1Params.push_back(Type::getInt32Ty(mod->getContext()));
      traceFn1Params.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* traceFn1Type = FunctionType::get(Type::getVoidTy(mod->getContext()), traceFn1Params, false);
-     vmState->traceFn1 = Function::Create(traceFn1Type, GlobalValue::ExternalLinkage, "traceFn1", mod);
-     vmState->EE->addGlobalMapping(vmState->traceFn1, (void*) &traceFn1);
+     vmState->traceFn1 = Function::Create(traceFn1Type, GlobalValue::ExternalLinkage, "traceEventFn1", mod);
+     vmState->EE->addGlobalMapping(vmState->traceFn1, (void*) &traceEventFn1);
 
      std::vector<const Type*> traceConstParams;
      traceConstParams.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
      traceConstParams.push_back(Type::getInt32Ty(mod->getContext()));
      traceConstParams.push_back(Type::getInt32Ty(mod->getContext()));
      FunctionType* traceConstType = FunctionType::get(Type::getVoidTy(mod->getContext()), traceConstParams, false);
-     vmState->traceConst = Function::Create(traceConstType, GlobalValue::ExternalLinkage, "traceConst", mod);
-     vmState->EE->addGlobalMapping(vmState->traceConst, (void*) &traceConst);
+     vmState->traceConst = Function::Create(traceConstType, GlobalValue::ExternalLinkage, "traceEventConst", mod);
+     vmState->EE->addGlobalMapping(vmState->traceConst, (void*) &traceEventConst);
 
-     // Create an externally linked set state function.
-     std::vector<const Type*> setstateParams;
-     setstateParams.push_back(PointerType::getUnqual(l2MachineStateStruc));
-     FunctionType* setstateType = FunctionType::get(Type::getVoidTy(mod->getContext()), setstateParams, false);
-     vmState->setstateFunction = Function::Create(setstateType, GlobalValue::ExternalLinkage, "l2jitsetstate", mod);
-     vmState->EE->addGlobalMapping(vmState->setstateFunction, (void*) &l2jitsetstate);
-
-     verifyFunction(*vmState->setstateFunction);
-     //std::cout << "Created the set state function.\n";
+     // Create the profile functions, that compiled code counts into the active profile through.
+     if (PROFILE_ENABLED)
+     {
+          std::vector<const Type*> profileParams(1, Type::getInt32Ty(mod->getContext()));
+          FunctionType* profileType = FunctionType::get(Type::getVoidTy(mod->getContext()), profileParams, false);
+          vmState->profileCount =
+               Function::Create(profileType, GlobalValue::ExternalLinkage, "l2jitProfileCount", mod);
+          vmState->EE->addGlobalMapping(vmState->profileCount, (void*) &l2jitProfileCount);
+          vmState->profileCall = Function::Create(profileType, GlobalValue::ExternalLinkage, "l2jitProfileCall", mod);
+          vmState->EE->addGlobalMapping(vmState->profileCall, (void*) &l2jitProfileCall);
+
+          profileParams.push_back(Type::getInt32Ty(mod->getContext()));
+          FunctionType* peakType = FunctionType::get(Type::getVoidTy(mod->getContext()), profileParams, false);
+          vmState->profilePeak = Function::Create(peakType, GlobalValue::ExternalLinkage, "l2jitProfilePeak", mod);
+          vmState->EE->addGlobalMapping(vmState->profilePeak, (void*) &l2jitProfilePeak);
+     }
 
      // Create the reset method to set up the machines initial state.
      Function *resetFunction =
@@ -751,6 +1294,14 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
           dyn_cast<GlobalVariable>(mod->getOrInsertGlobal("l2MachineState", PointerType::getUnqual(l2MachineStateStruc)));
      vmState->l2MachineState->setInitializer(Constant::getNullValue(PointerType::getUnqual(l2MachineStateStruc)));
 
+     // Hold the address of the machine instance in a global, rather than in the compiled code, so that compiled code
+     // can be cached and reloaded into a different instance.
+     const Type* instancePtrType = PointerType::getUnqual(Type::getInt8Ty(mod->getContext()));
+     vmState->instancePtr = dyn_cast<GlobalVariable>(mod->getOrInsertGlobal("l2jitInstance", instancePtrType));
+     vmState->instancePtr->setInitializer(
+          ConstantExpr::getIntToPtr(ConstantInt::get(IntegerType::getInt64Ty(mod->getContext()),
+                                                     (uint64_t)(intptr_t)l2jit), instancePtrType));
+
      //std::cout << "Created global variable to point to the machine state.\n";
 
      // Add the entry block to the new function.
@@ -767,18 +1318,15 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
      //std::cout << "Added malloc call for machine state.\n";
 
-     // Allocate space for the machines heaps and stacks.
-     MallocInst* heapMalloc = builder.CreateMalloc(IntegerType::getInt32Ty(mod->getContext()), i32c(TOP));
+     // Point the machine at the data area for its heaps and stacks.
+     Constant* dataPtr =
+          ConstantExpr::getIntToPtr(ConstantInt::get(IntegerType::getInt64Ty(mod->getContext()),
+                                                     (uint64_t)(intptr_t)l2jit->area.data),
+                                    PointerType::getUnqual(IntegerType::get(mod->getContext(), CELL_BITS)));
      Value* heapPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(0), (Value*)0);
-     builder.CreateStore(heapMalloc, heapPtr);
+     builder.CreateStore(dataPtr, heapPtr);
 
-     //std::cout << "Added malloc call for the machine heap.\n";
-
-     // Set the l2 machine vector base using the set state function.
-     Value* statePtr = builder.CreateLoad(statePtrPtr, "statePtr");
-     Value *setstateCallParams[] = { statePtr };
-     CallInst *failedUnify =
-          builder.CreateCall(vmState->setstateFunction, setstateCallParams, array_endof(setstateCallParams));
+     //std::cout << "Set the data area for the machine heap.\n";
 
      // Initialize the machines state.
      Value* hpPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(1), (Value*)0);
@@ -787,12 +1335,14 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      Value* epPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(4), (Value*)0);
      Value* espPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(5), (Value*)0);
      Value* wmPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(6), (Value*)0);
-     builder.CreateStore(i32c(REG_SIZE), hpPtr);
-     builder.CreateStore(i32c(REG_SIZE), spPtr);
+     Value* topPtr = CreateGEPRange(&builder, stateMalloc, i32c(0), i32c(7), (Value*)0);
+     builder.CreateStore(i32c(HEAP_BASE), hpPtr);
+     builder.CreateStore(i32c(HEAP_BASE), spPtr);
      builder.CreateStore(i32c(TOP), upPtr);
      builder.CreateStore(i32c(STACK_BASE), epPtr);
      builder.CreateStore(i32c(STACK_BASE), espPtr);
      builder.CreateStore(i1c(0), wmPtr);
+     builder.CreateStore(i32c(TOP), topPtr);
 
      //std::cout << "Created initialisations for machine registers.\n";
 
@@ -801,55 +1351,93 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      verifyFunction(*resetFunction);
      //std::cout << "Finished creating the reset function.\n";
 
-     // Create an externally linked deref function.
-     std::vector<const Type*> derefParams;
-     derefParams.push_back(PointerType::getUnqual(l2MachineStateStruc));
-     derefParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
-     FunctionType* derefType = FunctionType::get(IntegerType::getInt32Ty(mod->getContext()), derefParams, false);
-     vmState->derefFunction = Function::Create(derefType, GlobalValue::ExternalLinkage, "l2jitderef", mod);
-     vmState->EE->addGlobalMapping(vmState->derefFunction, (void*) &l2jitderef);
-
-     verifyFunction(*vmState->derefFunction);
-     //std::cout << "Created the deref function.\n";
+     // Create the general unify function. Dereferencing and the simple cases of unification are generated inline.
+     vmState->unifyFunction = CreateUnifyFunction(mod, l2MachineStateStruc);
+     //std::cout << "Created the unify function.\n";
 
-     // Create an externally linked unify function.
-     std::vector<const Type*> unifyParams;
-     unifyParams.push_back(PointerType::getUnqual(l2MachineStateStruc));
-     unifyParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
-     unifyParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
-     FunctionType* unifyType = FunctionType::get(IntegerType::getInt1Ty(mod->getContext()), unifyParams, false);
-     vmState->unifyFunction = Function::Create(unifyType, GlobalValue::ExternalLinkage, "l2jitunify", mod);
-     vmState->EE->addGlobalMapping(vmState->unifyFunction, (void*) &l2jitunify);
+     // Create an externally linked call function, which takes the machine instance and the entry point to call.
+     std::vector<const Type*> callParams;
+     callParams.push_back(PointerType::getUnqual(Type::getInt8Ty(mod->getContext())));
+     callParams.push_back(IntegerType::getInt32Ty(mod->getContext()));
+     FunctionType* callType = FunctionType::get(IntegerType::getInt32Ty(mod->getContext()), callParams, false);
+     vmState->callFunction = Function::Create(callType, GlobalValue::ExternalLinkage, "l2jitcall", mod);
+     vmState->EE->addGlobalMapping(vmState->callFunction, (void*) &l2jitcall);
 
-     verifyFunction(*vmState->unifyFunction);
-     //std::cout << "Created the unify function.\n";
+     verifyFunction(*vmState->callFunction);
+     //std::cout << "Created the call function.\n";
 
      // Provide debug dump of everything created for the reset.
      //mod->print(std::cout);
      //std::cout << *vmState->l2MachineState;
      //std::cout << *vmState->unifyFunction;
-     //std::cout << *vmState->derefFunction;
      //std::cout << *vmState->thePrintf;
      //std::cout << *resetFunction;
 
      //std::cout << "Reset function completed.\n";
 
-     verifyBitCode();
-     writeBitCodeToFile();
+     verifyBitCode(vmState);
+     writeBitCodeToFile(vmState);
 
-     // Execute the reset method immediately.
+     // Execute the reset method immediately, and keep the state vector that it creates.
      vmState->EE->runFunction(resetFunction, std::vector<GenericValue>());
+     l2jit->l2state = *(l2jitMachineState**)vmState->EE->getPointerToGlobal(vmState->l2MachineState);
+
+     // Queries are rolled back to the empty heap and stacks, if rollback is on.
+     l2jit->mark = *l2jit->l2state;
+     l2jit->hpPeak = HEAP_BASE;
+
+     pthread_mutex_unlock(&l2jitLock);
+
+     return (jlong)(intptr_t)l2jit;
+}
+
+/*
+ * Releases the machine state, its execution environment, and the data area that it holds. Releasing a zero handle
+ * does nothing.
+ *
+ * Class:     com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine
+ * Method:    nativeRelease
+ * Signature: (J)V
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_nativeRelease
+(JNIEnv * env, jobject obj, jlong state)
+{
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+
+     if (l2jit != 0)
+     {
+          l2jitCancelCompiles(l2jit);
+
+          pthread_mutex_lock(&l2jitLock);
+
+          jitSymbolsRelease(&l2jit->symbols);
+          delete l2jit->vm.FPM;
+          delete l2jit->vm.EE;
+          delete l2jit->listener;
+          delete l2jit->names;
+          free(l2jit->l2state);
+          free(l2jit->entries);
+          dataAreaRelease(&l2jit->area);
+          profileRelease(l2jit->profile);
+          free(l2jit);
+
+          pthread_mutex_unlock(&l2jitLock);
+     }
 }
 
 /*
  * Creates a marker cell for addition to the heap. There are two types of marker cells 'STR' which is followed by a
  * heap pointer to a structure, and 'REF' which is followed by a heap pointer to another marker cell.
  *
- * <p/>The marker type value will be placed in the top eight bits of the heap cell, and the offset in the remaining
- * 24. The marker cell value will be equal to:
+ * <p/>The marker type value is placed in the tag of the heap cell, and the offset in its value, laid out as in
+ * cell.h. The marker cell value will be equal to:
  *
  * <p/><pre>
- * (cellType << 24) | ((hp + offset) & 0xFFFFFF)
+ * CELL_MAKE(cellType, hp + offset)
  * </pre>
  *
  * @param builder     The LLVM builder helper positioned to insert the instructions.
@@ -862,20 +1450,19 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 Value* createHeapMarkerCell(IRBuilder<> &builder, Value* hp, Value* offset, int cellType)
 {
      Value* hpIncr = builder.CreateAdd(hp, offset);
-     Value* hpIncrMask = builder.CreateAnd(hpIncr, i32c(0xFFFFFF));
-     Value* result = builder.CreateOr(i32c(cellType << 24), hpIncrMask);
+     Value* result = CreateCell(&builder, cellType, hpIncr);
 
      //CreateTrace(&builder, vmState->M, "offset = %x\n" , offset, (Value*)0);
-     //CreateTrace(&builder, vmState->M, "masked = %x\n" , hpIncrMask, (Value*)0);
      //CreateTrace(&builder, vmState->M, "result = %x\n" , result, (Value*)0);
 
      return result;
 }
 
 /*
- * Loads a heap offset from the machines state, and creats a heap pointer within the heap to the cell with that offset.
+ * Loads a heap offset from the machines registers, and creats a heap pointer within the heap to the cell with that
+ * offset.
  *
- * @param sptr    A pointer within the machine state, where the heap offset is stored.
+ * @param sptr    A pointer to the register, where the heap offset is stored.
  * @param baseptr A pointer to the base of the heap.
  *
  * @param optr    The name of the variable to hold the heap cell pointer.
@@ -886,13 +1473,13 @@ Value* createHeapMarkerCell(IRBuilder<> &builder, Value* hp, Value* offset, int
      Value* optr = CreateGEP(&builder, baseptr, p);
 
 /*
- * Adds the specified increment to a heap offset, and stores the result back into the machines state.
+ * Adds the specified increment to a heap offset, and stores the result back into the machines registers.
  *
  * @param builder     The LLVM builder helper positioned to insert the instructions.
  * @param heapBasePtr A pointer to the base of the heap.
  * @param hp          The current value of the heap offset to adjust.
  * @param inc         The increment to add to the heap offset.
- * @param hpPtr       A pointer to the location in the machine state where the heap offset is stored.
+ * @param hpPtr       A pointer to the register where the heap offset is stored.
  */
 void updateHeapOffset(IRBuilder<> &builder, Value* hp, Value* inc, Value* hpPtr)
 {
@@ -962,33 +1549,396 @@ Value* getRegOrArgOffset(IRBuilder<> &builder, jint xi, jbyte mode, Value* regBa
 }
 
 /*
- * Notified whenever code is added to the machine. This provides a hook in point at which the machine may,
- * if required, compile the code down below the byte code level.
+ * Finds or creates the entry pointer for compiled code to call a predicate through, before the predicate itself is
+ * compiled. This starts out pointing to a stub, that calls the predicate in whichever tier it is in, and is patched
+ * to point to the compiled body of the predicate once it is compiled.
  *
- * @param codeBuffer The code buffer.
- * @param codeOffset The start offset of the new code.
- * @param length     The length of the new code.
+ * @param l2jit The machine instance.
+ * @param p_n   The offset of the predicate to call.
+ *
+ * @return The entry pointer to call the predicate through.
  */
-JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_codeAdded
-(JNIEnv * env, jobject object, jobject codeBuf, jint offset, jint length)
+static GlobalVariable* l2jitCallStub(l2jitInstance* l2jit, jint p_n)
 {
-     /*std::cout << "\nJNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_codeAdded: "
-       << "called\n";*/
+     llvmState* vmState = &l2jit->vm;
+     Module* mod = vmState->M;
+     char name[40];
+
+     sprintf(name, "f_%i_entry", p_n);
+     GlobalVariable* entry = mod->getGlobalVariable(name);
+
+     if ((entry != 0) && entry->hasInitializer())
+     {
+          return entry;
+     }
+
+     // Create the stub, which passes the call on to the call function.
+     FunctionType* bodyType =
+          FunctionType::get(Type::getInt32Ty(mod->getContext()), std::vector<const Type*>(), false);
+
+     sprintf(name, "f_%i_stub", p_n);
+     Function* stub = Function::Create(bodyType, GlobalValue::ExternalLinkage, name, mod);
+     stub->setCallingConv(CallingConv::Fast);
+
+     IRBuilder<> builder(BasicBlock::Create(mod->getContext(), "EntryBlock", stub));
+
+     Value *callParams[] = {
+          builder.CreateLoad(vmState->instancePtr, "instancePtr"),
+          i32c(p_n)
+     };
+
+     builder.CreateRet(builder.CreateCall(vmState->callFunction, callParams, array_endof(callParams)));
+
+     verifyFunction(*stub);
+
+     // Point the entry at the stub.
+     sprintf(name, "f_%i_entry", p_n);
+     entry = dyn_cast<GlobalVariable>(mod->getOrInsertGlobal(name, PointerType::getUnqual(bodyType)));
+     entry->setInitializer(stub);
+
+     return entry;
+}
+
+/*
+ * Patches the entry pointer that compiled code calls a predicate through, if there is one, to point to the newly
+ * compiled body of the predicate. Callers compiled from then on call the body directly.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The offset of the predicate.
+ * @param body   The compiled body of the predicate.
+ */
+static void l2jitPatchCallStub(l2jitInstance* l2jit, jint offset, Function* body)
+{
+     llvmState* vmState = &l2jit->vm;
+     char name[40];
+
+     sprintf(name, "f_%i_entry", offset);
+     GlobalVariable* entry = vmState->M->getGlobalVariable(name);
+
+     if ((entry != 0) && entry->hasInitializer())
+     {
+          *(void**)vmState->EE->getPointerToGlobal(entry) = vmState->EE->getPointerToFunction(body);
+     }
+}
+
+/*
+ * Creates the code to obtain the function to call, for a compiled call to a predicate. If the predicate is already
+ * compiled its body is called directly, otherwise it is called through its entry pointer.
+ *
+ * @param l2jit   The machine instance.
+ * @param builder The LLVM builder helper positioned to insert the instructions.
+ * @param p_n     The offset of the predicate to call.
+ *
+ * @return The function to call.
+ */
+static Value* l2jitCallTarget(l2jitInstance* l2jit, IRBuilder<> &builder, jint p_n)
+{
+     char name[40];
+
+     sprintf(name, "f_%i_body", p_n);
+     Function* body = l2jit->vm.M->getFunction(name);
+
+     if ((body != 0) && !body->isDeclaration())
+     {
+          return body;
+     }
+
+     return builder.CreateLoad(l2jitCallStub(l2jit, p_n), "callee");
+}
+
+/*
+ * Checks whether the code at an entry point is a predicate, rather than a query. Predicates are named before their
+ * code is added, and queries are not.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The entry point.
+ *
+ * @return <tt>JNI_TRUE</tt> if the code at the entry point is a predicate, <tt>JNI_FALSE</tt> if it is a query.
+ */
+static jboolean l2jitIsPredicate(l2jitInstance* l2jit, jint offset)
+{
+     pthread_mutex_lock(&l2jitQueueLock);
+
+     jboolean predicate = ((l2jit->names != 0) && (l2jit->names->find(offset) != l2jit->names->end())) ?
+          JNI_TRUE : JNI_FALSE;
+
+     pthread_mutex_unlock(&l2jitQueueLock);
+
+     return predicate;
+}
+
+/*
+ * Works out the path of the file in the code cache, that code compiled from the byte code at an entry point is held
+ * in. This is named by a hash of the byte code, and of everything else that the compiled code depends on. Code is not
+ * cached when there is no cache directory, or when tracing or profiling, as trace and profile calls are compiled into
+ * the code.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The start offset of the code.
+ * @param length The length of the code.
+ *
+ * @return The path of the file in the code cache, which the caller must free, or null if the code is not cached.
+ */
+static char* l2jitCachePath(l2jitInstance* l2jit, jint offset, jint length)
+{
+     if ((l2jit->cacheDir == 0) || TRACE_ENABLED || PROFILE_ENABLED)
+     {
+          return 0;
+     }
+
+     // Hash the byte code with FNV-1a, along with its offset, which it refers to itself and is compiled in by name.
+     // The cell width is hashed in too, as code compiled for one cell layout cannot run against the other, and so is
+     // whether the code is a predicate, as the same byte code compiles differently as a query.
+     jint header[6] = { CODE_CACHE_VERSION, CELL_BITS, offset, length, (l2jit->threshold > 0),
+                        l2jitIsPredicate(l2jit, offset) };
+     uint64_t hash = 14695981039346656037ULL;
+
+     for (size_t i = 0; i < sizeof(header); i++)
+     {
+          hash = (hash ^ ((unsigned char*)header)[i]) * 1099511628211ULL;
+     }
+
+     for (jint i = 0; i < length; i++)
+     {
+          hash = (hash ^ (unsigned char)l2jit->code[offset + i]) * 1099511628211ULL;
+     }
+
+     char* path = (char*)malloc(strlen(l2jit->cacheDir) + 40);
+     sprintf(path, "%s/l2jit_%016llx_%i.bc", l2jit->cacheDir, (unsigned long long)hash, offset);
+
+     return path;
+}
+
+/*
+ * Loads code compiled on an earlier run from the code cache, and links it into the module. The cached code is not
+ * used, if it calls directly to code that has not been compiled on this run.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The start offset of the code.
+ * @param fName  The name of the compiled function.
+ * @param path   The path of the file in the code cache.
+ *
+ * @return <tt>JNI_TRUE</tt> if the compiled code was loaded, <tt>JNI_FALSE</tt> if it must be compiled.
+ */
+static jboolean l2jitCacheLoad(l2jitInstance* l2jit, jint offset, const char* fName, const char* path)
+{
+     llvmState* vmState = &l2jit->vm;
+     std::string errorInfo;
+
+     MemoryBuffer* buffer = MemoryBuffer::getFile(path, &errorInfo);
+
+     if (buffer == 0)
+     {
+          return JNI_FALSE;
+     }
+
+     Module* cached = ParseBitcodeFile(buffer, getGlobalContext(), &errorInfo);
+     delete buffer;
+
+     if (cached == 0)
+     {
+          return JNI_FALSE;
+     }
+
+     // Provide entry pointers for the predicates that the cached code calls through them.
+     for (Module::global_iterator g = cached->global_begin(); g != cached->global_end(); ++g)
+     {
+          jint p_n;
+
+          if (g->isDeclaration() && g->getName().endswith("_entry") &&
+              (sscanf(g->getName().str().c_str(), "f_%i_entry", &p_n) == 1))
+          {
+               l2jitCallStub(l2jit, p_n);
+          }
+     }
+
+     // Check that everything the cached code calls directly is already compiled.
+     for (Module::iterator f = cached->begin(); f != cached->end(); ++f)
+     {
+          if (f->isDeclaration() && f->getName().startswith("f_"))
+          {
+               Function* target = vmState->M->getFunction(f->getName());
+
+               if ((target == 0) || target->isDeclaration())
+               {
+                    delete cached;
+
+                    return JNI_FALSE;
+               }
+          }
+     }
+
+     // Link the cached code against the machine, and generate the native code for it.
+     jboolean linkFailed = Linker::LinkModules(vmState->M, cached, &errorInfo) ? JNI_TRUE : JNI_FALSE;
+     delete cached;
+
+     char bodyName[40];
+     sprintf(bodyName, "%s_body", fName);
+
+     Function* function = vmState->M->getFunction(fName);
+     Function* body = vmState->M->getFunction(bodyName);
+
+     if (linkFailed || (function == 0) || function->isDeclaration() || (body == 0) || body->isDeclaration())
+     {
+          return JNI_FALSE;
+     }
+
+     jint (*compiled)() = (jint (*)())vmState->EE->getPointerToFunction(function);
+     __sync_synchronize();
+     l2jit->entries[offset].compiled = compiled;
+     l2jitPatchCallStub(l2jit, offset, body);
+
+     return JNI_TRUE;
+}
+
+/*
+ * Writes a compiled function out to the code cache. It is written out on its own in a module, with everything that
+ * it refers to as declarations, to link against the machine on loading. The file is written under a temporary name
+ * and then renamed, so that other processes sharing the cache never see a partly written file.
+ *
+ * @param l2jit    The machine instance.
+ * @param function The compiled function.
+ * @param body     The compiled body of the function.
+ * @param path     The path of the file in the code cache.
+ */
+static void l2jitCacheStore(l2jitInstance* l2jit, Function* function, Function* body, const char* path)
+{
+     Module* cached = CloneModule(l2jit->vm.M);
+
+     // Strip out everything but the function, leaving declarations of what it uses.
+     for (Module::iterator f = cached->begin(); f != cached->end(); ++f)
+     {
+          if ((f->getName() != function->getName()) && (f->getName() != body->getName()))
+          {
+               f->deleteBody();
+          }
+     }
+
+     for (Module::global_iterator g = cached->global_begin(); g != cached->global_end(); ++g)
+     {
+          g->setInitializer(0);
+          g->setLinkage(GlobalValue::ExternalLinkage);
+     }
+
+     for (Module::iterator f = cached->begin(); f != cached->end();)
+     {
+          Function* next = f++;
+
+          if (next->isDeclaration() && next->use_empty())
+          {
+               next->eraseFromParent();
+          }
+     }
+
+     for (Module::global_iterator g = cached->global_begin(); g != cached->global_end();)
+     {
+          GlobalVariable* next = g++;
+
+          if (next->use_empty())
+          {
+               next->eraseFromParent();
+          }
+     }
+
+     char* tmpPath = (char*)malloc(strlen(path) + 20);
+     sprintf(tmpPath, "%s.%i", path, (int)getpid());
+
+     std::string errorInfo;
+     raw_fd_ostream* out = new raw_fd_ostream(tmpPath, 1, 1, errorInfo);
+
+     if (errorInfo.empty())
+     {
+          WriteBitcodeToFile(cached, *out);
+          out->close();
+
+          if (rename(tmpPath, path) != 0)
+          {
+               remove(tmpPath);
+          }
+     }
+
+     delete out;
+     delete cached;
+     free(tmpPath);
+}
+
+/*
+ * Holds pointers to the locations of the machine registers, that are cached in compiled code.
+ */
+typedef struct
+{
+     Value* hp;
+     Value* sp;
+     Value* ep;
+     Value* esp;
+     Value* wm;
+} l2jitRegisters;
+
+/*
+ * Copies the machine registers from one set of locations to another. This is used to fill the local copies of the
+ * registers that compiled code works on from the machine state, and to spill them back again.
+ *
+ * @param builder The LLVM builder helper positioned to insert the instructions.
+ * @param from    The locations to copy the registers from.
+ * @param to      The locations to copy the registers to.
+ */
+void copyRegisters(IRBuilder<> &builder, l2jitRegisters* from, l2jitRegisters* to)
+{
+     builder.CreateStore(builder.CreateLoad(from->hp), to->hp);
+     builder.CreateStore(builder.CreateLoad(from->sp), to->sp);
+     builder.CreateStore(builder.CreateLoad(from->ep), to->ep);
+     builder.CreateStore(builder.CreateLoad(from->esp), to->esp);
+     builder.CreateStore(builder.CreateLoad(from->wm), to->wm);
+}
+
+/*
+ * Compiles the code at an entry point down to a native function, and records the function against the entry point.
+ * This must only be called with the LLVM lock held.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The start offset of the code to compile.
+ * @param length The length of the code.
+ */
+static void l2jitCompile(l2jitInstance* l2jit, jint offset, jint length)
+{
+     llvmState* vmState = &l2jit->vm;
+
      //std::cout << "\nCompilation Trace.\n";
 
      jboolean stopCompilation = JNI_FALSE;
-     jbyte* code = (jbyte*)env->GetDirectBufferAddress(codeBuf);
+     jbyte* code = l2jit->code;
      jint ip = offset;
      jint ep = 0;
      Module* mod = vmState->M;
 
+     // Last calls are only made as tail calls from predicates. The environment of a query holds its variables until
+     // their bindings have been read out, so it must outlive the last call of the query.
+     jboolean lastCallOpt = l2jitIsPredicate(l2jit, offset);
+
      // Create a function to hold the results of compiling down the byte code.
      char* fName = (char*)malloc(100 * sizeof(char));
      sprintf(fName, "f_%i", offset);
      //std::cout << "Creating function: " << fName << "\n";
 
+     // Reuse the code compiled for the same byte code on an earlier run, if it is in the code cache.
+     char* cachePath = l2jitCachePath(l2jit, offset, length);
+
+     if ((cachePath != 0) && l2jitCacheLoad(l2jit, offset, fName, cachePath))
+     {
+          free(cachePath);
+          free(fName);
+
+          return;
+     }
+
+     // The code is compiled into a body function, which compiled callers call and tail call with the fast calling
+     // convention. The function itself is a wrapper around the body, for calling from C.
+     char* bodyName = (char*)malloc(110 * sizeof(char));
+     sprintf(bodyName, "%s_body", fName);
+
      Function *newFunction =
-          cast<Function>(mod->getOrInsertFunction(fName, Type::getInt32Ty(mod->getContext()), (Type *)0));
+          cast<Function>(mod->getOrInsertFunction(bodyName, Type::getInt32Ty(mod->getContext()), (Type *)0));
+     newFunction->setCallingConv(CallingConv::Fast);
 
      // Add the entry block to the new function.
      BasicBlock *bb = BasicBlock::Create(mod->getContext(), "EntryBlock", newFunction);
@@ -1004,15 +1954,31 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
      // Take pointers to the base of the heap and the other elements of the machines state.
      Value* statePtrPtr = CreateGEP(&builder, vmState->l2MachineState, i32c(0), "statePtrPtr");
      Value* statePtr = builder.CreateLoad(statePtrPtr, "statePtr");
-     Value* hpPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(1), (Value*)0);
-     Value* spPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(2), (Value*)0);
-     Value* upPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(3), (Value*)0);
-     Value* epPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(4), (Value*)0);
-     Value* espPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(5), (Value*)0);
-     Value* wmPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(6), (Value*)0);
+     l2jitRegisters stateRegs;
+     stateRegs.hp = CreateGEPRange(&builder, statePtr, i32c(0), i32c(1), (Value*)0);
+     stateRegs.sp = CreateGEPRange(&builder, statePtr, i32c(0), i32c(2), (Value*)0);
+     stateRegs.ep = CreateGEPRange(&builder, statePtr, i32c(0), i32c(4), (Value*)0);
+     stateRegs.esp = CreateGEPRange(&builder, statePtr, i32c(0), i32c(5), (Value*)0);
+     stateRegs.wm = CreateGEPRange(&builder, statePtr, i32c(0), i32c(6), (Value*)0);
 
      //std::cout << "Took pointers into the machine state.\n";
 
+     // Work on local copies of the machine registers, which the mem2reg pass turns into SSA values. These are only
+     // spilled back to the machine state around calls and on returning.
+     l2jitRegisters localRegs;
+     localRegs.hp = builder.CreateAlloca(Type::getInt32Ty(mod->getContext()), 0, "hp");
+     localRegs.sp = builder.CreateAlloca(Type::getInt32Ty(mod->getContext()), 0, "sp");
+     localRegs.ep = builder.CreateAlloca(Type::getInt32Ty(mod->getContext()), 0, "ep");
+     localRegs.esp = builder.CreateAlloca(Type::getInt32Ty(mod->getContext()), 0, "esp");
+     localRegs.wm = builder.CreateAlloca(Type::getInt1Ty(mod->getContext()), 0, "wm");
+     copyRegisters(builder, &stateRegs, &localRegs);
+
+     Value* hpPtr = localRegs.hp;
+     Value* spPtr = localRegs.sp;
+     Value* epPtr = localRegs.ep;
+     Value* espPtr = localRegs.esp;
+     Value* wmPtr = localRegs.wm;
+
      // Load the heap pointers and set up a base pointer to the various data sections.
      Value* heapPtrPtr = CreateGEPRange(&builder, statePtr, i32c(0), i32c(0), (Value*)0);
      Value* heapBasePtr = builder.CreateLoad(heapPtrPtr, "heapBasePtr");
@@ -1020,6 +1986,11 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
      //std::cout << "Took pointers into the machine heap.\n";
 
+     // Keep track of which registers are known to hold fresh variables, that nothing can have been bound to yet, so
+     // that unifying against them can be reduced to a bind. This is forgotten on anything that may bind a variable.
+     jboolean freshReg[256];
+     memset(freshReg, JNI_FALSE, sizeof(freshReg));
+
      //std::cout << "Looping over instructions from " << ip << " to " << (offset + length) << ".\n";
 
      // Loop over the inserted instructions compiling them down into LLVM byte code instructions.
@@ -1028,6 +1999,9 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
           // Grab next instruction and switch on it.
           jbyte instruction = code[ip];
 
+          CreateProfileFn(&builder, vmState->profileCount, i32c(PROFILE_OPCODES + (unsigned char)instruction),
+                          (Value*)0);
+
           switch (instruction)
           {
                // put_struc xi:
@@ -1052,12 +2026,17 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                // heap[h+1] <- f/n
                Value* heapPtrInc = CreateGEP(&builder, heapPtr, i32c(1));
-               builder.CreateStore(i32c(f_n), heapPtrInc);
+               builder.CreateStore(cellc(f_n), heapPtrInc);
 
                // xi <- heap[h]
                Value *toreg = builder.CreateLoad(heapPtr);
                builder.CreateStore(toreg, regXiPtr);
 
+               if (mode == REG_ADDR)
+               {
+                    freshReg[(unsigned char)xi] = JNI_FALSE;
+               }
+
                // h <- h + 2
                updateHeapOffset(builder, hp, i32c(2), hpPtr);
 
@@ -1087,6 +2066,11 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                Value *toreg = builder.CreateLoad(heapPtr);
                builder.CreateStore(toreg, regXiPtr);
 
+               if (mode == REG_ADDR)
+               {
+                    freshReg[(unsigned char)xi] = JNI_TRUE;
+               }
+
                // h <- h + 1
                updateHeapOffset(builder, hp, i32c(1), hpPtr);
 
@@ -1134,20 +2118,27 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                CreateTraceFn(&builder, mod, vmState->traceFn1, "GET_STRUC", i32c(ip), regXiOffset, i32c(f_n), (Value*)0);
 
                // addr <- deref(xi);
-               Value *derefParams[] = {
-                    statePtr,
-                    regXiOffset
-               };
+               // A fresh variable dereferences in one step, and is known to be a REF.
+               jboolean xiFresh = (mode == REG_ADDR) && freshReg[(unsigned char)xi];
+               Value* addr;
+
+               if (xiFresh)
+               {
+                    addr = CreateCellVal(&builder, builder.CreateLoad(CreateGEP(&builder, heapBasePtr, regXiOffset)),
+                                         "addr");
+               }
+               else
+               {
+                    addr = CreateDeref(&builder, newFunction, heapBasePtr, regXiOffset);
+               }
 
-               CallInst* addr =
-                    builder.CreateCall<>(vmState->derefFunction, derefParams, array_endof(derefParams), "addr");
                Value* heapAddrPtr = CreateGEP(&builder, heapBasePtr, addr, "heapAddrPtr");
                Value* heapVal = builder.CreateLoad(heapAddrPtr, "heapVal");
-               Value* tag = builder.CreateLShr(heapVal, i32c(24), "tag");
-               Value* val = builder.CreateAnd(heapVal, i32c(0x00FFFFFF), "val");
+               Value* tag = CreateCellTag(&builder, heapVal, "tag");
+               Value* val = CreateCellVal(&builder, heapVal, "val");
 
                CreateTrace(&builder, mod, "addr    = %i\n", addr, (Value*)0);
-               CreateTrace(&builder, mod, "heapVal = %i\n", heapVal, (Value*)0);
+               CreateTrace(&builder, mod, "heapVal = %i\n", CreateIntFromCell(&builder, heapVal), (Value*)0);
                CreateTrace(&builder, mod, "tag     = %i\n", tag, (Value*)0);
                CreateTrace(&builder, mod, "val     = %i\n", val, (Value*)0);
 
@@ -1156,8 +2147,15 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                BasicBlock *tagStrBlock = BasicBlock::Create(mod->getContext(), "getStrucStrTag", newFunction);
                BasicBlock *continueBlock = BasicBlock::Create(mod->getContext(), "getStrucTagContinue", newFunction);
 
-               Value *isRef = builder.CreateICmpEQ(tag, i32c(REF), "isRef");
-               builder.CreateCondBr(isRef, tagRefBlock, tagStrBlock);
+               if (xiFresh)
+               {
+                    builder.CreateBr(tagRefBlock);
+               }
+               else
+               {
+                    Value *isRef = builder.CreateICmpEQ(tag, i32c(REF), "isRef");
+                    builder.CreateCondBr(isRef, tagRefBlock, tagStrBlock);
+               }
 
                // case REF:
                {
@@ -1171,7 +2169,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                     // heap[h+1] <- f/n
                     Value* heapPtrInc = CreateGEP(&builder, heapPtr, i32c(1), "heapPtrInc");
-                    builder.CreateStore(i32c(f_n), heapPtrInc);
+                    builder.CreateStore(cellc(f_n), heapPtrInc);
 
                     // bind(addr, h)
                     Value* toHeapAddr = createHeapMarkerCell(builder, hp, i32c(0), REF);
@@ -1202,9 +2200,9 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                     Value* strCmp = builder.CreateLoad(derefStrPtr);
 
                     CreateTrace(&builder, mod, "f_n     = %i\n", i32c(f_n), (Value*)0);
-                    CreateTrace(&builder, mod, "strCmp  = %i\n", strCmp, (Value*)0);
+                    CreateTrace(&builder, mod, "strCmp  = %i\n", CreateIntFromCell(&builder, strCmp), (Value*)0);
 
-                    Value* isMatch = builder.CreateICmpEQ(strCmp, i32c(f_n), "isMatch");
+                    Value* isMatch = builder.CreateICmpEQ(strCmp, cellc(f_n), "isMatch");
                     builder.CreateCondBr(isMatch, matchTrueBlock, matchFalseBlock);
 
                     // if heap[a] = f/n
@@ -1229,6 +2227,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                          // fail
                          CreateTrace(&builder, mod, "Failed on GET_STRUC.\n", i32c(0), (Value*)0);
+                         copyRegisters(builder, &localRegs, &stateRegs);
                          builder.CreateRet(i32c(0));
                     }
 
@@ -1238,6 +2237,9 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                builder.SetInsertPoint(continueBlock);
 
+               // Anything may have been bound.
+               memset(freshReg, JNI_FALSE, sizeof(freshReg));
+
                // P <- instruction_size(P)
                ip += 7;
 
@@ -1290,13 +2292,18 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                     Value *toreg = builder.CreateLoad(heapPtr);
                     builder.CreateStore(toreg, regXiPtr);
 
+                    // h <- h + 1
+                    updateHeapOffset(builder, hp, i32c(1), hpPtr);
+
                     builder.CreateBr(continueBlock);
                }
 
                builder.SetInsertPoint(continueBlock);
 
-               // h <- h + 1
-               updateHeapOffset(builder, hp, i32c(1), hpPtr);
+               if (mode == REG_ADDR)
+               {
+                    freshReg[(unsigned char)xi] = JNI_FALSE;
+               }
 
                // s <- s + 1
                updateHeapOffset(builder, sp, i32c(1), spPtr);
@@ -1313,6 +2320,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                jbyte mode = code[ip + 1];
                jint xi = (jint)code[ip + 2];
                Value* regXiPtr = getRegOrArgPtr(builder, xi, mode, regBasePtr, heapBasePtr, epPtr);
+               Value* regXiOffset = getRegOrArgOffset(builder, xi, mode, regBasePtr, heapBasePtr, epPtr);
 
                //trace1("UNIFY_VAL", ip, xi);
                CreateTraceFn(&builder, mod, vmState->trace1, "UNIFY_VAL", i32c(ip), i32c(xi), (Value*)0);
@@ -1334,25 +2342,19 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                     builder.SetInsertPoint(writeModeFalseBlock);
 
                     // unify (xi, s)
-                    Value *unifyParams[] = {
-                         statePtr,
-                         i32c(xi),
-                         sp
-                    };
-
-                    CallInst *failedUnify =
-                         builder.CreateCall(vmState->unifyFunction, unifyParams, array_endof(unifyParams));
+                    jboolean xiFresh = (mode == REG_ADDR) && freshReg[(unsigned char)xi];
+                    Value *unified =
+                         CreateUnify(&builder, vmState, newFunction, statePtr, heapBasePtr, regXiOffset, sp, xiFresh);
 
                     // check if unification failed.
                     BasicBlock *failBlock = BasicBlock::Create(mod->getContext(), "unifyValUnifyFailed", newFunction);
 
-                    Value *failed = builder.CreateICmpEQ(failedUnify, i1c(0));
-                    //builder.CreateCondBr(failedUnify, failBlock, continueBlock);
-                    builder.CreateCondBr(failedUnify, continueBlock, failBlock);
+                    builder.CreateCondBr(unified, continueBlock, failBlock);
 
                     // fail case:
                     {
                          builder.SetInsertPoint(failBlock);
+                         copyRegisters(builder, &localRegs, &stateRegs);
                          builder.CreateRet(i32c(0));
                     }
                }
@@ -1375,6 +2377,9 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                builder.SetInsertPoint(continueBlock);
 
+               // Anything may have been bound.
+               memset(freshReg, JNI_FALSE, sizeof(freshReg));
+
                // s <- s + 1
                updateHeapOffset(builder, sp, i32c(1), spPtr);
 
@@ -1408,9 +2413,16 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                builder.CreateStore(toreg, regXiPtr);
 
                // Ai <- heap[h]
-               Value* regAiPtr = CreateGEP(&builder, regBasePtr, i32c(xi));
+               Value* regAiPtr = CreateGEP(&builder, regBasePtr, i32c(ai));
                builder.CreateStore(toreg, regAiPtr);
 
+               if (mode == REG_ADDR)
+               {
+                    freshReg[(unsigned char)xi] = JNI_TRUE;
+               }
+
+               freshReg[(unsigned char)ai] = JNI_TRUE;
+
                // h <- h + 1
                updateHeapOffset(builder, hp, i32c(1), hpPtr);
 
@@ -1435,8 +2447,9 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                // Ai <- Xn
                Value* regAiPtr = CreateGEP(&builder, regBasePtr, i32c(ai));
                Value* toMove = builder.CreateLoad(regXiPtr);
-               CreateTrace(&builder, mod, "toMove = %x\n", toMove, (Value*)0);
+               CreateTrace(&builder, mod, "toMove = %x\n", CreateIntFromCell(&builder, toMove), (Value*)0);
                builder.CreateStore(toMove, regAiPtr);
+               freshReg[(unsigned char)ai] = (mode == REG_ADDR) ? freshReg[(unsigned char)xi] : JNI_FALSE;
 
                // P <- P + instruction_size(P)
                ip += 4;
@@ -1461,6 +2474,11 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                Value* toMove = builder.CreateLoad(regAiPtr);
                builder.CreateStore(toMove, regXiPtr);
 
+               if (mode == REG_ADDR)
+               {
+                    freshReg[(unsigned char)xi] = freshReg[(unsigned char)ai];
+               }
+
                // P <- P + instruction_size(P)
                ip += 4;
 
@@ -1480,33 +2498,42 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                CreateTraceFn(&builder, mod, vmState->trace2, "GET_VAL", i32c(ip), regXiOffset, i8c(mode), i32c(ai), i32c(-3), (Value*)0);
 
                // unify (Xn, Ai)
-               Value *unifyParams[] = {
-                    statePtr,
-                    regXiOffset,
-                    i32c(ai)
-               };
+               // Whichever side is known to hold a fresh variable is placed first, so that it is simply bound.
+               jboolean xiFresh = (mode == REG_ADDR) && freshReg[(unsigned char)xi];
+               jboolean aiFresh = freshReg[(unsigned char)ai];
+               Value *unified;
 
-               CallInst *failedUnify =
-                    builder.CreateCall(vmState->unifyFunction, unifyParams, array_endof(unifyParams));
+               if (aiFresh && !xiFresh)
+               {
+                    unified = CreateUnify(&builder, vmState, newFunction, statePtr, heapBasePtr, i32c(ai), regXiOffset,
+                                          true);
+               }
+               else
+               {
+                    unified = CreateUnify(&builder, vmState, newFunction, statePtr, heapBasePtr, regXiOffset, i32c(ai),
+                                          xiFresh);
+               }
 
                // check if unification failed.
                BasicBlock *failBlock = BasicBlock::Create(mod->getContext(), "getValUnifyFailed", newFunction);
                BasicBlock *continueBlock = BasicBlock::Create(mod->getContext(), "getValUnifyContinue", newFunction);
 
-               Value *failed = builder.CreateICmpEQ(failedUnify, i1c(0));
-               //builder.CreateCondBr(failedUnify, failBlock, continueBlock);
-               builder.CreateCondBr(failedUnify, continueBlock, failBlock);
+               builder.CreateCondBr(unified, continueBlock, failBlock);
 
                // fail case:
                {
                     builder.SetInsertPoint(failBlock);
 
                     //CreateTrace(&builder, mod, "Failed unify on GET_VAL.\n", i32c(0), (Value*)0);
+                    copyRegisters(builder, &localRegs, &stateRegs);
                     builder.CreateRet(i32c(0));
                }
 
                builder.SetInsertPoint(continueBlock);
 
+               // Anything may have been bound.
+               memset(freshReg, JNI_FALSE, sizeof(freshReg));
+
                // P <- P + instruction_size(P)
                ip += 4;
 
@@ -1526,6 +2553,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                if (p_n == -1)
                {
                     // fail at runtime.
+                    copyRegisters(builder, &localRegs, &stateRegs);
                     builder.CreateRet(i32c(0));
 
                     // stop compilation.
@@ -1533,17 +2561,46 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                }
                else
                {
+                    CreateProfileFn(&builder, vmState->profileCall, i32c(p_n), (Value*)0);
+
                     // CP <- P + instruction_size(P)
                     // ip <- @(p/n)
 
-                    // Obtain the address of the compiled code to call.
-                    char* cfName = (char*)malloc(30 * sizeof(char));
-                    sprintf(cfName, "f_%i", p_n);
-                    Function* callTarget = vmState->EE->FindFunctionNamed(cfName);
-                    free(cfName);
+                    // Call the compiled body directly, if there is one yet. Otherwise go through its entry pointer.
+                    Value* callTarget = l2jitCallTarget(l2jit, builder, p_n);
+
+                    // A last call of a predicate, followed only by deallocate, deallocates first and then becomes
+                    // a tail call. Variables are all held on the heap, so the environment is no longer needed by then.
+                    if (lastCallOpt && ((ip + 5) < (offset + length)) && (code[ip + 5] == DEALLOCATE))
+                    {
+                         //trace0("DEALLOCATE", ip + 5);
+                         CreateTraceFn(&builder, mod, vmState->trace0, "DEALLOCATE", i32c(ip + 5), (Value*)0);
+
+                         loadState(epPtr, heapBasePtr, envPtr, lcoEp);
+
+                         // E <- STACK[E]
+                         builder.CreateStore(lcoEp, espPtr);
+                         Value* oldEp = CreateIntFromCell(&builder, builder.CreateLoad(envPtr));
+                         builder.CreateStore(oldEp, epPtr);
+
+                         // P <- @(p/n), with CP left as it was.
+                         copyRegisters(builder, &localRegs, &stateRegs);
+
+                         CallInst* tailCall = builder.CreateCall(callTarget);
+                         tailCall->setCallingConv(CallingConv::Fast);
+                         tailCall->setTailCall();
+                         builder.CreateRet(tailCall);
+
+                         // P <- P + instruction_size(P), skipping over the deallocate.
+                         ip += 6;
+
+                         break;
+                    }
+
+                    copyRegisters(builder, &localRegs, &stateRegs);
 
-                    // Call the compiled query.
                     CallInst* failedCall = builder.CreateCall(callTarget);
+                    failedCall->setCallingConv(CallingConv::Fast);
 
                     // Check if the call failed.
                     BasicBlock* failBlock = BasicBlock::Create(mod->getContext(), "callFailed", newFunction);
@@ -1553,7 +2610,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                     //CreateTrace(&builder, mod, "failedCall = %i\n", failedCall, (Value*)0);
                     builder.CreateCondBr(failed, failBlock, continueBlock);
 
-                    // Fail case:
+                    // Fail case, the machine state is left as the called code left it:
                     {
                          builder.SetInsertPoint(failBlock);
                          //CreateTrace(&builder, mod, "Call failed.\n", i32c(0), (Value*)0);
@@ -1561,9 +2618,13 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                     }
 
                     builder.SetInsertPoint(continueBlock);
+                    copyRegisters(builder, &stateRegs, &localRegs);
                     //CreateTrace(&builder, mod, "Call succeeded.\n", i32c(0), (Value*)0);
                }
 
+               // Anything may have been bound.
+               memset(freshReg, JNI_FALSE, sizeof(freshReg));
+
                // P <- P + instruction_Size(P)
                ip += 5;
 
@@ -1577,6 +2638,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                CreateTraceFn(&builder, mod, vmState->trace0, "PROCEED", i32c(ip), (Value*)0);
 
                // P <- CP
+               copyRegisters(builder, &localRegs, &stateRegs);
                builder.CreateRet(i32c(1));
 
                // P <- P + instruction_Size(P)
@@ -1599,17 +2661,19 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                // STACK[newE] <- E
                Value* stackPtr = CreateGEP(&builder, newEnvPtr, i32c(0));
-               builder.CreateStore(ep, stackPtr);
+               builder.CreateStore(CreateCellFromInt(&builder, ep), stackPtr);
 
                // STACK[E + 1] <- N
                Value* stackPtrInc = CreateGEP(&builder, newEnvPtr, i32c(1));
-               builder.CreateStore(i32c(n), stackPtrInc);
+               builder.CreateStore(cellc(n), stackPtrInc);
 
                // E <- newE
                // newE <- E + n + 2
                builder.CreateStore(esp, epPtr);
                Value* newEsp = builder.CreateAdd(esp, i32c(n + 2));
                builder.CreateStore(newEsp, espPtr);
+               CreateProfileFn(&builder, vmState->profilePeak, i32c(PROFILE_ESP_PEAK),
+                               builder.CreateSub(newEsp, i32c(STACK_BASE)));
 
                // P <- P + instruction_size(P)
                ip += 2;
@@ -1627,10 +2691,11 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
 
                // E <- STACK[E]
                builder.CreateStore(ep, espPtr);
-               Value* oldEp = builder.CreateLoad(envPtr);
+               Value* oldEp = CreateIntFromCell(&builder, builder.CreateLoad(envPtr));
                builder.CreateStore(oldEp, epPtr);
 
                // P <- STACK.pop (i.e. return succesfully).
+               copyRegisters(builder, &localRegs, &stateRegs);
                builder.CreateRet(i32c(1));
 
                // P <- P + instruction_size(P)
@@ -1646,6 +2711,7 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
                CreateTraceFn(&builder, mod, vmState->trace0, "UNKNOWN (Fail)", i32c(ip), (Value*)0);
 
                // fail at runtime.
+               copyRegisters(builder, &localRegs, &stateRegs);
                builder.CreateRet(i32c(0));
 
                // stop compilation.
@@ -1654,68 +2720,1014 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
           }
      }
 
+     // Create the wrapper around the body, for calling from C.
+     Function *wrapperFunction =
+          cast<Function>(mod->getOrInsertFunction(fName, Type::getInt32Ty(mod->getContext()), (Type *)0));
+     builder.SetInsertPoint(BasicBlock::Create(mod->getContext(), "EntryBlock", wrapperFunction));
+
+     CallInst* bodyCall = builder.CreateCall(newFunction);
+     bodyCall->setCallingConv(CallingConv::Fast);
+     builder.CreateRet(bodyCall);
+
      // Pass the new function through the optimizer pipeline.
      vmState->FPM->run(*mod);
 
      //std::cout << "Created function: " << fName << ":\n";
      free(fName);
+     free(bodyName);
      //std::cout << *newFunction;
 
-     verifyBitCode();
-     writeBitCodeToFile();
-}
+     verifyBitCode(vmState);
+     writeBitCodeToFile(vmState);
+
+     // Keep the optimized code in the code cache, for later runs.
+     if (cachePath != 0)
+     {
+          l2jitCacheStore(l2jit, wrapperFunction, newFunction, cachePath);
+          free(cachePath);
+     }
+
+     // Generate the native code for the function, and point callers waiting on it at the body. The code is complete
+     // before it is published, as it may be picked up straight away by a thread running the machine.
+     jint (*compiled)() = (jint (*)())vmState->EE->getPointerToFunction(wrapperFunction);
+     __sync_synchronize();
+     l2jit->entries[offset].compiled = compiled;
+     l2jitPatchCallStub(l2jit, offset, newFunction);
+}
+
+/*
+ * Runs the background compiler thread, which compiles the code of each request queued to it in turn, for as long as
+ * the process runs. Compiling takes the LLVM lock, as all compiles do, but the queue is only held to take a request
+ * off of it.
+ *
+ * @param arg Unused.
+ *
+ * @return Never returns.
+ */
+static void* l2jitCompiler(void* arg)
+{
+     for (;;)
+     {
+          pthread_mutex_lock(&l2jitQueueLock);
+
+          while (l2jitQueueHead == 0)
+          {
+               pthread_cond_wait(&l2jitQueued, &l2jitQueueLock);
+          }
+
+          l2jitRequest* request = l2jitQueueHead;
+          l2jitQueueHead = request->next;
+
+          if (l2jitQueueHead == 0)
+          {
+               l2jitQueueTail = 0;
+          }
+
+          l2jitCompiling = request->l2jit;
+
+          pthread_mutex_unlock(&l2jitQueueLock);
+
+          pthread_mutex_lock(&l2jitLock);
+
+          l2jitCompile(request->l2jit, request->offset, request->length);
+
+          pthread_mutex_unlock(&l2jitLock);
+
+          pthread_mutex_lock(&l2jitQueueLock);
+
+          l2jitCompiling = 0;
+          pthread_cond_broadcast(&l2jitCompiled);
+
+          pthread_mutex_unlock(&l2jitQueueLock);
+
+          free(request);
+     }
+
+     return 0;
+}
+
+/*
+ * Starts the background compiler thread. If it cannot be started, code is compiled on the thread that needs it.
+ */
+static void l2jitStartCompiler()
+{
+     pthread_t thread;
+
+     if (pthread_create(&thread, NULL, l2jitCompiler, NULL) == 0)
+     {
+          pthread_detach(thread);
+          l2jitCompilerStarted = true;
+     }
+}
+
+/*
+ * Compiles the code at an entry point. When compiling in the background, the code is queued to the compiler thread,
+ * and this returns straight away, leaving the code to be interpreted until its compiled code is published. Otherwise
+ * it is compiled before this returns. This must be called without the LLVM lock held.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The start offset of the code to compile.
+ * @param length The length of the code.
+ */
+static void l2jitRequestCompile(l2jitInstance* l2jit, jint offset, jint length)
+{
+     l2jitEntry* entry = &l2jit->entries[offset];
+
+     if (l2jit->background)
+     {
+          pthread_once(&l2jitCompilerOnce, l2jitStartCompiler);
+     }
+
+     if (!l2jit->background || !l2jitCompilerStarted)
+     {
+          pthread_mutex_lock(&l2jitLock);
+
+          l2jitCompile(l2jit, offset, length);
+
+          pthread_mutex_unlock(&l2jitLock);
+
+          return;
+     }
+
+     if (entry->queued)
+     {
+          return;
+     }
+
+     l2jitRequest* request = (l2jitRequest*)malloc(sizeof(l2jitRequest));
+
+     if (request == 0)
+     {
+          return;
+     }
+
+     request->l2jit = l2jit;
+     request->offset = offset;
+     request->length = length;
+     request->next = 0;
+     entry->queued = JNI_TRUE;
+
+     pthread_mutex_lock(&l2jitQueueLock);
+
+     if (l2jitQueueTail != 0)
+     {
+          l2jitQueueTail->next = request;
+     }
+     else
+     {
+          l2jitQueueHead = request;
+     }
+
+     l2jitQueueTail = request;
+     pthread_cond_signal(&l2jitQueued);
+
+     pthread_mutex_unlock(&l2jitQueueLock);
+}
+
+/*
+ * Takes all of the requests for a machine instance off of the queue to the compiler thread, and waits for any of its
+ * code that is being compiled to be finished with, so that its code and execution environment can be cleared. This
+ * must be called without the LLVM lock held.
+ *
+ * @param l2jit The machine instance.
+ */
+static void l2jitCancelCompiles(l2jitInstance* l2jit)
+{
+     pthread_mutex_lock(&l2jitQueueLock);
+
+     l2jitRequest** at = &l2jitQueueHead;
+     l2jitQueueTail = 0;
+
+     while (*at != 0)
+     {
+          l2jitRequest* request = *at;
+
+          if (request->l2jit == l2jit)
+          {
+               *at = request->next;
+               l2jit->entries[request->offset].queued = JNI_FALSE;
+               free(request);
+          }
+          else
+          {
+               l2jitQueueTail = request;
+               at = &request->next;
+          }
+     }
+
+     while (l2jitCompiling == l2jit)
+     {
+          pthread_cond_wait(&l2jitCompiled, &l2jitQueueLock);
+     }
+
+     pthread_mutex_unlock(&l2jitQueueLock);
+}
+
+/*
+ * Calculates the offset, relative to the base of the machine heap, of either a register or local variable,
+ * depending on the addressing mode.
+ *
+ * @param l2state The address of l2 machine state vector.
+ * @param xi      The register or local variable offset.
+ * @param mode    The addressing mode (REG_ADDR or STACK_ADDR).
+ *
+ * @return The offset of the register or local variable.
+ */
+static inline jint l2jitRegOrArgOffset(l2jitMachineState* l2state, jint xi, jbyte mode)
+{
+     // Offset the argument index by 2, as the first two slots of the environment
+     // contain the environment size, and a previous environment pointer.
+     return (mode == STACK_ADDR) ? l2state->ep + xi + 2 : xi;
+}
+
+/*
+ * Interprets the code at an entry point. This carries out the same steps as the code that the compiler generates,
+ * on the same machine state, so that code may move from being interpreted to being compiled between any two calls.
+ *
+ * @param l2jit The machine instance.
+ * @param ip    The entry point to interpret from.
+ *
+ * @return Non-zero if the code succeeded, zero if it failed.
+ */
+static jint l2jitInterpret(l2jitInstance* l2jit, jint ip)
+{
+     l2jitMachineState* l2state = l2jit->l2state;
+     jbyte* code = l2jit->code;
+     jcell* heap = l2state->heapBasePtr;
+
+     for (;;)
+     {
+          // Grab next instruction and switch on it.
+          jbyte instruction = code[ip];
+
+          PROFILE_OPCODE(instruction);
+
+          switch (instruction)
+          {
+               // put_struc xi:
+          case PUT_STRUC:
+          {
+               // grab f/n
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint f_n = *(jint*)(code + ip + 3);
+
+               traceFn1((char*)"PUT_STRUC", ip, (jint)code[ip + 2], f_n);
+
+               // heap[h] <- STR, h + 1
+               heap[l2state->hp] = CELL_MAKE(STR, l2state->hp + 1);
+
+               // heap[h+1] <- f/n
+               heap[l2state->hp + 1] = f_n;
+
+               // xi <- heap[h]
+               heap[xi] = heap[l2state->hp];
+
+               // h <- h + 2
+               l2state->hp += 2;
+
+               // P <- instruction_size(P)
+               ip += 7;
+
+               break;
+          }
+
+          // set_var xi:
+          case SET_VAR:
+          {
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+
+               trace1((char*)"SET_VAR", ip, (jint)code[ip + 2]);
+
+               // heap[h] <- REF, h
+               heap[l2state->hp] = CELL_MAKE(REF, l2state->hp);
+
+               // xi <- heap[h]
+               heap[xi] = heap[l2state->hp];
+
+               // h <- h + 1
+               l2state->hp++;
+
+               // P <- instruction_size(P)
+               ip += 3;
+
+               break;
+          }
+
+          // set_val xi:
+          case SET_VAL:
+          {
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+
+               trace1((char*)"SET_VAL", ip, (jint)code[ip + 2]);
+
+               // heap[h] <- xi
+               heap[l2state->hp] = heap[xi];
+
+               // h <- h + 1
+               l2state->hp++;
+
+               // P <- instruction_size(P)
+               ip += 3;
+
+               break;
+          }
+
+          // get_struc xi,
+          case GET_STRUC:
+          {
+               // grab f/n
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint f_n = *(jint*)(code + ip + 3);
+
+               traceFn1((char*)"GET_STRUC", ip, xi, f_n);
+
+               // addr <- deref(xi);
+               jint addr = l2jitderef(l2state, xi);
+               jint tag = CELL_TAG(heap[addr]);
+               jint val = CELL_VAL(heap[addr]);
+
+               // switch STORE[addr]
+               if (tag == REF)
+               {
+                    // heap[h] <- STR, h + 1
+                    heap[l2state->hp] = CELL_MAKE(STR, l2state->hp + 1);
+
+                    // heap[h+1] <- f/n
+                    heap[l2state->hp + 1] = f_n;
+
+                    // bind(addr, h)
+                    heap[addr] = CELL_MAKE(REF, l2state->hp);
+
+                    // h <- h + 2
+                    l2state->hp += 2;
+
+                    // mode <- write
+                    l2state->wm = 1;
+               }
+               // case STR, a:
+               else if (heap[val] == f_n)
+               {
+                    // s <- a + 1
+                    l2state->sp = val + 1;
+
+                    // mode <- read
+                    l2state->wm = 0;
+               }
+               else
+               {
+                    // fail
+                    return 0;
+               }
+
+               // P <- instruction_size(P)
+               ip += 7;
+
+               break;
+          }
+
+          // unify_var xi:
+          case UNIFY_VAR:
+          {
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+
+               trace1((char*)"UNIFY_VAR", ip, (jint)code[ip + 2]);
+
+               // switch write mode
+               if (!l2state->wm)
+               {
+                    // xi <- heap[s]
+                    heap[xi] = heap[l2state->sp];
+               }
+               else
+               {
+                    // heap[h] <- REF, h
+                    heap[l2state->hp] = CELL_MAKE(REF, l2state->hp);
+
+                    // xi <- heap[h]
+                    heap[xi] = heap[l2state->hp];
+
+                    // h <- h + 1
+                    l2state->hp++;
+               }
+
+               // s <- s + 1
+               l2state->sp++;
+
+               // P <- P + instruction_size(P)
+               ip += 3;
+
+               break;
+          }
+
+          // unify_val xi:
+          case UNIFY_VAL:
+          {
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+
+               trace1((char*)"UNIFY_VAL", ip, (jint)code[ip + 2]);
+
+               // switch write mode
+               if (!l2state->wm)
+               {
+                    // unify (xi, s)
+                    if (!l2jitunify(l2state, xi, l2state->sp))
+                    {
+                         return 0;
+                    }
+               }
+               else
+               {
+                    // heap[h] <- xi
+                    heap[l2state->hp] = heap[xi];
+
+                    // h <- h + 1
+                    l2state->hp++;
+               }
+
+               // s <- s + 1
+               l2state->sp++;
+
+               // P <- P + instruction_size(P)
+               ip += 3;
+
+               break;
+          }
+
+          // put_var Xn, Ai:
+          case PUT_VAR:
+          {
+               // grab addr, Ai
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint ai = (jint)code[ip + 3];
+
+               trace2((char*)"PUT_VAR", ip, (jint)code[ip + 2], code[ip + 1], ai, -3);
+
+               // heap[h] <- REF, h
+               heap[l2state->hp] = CELL_MAKE(REF, l2state->hp);
+
+               // Xn <- heap[h]
+               heap[xi] = heap[l2state->hp];
+
+               // Ai <- heap[h]
+               heap[ai] = heap[l2state->hp];
+
+               // h <- h + 1
+               l2state->hp++;
+
+               // P <- P + instruction_size(P)
+               ip += 4;
+
+               break;
+          }
+
+          // put_val Xn, Ai:
+          case PUT_VAL:
+          {
+               // grab Ai
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint ai = (jint)code[ip + 3];
+
+               trace2((char*)"PUT_VAL", ip, (jint)code[ip + 2], code[ip + 1], ai, -3);
+
+               // Ai <- Xn
+               heap[ai] = heap[xi];
+
+               // P <- P + instruction_size(P)
+               ip += 4;
+
+               break;
+          }
+
+          // get var Xn, Ai:
+          case GET_VAR:
+          {
+               // grab Ai
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint ai = (jint)code[ip + 3];
+
+               trace2((char*)"GET_VAR", ip, (jint)code[ip + 2], code[ip + 1], ai, -3);
+
+               // Xn <- Ai
+               heap[xi] = heap[ai];
+
+               // P <- P + instruction_size(P)
+               ip += 4;
+
+               break;
+          }
+
+          // get_val Xn, Ai:
+          case GET_VAL:
+          {
+               // grab Ai
+               jint xi = l2jitRegOrArgOffset(l2state, (jint)code[ip + 2], code[ip + 1]);
+               jint ai = (jint)code[ip + 3];
+
+               trace2((char*)"GET_VAL", ip, xi, code[ip + 1], ai, -3);
+
+               // unify (Xn, Ai)
+               if (!l2jitunify(l2state, xi, ai))
+               {
+                    return 0;
+               }
+
+               // P <- P + instruction_size(P)
+               ip += 4;
+
+               break;
+          }
+
+          // call @(p/n)
+          case CALL:
+          {
+               // grab @(p/n)
+               jint p_n = *(jint*)(code + ip + 1);
+
+               traceFn0((char*)"CALL", ip, p_n);
+
+               // Fail if the predicate to call is not known and linked in.
+               if (p_n == -1)
+               {
+                    return 0;
+               }
+
+               PROFILE_CALL(p_n);
+
+               if (!l2jitRun(l2jit, p_n))
+               {
+                    return 0;
+               }
+
+               // P <- P + instruction_Size(P)
+               ip += 5;
+
+               break;
+          }
+
+          // proceed:
+          case PROCEED:
+          {
+               trace0((char*)"PROCEED", ip);
+
+               // P <- CP
+               return 1;
+          }
+
+          // allocate N:
+          case ALLOCATE:
+          {
+               // grab N
+               jint n = (jint)code[ip + 1];
+
+               traceConst((char*)"ALLOCATE", ip, n);
+
+               // STACK[newE] <- E
+               heap[l2state->esp] = l2state->ep;
+
+               // STACK[E + 1] <- N
+               heap[l2state->esp + 1] = n;
+
+               // E <- newE
+               // newE <- E + n + 2
+               l2state->ep = l2state->esp;
+               l2state->esp += n + 2;
+
+               PROFILE_PEAK(PROFILE_ESP_PEAK, l2state->esp - STACK_BASE);
+
+               // P <- P + instruction_size(P)
+               ip += 2;
+
+               break;
+          }
+
+          // deallocate:
+          case DEALLOCATE:
+          {
+               trace0((char*)"DEALLOCATE", ip);
+
+               // E <- STACK[E]
+               l2state->esp = l2state->ep;
+               l2state->ep = (jint)heap[l2state->ep];
+
+               // P <- STACK.pop (i.e. return succesfully).
+               return 1;
+          }
+
+          // An unknown instruction was encountered. Something has gone wrong, so fail.
+          default:
+          {
+               trace0((char*)"UNKNOWN (Fail)", ip);
+
+               return 0;
+          }
+          }
+     }
+}
+
+/*
+ * Runs the code at an entry point, through its compiled function if it has one, or otherwise by interpreting it.
+ * Every run of the code whilst it is interpreted counts towards the threshold at which it is compiled.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The entry point to run.
+ *
+ * @return Non-zero if the code succeeded, zero if it failed.
+ */
+static jint l2jitRun(l2jitInstance* l2jit, jint offset)
+{
+     if ((offset < 0) || (offset >= l2jit->codeSize))
+     {
+          return 0;
+     }
+
+     l2jitEntry* entry = &l2jit->entries[offset];
+
+     // Compiled code is called straight through its entry point.
+     if (entry->compiled != 0)
+     {
+          return entry->compiled();
+     }
+
+     // Compile the code once it becomes hot, carrying on interpreting it until it is compiled in the background.
+     if ((entry->length > 0) && !entry->queued && (++entry->count >= l2jit->threshold))
+     {
+          l2jitRequestCompile(l2jit, offset, entry->length);
+
+          if (entry->compiled != 0)
+          {
+               return entry->compiled();
+          }
+     }
+
+     return l2jitInterpret(l2jit, offset);
+}
+
+/*
+ * Names the predicate at an entry point, so that the code compiled for it is published under its name. This is
+ * called before the code of the predicate is added.
+ *
+ * @param state  A handle onto the machine state.
+ * @param offset The entry point of the predicate.
+ * @param name   The name of the predicate, as name/arity.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_nameEntryPoint
+(JNIEnv * env, jobject object, jlong state, jint offset, jstring name)
+{
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     const char* chars = env->GetStringUTFChars(name, 0);
+
+     if (chars == 0)
+     {
+          return;
+     }
+
+     pthread_mutex_lock(&l2jitQueueLock);
+
+     if (l2jit->names == 0)
+     {
+          l2jit->names = new std::map<jint, std::string>();
+     }
+
+     (*l2jit->names)[offset] = chars;
+
+     pthread_mutex_unlock(&l2jitQueueLock);
+
+     env->ReleaseStringUTFChars(name, chars);
+}
+
+/*
+ * Notified whenever code is added to the machine. This provides a hook in point at which the machine may,
+ * if required, compile the code down below the byte code level. When running tiered, the entry point is only
+ * recorded here, and its code is interpreted until it becomes hot. With a threshold of zero, it is compiled
+ * straight away. Code is compiled on the background compiler thread unless AIMA_JIT_BACKGROUND is set to 0, so
+ * that adding code never waits on LLVM; until its compiled code is published, it is interpreted.
+ *
+ * @param state      A handle onto the machine state.
+ * @param codeBuffer The code buffer.
+ * @param codeOffset The start offset of the new code.
+ * @param length     The length of the new code.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_codeAdded
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset, jint length)
+{
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     jbyte* code = (jbyte*)env->GetDirectBufferAddress(codeBuf);
+
+     /*std::cout << "\nJNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_codeAdded: "
+       << "called\n";*/
+
+     // Keep a table of the entry points in the code buffer, starting a fresh one whenever the buffer changes.
+     if (code != l2jit->code)
+     {
+          l2jitCancelCompiles(l2jit);
+          free(l2jit->entries);
+
+          l2jit->code = code;
+          l2jit->codeSize = (jint)env->GetDirectBufferCapacity(codeBuf);
+          l2jit->entries = (l2jitEntry*)calloc(l2jit->codeSize, sizeof(l2jitEntry));
+     }
+
+     l2jitEntry* entry = &l2jit->entries[offset];
+     entry->length = length;
+     entry->count = 0;
+     entry->queued = JNI_FALSE;
+     entry->compiled = 0;
+
+     if (l2jit->threshold == 0)
+     {
+          l2jitRequestCompile(l2jit, offset, length);
+     }
+}
+
+/*
+ * Puts the heap and stack pointers of a machine back to its watermark, dropping everything that the queries run since
+ * it was recorded left behind, but remembering how far the heap went. The heap is not collected, so nothing else can
+ * refer to the part of it that is dropped.
+ *
+ * @param l2jit The machine instance.
+ */
+static void l2jitRollback(l2jitInstance* l2jit)
+{
+     l2jitMachineState* l2state = l2jit->l2state;
+
+     if (l2state->hp > l2jit->hpPeak)
+     {
+          l2jit->hpPeak = l2state->hp;
+     }
+
+     l2state->hp = l2jit->mark.hp;
+     l2state->sp = l2jit->mark.sp;
+     l2state->up = l2jit->mark.up;
+     l2state->ep = l2jit->mark.ep;
+     l2state->esp = l2jit->mark.esp;
+     l2state->wm = JNI_FALSE;
+}
+
+/*
+ * Runs the code at an entry point, in whichever tier it has reached, failing if a region of the data area overflows.
+ *
+ * @param l2jit  The machine instance.
+ * @param offset The entry point to run.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
+ */
+static jboolean l2jitRunGuarded(l2jitInstance* l2jit, jint offset)
+{
+     jboolean result;
+     dataAreaJmpBuf overflow;
+
+     // Start from the watermark, if rollback is on, as the answer to the query before this one has been read out.
+     if (l2jit->rollback)
+     {
+          l2jitRollback(l2jit);
+     }
+
+     PROFILE_BEGIN(l2jit->profile);
+
+     if (DATA_AREA_GUARD(&l2jit->area, overflow))
+     {
+          DATA_AREA_UNGUARD();
+          PROFILE_END();
+          traceIt((char*)"Data area overflow (Fail)");
+
+          return JNI_FALSE;
+     }
+
+     result = l2jitRun(l2jit, offset) != 0 ? JNI_TRUE : JNI_FALSE;
+
+     // The heap is not collected, so it is at its peak at the end of each run.
+     PROFILE_PEAK(PROFILE_HP_PEAK, l2jit->l2state->hp - HEAP_BASE);
+
+     DATA_AREA_UNGUARD();
+     PROFILE_END();
+
+     return result;
+}
 
 /*
  * Executes a compiled functor returning an indication of whether or not a unification was found.
  *
- * @param env     The native code execution environment.
- * @param obj     The object that is the context to this native method.
- * @param offset  The offset within the code buffer of the byte code to execute.
+ * @param env    The native code execution environment.
+ * @param obj    The object that is the context to this native method.
+ * @param state  A handle onto the machine state.
+ * @param offset The offset within the code buffer of the byte code to execute.
  *
  * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
  */
 JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_execute
-(JNIEnv * env, jobject object, jobject codeBuf, jint offset)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset)
 {
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+
      /*std::cout << "\nJNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_execute:"
        << " called\n";*/
      //mod->print(std::cout);
-     std::cerr << "\nL2 Execute\n\n";
+     traceIt((char*)"\nL2 Execute\n");
 
-     // Obtain the address of the compiled code to call.
-     char* fName = (char*)malloc(100 * sizeof(char));
-     sprintf(fName, "f_%i", offset);
-     ///std::cout << "Looking up function: " << fName << "\n";
+     return l2jitRunGuarded(l2jit, offset);
+}
+
+/*
+ * Executes a compiled functor for at most a budget of calls. Compiled code runs on the native stack, and cannot be
+ * suspended part way through, so budgeted execution is not supported by the JIT, and this always throws.
+ *
+ * @param state  A handle onto the machine state.
+ * @param offset The offset within the code buffer of the byte code to execute.
+ * @param budget The number of calls that may be made before the execution is suspended.
+ *
+ * @return RM_FAILED, with an UnsupportedOperationException raised.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_executeBudget
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset, jlong budget)
+{
+     env->ThrowNew(env->FindClass("java/lang/UnsupportedOperationException"),
+                   "Budgeted execution is not supported by the JIT compiled machine.");
 
-     Function *compiledQuery = vmState->EE->FindFunctionNamed(fName);
+     return 0;
+}
 
-     // Call the compiled query.
-     std::vector<GenericValue> noargs;
-     GenericValue gv = vmState->EE->runFunction(compiledQuery, noargs);
+/*
+ * Carries on with a suspended execution. No execution is ever suspended by the JIT, so this always throws.
+ *
+ * @param state  A handle onto the machine state.
+ * @param budget The number of calls that may be made before the execution is suspended again.
+ *
+ * @return RM_FAILED, with an UnsupportedOperationException raised.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_resume
+(JNIEnv * env, jobject object, jlong state, jlong budget)
+{
+     env->ThrowNew(env->FindClass("java/lang/UnsupportedOperationException"),
+                   "Budgeted execution is not supported by the JIT compiled machine.");
 
-     // Interpret the result of the execution.
-     return gv.IntVal.getBoolValue();
-     //return JNI_FALSE;
+     return 0;
 }
 
 /*
- * Dereferences a heap pointer (or register), returning the address that it refers to after following all
- * reference chains to their conclusion. This method is also side effecting, in that the contents of the
- * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
+ * Asks the execution running on the machine to suspend itself. Compiled code does not check for interrupts, so this
+ * always throws.
  *
- * @param a The address to dereference.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_interrupt
+(JNIEnv * env, jobject object, jlong state)
+{
+     env->ThrowNew(env->FindClass("java/lang/UnsupportedOperationException"),
+                   "Interrupting an execution is not supported by the JIT compiled machine.");
+}
+
+/*
+ * Turns rollback on or off. With rollback on, each top-level query is started from the watermark, so that the heap
+ * cells and environment frames that the query before it left behind are reused, and a long lived machine runs in flat
+ * memory without being reset. Turning rollback on records the present heap and stack pointers as the watermark; a
+ * reset records the empty heap and stacks as the watermark, and leaves rollback as it was.
  *
- * @return The address that the reference refers to.
+ * @param state   A handle onto the machine state.
+ * @param enabled <tt>true</tt> to roll back to the watermark before each query, <tt>false</tt> not to.
  */
-JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_deref
-(JNIEnv * env, jobject obj, jint a)
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_setRollback
+(JNIEnv * env, jobject obj, jlong state, jboolean enabled)
 {
-     jint addr = l2jitderef(l2state, a);
-     jint heapCell = l2state->heapBasePtr[addr];
-     derefTag = (jbyte)((heapCell & 0xFF000000) >> 24);
-     derefVal = heapCell & 0x00FFFFFF;
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
 
-     return addr;
+     if (enabled && !l2jit->rollback)
+     {
+          l2jit->mark = *l2jit->l2state;
+     }
+
+     l2jit->rollback = enabled;
+}
+
+/*
+ * Encodes a term on the heap into the result buffer of a batch, in prefix order. Each term is written as its tag
+ * followed by its address, which for a structure is followed by its f/n cell and then each of its arguments. The tag
+ * and address are written out separately, so that the format does not depend on the layout of the cells. The last
+ * argument of each structure is encoded by going round again rather than by recursing, so that lists and other right
+ * recursive terms of any length are encoded in constant stack.
+ *
+ * @param l2state The machine state.
+ * @param addr    The address of the term to encode.
+ * @param out     The result buffer.
+ * @param pos     The position in the result buffer to write the term at.
+ * @param limit   The size of the result buffer.
+ *
+ * @return The position in the result buffer after the term, or -1 if the term does not fit.
+ */
+static jint l2jitEncodeTerm(l2jitMachineState* l2state, jint addr, jint* out, jint pos, jint limit)
+{
+     while (true)
+     {
+          jcell heapCell = l2state->heapBasePtr[l2jitderef(l2state, addr)];
+          jbyte tag = CELL_TAG(heapCell);
+          jint val = CELL_VAL(heapCell);
+
+          if (tag == REF)
+          {
+               if (pos + 2 > limit)
+               {
+                    return -1;
+               }
+
+               out[pos++] = REF;
+               out[pos++] = val;
+
+               return pos;
+          }
+
+          if (pos + 3 > limit)
+          {
+               return -1;
+          }
+
+          out[pos++] = STR;
+          out[pos++] = val;
+          out[pos++] = (jint)l2state->heapBasePtr[val];
+          jint arity = (jint)(l2state->heapBasePtr[val] & 0xFF);
+
+          if (arity == 0)
+          {
+               return pos;
+          }
+
+          for (jint i = 0; (i < arity - 1) && (pos >= 0); i++)
+          {
+               pos = l2jitEncodeTerm(l2state, val + 1 + i, out, pos, limit);
+          }
+
+          if (pos < 0)
+          {
+               return -1;
+          }
+
+          // Carry on with the last argument.
+          addr = val + arity;
+     }
+}
+
+/*
+ * Executes a batch of queries one after the other, writing out whether each succeeded and the bindings of its
+ * variables into a result buffer. Each query is run from the state that the machine was in at the start of the
+ * batch, so the heap is reset between queries. The batch stops early if the result buffer fills up.
+ *
+ * The query buffer holds, for each query, its entry point, the number of variables to report, and the stack offset
+ * of each variable. The result buffer receives, for each query, 1 if it succeeded or 0 if it failed, followed on
+ * success by each variable binding encoded as by {@link #l2jitEncodeTerm}.
+ *
+ * @param state      A handle onto the machine state.
+ * @param codeBuf    A direct buffer containing the byte code to execute.
+ * @param queryBuf   A direct buffer of the queries to run.
+ * @param queryCount The number of queries in the query buffer.
+ * @param resultBuf  A direct buffer to write the results to.
+ *
+ * @return The number of queries that were run and had their results written out.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_executeBatch
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jobject queryBuf, jint queryCount, jobject resultBuf)
+{
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     l2jitMachineState* l2state = l2jit->l2state;
+     l2jitMachineState start = *l2state;
+     jint q;
+     jint at = 0;
+     jint pos = 0;
+
+     jint* queries = (jint*)env->GetDirectBufferAddress(queryBuf);
+     jint* out = (jint*)env->GetDirectBufferAddress(resultBuf);
+     jint limit = (jint)(env->GetDirectBufferCapacity(resultBuf) / sizeof(jint));
+
+     traceIt((char*)"\nL2 Execute Batch\n");
+
+     for (q = 0; (q < queryCount) && (pos < limit); q++)
+     {
+          jint offset = queries[at];
+          jint varCount = queries[at + 1];
+          jint* vars = queries + at + 2;
+
+          jboolean result = l2jitRunGuarded(l2jit, offset);
+          out[pos++] = (result == JNI_TRUE) ? 1 : 0;
+
+          for (jint v = 0; (result == JNI_TRUE) && (v < varCount) && (pos >= 0); v++)
+          {
+               pos = l2jitEncodeTerm(l2state, vars[v] + l2state->ep + 2, out, pos, limit);
+          }
+
+          // Put the machine back to how it was at the start of the batch.
+          l2state->hp = start.hp;
+          l2state->sp = start.sp;
+          l2state->up = start.up;
+          l2state->ep = start.ep;
+          l2state->esp = start.esp;
+          l2state->wm = start.wm;
+
+          if (pos < 0)
+          {
+               break;
+          }
+
+          at += 2 + varCount;
+     }
+
+     return q;
 }
 
 /*
@@ -1723,53 +3735,99 @@ JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachi
  * may point to other environment frames, but should not contain unbound variables, so ultimately this dereferencing
  * should resolve onto a structure or variable on the heap.
  *
- * @param  a The offset into the current environment stack frame to dereference.
+ * @param  state A handle onto the machine state.
+ * @param  a     The offset into the current environment stack frame to dereference.
  *
  * @return The address that the reference refers to.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_derefStack
-(JNIEnv * env, jobject obj, jint a)
+(JNIEnv * env, jobject obj, jlong state, jint a)
 {
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     l2jitMachineState* l2state = l2jit->l2state;
+
      //fprintf(stderr, "derefStack: ep = %i\n", l2state->ep);
 
-     jint addr = l2jitderef(l2state, a + l2state->ep + 2);
-     jint heapCell = l2state->heapBasePtr[addr];
-     derefTag = (jbyte)((heapCell & 0xFF000000) >> 24);
-     derefVal = heapCell & 0x00FFFFFF;
+     return l2jitderef(l2state, a + l2state->ep + 2);
+}
 
-     return addr;
+/*
+ * Creates a direct byte buffer onto the data area that the registers, heap and stacks are held in, so that the
+ * heap can be read from Java without calling into the native machine for each cell. The buffer is only valid until
+ * the machine is next reset.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return A direct byte buffer onto the data area.
+ */
+JNIEXPORT jobject JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getDataArea
+(JNIEnv * env, jobject obj, jlong state)
+{
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+
+     return env->NewDirectByteBuffer(l2jit->area.data, (jlong)l2jit->area.top * sizeof(jcell));
+}
+
+/*
+ * Reports the size in bytes of the heap cells that this machine was built with, so that the data area can be read
+ * from Java with the matching cell layout.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return The size of a heap cell in bytes.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getCellSize
+(JNIEnv * env, jobject obj, jlong state)
+{
+     return (jint)sizeof(jcell);
 }
 
 /*
- * Gets the heap cell tag for the most recent dereference operation.
+ * Reports the most heap cells that have been in use at once, since the machine was last reset. The JIT does not
+ * collect the heap, so this is the current extent of the heap, or its extent before a rollback if that was further.
+ *
+ * @param state A handle onto the machine state.
  *
- * @return The heap cell tag for the most recent dereference operation.
+ * @return The peak number of heap cells in use.
  */
-JNIEXPORT jbyte JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getDerefTag
-(JNIEnv * env, jobject obj)
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getHeapPeak
+(JNIEnv * env, jobject obj, jlong state)
 {
-     return derefTag;
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+     jint hp = l2jit->l2state->hp;
+
+     return ((hp > l2jit->hpPeak) ? hp : l2jit->hpPeak) - HEAP_BASE;
 }
 
 /*
- * Gets the heap cell value for the most recent dereference operation.
+ * Creates a direct byte buffer onto the profile counters of the machine, laid out as described in profile.h, so that
+ * they can be read from Java as they are updated. Code that has been compiled counts opcodes, calls, unifications and
+ * stack depth, but not dereference chains or unification stack depth, which are only counted whilst interpreting.
+ *
+ * @param state A handle onto the machine state.
  *
- * @return The heap cell value for the most recent dereference operation.
+ * @return A direct byte buffer onto the profile counters, or <tt>null</tt> if profiling was not compiled in.
  */
-JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getDerefVal
-(JNIEnv * env, jobject obj)
+JNIEXPORT jobject JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getProfile
+(JNIEnv * env, jobject obj, jlong state)
 {
-     return derefVal;
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+
+     return (l2jit->profile != 0) ? env->NewDirectByteBuffer(l2jit->profile, PROFILE_SIZE * sizeof(jlong)) : 0;
 }
 
 /*
- * Gets the value of the heap cell at the specified location.
+ * Zeroes the profile counters of the machine. This does nothing if profiling was not compiled in.
  *
- * @param addr The address to fetch from the heap.
- * @return The heap cell at the specified location.
+ * @param state A handle onto the machine state.
  */
-JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_getHeap
-(JNIEnv * env, jobject obj, jint addr)
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l2_L2ResolvingNativeMachine_clearProfile
+(JNIEnv * env, jobject obj, jlong state)
 {
-     return l2state->heapBasePtr[addr];
+     l2jitInstance* l2jit = (l2jitInstance*)(intptr_t)state;
+
+     if (l2jit->profile != 0)
+     {
+          profileClear(l2jit->profile);
+     }
 }
@@ -0,0 +1,37 @@
+/*
+ * Copyright The Sett Ltd, 2005 to 2014.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.thesett.aima.logic.fol.wam.nativemachine;
+
+import junit.framework.Test;
+import junit.framework.TestCase;
+
+/**
+ * WAMResolvingNativeMachineLinuxTest runs the native WAM machine tests against the Linux build of the native library.
+ *
+ * @author Rupert Smith
+ */
+public class WAMResolvingNativeMachineLinuxTest extends TestCase
+{
+    public WAMResolvingNativeMachineLinuxTest(String name)
+    {
+        super(name);
+    }
+
+    public static Test suite() throws Exception
+    {
+        return WAMResolvingNativeMachineTestBase.suite();
+    }
+}
@@ -0,0 +1,82 @@
+/* Defines the layout of the tagged heap cells of the l0 to l3 machines, and of the code that the l2 JIT generates. */
+#ifndef _CELL_H
+#define _CELL_H
+
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A tagged cell holds a tag and a value, which for REF and STR cells is an address in the data area. Functor cells
+ * (f << 8 | n) and the links held in environment frames are stored in cells as plain values, with no tag.
+ *
+ * The layout is picked at build time. By default cells are the compact 32 bit layout, with an 8 bit tag above a 24
+ * bit value, which limits the data area to 16M cells. Building with AIMA_CELL64 defined selects 64 bit cells, with a
+ * 3 bit tag below the value; addresses are still held in jints everywhere else, so this allows a data area of up to
+ * 2G cells. The tag and value of a cell should only ever be taken apart and put together through the macros here.
+ */
+#ifdef AIMA_CELL64
+
+/* Holds a heap cell. */
+typedef jlong jcell;
+
+/* Defines the width of a cell in bits. */
+#define CELL_BITS 64
+
+/* Defines the shift to apply to a cell to extract its tag. */
+#define CELL_TAG_SHIFT 0
+
+/* Defines the mask to apply to the shifted cell to extract its tag. */
+#define CELL_TAG_MASK 0x7
+
+/* Defines the shift to apply to a cell to extract its value. */
+#define CELL_VAL_SHIFT 3
+
+/* Defines the mask to apply to the shifted cell to extract its value. */
+#define CELL_VAL_MASK 0x7FFFFFFF
+
+/* Defines the limit of the data area, as addresses are held in jints. */
+#define CELL_ADDR_LIMIT 0x7FFFFFFF
+
+#else
+
+/* Holds a heap cell. */
+typedef jint jcell;
+
+/* Defines the width of a cell in bits. */
+#define CELL_BITS 32
+
+/* Defines the shift to apply to a cell to extract its tag. */
+#define CELL_TAG_SHIFT 24
+
+/* Defines the mask to apply to the shifted cell to extract its tag. */
+#define CELL_TAG_MASK 0xFF
+
+/* Defines the shift to apply to a cell to extract its value. */
+#define CELL_VAL_SHIFT 0
+
+/* Defines the mask to apply to the shifted cell to extract its value. */
+#define CELL_VAL_MASK 0x00FFFFFF
+
+/* Defines the limit of the data area, as cells hold 24 bit addresses. */
+#define CELL_ADDR_LIMIT 0x1000000
+
+#endif
+
+/* Extracts the tag from a cell. */
+#define CELL_TAG(c) ((jbyte)(((c) >> CELL_TAG_SHIFT) & CELL_TAG_MASK))
+
+/* Extracts the value, or address, from a cell. */
+#define CELL_VAL(c) ((jint)(((c) >> CELL_VAL_SHIFT) & CELL_VAL_MASK))
+
+/* Makes a cell from a tag and a value. */
+#define CELL_MAKE(tag, val) \
+     ((jcell)(((jcell)(tag) << CELL_TAG_SHIFT) | (((jcell)(val) & CELL_VAL_MASK) << CELL_VAL_SHIFT)))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CELL_H */
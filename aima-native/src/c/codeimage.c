@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "codeimage.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Defines the positions of the fields of the code image header, in jints. */
+#define HDR_MAGIC 0
+#define HDR_VERSION 1
+#define HDR_LEVEL 2
+#define HDR_CODE_OFFSET 3
+#define HDR_CODE_LENGTH 4
+#define HDR_CALL_OFFSET 5
+#define HDR_CALL_COUNT 6
+#define HDR_SYMBOL_OFFSET 7
+#define HDR_SYMBOL_LENGTH 8
+#define HDR_SWITCH_OFFSET 9
+#define HDR_SWITCH_COUNT 10
+
+/*
+ * Checks that a section of a code image lies within it, and is aligned for the jints that it holds.
+ *
+ * @param size   The size of the image in bytes.
+ * @param offset The offset of the section.
+ * @param count  The number of elements in the section.
+ * @param width  The size of an element of the section in bytes.
+ *
+ * @return <tt>true</tt> if the section is within the image.
+ */
+static jboolean codeImageSection(size_t size, jint offset, jint count, size_t width)
+{
+     if ((offset < CODE_IMAGE_HEADER_SIZE) || (count < 0) || ((size_t)offset > size))
+     {
+          return JNI_FALSE;
+     }
+
+     if ((width > 1) && ((offset % sizeof(jint)) != 0))
+     {
+          return JNI_FALSE;
+     }
+
+     return ((size - (size_t)offset) / width >= (size_t)count) ? JNI_TRUE : JNI_FALSE;
+}
+
+/*
+ * Maps an image file into memory, read only where possible.
+ *
+ * @param image The code image to map the file for.
+ * @param path  The path of the image file.
+ *
+ * @return <tt>true</tt> if the file was mapped.
+ */
+static jboolean codeImageMap(codeImage *image, const char *path)
+{
+#ifndef _WIN32
+     struct stat info;
+     int fd = open(path, O_RDONLY);
+
+     if (fd < 0)
+     {
+          return JNI_FALSE;
+     }
+
+     if ((fstat(fd, &info) != 0) || (info.st_size < CODE_IMAGE_HEADER_SIZE))
+     {
+          close(fd);
+          return JNI_FALSE;
+     }
+
+     image->mappingSize = (size_t)info.st_size;
+     image->mapping = mmap(NULL, image->mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+     // The mapping holds its own reference to the file.
+     close(fd);
+
+     if (image->mapping == MAP_FAILED)
+     {
+          image->mapping = NULL;
+          return JNI_FALSE;
+     }
+#else
+     FILE *file = fopen(path, "rb");
+     long size;
+
+     if (file == NULL)
+     {
+          return JNI_FALSE;
+     }
+
+     if ((fseek(file, 0, SEEK_END) != 0) || ((size = ftell(file)) < CODE_IMAGE_HEADER_SIZE) ||
+         (fseek(file, 0, SEEK_SET) != 0))
+     {
+          fclose(file);
+          return JNI_FALSE;
+     }
+
+     image->mappingSize = (size_t)size;
+     image->mapping = malloc(image->mappingSize);
+
+     if ((image->mapping != NULL) && (fread(image->mapping, 1, image->mappingSize, file) != image->mappingSize))
+     {
+          free(image->mapping);
+          image->mapping = NULL;
+     }
+
+     fclose(file);
+
+     if (image->mapping == NULL)
+     {
+          return JNI_FALSE;
+     }
+#endif
+
+     return JNI_TRUE;
+}
+
+/*
+ * Opens a code image file, mapping it into memory and checking that its header and tables are consistent.
+ *
+ * @param image The code image to initialize.
+ * @param path  The path of the image file.
+ *
+ * @return <tt>true</tt> if the image was opened, <tt>false</tt> if it could not be read or is not a valid image.
+ */
+jboolean codeImageOpen(codeImage *image, const char *path)
+{
+     const jint *header;
+     char *base;
+     size_t size;
+     int i;
+
+     memset(image, 0, sizeof(codeImage));
+
+     if (codeImageMap(image, path) == JNI_FALSE)
+     {
+          return JNI_FALSE;
+     }
+
+     base = (char *)image->mapping;
+     size = image->mappingSize;
+     header = (const jint *)base;
+
+     if ((header[HDR_MAGIC] != CODE_IMAGE_MAGIC) || (header[HDR_VERSION] != CODE_IMAGE_VERSION) ||
+         !codeImageSection(size, header[HDR_CODE_OFFSET], header[HDR_CODE_LENGTH], 1) ||
+         !codeImageSection(size, header[HDR_CALL_OFFSET], header[HDR_CALL_COUNT], sizeof(codeImageCall)) ||
+         !codeImageSection(size, header[HDR_SYMBOL_OFFSET], header[HDR_SYMBOL_LENGTH], 1) ||
+         !codeImageSection(size, header[HDR_SWITCH_OFFSET], header[HDR_SWITCH_COUNT], sizeof(codeImageSwitch)))
+     {
+          codeImageClose(image);
+          return JNI_FALSE;
+     }
+
+     image->level = header[HDR_LEVEL];
+     image->code = (jbyte *)(base + header[HDR_CODE_OFFSET]);
+     image->codeLength = header[HDR_CODE_LENGTH];
+     image->calls = (const codeImageCall *)(base + header[HDR_CALL_OFFSET]);
+     image->callCount = header[HDR_CALL_COUNT];
+     image->symbols = base + header[HDR_SYMBOL_OFFSET];
+     image->symbolLength = header[HDR_SYMBOL_LENGTH];
+     image->switches = (const codeImageSwitch *)(base + header[HDR_SWITCH_OFFSET]);
+     image->switchCount = header[HDR_SWITCH_COUNT];
+
+     // The functor names must be terminated, so that none of them can run off the end of the image.
+     if ((image->symbolLength > 0) && (image->symbols[image->symbolLength - 1] != '\0'))
+     {
+          codeImageClose(image);
+          return JNI_FALSE;
+     }
+
+     // Every predicate and switch table must lie within the code.
+     for (i = 0; i < image->callCount; i++)
+     {
+          const codeImageCall *call = &image->calls[i];
+
+          if ((call->entry < 0) || (call->length < 0) || (call->entry > image->codeLength - call->length) ||
+              (call->symbol < 0) || (call->symbol >= image->symbolLength))
+          {
+               codeImageClose(image);
+               return JNI_FALSE;
+          }
+     }
+
+     for (i = 0; i < image->switchCount; i++)
+     {
+          const codeImageSwitch *table = &image->switches[i];
+
+          if ((table->offset < 0) || (table->size < 0) || (table->offset > image->codeLength - table->size))
+          {
+               codeImageClose(image);
+               return JNI_FALSE;
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Releases the memory held by a code image. Closing an image that was never opened, or already closed, does nothing.
+ *
+ * @param image The code image to close.
+ */
+void codeImageClose(codeImage *image)
+{
+     if (image->mapping != NULL)
+     {
+#ifndef _WIN32
+          munmap(image->mapping, image->mappingSize);
+#else
+          free(image->mapping);
+#endif
+     }
+
+     memset(image, 0, sizeof(codeImage));
+}
+
+/*
+ * Looks up a predicate in the call table of a code image, by name and arity.
+ *
+ * @param image The code image to search.
+ * @param name  The functor name of the predicate.
+ * @param arity The arity of the predicate.
+ *
+ * @return The call table entry of the predicate, or <tt>NULL</tt> if the image does not hold it.
+ */
+const codeImageCall *codeImageFindCall(const codeImage *image, const char *name, jint arity)
+{
+     int i;
+
+     for (i = 0; i < image->callCount; i++)
+     {
+          const codeImageCall *call = &image->calls[i];
+
+          if ((call->arity == arity) && (strcmp(codeImageCallName(image, call), name) == 0))
+          {
+               return call;
+          }
+     }
+
+     return NULL;
+}
+
+/*
+ * Looks up the functor name of a call table entry.
+ *
+ * @param image The code image holding the entry.
+ * @param call  The call table entry.
+ *
+ * @return The functor name.
+ */
+const char *codeImageCallName(const codeImage *image, const codeImageCall *call)
+{
+     return image->symbols + call->symbol;
+}
@@ -0,0 +1,146 @@
+/* Defines a file format for compiled byte code, that the native machines map into memory and execute in place. */
+#ifndef _CODEIMAGE_H
+#define _CODEIMAGE_H
+
+#include <stddef.h>
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A code image holds the byte code of a program exactly as the Java compilers lay it out in the code buffer of a
+ * machine, so the absolute call targets in it stay valid, together with the call table giving the name and location
+ * of every predicate in it. All numbers in an image are jints, in the byte order of the machine that wrote it. It
+ * is laid out as:
+ *
+ * <pre>
+ * header       magic, version, level, codeOffset, codeLength, callOffset, callCount, symbolOffset, symbolLength,
+ *              switchOffset, switchCount, padded out to CODE_IMAGE_HEADER_SIZE bytes.
+ * calls        callCount entries of name, arity, entry, length, symbol. The name is the interned functor id that the
+ *              code was linked with, and symbol the offset of the functor name in the symbols.
+ * symbols      symbolLength bytes of NUL terminated functor names.
+ * switches     switchCount entries of offset, size, locating switch tables held within the code.
+ * code         codeLength bytes of byte code, starting on a page boundary.
+ * </pre>
+ *
+ * The byte code starts on a page boundary so that, on POSIX systems, an image is mapped read only and executed
+ * where it lies, and only the pages of it that a query runs through are ever read in. Elsewhere the image is read
+ * into memory in full.
+ */
+
+/* Defines the magic number that a code image starts with, reading "AIMI" on little endian machines. */
+#define CODE_IMAGE_MAGIC 0x494D4941
+
+/* Defines the version of the code image format. */
+#define CODE_IMAGE_VERSION 1
+
+/* Defines the size of the code image header in bytes. */
+#define CODE_IMAGE_HEADER_SIZE 64
+
+/* Defines the alignment of the byte code within a code image, in bytes. */
+#define CODE_IMAGE_CODE_ALIGN 4096
+
+/* Defines the number of jints in a call table entry. */
+#define CODE_IMAGE_CALL_SIZE 5
+
+/* Defines the number of jints in a switch table entry. */
+#define CODE_IMAGE_SWITCH_SIZE 2
+
+/* Holds one entry of the call table of a code image. */
+typedef struct
+{
+     jint name;
+     jint arity;
+     jint entry;
+     jint length;
+     jint symbol;
+} codeImageCall;
+
+/* Holds one entry of the switch table of a code image. */
+typedef struct
+{
+     jint offset;
+     jint size;
+} codeImageSwitch;
+
+typedef struct
+{
+     /* Holds the start of the image in memory. */
+     void *mapping;
+
+     /* Holds the size of the image in memory, in bytes. */
+     size_t mappingSize;
+
+     /* Holds the machine level that the code was compiled for. */
+     jint level;
+
+     /* Holds the byte code. */
+     jbyte *code;
+
+     /* Holds the length of the byte code in bytes. */
+     jint codeLength;
+
+     /* Holds the call table. */
+     const codeImageCall *calls;
+
+     /* Holds the number of entries in the call table. */
+     jint callCount;
+
+     /* Holds the functor names. */
+     const char *symbols;
+
+     /* Holds the length of the functor names in bytes. */
+     jint symbolLength;
+
+     /* Holds the switch tables. */
+     const codeImageSwitch *switches;
+
+     /* Holds the number of switch tables. */
+     jint switchCount;
+} codeImage;
+
+/*
+ * Opens a code image file, mapping it into memory and checking that its header and tables are consistent.
+ *
+ * @param image The code image to initialize.
+ * @param path  The path of the image file.
+ *
+ * @return <tt>true</tt> if the image was opened, <tt>false</tt> if it could not be read or is not a valid image.
+ */
+jboolean codeImageOpen(codeImage *image, const char *path);
+
+/*
+ * Releases the memory held by a code image. Closing an image that was never opened, or already closed, does nothing.
+ *
+ * @param image The code image to close.
+ */
+void codeImageClose(codeImage *image);
+
+/*
+ * Looks up a predicate in the call table of a code image, by name and arity.
+ *
+ * @param image The code image to search.
+ * @param name  The functor name of the predicate.
+ * @param arity The arity of the predicate.
+ *
+ * @return The call table entry of the predicate, or <tt>NULL</tt> if the image does not hold it.
+ */
+const codeImageCall *codeImageFindCall(const codeImage *image, const char *name, jint arity);
+
+/*
+ * Looks up the functor name of a call table entry.
+ *
+ * @param image The code image holding the entry.
+ * @param call  The call table entry.
+ *
+ * @return The functor name.
+ */
+const char *codeImageCallName(const codeImage *image, const codeImageCall *call);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CODEIMAGE_H */
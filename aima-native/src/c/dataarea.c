@@ -0,0 +1,403 @@
+#include <stdlib.h>
+#include <string.h>
+#include "dataarea.h"
+
+#ifdef DATA_AREA_GUARDED
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/* Defines the number of released data areas that are kept for reuse. */
+#define DATA_AREA_POOL_SIZE 4
+
+/* Defines the size in bytes above which a region is cleared by dropping its pages, rather than zeroing them. */
+#define DATA_AREA_MADVISE_BYTES (64 * 1024)
+
+#ifdef DATA_AREA_GUARDED
+
+/* Holds the place to return to on the current thread, when a machine overflows a region of its data area. */
+__thread sigjmp_buf *dataAreaOverflow;
+
+/* Holds the data area being executed on by the current thread, if any. */
+__thread dataArea *dataAreaActive;
+
+/* Holds the SIGSEGV action that was in place before the data area handler was installed. */
+static struct sigaction previousAction;
+
+/* Used to ensure that the fault handler is only installed once. */
+static pthread_once_t handlerOnce = PTHREAD_ONCE_INIT;
+
+/* Holds released data areas, cleared and ready to be taken up again by a data area with the same layout. */
+static dataArea pool[DATA_AREA_POOL_SIZE];
+
+/* Holds the number of data areas in the pool. */
+static int poolCount;
+
+/* Used to guard the pool. */
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Handles a segmentation fault. If the current thread is executing on a data area and the fault lies within it,
+ * then it can only be an access to a guard page, so control returns to the point at which the execution was
+ * guarded. Any other fault is passed on to the previously installed handler, which in a JVM is the handler that
+ * the JVM relies on for its own purposes, so it must always be chained to.
+ *
+ * @param sig     The signal number.
+ * @param info    The details of the fault.
+ * @param context The machine context at the fault.
+ */
+static void dataAreaFault(int sig, siginfo_t *info, void *context)
+{
+     dataArea *area = dataAreaActive;
+     char *addr = (char *)info->si_addr;
+
+     if ((area != NULL) && (dataAreaOverflow != NULL) && (addr >= (char *)area->reservation) &&
+         (addr < (char *)area->reservation + area->reservationSize))
+     {
+          siglongjmp(*dataAreaOverflow, 1);
+     }
+
+     if (previousAction.sa_flags & SA_SIGINFO)
+     {
+          previousAction.sa_sigaction(sig, info, context);
+     }
+     else if ((previousAction.sa_handler == SIG_DFL) || (previousAction.sa_handler == SIG_IGN))
+     {
+          // Put the default action back, so that the faulting instruction kills the process when it is re-run.
+          signal(sig, SIG_DFL);
+     }
+     else
+     {
+          previousAction.sa_handler(sig);
+     }
+}
+
+/*
+ * Installs the fault handler, keeping the previous handler to chain to.
+ */
+static void dataAreaInstallHandler()
+{
+     struct sigaction action;
+
+     memset(&action, 0, sizeof(action));
+     action.sa_sigaction = dataAreaFault;
+     action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+     sigemptyset(&action.sa_mask);
+
+     sigaction(SIGSEGV, &action, &previousAction);
+}
+
+#endif
+
+/*
+ * Lays out the requested regions of a data area consecutively in the order given, without reserving any memory for
+ * them. The region sizes are rounded up to whole pages, with a guard page between each of them.
+ *
+ * @param area     The data area to lay out.
+ * @param sizes    The requested size of each region, in cells.
+ * @param count    The number of regions.
+ * @param limit    The highest cell offset that the machine can address.
+ * @param cellSize The size of a cell in bytes.
+ *
+ * @return <tt>true</tt> if the regions were laid out, <tt>false</tt> if they do not fit below the limit.
+ */
+static jboolean dataAreaLayout(dataArea *area, const jint *sizes, int count, jint limit, size_t cellSize)
+{
+     size_t guard;
+     size_t pageCells;
+     size_t offset;
+     int i;
+
+     memset(area, 0, sizeof(dataArea));
+
+     if ((count < 1) || (cellSize == 0) || (count > DATA_AREA_MAX_REGIONS))
+     {
+          return JNI_FALSE;
+     }
+
+#ifdef DATA_AREA_GUARDED
+     guard = (size_t)sysconf(_SC_PAGESIZE);
+#else
+     guard = 0;
+#endif
+
+     pageCells = guard > 0 ? guard / cellSize : 1;
+
+     // Lay out the regions with a guard page between each of them.
+     offset = 0;
+
+     for (i = 0; i < count; i++)
+     {
+          size_t size;
+
+          if (sizes[i] < 0)
+          {
+               return JNI_FALSE;
+          }
+
+          size = (((size_t)sizes[i] + pageCells - 1) / pageCells) * pageCells;
+
+          if (offset + size > (size_t)limit)
+          {
+               return JNI_FALSE;
+          }
+
+          area->base[i] = (jint)offset;
+          area->size[i] = (jint)size;
+          offset += size + (guard / cellSize);
+     }
+
+     area->regionCount = count;
+     area->top = area->base[count - 1] + area->size[count - 1];
+     area->cellSize = cellSize;
+
+     // The reservation holds the regions, plus a guard page at the start.
+     area->reservationSize = guard + offset * cellSize;
+
+     return JNI_TRUE;
+}
+
+/*
+ * Checks if two data areas have the same layout, so that the memory of one may be used for the other.
+ *
+ * @param area   The first data area.
+ * @param layout The second data area.
+ *
+ * @return <tt>true</tt> if the areas have the same regions, cell size and reservation size.
+ */
+static jboolean dataAreaSameLayout(const dataArea *area, const dataArea *layout)
+{
+     int i;
+
+     if ((area->regionCount != layout->regionCount) || (area->cellSize != layout->cellSize) ||
+         (area->reservationSize != layout->reservationSize))
+     {
+          return JNI_FALSE;
+     }
+
+     for (i = 0; i < area->regionCount; i++)
+     {
+          if ((area->base[i] != layout->base[i]) || (area->size[i] != layout->size[i]))
+          {
+               return JNI_FALSE;
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Hands the memory of a data area back, without pooling it.
+ *
+ * @param area The data area to unreserve.
+ */
+static void dataAreaUnreserve(dataArea *area)
+{
+     if (area->reservation != NULL)
+     {
+#ifdef DATA_AREA_GUARDED
+          munmap(area->reservation, area->reservationSize);
+#else
+          free(area->reservation);
+#endif
+     }
+
+     memset(area, 0, sizeof(dataArea));
+}
+
+/*
+ * Zeroes the start of a region of a data area. Large spans are handed back to the operating system where it is
+ * known to zero fill them again when they are next touched, so that the cost of clearing them is only in the pages
+ * that were used, and those pages are no longer held onto. Smaller spans are zeroed in place.
+ *
+ * @param area   The data area.
+ * @param region The region to clear.
+ * @param used   The number of cells at the start of the region to clear, or -1 to clear all of it.
+ */
+static void dataAreaClearRegion(dataArea *area, int region, jint used)
+{
+     size_t cells = ((used < 0) || (used > area->size[region])) ? (size_t)area->size[region] : (size_t)used;
+     size_t bytes = cells * area->cellSize;
+     char *start = (char *)area->data + (size_t)area->base[region] * area->cellSize;
+
+#if defined(DATA_AREA_GUARDED) && defined(__linux__)
+     if (bytes >= DATA_AREA_MADVISE_BYTES)
+     {
+          size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+          // Regions start on a page boundary and are a whole number of pages long, so whole pages can be dropped.
+          if (madvise(start, ((bytes + page - 1) / page) * page, MADV_DONTNEED) == 0)
+          {
+               return;
+          }
+     }
+#endif
+
+     memset(start, 0, bytes);
+}
+
+/*
+ * Creates a data area, laying out the requested regions consecutively in the order given. The region sizes are
+ * rounded up to whole pages; the rounded sizes and the region offsets are left in the area. A released area with
+ * the same layout is taken from the pool if there is one, rather than reserving fresh memory.
+ *
+ * @param area     The data area to initialize.
+ * @param sizes    The requested size of each region, in cells.
+ * @param count    The number of regions.
+ * @param limit    The highest cell offset that the machine can address.
+ * @param cellSize The size of a cell in bytes.
+ *
+ * @return <tt>true</tt> if the area was created, <tt>false</tt> if the regions do not fit below the limit or the
+ *         memory could not be reserved.
+ */
+jboolean dataAreaCreate(dataArea *area, const jint *sizes, int count, jint limit, size_t cellSize)
+{
+#ifdef DATA_AREA_GUARDED
+     int i;
+#endif
+
+     if (dataAreaLayout(area, sizes, count, limit, cellSize) == JNI_FALSE)
+     {
+          return JNI_FALSE;
+     }
+
+#ifdef DATA_AREA_GUARDED
+     pthread_once(&handlerOnce, dataAreaInstallHandler);
+
+     // Take up a pooled area with the same layout, if there is one. Pooled areas have already been cleared.
+     pthread_mutex_lock(&poolLock);
+
+     for (i = 0; i < poolCount; i++)
+     {
+          if (dataAreaSameLayout(&pool[i], area) == JNI_TRUE)
+          {
+               *area = pool[i];
+               pool[i] = pool[--poolCount];
+               pthread_mutex_unlock(&poolLock);
+
+               return JNI_TRUE;
+          }
+     }
+
+     pthread_mutex_unlock(&poolLock);
+
+     area->reservation =
+          mmap(NULL, area->reservationSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+     if (area->reservation == MAP_FAILED)
+     {
+          area->reservation = NULL;
+
+          return JNI_FALSE;
+     }
+
+     area->data = (char *)area->reservation + (size_t)sysconf(_SC_PAGESIZE);
+
+     // Open up the regions. Their pages are zero filled as they are first touched.
+     for (i = 0; i < count; i++)
+     {
+          if ((area->size[i] > 0) &&
+              (mprotect((char *)area->data + (size_t)area->base[i] * cellSize, (size_t)area->size[i] * cellSize,
+                        PROT_READ | PROT_WRITE) != 0))
+          {
+               dataAreaUnreserve(area);
+
+               return JNI_FALSE;
+          }
+     }
+#else
+     area->reservation = calloc(area->reservationSize, 1);
+
+     if (area->reservation == NULL)
+     {
+          return JNI_FALSE;
+     }
+
+     area->data = area->reservation;
+#endif
+
+     return JNI_TRUE;
+}
+
+/*
+ * Clears the regions of a data area back to zero, so that it can be used again as if freshly created.
+ *
+ * @param area The data area to clear.
+ * @param used The number of cells at the start of each region that may have been written to, or -1 for a region
+ *             that must be cleared in full. <tt>NULL</tt> clears every region in full.
+ */
+void dataAreaClear(dataArea *area, const jint *used)
+{
+     int i;
+
+     for (i = 0; i < area->regionCount; i++)
+     {
+          dataAreaClearRegion(area, i, (used != NULL) ? used[i] : -1);
+     }
+}
+
+/*
+ * Resets a data area to the requested regions, all zeroed. If the area already has the same layout, its memory is
+ * kept and only the parts of it that were used are cleared, so the cost of a reset goes with how much of the area
+ * was used rather than with its size. Otherwise it is released, and created afresh.
+ *
+ * @param area     The data area to reset, which may not have been created yet.
+ * @param sizes    The requested size of each region, in cells.
+ * @param count    The number of regions.
+ * @param limit    The highest cell offset that the machine can address.
+ * @param cellSize The size of a cell in bytes.
+ * @param used     The number of cells at the start of each region that may have been written to, as for
+ *                 dataAreaClear.
+ *
+ * @return <tt>true</tt> if the area was reset, <tt>false</tt> if it had to be created afresh and could not be, in
+ *         which case it is left released.
+ */
+jboolean dataAreaReset(dataArea *area, const jint *sizes, int count, jint limit, size_t cellSize, const jint *used)
+{
+     dataArea layout;
+
+     if ((area->reservation != NULL) && (dataAreaLayout(&layout, sizes, count, limit, cellSize) == JNI_TRUE) &&
+         (dataAreaSameLayout(area, &layout) == JNI_TRUE))
+     {
+          dataAreaClear(area, used);
+
+          return JNI_TRUE;
+     }
+
+     dataAreaRelease(area);
+
+     return dataAreaCreate(area, sizes, count, limit, cellSize);
+}
+
+/*
+ * Releases the memory held by a data area. The area is cleared and kept in the pool for reuse if there is room for
+ * it, and its memory handed back otherwise. Releasing an area that was never created, or already released, does
+ * nothing.
+ *
+ * @param area The data area to release.
+ */
+void dataAreaRelease(dataArea *area)
+{
+     if (area->reservation == NULL)
+     {
+          return;
+     }
+
+#ifdef DATA_AREA_GUARDED
+     dataAreaClear(area, NULL);
+
+     pthread_mutex_lock(&poolLock);
+
+     if (poolCount < DATA_AREA_POOL_SIZE)
+     {
+          pool[poolCount++] = *area;
+          memset(area, 0, sizeof(dataArea));
+     }
+
+     pthread_mutex_unlock(&poolLock);
+#endif
+
+     dataAreaUnreserve(area);
+}
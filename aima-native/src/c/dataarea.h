@@ -0,0 +1,144 @@
+/* Defines a data area for the native machines, reserved as virtual memory with guard pages around its regions. */
+#ifndef _DATAAREA_H
+#define _DATAAREA_H
+
+#include <stddef.h>
+#include <setjmp.h>
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A data area is split into regions (registers, heap, stack, trail, PDL), each addressed by a cell offset from the
+ * start of the area. On POSIX systems the whole area is reserved in one mapping that the operating system only
+ * commits pages of as they are first touched, so the regions can be sized to millions of cells and only use the
+ * memory that they grow into. An inaccessible guard page is placed before and after every region. The machines
+ * do no bounds checks of their own when pushing onto the heap or stacks; running off the end of a region hits a
+ * guard page, and the fault is turned into a clean failure of the executing query by DATA_AREA_GUARD.
+ *
+ * Elsewhere the area is allocated in one block with no guard pages, and overflows are not detected.
+ *
+ * Reserving and mapping an area is costly next to running a short query on it, so a machine being reset keeps its
+ * area and clears only the parts of it that were used, and released areas are kept in a small pool from which
+ * areas of the same layout are created.
+ */
+
+/* Defines the maximum number of regions in a data area. */
+#define DATA_AREA_MAX_REGIONS 8
+
+typedef struct
+{
+     /* Holds the first cell of the data area. All region offsets are relative to this. */
+     void *data;
+
+     /* Holds the size of a cell in bytes. */
+     size_t cellSize;
+
+     /* Holds the start of the underlying reservation, including the leading guard page. */
+     void *reservation;
+
+     /* Holds the size of the underlying reservation in bytes. */
+     size_t reservationSize;
+
+     /* Holds the number of regions in the area. */
+     int regionCount;
+
+     /* Holds the offset of the base of each region. */
+     jint base[DATA_AREA_MAX_REGIONS];
+
+     /* Holds the size of each region in cells, rounded up to a whole number of pages. */
+     jint size[DATA_AREA_MAX_REGIONS];
+
+     /* Holds the offset one past the end of the last region. */
+     jint top;
+} dataArea;
+
+#ifndef _WIN32
+#define DATA_AREA_GUARDED
+
+/* Holds the place to return to when a guarded execution overflows its data area. */
+typedef sigjmp_buf dataAreaJmpBuf;
+
+/* Holds the place to return to on the current thread, when a machine overflows a region of its data area. */
+extern __thread sigjmp_buf *dataAreaOverflow;
+
+/* Holds the data area being executed on by the current thread, if any. */
+extern __thread dataArea *dataAreaActive;
+
+/*
+ * Starts guarding execution on a data area. Evaluates to zero when first called, and to non-zero when execution
+ * returns here after overflowing the area. The jump buffer must belong to the calling function, and every exit
+ * from the guarded execution must pass through DATA_AREA_UNGUARD.
+ */
+#define DATA_AREA_GUARD(area, jmp) \
+     (dataAreaActive = (area), dataAreaOverflow = &(jmp), sigsetjmp(jmp, 1))
+
+/* Ends guarding execution on a data area. */
+#define DATA_AREA_UNGUARD() (dataAreaActive = NULL, dataAreaOverflow = NULL)
+
+#else
+
+typedef jmp_buf dataAreaJmpBuf;
+
+#define DATA_AREA_GUARD(area, jmp) 0
+
+#define DATA_AREA_UNGUARD()
+
+#endif
+
+/*
+ * Creates a data area, laying out the requested regions consecutively in the order given. The region sizes are
+ * rounded up to whole pages; the rounded sizes and the region offsets are left in the area.
+ *
+ * @param area     The data area to initialize.
+ * @param sizes    The requested size of each region, in cells.
+ * @param count    The number of regions.
+ * @param limit    The highest cell offset that the machine can address.
+ * @param cellSize The size of a cell in bytes.
+ *
+ * @return <tt>true</tt> if the area was created, <tt>false</tt> if the regions do not fit below the limit or the
+ *         memory could not be reserved.
+ */
+jboolean dataAreaCreate(dataArea *area, const jint *sizes, int count, jint limit, size_t cellSize);
+
+/*
+ * Clears the regions of a data area back to zero, so that it can be used again as if freshly created.
+ *
+ * @param area The data area to clear.
+ * @param used The number of cells at the start of each region that may have been written to, or -1 for a region
+ *             that must be cleared in full. <tt>NULL</tt> clears every region in full.
+ */
+void dataAreaClear(dataArea *area, const jint *used);
+
+/*
+ * Resets a data area to the requested regions, all zeroed. If the area already has the same layout, its memory is
+ * kept and only the parts of it that were used are cleared. Otherwise it is released, and created afresh.
+ *
+ * @param area     The data area to reset, which may not have been created yet.
+ * @param sizes    The requested size of each region, in cells.
+ * @param count    The number of regions.
+ * @param limit    The highest cell offset that the machine can address.
+ * @param cellSize The size of a cell in bytes.
+ * @param used     The number of cells at the start of each region that may have been written to, as for
+ *                 dataAreaClear.
+ *
+ * @return <tt>true</tt> if the area was reset, <tt>false</tt> if it had to be created afresh and could not be, in
+ *         which case it is left released.
+ */
+jboolean dataAreaReset(dataArea *area, const jint *sizes, int count, jint limit, size_t cellSize, const jint *used);
+
+/*
+ * Releases the memory held by a data area. The area is kept in a pool for reuse if there is room for it. Releasing
+ * an area that was never created, or already released, does nothing.
+ *
+ * @param area The data area to release.
+ */
+void dataAreaRelease(dataArea *area);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _DATAAREA_H */
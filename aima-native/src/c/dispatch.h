@@ -0,0 +1,120 @@
+/* Defines macros for writing the byte code interpreter loops, as either direct threaded code or a switch loop. */
+#ifndef _DISPATCH_H
+#define _DISPATCH_H
+
+#include <stdint.h>
+#include "profile.h"
+
+/*
+ * Threaded dispatch uses the GCC labels-as-values extension, so that each instruction handler jumps straight to
+ * the handler for the next instruction through a table of label addresses. This avoids re-testing the loop
+ * condition and funnelling every instruction through a single indirect branch. Compilers without the extension,
+ * or builds defining NO_THREADED_DISPATCH, fall back to a portable switch inside a loop.
+ *
+ * Both forms expect the interpreter to hold the byte code in 'code', its size in 'length', the instruction
+ * pointer in 'ip' and the failure flag in 'failed'. Handlers are introduced with OP(opcode) and must end with one
+ * of the following:
+ *
+ * NEXT               - The handler only advanced ip past itself, so no bounds check is needed.
+ * NEXT_UNLESS_FAILED - As NEXT, but the handler may have set 'failed'.
+ * JUMP               - The handler transferred control, so ip is checked against the end of the code.
+ * FAIL               - The handler failed.
+ * HALT               - The handler ended execution.
+ *
+ * An interpreter that runs pre-decoded instructions, rather than byte code, defines DECODED_DISPATCH before
+ * including this file. 'code' then holds an array of instructions, each starting with a 'handler' field, 'length' is
+ * the number of them, and 'ip' indexes them. The handler field holds DISPATCH_HANDLER(opcode) for the decoded opcode,
+ * which is the address of its handler when dispatch is threaded, so that dispatching costs only the one indirect
+ * jump, and the opcode itself when dispatching through a switch.
+ *
+ * When profiling is compiled in, each handler counts its opcode into the active profile as it is entered.
+ */
+
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+/* Defines how the next opcode is fetched. An interpreter may override this before including this file. */
+#ifndef FETCH_OPCODE
+#ifdef DECODED_DISPATCH
+#define FETCH_OPCODE ((int)(intptr_t)code[ip].handler)
+#else
+#define FETCH_OPCODE ((unsigned char)code[ip])
+#endif
+#endif
+
+#ifdef THREADED_DISPATCH
+
+/* Defines the table of handler addresses, indexed by opcode. Unlisted opcodes go to the OP_UNKNOWN handler. */
+#define DISPATCH_TABLE(...) \
+     _Pragma("GCC diagnostic push") \
+     _Pragma("GCC diagnostic ignored \"-Woverride-init\"") \
+     static const void *dispatchTable[256] = { [0 ... 255] = &&op_UNKNOWN, __VA_ARGS__ }; \
+     _Pragma("GCC diagnostic pop")
+
+/* Defines an entry in the dispatch table. */
+#define DISPATCH_ENTRY(op) [op] = &&op_##op
+
+/* Introduces the handler for an opcode. */
+#define OP(op) op_##op: PROFILE_OPCODE(op);
+
+/* Introduces the handler for unknown opcodes. */
+#define OP_UNKNOWN op_UNKNOWN:
+
+/* Looks up the handler address that a decoded instruction holds for an opcode. */
+#define DISPATCH_HANDLER(op) (dispatchTable[(unsigned char)(op)])
+
+/* Dispatches to the handler for the instruction at ip. */
+#ifdef DECODED_DISPATCH
+#define NEXT goto *code[ip].handler
+#else
+#define NEXT goto *dispatchTable[FETCH_OPCODE]
+#endif
+
+/* Dispatches to the handler for the instruction at ip, unless the current handler failed. */
+#define NEXT_UNLESS_FAILED do { if (failed == JNI_TRUE) goto failure; NEXT; } while (0)
+
+/* Dispatches to the handler for the instruction at ip, after a control transfer that may leave the code. */
+#define JUMP do { if (ip >= length) goto halt; NEXT; } while (0)
+
+/* Fails the current execution. */
+#define FAIL goto failure
+
+/* Ends the current execution. */
+#define HALT goto halt
+
+/* Starts the interpreter loop. The loop condition is only checked on control transfers. */
+#define INTERP_LOOP_BEGIN(cond) JUMP;
+
+/* Ends the interpreter loop, providing the labels that failing and halting handlers jump to. */
+#define INTERP_LOOP_END failure: failed = JNI_TRUE; halt: ;
+
+#else
+
+#define DISPATCH_TABLE(...)
+
+#define DISPATCH_ENTRY(op)
+
+#define DISPATCH_HANDLER(op) ((const void *)(intptr_t)(op))
+
+#define OP(op) case op: PROFILE_OPCODE(op);
+
+#define OP_UNKNOWN default:
+
+#define NEXT continue
+
+#define NEXT_UNLESS_FAILED continue
+
+#define JUMP continue
+
+#define FAIL { failed = JNI_TRUE; continue; }
+
+#define HALT continue
+
+#define INTERP_LOOP_BEGIN(cond) while (cond) { switch (FETCH_OPCODE) {
+
+#define INTERP_LOOP_END } }
+
+#endif
+
+#endif /* _DISPATCH_H */
@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include "jitsymbols.h"
+
+#if defined(__linux__) && !defined(_WIN32)
+#define JIT_SYMBOLS_ELF
+#endif
+
+#ifdef JIT_SYMBOLS_ELF
+
+#include <stdio.h>
+#include <stdint.h>
+#include <elf.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/* Defines the ELF types and constants of the word size of the host. */
+#if defined(__LP64__) || defined(_LP64)
+#define JIT_ELF(type) Elf64_##type
+#define JIT_ELF_CLASS ELFCLASS64
+#define JIT_ELF_ST_INFO(bind, type) ELF64_ST_INFO(bind, type)
+#else
+#define JIT_ELF(type) Elf32_##type
+#define JIT_ELF_CLASS ELFCLASS32
+#define JIT_ELF_ST_INFO(bind, type) ELF32_ST_INFO(bind, type)
+#endif
+
+/* Defines the ELF machine of the host. */
+#if defined(__x86_64__)
+#define JIT_ELF_MACHINE EM_X86_64
+#elif defined(__i386__)
+#define JIT_ELF_MACHINE EM_386
+#elif defined(__aarch64__)
+#define JIT_ELF_MACHINE EM_AARCH64
+#elif defined(__arm__)
+#define JIT_ELF_MACHINE EM_ARM
+#elif defined(__powerpc64__)
+#define JIT_ELF_MACHINE EM_PPC64
+#elif defined(__powerpc__)
+#define JIT_ELF_MACHINE EM_PPC
+#else
+#define JIT_ELF_MACHINE EM_NONE
+#endif
+
+/* Defines the byte order of the host, in the ELF identification. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define JIT_ELF_DATA ELFDATA2MSB
+#else
+#define JIT_ELF_DATA ELFDATA2LSB
+#endif
+
+/* Defines the sections of the object files registered with the debugger, in the order they are laid out. */
+#define SECT_NULL 0
+#define SECT_TEXT 1
+#define SECT_SYMTAB 2
+#define SECT_STRTAB 3
+#define SECT_SHSTRTAB 4
+#define SECT_COUNT 5
+
+/* Defines the names of the sections, as the section header string table, and the offset of each name in it. */
+#define SHSTRTAB "\0.text\0.symtab\0.strtab\0.shstrtab"
+#define SHSTR_TEXT 1
+#define SHSTR_SYMTAB 7
+#define SHSTR_STRTAB 15
+#define SHSTR_SHSTRTAB 23
+
+/* Defines the actions that the debugger is told of, as in its JIT interface. */
+#define JIT_NOACTION 0
+#define JIT_REGISTER_FN 1
+#define JIT_UNREGISTER_FN 2
+
+/* Holds an entry in the list of object files registered with the debugger, as laid out by its JIT interface. */
+struct jit_code_entry
+{
+     struct jit_code_entry *next_entry;
+     struct jit_code_entry *prev_entry;
+     const char *symfile_addr;
+     uint64_t symfile_size;
+};
+
+/* Holds the list of object files registered with the debugger, as laid out by its JIT interface. */
+struct jit_descriptor
+{
+     uint32_t version;
+     uint32_t action_flag;
+     struct jit_code_entry *relevant_entry;
+     struct jit_code_entry *first_entry;
+};
+
+/* Holds the layout of the object file that describes one function to the debugger. */
+typedef struct
+{
+     JIT_ELF(Ehdr) header;
+     JIT_ELF(Shdr) sections[SECT_COUNT];
+     JIT_ELF(Sym) symbols[2];
+     char shstrtab[sizeof(SHSTRTAB)];
+     char strtab[1];
+} jitObject;
+
+struct jitSymbol
+{
+     /* Holds the start of the code that the symbol is for. */
+     const void *code;
+
+     /* Holds the registration of the symbol with the debugger. */
+     struct jit_code_entry entry;
+
+     /* Holds the next symbol of the same compiler. */
+     jitSymbol *next;
+};
+
+/* Holds the list of registered object files read by the debugger. The debugger finds this by its name. */
+struct jit_descriptor __jit_debug_descriptor = { 1, JIT_NOACTION, NULL, NULL };
+
+/* Used to guard the debugger list, the perf map, and the lists of symbols. */
+static pthread_mutex_t symbolsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Holds the perf map, once it has been opened. */
+static FILE *perfMap;
+
+/* Used to record whether an attempt to open the perf map has been made. */
+static int perfMapOpened;
+
+/*
+ * Is called whenever the list of registered object files changes. The debugger sets a breakpoint on this function,
+ * by its name, to catch the changes, so it must not be inlined or optimized away.
+ */
+void __attribute__((noinline)) __jit_debug_register_code(void)
+{
+     __asm__ __volatile__("");
+}
+
+/*
+ * Writes a line into the perf map for a function, opening the map on the first call. This must only be called with
+ * the symbols lock held.
+ *
+ * @param name The name of the function.
+ * @param code The start of the code of the function.
+ * @param size The size of the code of the function in bytes.
+ */
+static void jitSymbolsPerfMap(const char *name, const void *code, size_t size)
+{
+     if (!perfMapOpened)
+     {
+          const char *enabled = getenv("AIMA_JIT_PERF_MAP");
+          char path[64];
+
+          perfMapOpened = 1;
+
+          if ((enabled == NULL) || (strcmp(enabled, "0") != 0))
+          {
+               sprintf(path, "/tmp/perf-%d.map", (int)getpid());
+               perfMap = fopen(path, "a");
+          }
+     }
+
+     if (perfMap != NULL)
+     {
+          fprintf(perfMap, "%lx %lx %s\n", (unsigned long)(uintptr_t)code, (unsigned long)size, name);
+          fflush(perfMap);
+     }
+}
+
+/*
+ * Builds the object file that describes a function to the debugger. The object is relocatable, and holds no code;
+ * its text section takes up no space in the file, but is placed at the address of the code in memory, and the one
+ * symbol in it covers the whole of that section.
+ *
+ * @param name       The name of the function.
+ * @param code       The start of the code of the function.
+ * @param size       The size of the code of the function in bytes.
+ * @param objectSize Receives the size of the object file in bytes.
+ *
+ * @return The object file, to be freed by the caller, or <tt>NULL</tt> if it could not be allocated.
+ */
+static jitObject *jitSymbolsObject(const char *name, const void *code, size_t size, size_t *objectSize)
+{
+     size_t nameLength = strlen(name);
+     jitObject *obj;
+
+     *objectSize = sizeof(jitObject) + nameLength + 1;
+
+     if ((obj = calloc(1, *objectSize)) == NULL)
+     {
+          return NULL;
+     }
+
+     memcpy(obj->header.e_ident, ELFMAG, SELFMAG);
+     obj->header.e_ident[EI_CLASS] = JIT_ELF_CLASS;
+     obj->header.e_ident[EI_DATA] = JIT_ELF_DATA;
+     obj->header.e_ident[EI_VERSION] = EV_CURRENT;
+     obj->header.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+     obj->header.e_type = ET_REL;
+     obj->header.e_machine = JIT_ELF_MACHINE;
+     obj->header.e_version = EV_CURRENT;
+     obj->header.e_shoff = offsetof(jitObject, sections);
+     obj->header.e_ehsize = sizeof(JIT_ELF(Ehdr));
+     obj->header.e_shentsize = sizeof(JIT_ELF(Shdr));
+     obj->header.e_shnum = SECT_COUNT;
+     obj->header.e_shstrndx = SECT_SHSTRTAB;
+
+     // The text section is where the code is in memory.
+     obj->sections[SECT_TEXT].sh_name = SHSTR_TEXT;
+     obj->sections[SECT_TEXT].sh_type = SHT_NOBITS;
+     obj->sections[SECT_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+     obj->sections[SECT_TEXT].sh_addr = (uintptr_t)code;
+     obj->sections[SECT_TEXT].sh_size = size;
+     obj->sections[SECT_TEXT].sh_addralign = 1;
+
+     // The symbol table holds the null symbol, and the global symbol for the function.
+     obj->sections[SECT_SYMTAB].sh_name = SHSTR_SYMTAB;
+     obj->sections[SECT_SYMTAB].sh_type = SHT_SYMTAB;
+     obj->sections[SECT_SYMTAB].sh_offset = offsetof(jitObject, symbols);
+     obj->sections[SECT_SYMTAB].sh_size = sizeof(obj->symbols);
+     obj->sections[SECT_SYMTAB].sh_link = SECT_STRTAB;
+     obj->sections[SECT_SYMTAB].sh_info = 1;
+     obj->sections[SECT_SYMTAB].sh_addralign = sizeof(void *);
+     obj->sections[SECT_SYMTAB].sh_entsize = sizeof(JIT_ELF(Sym));
+
+     obj->symbols[1].st_name = 1;
+     obj->symbols[1].st_info = JIT_ELF_ST_INFO(STB_GLOBAL, STT_FUNC);
+     obj->symbols[1].st_shndx = SECT_TEXT;
+     obj->symbols[1].st_value = 0;
+     obj->symbols[1].st_size = size;
+
+     // The string table holds the name of the function, after the empty name.
+     obj->sections[SECT_STRTAB].sh_name = SHSTR_STRTAB;
+     obj->sections[SECT_STRTAB].sh_type = SHT_STRTAB;
+     obj->sections[SECT_STRTAB].sh_offset = offsetof(jitObject, strtab);
+     obj->sections[SECT_STRTAB].sh_size = nameLength + 2;
+     obj->sections[SECT_STRTAB].sh_addralign = 1;
+     memcpy(obj->strtab + 1, name, nameLength + 1);
+
+     obj->sections[SECT_SHSTRTAB].sh_name = SHSTR_SHSTRTAB;
+     obj->sections[SECT_SHSTRTAB].sh_type = SHT_STRTAB;
+     obj->sections[SECT_SHSTRTAB].sh_offset = offsetof(jitObject, shstrtab);
+     obj->sections[SECT_SHSTRTAB].sh_size = sizeof(SHSTRTAB);
+     obj->sections[SECT_SHSTRTAB].sh_addralign = 1;
+     memcpy(obj->shstrtab, SHSTRTAB, sizeof(SHSTRTAB));
+
+     return obj;
+}
+
+/*
+ * Takes a symbol out of the list of object files registered with the debugger, and frees it. This must only be
+ * called with the symbols lock held.
+ *
+ * @param symbol The symbol to unregister.
+ */
+static void jitSymbolsUnregister(jitSymbol *symbol)
+{
+     struct jit_code_entry *entry = &symbol->entry;
+
+     if (entry->prev_entry != NULL)
+     {
+          entry->prev_entry->next_entry = entry->next_entry;
+     }
+     else
+     {
+          __jit_debug_descriptor.first_entry = entry->next_entry;
+     }
+
+     if (entry->next_entry != NULL)
+     {
+          entry->next_entry->prev_entry = entry->prev_entry;
+     }
+
+     __jit_debug_descriptor.relevant_entry = entry;
+     __jit_debug_descriptor.action_flag = JIT_UNREGISTER_FN;
+     __jit_debug_register_code();
+
+     free((void *)entry->symfile_addr);
+     free(symbol);
+}
+
+#endif
+
+/*
+ * Publishes a symbol for a function of compiled code.
+ *
+ * @param symbols The symbols of the compiler that emitted the function.
+ * @param name    The name of the function.
+ * @param code    The start of the code of the function.
+ * @param size    The size of the code of the function in bytes.
+ */
+void jitSymbolsPublish(jitSymbols *symbols, const char *name, const void *code, size_t size)
+{
+#ifdef JIT_SYMBOLS_ELF
+     jitSymbol *symbol = calloc(1, sizeof(jitSymbol));
+     size_t objectSize;
+     jitObject *obj = (symbol != NULL) ? jitSymbolsObject(name, code, size, &objectSize) : NULL;
+
+     pthread_mutex_lock(&symbolsLock);
+
+     jitSymbolsPerfMap(name, code, size);
+
+     if (obj != NULL)
+     {
+          // Register the object with the debugger, at the head of its list.
+          symbol->code = code;
+          symbol->entry.symfile_addr = (const char *)obj;
+          symbol->entry.symfile_size = objectSize;
+          symbol->entry.next_entry = __jit_debug_descriptor.first_entry;
+
+          if (symbol->entry.next_entry != NULL)
+          {
+               symbol->entry.next_entry->prev_entry = &symbol->entry;
+          }
+
+          __jit_debug_descriptor.first_entry = &symbol->entry;
+          __jit_debug_descriptor.relevant_entry = &symbol->entry;
+          __jit_debug_descriptor.action_flag = JIT_REGISTER_FN;
+          __jit_debug_register_code();
+
+          symbol->next = symbols->first;
+          symbols->first = symbol;
+     }
+     else
+     {
+          free(symbol);
+     }
+
+     pthread_mutex_unlock(&symbolsLock);
+#endif
+}
+
+/*
+ * Withdraws the symbol published for a function, as its code is about to be freed. Withdrawing a function that has
+ * no symbol does nothing.
+ *
+ * @param symbols The symbols of the compiler that emitted the function.
+ * @param code    The start of the code of the function.
+ */
+void jitSymbolsWithdraw(jitSymbols *symbols, const void *code)
+{
+#ifdef JIT_SYMBOLS_ELF
+     jitSymbol **at;
+
+     pthread_mutex_lock(&symbolsLock);
+
+     for (at = &symbols->first; *at != NULL; at = &(*at)->next)
+     {
+          if ((*at)->code == code)
+          {
+               jitSymbol *symbol = *at;
+
+               *at = symbol->next;
+               jitSymbolsUnregister(symbol);
+
+               break;
+          }
+     }
+
+     pthread_mutex_unlock(&symbolsLock);
+#endif
+}
+
+/*
+ * Withdraws all of the symbols of a compiler, as all of its code is about to be freed.
+ *
+ * @param symbols The symbols of the compiler.
+ */
+void jitSymbolsRelease(jitSymbols *symbols)
+{
+#ifdef JIT_SYMBOLS_ELF
+     pthread_mutex_lock(&symbolsLock);
+
+     while (symbols->first != NULL)
+     {
+          jitSymbol *symbol = symbols->first;
+
+          symbols->first = symbol->next;
+          jitSymbolsUnregister(symbol);
+     }
+
+     pthread_mutex_unlock(&symbolsLock);
+#endif
+}
@@ -0,0 +1,72 @@
+/* Defines the publishing of symbols for JIT compiled code, to profilers and debuggers. */
+#ifndef _JITSYMBOLS_H
+#define _JITSYMBOLS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Code compiled at run time has no symbols in any file on disk, so profilers and debuggers only see it as anonymous
+ * addresses. A compiler publishes a symbol for each function that it emits here, in the two ways that the common
+ * tools look for them:
+ *
+ * <pre>
+ * perf map      A line of the start address, size and name of the function is appended to /tmp/perf-[pid].map,
+ *               which perf, and the profilers that follow its convention, read to name addresses in the process.
+ *               Writing the map is turned off by setting AIMA_JIT_PERF_MAP to 0.
+ * GDB JIT       A small in memory ELF object file, holding a symbol for the function that covers its code, is
+ *               registered through the JIT interface of GDB, which reads it in when attached to the process, so that
+ *               backtraces and disassembly show the name of the function. These objects carry no unwind or line
+ *               information.
+ * </pre>
+ *
+ * The perf map is only ever appended to, so its entries outlive the code they name; perf takes the latest entry for
+ * an address. Registrations with the debugger are withdrawn when the code is freed.
+ *
+ * Symbols are only published on platforms with ELF object files; elsewhere publishing does nothing. All of the
+ * functions may be called from any thread.
+ */
+
+/* Holds one published symbol, and its registration with the debugger. */
+typedef struct jitSymbol jitSymbol;
+
+typedef struct
+{
+     /* Holds the symbols published for a compiler, that are still registered. */
+     jitSymbol *first;
+} jitSymbols;
+
+/*
+ * Publishes a symbol for a function of compiled code.
+ *
+ * @param symbols The symbols of the compiler that emitted the function.
+ * @param name    The name of the function.
+ * @param code    The start of the code of the function.
+ * @param size    The size of the code of the function in bytes.
+ */
+void jitSymbolsPublish(jitSymbols *symbols, const char *name, const void *code, size_t size);
+
+/*
+ * Withdraws the symbol published for a function, as its code is about to be freed. Withdrawing a function that has
+ * no symbol does nothing.
+ *
+ * @param symbols The symbols of the compiler that emitted the function.
+ * @param code    The start of the code of the function.
+ */
+void jitSymbolsWithdraw(jitSymbols *symbols, const void *code);
+
+/*
+ * Withdraws all of the symbols of a compiler, as all of its code is about to be freed.
+ *
+ * @param symbols The symbols of the compiler.
+ */
+void jitSymbolsRelease(jitSymbols *symbols);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _JITSYMBOLS_H */
@@ -1,18 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine.h"
-
-/** Defines the machine instruction types. */
-#define PUT_STRUC 0x01
-#define SET_VAR 0x02
-#define SET_VAL 0x03
-#define GET_STRUC 0x04
-#define UNIFY_VAR 0x05
-#define UNIFY_VAL 0x06
-
-/** Defines the heap cell marker types. */
-#define REF 0x01
-#define STR 0x02
+#include "machinecore.h"
 
 /* Defines the heap size to use for the virtual machine. */
 #define HEAP_SIZE 10000
@@ -29,7 +19,7 @@ typedef struct
      jint ip;
 
      /* Holds the working heap. */
-     jint *heap;
+     jcell *heap;
 
      /* Holds the heap pointer. */
      jint hp;
@@ -38,10 +28,7 @@ typedef struct
      jint sp;
 
      /* Holds the unification stack. */
-     jint *ustack;
-
-     /* Holds the unification stack pointer. */
-     jint up;
+     jcell *ustack;
 
      /* Used to record whether the machine is in structure read or write mode. */
      jboolean writeMode;
@@ -53,70 +40,69 @@ typedef struct
      jint derefVal;
 } l0MachineState;
 
-l0MachineState *l0state = -1;
-
 /*
- * Creates the machines initial state.
+ * Creates the machines initial state. Each machine instance has its own state, so separate instances may run on
+ * separate threads at the same time. A single instance must not be used from more than one thread at once.
+ *
+ * Class:     com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine
+ * Method:    nativeReset
+ * Signature: (J)J
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state, or zero if it has not been created yet.
+ *
+ * @return A handle onto the machine state.
  */
-void l0reset()
+JNIEXPORT jlong JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_nativeReset
+(JNIEnv * env, jobject obj, jlong state)
 {
-     l0state = malloc(sizeof(l0MachineState));
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
 
-     // Create fresh heaps, code areas and stacks.
-     l0state->heap = malloc((REG_SIZE + HEAP_SIZE) * sizeof(jint));
-     l0state->ustack = malloc(USTACK_SIZE * sizeof(jint));
+     // Allocate space for the machines state, and its heaps and stacks, the first time that it is reset.
+     if (l0state == NULL)
+     {
+          l0state = malloc(sizeof(l0MachineState));
+          l0state->heap = malloc((REG_SIZE + HEAP_SIZE) * sizeof(jcell));
+          l0state->ustack = malloc(USTACK_SIZE * sizeof(jcell));
+     }
 
      // Registers are on the top of the heap, so initialize the heap pointers to the heap area.
      l0state->hp = REG_SIZE;
      l0state->sp = REG_SIZE;
 
-     // Clear the unification stack.
-     l0state->up = -1;
-
      // Turn off write mode.
      l0state->writeMode = JNI_FALSE;
 
      // Could probably not bother resetting these, but will do it anyway just to be sure.
      l0state->derefTag = 0;
      l0state->derefVal = 0;
-}
 
-/*
- * Pushes a value onto the unification stack.
- *
- * @param val The value to push onto the stack.
- */
-void uPush(jint val)
-{
-     l0state->ustack[++l0state->up] = val;
+     return (jlong)(intptr_t)l0state;
 }
 
 /*
- * Pops a value from the unification stack.
+ * Releases the machine state, and the heaps and stacks that it holds. Releasing a zero handle does nothing.
  *
- * @return The top value from the unification stack.
- */
-jint uPop()
-{
-     return l0state->ustack[l0state->up--];
-}
-
-/*
- * Clears the unification stack.
- */
-void uClear()
-{
-     l0state->up = -1;
-}
-
-/*
- * Checks if the unification stack is empty.
+ * Class:     com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine
+ * Method:    nativeRelease
+ * Signature: (J)V
  *
- * @return <tt>true</tt> if the unification stack is empty, <tt>false</tt> otherwise.
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
  */
-jboolean uEmpty()
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_nativeRelease
+(JNIEnv * env, jobject obj, jlong state)
 {
-     return l0state->up == -1 ? JNI_TRUE : JNI_FALSE;
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
+
+     if (l0state != NULL)
+     {
+          free(l0state->heap);
+          free(l0state->ustack);
+          free(l0state);
+     }
 }
 
 /*
@@ -124,147 +110,49 @@ jboolean uEmpty()
  * reference chains to their conclusion. This method is also side effecting, in that the contents of the
  * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
  *
- * @param a The address to dereference.
+ * @param l0state The machine state.
+ * @param a       The address to dereference.
  *
  * @return The address that the reference refers to.
  */
-jint deref(jint a)
+jint deref(l0MachineState *l0state, jint a)
 {
-     jint addr;
-     jint tmp;
-     jbyte derefTag;
-     jint derefVal;
-
-     //printf("jint deref(jint a = 0x%02x): called\n", a);
+     jcell cell;
+     jint addr = coreDeref(l0state->heap, a, &cell);
 
-     // tag, value <- STORE[a]
-     addr = a;
-     tmp = l0state->heap[a];
-     derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-     derefVal = tmp & 0x00FFFFFF;
-
-     // while tag = REF and value != a
-     while ((derefTag == REF))
-     {
-          // tag, value <- STORE[a]
-          addr = derefVal;
-          tmp = l0state->heap[derefVal];
-          derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-          tmp = tmp & 0x00FFFFFF;
-
-          // Break on free var.
-          if (derefVal == tmp)
-          {
-               break;
-          }
-
-          derefVal = tmp;
-     }
-
-     //printf("derefTag = 0x%02x\n", derefTag);
-     //printf("derefVal = 0x%02x\n", derefVal);
-     //printf("addr = 0x%02x\n", addr);
-
-     l0state->derefTag = derefTag;
-     l0state->derefVal = derefVal;
+     l0state->derefTag = CELL_TAG(cell);
+     l0state->derefVal = CELL_VAL(cell);
 
      return addr;
 }
 
 /*
  * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
- * element by element, free references become bound.
+ * element by element, free references become bound. The unification stack is left empty again afterwards.
  *
- * @param a1 The address of the first structure or reference.
- * @param a2 The address of the second structure or reference.
+ * @param l0state The machine state.
+ * @param a1      The address of the first structure or reference.
+ * @param a2      The address of the second structure or reference.
  *
  * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
  */
-jboolean unify(jint a1, jint a2)
+jboolean unify(l0MachineState *l0state, jint a1, jint a2)
 {
-     jboolean fail;
-
-     //printf("jboolean unify(jint a1 = 0x%02x, jint a2 = 0x%02x): called\n", a1, a2);
-
-     // pdl.push(a1)
-     // pdl.push(a2)
-     uPush(a1);
-     uPush(a2);
-
-     // fail <- false
-     fail = JNI_FALSE;
-
-     // while !empty(PDL) and not failed
-     while (uEmpty() == JNI_FALSE && !fail)
-     {
-          // d1 <- deref(pdl.pop())
-          // d2 <- deref(pdl.pop())
-          // t1, v1 <- STORE[d1]
-          // t2, v2 <- STORE[d2]
-          jint d1 = deref(uPop());
-          jint t1 = l0state->derefTag;
-          jint v1 = l0state->derefVal;
-
-          int d2 = deref(uPop());
-          int t2 = l0state->derefTag;
-          int v2 = l0state->derefVal;
-
-          // if (d1 != d2)
-          if (d1 != d2)
-          {
-               // if (t1 = REF or t2 = REF)
-               // bind(d1, d2)
-               if ((t1 == REF))
-               {
-                    l0state->heap[d1] = (REF << 24) | (d2 & 0xFFFFFF);
-               }
-               else if (t2 == REF)
-               {
-                    l0state->heap[d2] = (REF << 24) | (d1 & 0xFFFFFF);
-               }
-               else
-               {
-                    // f1/n1 <- STORE[v1]
-                    // f2/n2 <- STORE[v2]
-                    jint f_n1 = l0state->heap[v1];
-                    jint f_n2 = l0state->heap[v2];
-                    jbyte n1 = (jbyte)(f_n1 & 0xFF);
-
-                    // if f1 = f2 and n1 = n2
-                    if (f_n1 == f_n2)
-                    {
-                         // for i <- 1 to n1
-                         jint i;
-                         for (i = 1; i <= n1; i++)
-                         {
-                              // pdl.push(v1 + i)
-                              // pdl.push(v2 + i)
-                              uPush(v1 + i);
-                              uPush(v2 + i);
-                         }
-                    }
-                    else
-                    {
-                         // fail <- true
-                         fail = JNI_TRUE;
-                    }
-               }
-          }
-     }
-
-     return fail == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+     return coreUnify(l0state->heap, l0state->ustack, USTACK_SIZE, a1, a2);
 }
 
 /*
  * Executes a compiled functor returning an indication of whether or not a unification was found.
  *
+ * @param state   A handle onto the machine state.
  * @param functor The compiled byte code to execute.
  *
  * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
  */
 JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_execute
-(JNIEnv * env, jobject obj, jobject codeBuf)
+(JNIEnv * env, jobject obj, jlong state, jobject codeBuf)
 {
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
      jint addr;
      jbyte tag;
      jint a;
@@ -279,18 +167,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
      jsize length = (*env)->GetDirectBufferCapacity(env, codeBuf);
      jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
 
-     // Reset the machine to its initial state if no machine state exists yet.
-     if (l0state == -1)
-     {
-          l0reset();
-     }
-
      hp = l0state->hp;
      sp = l0state->sp;
      writeMode = l0state->writeMode;
 
      ip = 0;
-     uClear();
 
      //printf("JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_execute: called\n");
 
@@ -312,7 +193,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                //printf("PUT_STRUC %i,%i (0x%02x)\n", Xi, f_n, f_n);
 
                // heap[h] <- STR, h + 1
-               l0state->heap[hp] = (STR << 24) | ((hp + 1) & 0xFFFFFF);
+               l0state->heap[hp] = CELL_MAKE(STR, hp + 1);
 
                // heap[h+1] <- f/n
                l0state->heap[hp + 1] = f_n;
@@ -332,7 +213,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                //printf("SET_VAR %i\n", Xi);
 
                // heap[h] <- REF, h
-               l0state->heap[hp] = (REF << 24) | (hp & 0xFFFFFF);
+               l0state->heap[hp] = CELL_MAKE(REF, hp);
 
                // Xi <- heap[h]
                l0state->heap[Xi] = l0state->heap[hp];
@@ -367,12 +248,12 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                //printf("GET_STRUC %i,%i (0x%02x)\n", Xi, f_n, f_n);
 
                // addr <- deref(Xi);
-               addr = deref(Xi);
+               addr = deref(l0state, Xi);
 
                // switch STORE[addr]
                //int tmp = heap[addr];
-               //byte tag = (byte)((tmp & 0xFF000000) >> 24);
-               //int a = tmp & 0x00FFFFFF;
+               //byte tag = CELL_TAG(tmp);
+               //int a = CELL_VAL(tmp);
                tag = l0state->derefTag;
                a = l0state->derefVal;
 
@@ -386,13 +267,13 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                     //printf("tag = REF\n");
 
                     // heap[h] <- STR, h + 1
-                    l0state->heap[hp] = (STR << 24) | ((hp + 1) & 0xFFFFFF);
+                    l0state->heap[hp] = CELL_MAKE(STR, hp + 1);
 
                     // heap[h+1] <- f/n
                     l0state->heap[hp + 1] = f_n;
 
                     // bind(addr, h)
-                    l0state->heap[addr] = (REF << 24) | (hp & 0xFFFFFF);
+                    l0state->heap[addr] = CELL_MAKE(REF, hp);
 
                     // h <- h + 2
                     hp += 2;
@@ -450,7 +331,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                {
                     // case write:
                     // heap[h] <- REF, h
-                    l0state->heap[hp] = (REF << 24) | (hp & 0xFFFFFF);
+                    l0state->heap[hp] = CELL_MAKE(REF, hp);
 
                     // Xi <- heap[h]
                     l0state->heap[Xi] = l0state->heap[hp];
@@ -475,7 +356,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
                {
                     // case read:
                     // unify (Xi, s)
-                    failed = unify(Xi, sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+                    failed = unify(l0state, Xi, sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
                }
                else
                {
@@ -508,46 +389,60 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMa
  * reference chains to their conclusion. This method is also side effecting, in that the contents of the
  * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
  *
- * @param a The address to dereference.
+ * @param state A handle onto the machine state.
+ * @param a     The address to dereference.
  *
  * @return The address that the reference refers to.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_deref
-(JNIEnv * env, jobject obj, jint a)
+(JNIEnv * env, jobject obj, jlong state, jint a)
 {
-     return deref(a);
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
+
+     return deref(l0state, a);
 }
 
 /*
  * Gets the heap cell tag for the most recent dereference operation.
  *
+ * @param state A handle onto the machine state.
+ *
  * @return The heap cell tag for the most recent dereference operation.
  */
 JNIEXPORT jbyte JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_getDerefTag
-(JNIEnv * env, jobject obj)
+(JNIEnv * env, jobject obj, jlong state)
 {
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
+
      return l0state->derefTag;
 }
 
 /*
  * Gets the heap cell value for the most recent dereference operation.
  *
+ * @param state A handle onto the machine state.
+ *
  * @return The heap cell value for the most recent dereference operation.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_getDerefVal
-(JNIEnv * env, jobject obj)
+(JNIEnv * env, jobject obj, jlong state)
 {
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
+
      return l0state->derefVal;
 }
 
 /*
  * Gets the value of the heap cell at the specified location.
  *
- * @param addr The address to fetch from the heap.
+ * @param state A handle onto the machine state.
+ * @param addr  The address to fetch from the heap.
  * @return The heap cell at the specified location.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l0_L0UnifyingNativeMachine_getHeap
-(JNIEnv * env, jobject obj, jint addr)
+(JNIEnv * env, jobject obj, jlong state, jint addr)
 {
-     return l0state->heap[addr];
+     l0MachineState *l0state = (l0MachineState *)(intptr_t)state;
+
+     return (jint)l0state->heap[addr];
 }
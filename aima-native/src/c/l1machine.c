@@ -1,24 +1,13 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine.h"
+#include "machinecore.h"
 
-/** Defines the machine instruction types. */
-#define PUT_STRUC 0x01
-#define SET_VAR 0x02
-#define SET_VAL 0x03
-#define GET_STRUC 0x04
-#define UNIFY_VAR 0x05
-#define UNIFY_VAL 0x06
-#define PUT_VAR 0x07
-#define PUT_VAL 0x08
-#define GET_VAR 0x09
-#define GET_VAL 0x0a
-#define CALL 0x0b
-#define PROCEED 0x0c
-
-/** Defines the heap cell marker types. */
-#define REF 0x01
-#define STR 0x02
+/* Fetches the next instruction along with its first operand, which every instruction has. */
+#define FETCH_OPCODE ((unsigned char)(instruction = code[ip++], xi = (jint)code[ip++], instruction))
+
+#include "dispatch.h"
 
 /* Defines the heap size to use for the virtual machine. */
 #define HEAP_SIZE 10000
@@ -35,7 +24,7 @@ typedef struct
      jint ip;
 
      /* Holds the working heap. */
-     jint *heap;
+     jcell *heap;
 
      /* Holds the heap pointer. */
      jint hp;
@@ -44,10 +33,7 @@ typedef struct
      jint sp;
 
      /* Holds the unification stack. */
-     jint *ustack;
-
-     /* Holds the unification stack pointer. */
-     jint up;
+     jcell *ustack;
 
      /* Used to record whether the machine is in structure read or write mode. */
      jboolean writeMode;
@@ -59,211 +45,74 @@ typedef struct
      jint derefVal;
 } l1MachineState;
 
-l1MachineState *l1state;
-
-/*
- * Pushes a value onto the unification stack.
- *
- * @param val The value to push onto the stack.
- */
-void l1uPush(jint val)
-{
-     l1state->ustack[++(l1state->up)] = val;
-}
-
-/*
- * Pops a value from the unification stack.
- *
- * @return The top value from the unification stack.
- */
-jint l1uPop()
-{
-     return l1state->ustack[(l1state->up)--];
-}
-
-/*
- * Clears the unification stack.
- */
-void l1uClear()
-{
-     l1state->up = -1;
-}
-
-/*
- * Checks if the unification stack is empty.
- *
- * @return <tt>true</tt> if the unification stack is empty, <tt>false</tt> otherwise.
- */
-jboolean l1uEmpty()
-{
-     return l1state->up == -1 ? JNI_TRUE : JNI_FALSE;
-}
-
 /*
  * Dereferences a heap pointer (or register), returning the address that it refers to after following all
  * reference chains to their conclusion. This method is also side effecting, in that the contents of the
  * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
  *
- * @param a The address to dereference.
+ * @param l1state The machine state.
+ * @param a       The address to dereference.
  *
  * @return The address that the reference refers to.
  */
-jint l1deref(jint a)
+jint l1deref(l1MachineState *l1state, jint a)
 {
-     jint addr;
-     jint tmp;
-     jbyte derefTag;
-     jint derefVal;
-
-     //printf("jint deref(jint a = 0x%02x): called\n", a);
-
-     // tag, value <- STORE[a]
-     addr = a;
-     tmp = l1state->heap[a];
-     derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-     derefVal = tmp & 0x00FFFFFF;
-
-     // while tag = REF and value != a
-     while ((derefTag == REF))
-     {
-          // tag, value <- STORE[a]
-          addr = derefVal;
-          tmp = l1state->heap[derefVal];
-          derefTag = (jbyte)((tmp & 0xFF000000) >> 24);
-          tmp = tmp & 0x00FFFFFF;
-
-          // Break on free var.
-          if (derefVal == tmp)
-          {
-               break;
-          }
-
-          derefVal = tmp;
-     }
-
-     //printf("derefTag = 0x%02x\n", derefTag);
-     //printf("derefVal = 0x%02x\n", derefVal);
-     //printf("addr = 0x%02x\n", addr);
+     jcell cell;
+     jint addr = coreDeref(l1state->heap, a, &cell);
 
-     l1state->derefTag = derefTag;
-     l1state->derefVal = derefVal;
+     l1state->derefTag = CELL_TAG(cell);
+     l1state->derefVal = CELL_VAL(cell);
 
      return addr;
 }
 
 /*
  * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
- * element by element, free references become bound.
+ * element by element, free references become bound. The unification stack is left empty again afterwards.
  *
- * @param a1 The address of the first structure or reference.
- * @param a2 The address of the second structure or reference.
+ * @param l1state The machine state.
+ * @param a1      The address of the first structure or reference.
+ * @param a2      The address of the second structure or reference.
  *
  * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
  */
-jboolean l1unify(jint a1, jint a2)
+jboolean l1unify(l1MachineState *l1state, jint a1, jint a2)
 {
-     jboolean fail;
-
-     //printf("jboolean unify(jint a1 = 0x%02x, jint a2 = 0x%02x): called\n", a1, a2);
-
-     // pdl.push(a1)
-     // pdl.push(a2)
-     l1uPush(a1);
-     l1uPush(a2);
-
-     // fail <- false
-     fail = JNI_FALSE;
-
-     // while !empty(PDL) and not failed
-     while (l1uEmpty() == JNI_FALSE && !fail)
-     {
-          // d1 <- deref(pdl.pop())
-          // d2 <- deref(pdl.pop())
-          // t1, v1 <- STORE[d1]
-          // t2, v2 <- STORE[d2]
-          jint d1 = l1deref(l1uPop());
-          jint t1 = l1state->derefTag;
-          jint v1 = l1state->derefVal;
-
-          int d2 = l1deref(l1uPop());
-          int t2 = l1state->derefTag;
-          int v2 = l1state->derefVal;
-
-          // if (d1 != d2)
-          if (d1 != d2)
-          {
-               // if (t1 = REF or t2 = REF)
-               // bind(d1, d2)
-               if ((t1 == REF))
-               {
-                    l1state->heap[d1] = (REF << 24) | (d2 & 0xFFFFFF);
-               }
-               else if (t2 == REF)
-               {
-                    l1state->heap[d2] = (REF << 24) | (d1 & 0xFFFFFF);
-               }
-               else
-               {
-                    // f1/n1 <- STORE[v1]
-                    // f2/n2 <- STORE[v2]
-                    jint f_n1 = l1state->heap[v1];
-                    jint f_n2 = l1state->heap[v2];
-                    jbyte n1 = (jbyte)(f_n1 & 0xFF);
-
-                    // if f1 = f2 and n1 = n2
-                    if (f_n1 == f_n2)
-                    {
-                         // for i <- 1 to n1
-                         jint i;
-                         for (i = 1; i <= n1; i++)
-                         {
-                              // pdl.push(v1 + i)
-                              // pdl.push(v2 + i)
-                              l1uPush(v1 + i);
-                              l1uPush(v2 + i);
-                         }
-                    }
-                    else
-                    {
-                         // fail <- true
-                         fail = JNI_TRUE;
-                    }
-               }
-          }
-     }
-
-     return fail == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+     return coreUnify(l1state->heap, l1state->ustack, USTACK_SIZE, a1, a2);
 }
 
 /*
  * Resets the machine to its initial state. This clears any programs from the machine, and clears all of its stacks
- * and heaps.
+ * and heaps. Each machine instance has its own state, created on its first reset, so separate instances may run on
+ * separate threads at the same time. A single instance must not be used from more than one thread at once.
  *
  * Class:     com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine
- * Method:    reset
- * Signature: ()V
+ * Method:    nativeReset
+ * Signature: (J)J
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state, or zero if it has not been created yet.
  *
- * @param env     The native code execution environment.
- * @param obj     The object that is the context to this native method.
- * @param offset  The offset within the code buffer of the byte code to execute.
+ * @return A handle onto the machine state.
  */
-JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_nativeReset
-(JNIEnv * env, jobject obj)
+JNIEXPORT jlong JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_nativeReset
+(JNIEnv * env, jobject obj, jlong state)
 {
-     // Allocate space for the machines state.
-     l1state = malloc(sizeof(l1MachineState));
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
 
-     // Create fresh heaps, code areas and stacks.
-     l1state->heap = malloc((REG_SIZE + HEAP_SIZE) * sizeof(jint));
-     l1state->ustack = malloc(USTACK_SIZE * sizeof(jint));
+     // Allocate space for the machines state, and its heaps and stacks, the first time that it is reset.
+     if (l1state == NULL)
+     {
+          l1state = malloc(sizeof(l1MachineState));
+          l1state->heap = malloc((REG_SIZE + HEAP_SIZE) * sizeof(jcell));
+          l1state->ustack = malloc(USTACK_SIZE * sizeof(jcell));
+     }
 
      // Registers are on the top of the heap, so initialize the heap pointers to the heap area.
      l1state->hp = REG_SIZE;
      l1state->sp = REG_SIZE;
 
-     // Clear the unification stack.
-     l1state->up = -1;
-
      // Turn off write mode.
      l1state->writeMode = JNI_FALSE;
 
@@ -273,20 +122,48 @@ JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachin
      // Could probably not bother resetting these, but will do it anyway just to be sure.
      l1state->derefTag = 0;
      l1state->derefVal = 0;
+
+     return (jlong)(intptr_t)l1state;
+}
+
+/*
+ * Releases the machine state, and the heaps and stacks that it holds. Releasing a zero handle does nothing.
+ *
+ * Class:     com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine
+ * Method:    nativeRelease
+ * Signature: (J)V
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_nativeRelease
+(JNIEnv * env, jobject obj, jlong state)
+{
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
+
+     if (l1state != NULL)
+     {
+          free(l1state->heap);
+          free(l1state->ustack);
+          free(l1state);
+     }
 }
 
 /*
  * Executes a compiled functor returning an indication of whether or not a unification was found.
  *
- * @param env     The native code execution environment.
- * @param obj     The object that is the context to this native method.
- * @param offset  The offset within the code buffer of the byte code to execute.
+ * @param env    The native code execution environment.
+ * @param obj    The object that is the context to this native method.
+ * @param state  A handle onto the machine state.
+ * @param offset The offset within the code buffer of the byte code to execute.
  *
  * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
  */
 JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_execute
-(JNIEnv * env, jobject object, jobject codeBuf, jint offset)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset)
 {
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
      jint addr;
      jbyte tag;
      jint a;
@@ -295,6 +172,8 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
      jint sp = l1state->sp;
      jboolean writeMode = l1state->writeMode;
      jint ip;
+     jbyte instruction;
+     jint xi;
 
      jboolean failed = JNI_FALSE;
 
@@ -304,20 +183,19 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
      jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
 
      ip = offset;
-     l1uClear();
+
+     DISPATCH_TABLE(DISPATCH_ENTRY(PUT_STRUC), DISPATCH_ENTRY(SET_VAR), DISPATCH_ENTRY(SET_VAL),
+                    DISPATCH_ENTRY(GET_STRUC), DISPATCH_ENTRY(UNIFY_VAR), DISPATCH_ENTRY(UNIFY_VAL),
+                    DISPATCH_ENTRY(PUT_VAR), DISPATCH_ENTRY(PUT_VAL), DISPATCH_ENTRY(GET_VAR),
+                    DISPATCH_ENTRY(GET_VAL), DISPATCH_ENTRY(CALL), DISPATCH_ENTRY(PROCEED));
 
      //printf("\nJNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_execute: called\n");
 
-     while (failed == JNI_FALSE && complete == JNI_FALSE && (ip < length))
+     // Each instruction is fetched along with its first operand.
+     INTERP_LOOP_BEGIN(failed == JNI_FALSE && complete == JNI_FALSE && (ip < length))
      {
-          // Grab next instruction and switch on it.
-          jbyte instruction = code[ip++];
-          jint xi = (jint)code[ip++];
-
-          switch (instruction)
-          {
                // put_struc xi:
-          case PUT_STRUC:
+          OP(PUT_STRUC)
           {
                // grab f/n
                jint f_n = *(jint*)(code + ip);
@@ -326,7 +204,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                //printf("0x%02x: PUT_STRUC X%i,%i (0x%02x, 0x%02x)\n", (ip - 6), xi, f_n, xi, f_n);
 
                // heap[h] <- STR, h + 1
-               l1state->heap[hp] = (STR << 24) | ((hp + 1) & 0xFFFFFF);
+               l1state->heap[hp] = CELL_MAKE(STR, hp + 1);
 
                // heap[h+1] <- f/n
                l1state->heap[hp + 1] = f_n;
@@ -337,16 +215,16 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // h <- h + 2
                hp += 2;
 
-               break;
+               NEXT;
           }
 
           // set_var xi:
-          case SET_VAR:
+          OP(SET_VAR)
           {
                //printf("0x%02x: SET_VAR X%i (0x%02x)\n", (ip - 2), xi, xi);
 
                // heap[h] <- REF, h
-               l1state->heap[hp] = (REF << 24) | (hp & 0xFFFFFF);
+               l1state->heap[hp] = CELL_MAKE(REF, hp);
 
                // xi <- heap[h]
                l1state->heap[xi] = l1state->heap[hp];
@@ -354,11 +232,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // h <- h + 1
                hp++;
 
-               break;
+               NEXT;
           }
 
           // set_val xi:
-          case SET_VAL:
+          OP(SET_VAL)
           {
                //printf("0x%02x: SET_VAL %i  (0x%02x)\n", (ip - 2), xi, xi);
 
@@ -368,11 +246,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // h <- h + 1
                hp++;
 
-               break;
+               NEXT;
           }
 
           // get_struc xi,
-          case GET_STRUC:
+          OP(GET_STRUC)
           {
                // grab f/n
                jint f_n = *(jint*)(code + ip);
@@ -381,12 +259,12 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                //printf("0x%02x: GET_STRUC X%i,%i (0x%02x, 0x%02x)\n", (ip - 6), xi, f_n, xi, f_n);
 
                // addr <- deref(xi);
-               addr = l1deref(xi);
+               addr = l1deref(l1state, xi);
 
                // switch STORE[addr]
                //int tmp = heap[addr];
-               //byte tag = (byte)((tmp & 0xFF000000) >> 24);
-               //int a = tmp & 0x00FFFFFF;
+               //byte tag = CELL_TAG(tmp);
+               //int a = CELL_VAL(tmp);
                tag = l1state->derefTag;
                a = l1state->derefVal;
 
@@ -400,13 +278,13 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                     //printf("tag = REF\n");
 
                     // heap[h] <- STR, h + 1
-                    l1state->heap[hp] = (STR << 24) | ((hp + 1) & 0xFFFFFF);
+                    l1state->heap[hp] = CELL_MAKE(STR, hp + 1);
 
                     // heap[h+1] <- f/n
                     l1state->heap[hp + 1] = f_n;
 
                     // bind(addr, h)
-                    l1state->heap[addr] = (REF << 24) | (hp & 0xFFFFFF);
+                    l1state->heap[addr] = CELL_MAKE(REF, hp);
 
                     // h <- h + 2
                     hp += 2;
@@ -445,11 +323,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                }
                }
 
-               break;
+               NEXT_UNLESS_FAILED;
           }
 
           // unify_var xi:
-          case UNIFY_VAR:
+          OP(UNIFY_VAR)
           {
                //printf("0x%02x: UNIFY_VAR X%i (0x%02x)\n", (ip - 2), xi, xi);
 
@@ -464,7 +342,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                {
                     // case write:
                     // heap[h] <- REF, h
-                    l1state->heap[hp] = (REF << 24) | (hp & 0xFFFFFF);
+                    l1state->heap[hp] = CELL_MAKE(REF, hp);
 
                     // xi <- heap[h]
                     l1state->heap[xi] = l1state->heap[hp];
@@ -476,11 +354,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // s <- s + 1
                sp++;
 
-               break;
+               NEXT;
           }
 
           // unify_val xi:
-          case UNIFY_VAL:
+          OP(UNIFY_VAL)
           {
                //printf("0x%02x: UNIFY_VAL X%i (0x%02x)\n", (ip - 2), xi, xi);
 
@@ -489,7 +367,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                {
                     // case read:
                     // unify (xi, s)
-                    failed = l1unify(xi, sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+                    failed = l1unify(l1state, xi, sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
                }
                else
                {
@@ -504,12 +382,12 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // s <- s + 1
                sp++;
 
-               break;
+               NEXT_UNLESS_FAILED;
           }
 
 
           // put_var Xn, Ai:
-          case PUT_VAR:
+          OP(PUT_VAR)
           {
                // grab Ai
                jbyte ai = (jint)code[ip++];
@@ -517,7 +395,7 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                //printf("0x%02x: PUT_VAR X%i, A%i (0x%02x, 0x%02x)\n", (ip - 3), xi, ai, xi, ai);
 
                // heap[h] <- REF, H
-               l1state->heap[hp] = (REF << 24) | (hp & 0xFFFFFF);
+               l1state->heap[hp] = CELL_MAKE(REF, hp);
 
                // Xn <- heap[h]
                l1state->heap[xi] = l1state->heap[hp];
@@ -528,11 +406,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // h <- h + 1
                hp++;
 
-               break;
+               NEXT;
           }
 
           // put_val Xn, Ai:
-          case PUT_VAL:
+          OP(PUT_VAL)
           {
                // grab Ai
                jbyte ai = (jint)code[ip++];
@@ -542,11 +420,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // Ai <- Xn
                l1state->heap[ai] = l1state->heap[xi];
 
-               break;
+               NEXT;
           }
 
           // get var Xn, Ai:
-          case GET_VAR:
+          OP(GET_VAR)
           {
                // grab Ai
                jbyte ai = (jint)code[ip++];
@@ -556,11 +434,11 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // Xn <- Ai
                l1state->heap[xi] = l1state->heap[ai];
 
-               break;
+               NEXT;
           }
 
           // get_val Xn, Ai:
-          case GET_VAL:
+          OP(GET_VAL)
           {
                // grab Ai
                jbyte ai = (jint)code[ip++];
@@ -568,13 +446,13 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                //printf("0x%02x: GET_VAL X%i, A%i (0x%02x, 0x%02x)\n", (ip - 3), xi, ai, xi, ai);
 
                // unify (Xn, Ai)
-               failed = l1unify(xi, ai) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               failed = l1unify(l1state, xi, ai) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
 
-               break;
+               NEXT_UNLESS_FAILED;
           }
 
           // call @(p/n)
-          case CALL:
+          OP(CALL)
           {
                // grab @(p/n) (ip is decremented here, because already took first byte of the address as xi).
                int p_n = *(jint*)(code + ip - 1);
@@ -584,27 +462,31 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
                // Ensure that the predicate to call is known and linked int, otherwise fail.
                if (p_n == -1)
                {
-                    failed = JNI_TRUE;
-
-                    break;
+                    FAIL;
                }
 
                // ip <- @(p/n)
                ip = p_n;
 
-               break;
+               JUMP;
           }
 
-          case PROCEED:
+          OP(PROCEED)
           {
                //printf("0x%02x: PROCEED\n", (ip - 2));
                // noop.
 
                complete = JNI_TRUE;
-               break;
+               HALT;
           }
+
+          // An unknown instruction was encountered. Something has gone wrong, so fail.
+          OP_UNKNOWN
+          {
+               FAIL;
           }
      }
+     INTERP_LOOP_END
 
      // Preserve the current state of the machine.
      l1state->hp = hp;
@@ -619,46 +501,60 @@ JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMa
  * reference chains to their conclusion. This method is also side effecting, in that the contents of the
  * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
  *
- * @param a The address to dereference.
+ * @param state A handle onto the machine state.
+ * @param a     The address to dereference.
  *
  * @return The address that the reference refers to.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_deref
-(JNIEnv * env, jobject obj, jint a)
+(JNIEnv * env, jobject obj, jlong state, jint a)
 {
-     return l1deref(a);
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
+
+     return l1deref(l1state, a);
 }
 
 /*
  * Gets the heap cell tag for the most recent dereference operation.
  *
+ * @param state A handle onto the machine state.
+ *
  * @return The heap cell tag for the most recent dereference operation.
  */
 JNIEXPORT jbyte JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_getDerefTag
-(JNIEnv * env, jobject obj)
+(JNIEnv * env, jobject obj, jlong state)
 {
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
+
      return l1state->derefTag;
 }
 
 /*
  * Gets the heap cell value for the most recent dereference operation.
  *
+ * @param state A handle onto the machine state.
+ *
  * @return The heap cell value for the most recent dereference operation.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_getDerefVal
-(JNIEnv * env, jobject obj)
+(JNIEnv * env, jobject obj, jlong state)
 {
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
+
      return l1state->derefVal;
 }
 
 /*
  * Gets the value of the heap cell at the specified location.
  *
- * @param addr The address to fetch from the heap.
+ * @param state A handle onto the machine state.
+ * @param addr  The address to fetch from the heap.
  * @return The heap cell at the specified location.
  */
 JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_l1_L1UnifyingNativeMachine_getHeap
-(JNIEnv * env, jobject obj, jint addr)
+(JNIEnv * env, jobject obj, jlong state, jint addr)
 {
-     return l1state->heap[addr];
+     l1MachineState *l1state = (l1MachineState *)(intptr_t)state;
+
+     return (jint)l1state->heap[addr];
 }
@@ -0,0 +1,284 @@
+/* Defines the instruction set, and the dereference and unification core, shared by the l0 to l3 machines and the l2 JIT. */
+#ifndef _MACHINECORE_H
+#define _MACHINECORE_H
+
+#include <jni.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "cell.h"
+#include "profile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Each level of the machine supports a prefix of the same instruction set, so the opcodes are defined here once. L0
+ * uses the structure building and matching instructions only, L1 adds the argument register instructions and calls,
+ * and L2 and L3 add environment frames.
+ *
+ * The core works directly on the cells of a machine, and on a unification stack (PDL) of addresses that grows down
+ * from a base. A machine may keep its PDL in its data area, or in a separate block of cells. When profiling is
+ * compiled in, the core counts dereference chain lengths, unifications and PDL depth into the active profile.
+ */
+
+/* Defines the machine instruction types. */
+#define PUT_STRUC 0x01
+#define SET_VAR 0x02
+#define SET_VAL 0x03
+#define GET_STRUC 0x04
+#define UNIFY_VAR 0x05
+#define UNIFY_VAL 0x06
+#define PUT_VAR 0x07
+#define PUT_VAL 0x08
+#define GET_VAR 0x09
+#define GET_VAL 0x0a
+#define CALL 0x0b
+#define PROCEED 0x0c
+#define ALLOCATE 0x0d
+#define DEALLOCATE 0x0e
+
+/* Defines the addressing modes. */
+#define REG_ADDR 0x01
+#define STACK_ADDR 0x02
+
+/* Defines the heap cell marker types. */
+#define REF 0x01
+#define STR 0x02
+
+/* Defines the number of cells that the unifier compares at once, in a 128 bit vector. */
+#define UNIFY_VECTOR_CELLS (16 / (int)sizeof(jcell))
+
+/* Defines the bits of a vector comparison mask that cover one cell. */
+#define UNIFY_CELL_MASK ((1 << sizeof(jcell)) - 1)
+
+/*
+ * Dereferences an address, following reference chains to their conclusion, and hands back the cell that the address
+ * refers to.
+ *
+ * @param data The cells of the machine.
+ * @param a    The address to dereference.
+ * @param cell Receives the heap cell at the dereferenced address.
+ *
+ * @return The address that the reference refers to.
+ */
+static inline jint coreDeref(const jcell *data, jint a, jcell *cell)
+{
+     jcell c = data[a];
+#ifdef NATIVE_PROFILE
+     jint links = 0;
+#endif
+
+     // while tag = REF and value != a
+     while (CELL_TAG(c) == REF)
+     {
+          jint next = CELL_VAL(c);
+
+          // Break on free var.
+          if (next == a)
+          {
+               break;
+          }
+
+          a = next;
+          c = data[a];
+#ifdef NATIVE_PROFILE
+          links++;
+#endif
+     }
+
+     PROFILE_DEREF(links);
+     *cell = c;
+
+     return a;
+}
+
+/*
+ * Pushes the pairs of arguments of two structures with the same functor that still need to be unified onto the
+ * unification stack. Arguments with identical cells refer to the same variable or the same structure, so they
+ * already unify and are skipped; with SSE2 the argument cells are compared a vector at a time to skip over runs
+ * of them. The last pair that differs is not pushed, but handed back for the caller to carry on unifying in place.
+ *
+ * @param data The cells of the machine.
+ * @param pdl  The cells of the unification stack.
+ * @param v1   The address of the functor cell of the first structure.
+ * @param v2   The address of the functor cell of the second structure.
+ * @param n    The arity of the structures.
+ * @param up   The unification stack pointer, updated with the pairs pushed.
+ *
+ * @return The index of the last argument that differs, or 0 if all of the arguments are identical.
+ */
+static inline jint coreUnifyArgs(const jcell *data, jcell *pdl, jint v1, jint v2, jint n, jint *up)
+{
+     jint i = 1;
+     jint last = 0;
+     jint sp = *up;
+
+#ifdef __SSE2__
+     for (; i + UNIFY_VECTOR_CELLS - 1 <= n; i += UNIFY_VECTOR_CELLS)
+     {
+          __m128i c1 = _mm_loadu_si128((const __m128i *)(data + v1 + i));
+          __m128i c2 = _mm_loadu_si128((const __m128i *)(data + v2 + i));
+          int same = _mm_movemask_epi8(_mm_cmpeq_epi32(c1, c2));
+          jint j;
+
+          if (same == 0xFFFF)
+          {
+               continue;
+          }
+
+          for (j = 0; j < UNIFY_VECTOR_CELLS; j++)
+          {
+               if (((same >> (j * (int)sizeof(jcell))) & UNIFY_CELL_MASK) != UNIFY_CELL_MASK)
+               {
+                    if (last != 0)
+                    {
+                         // pdl.push(v1 + last)
+                         // pdl.push(v2 + last)
+                         pdl[--sp] = v1 + last;
+                         pdl[--sp] = v2 + last;
+                    }
+
+                    last = i + j;
+               }
+          }
+     }
+#endif
+
+     for (; i <= n; i++)
+     {
+          if (data[v1 + i] != data[v2 + i])
+          {
+               if (last != 0)
+               {
+                    // pdl.push(v1 + last)
+                    // pdl.push(v2 + last)
+                    pdl[--sp] = v1 + last;
+                    pdl[--sp] = v2 + last;
+               }
+
+               last = i;
+          }
+     }
+
+     *up = sp;
+
+     return last;
+}
+
+/*
+ * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
+ * element by element, free references become bound.
+ *
+ * The unification stack pointer is kept in a local for the duration, and the last argument pair of each structure
+ * is unified in place rather than going through the stack, so unifying atoms and small structures mostly does not
+ * touch the stack at all. The stack is left empty again, whether the unification succeeds or fails.
+ *
+ * @param data The cells of the machine.
+ * @param pdl  The cells of the unification stack, which may be the same as the cells of the machine.
+ * @param base The empty position of the unification stack, which it grows down from.
+ * @param a1   The address of the first structure or reference.
+ * @param a2   The address of the second structure or reference.
+ *
+ * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
+ */
+static inline jboolean coreUnify(jcell *data, jcell *pdl, jint base, jint a1, jint a2)
+{
+     jint up = base;
+
+     PROFILE_COUNT(PROFILE_UNIFY);
+
+     // Identical addresses always unify.
+     if (a1 == a2)
+     {
+          return JNI_TRUE;
+     }
+
+     // pdl.push(a1)
+     // pdl.push(a2)
+     pdl[--up] = a1;
+     pdl[--up] = a2;
+     PROFILE_PEAK(PROFILE_PDL_PEAK, base - up);
+
+     // while !empty(PDL)
+     while (up < base)
+     {
+          // x1 <- pdl.pop()
+          // x2 <- pdl.pop()
+          jint x1 = (jint)pdl[up++];
+          jint x2 = (jint)pdl[up++];
+
+          for (;;)
+          {
+               jcell c1;
+               jcell c2;
+
+               // d1 <- deref(x1)
+               // d2 <- deref(x2)
+               // t1, v1 <- STORE[d1]
+               // t2, v2 <- STORE[d2]
+               jint d1 = coreDeref(data, x1, &c1);
+               jint d2 = coreDeref(data, x2, &c2);
+               jint v1 = CELL_VAL(c1);
+               jint v2 = CELL_VAL(c2);
+               jcell f_n1;
+               jint last;
+
+               // if (d1 = d2) the cells already unify.
+               if (d1 == d2)
+               {
+                    break;
+               }
+
+               // if (t1 = REF or t2 = REF)
+               // bind(d1, d2)
+               if (CELL_TAG(c1) == REF)
+               {
+                    data[d1] = CELL_MAKE(REF, d2);
+                    break;
+               }
+               else if (CELL_TAG(c2) == REF)
+               {
+                    data[d2] = CELL_MAKE(REF, d1);
+                    break;
+               }
+
+               // Two references to the same structure already unify.
+               if (v1 == v2)
+               {
+                    break;
+               }
+
+               // f1/n1 <- STORE[v1]
+               // f2/n2 <- STORE[v2]
+               // if f1 != f2 or n1 != n2, fail
+               f_n1 = data[v1];
+
+               if (f_n1 != data[v2])
+               {
+                    return JNI_FALSE;
+               }
+
+               // for i <- 1 to n1, push the pairs of arguments that differ, and carry on with the last of them.
+               last = coreUnifyArgs(data, pdl, v1, v2, (jint)(f_n1 & 0xFF), &up);
+               PROFILE_PEAK(PROFILE_PDL_PEAK, base - up);
+
+               if (last == 0)
+               {
+                    break;
+               }
+
+               x1 = v2 + last;
+               x2 = v1 + last;
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MACHINECORE_H */
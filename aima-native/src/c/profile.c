@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+#ifdef NATIVE_PROFILE
+
+/* Holds the profile counters of the machine executing on the current thread, if any. */
+__thread jlong *profileActive;
+
+/* Holds the opcode last executed on the current thread, modulo PROFILE_PAIR_OPCODES, for counting opcode pairs. */
+__thread int profilePrevious;
+
+#endif
+
+/*
+ * Creates a block of profile counters, all zeroed.
+ *
+ * @return The profile counters, or <tt>NULL</tt> if they could not be allocated.
+ */
+jlong *profileCreate(void)
+{
+     return calloc(PROFILE_SIZE, sizeof(jlong));
+}
+
+/*
+ * Releases a block of profile counters. Releasing <tt>NULL</tt> does nothing.
+ *
+ * @param counters The profile counters.
+ */
+void profileRelease(jlong *counters)
+{
+     free(counters);
+}
+
+/*
+ * Zeroes all of a block of profile counters.
+ *
+ * @param counters The profile counters.
+ */
+void profileClear(jlong *counters)
+{
+     memset(counters, 0, PROFILE_SIZE * sizeof(jlong));
+}
+
+/*
+ * Counts a call to a target in the table of calls by target. The table is probed linearly from the hash of the
+ * target, and once it is full, calls to targets not already in it are only counted in total.
+ *
+ * @param counters The profile counters.
+ * @param target   The entry point that was called.
+ */
+void profileCall(jlong *counters, jint target)
+{
+     jlong *table = counters + PROFILE_CALL_TABLE;
+     unsigned int slot = ((unsigned int)target * 0x9E3779B9u) >> (32 - PROFILE_CALL_BITS);
+     int probes;
+
+     for (probes = 0; probes < PROFILE_CALL_SLOTS; probes++)
+     {
+          jlong *entry = table + 2 * ((slot + probes) & (PROFILE_CALL_SLOTS - 1));
+
+          if (entry[0] == (jlong)target + 1)
+          {
+               entry[1]++;
+               return;
+          }
+
+          if (entry[0] == 0)
+          {
+               entry[0] = (jlong)target + 1;
+               entry[1] = 1;
+               return;
+          }
+     }
+
+     counters[PROFILE_CALLS_LOST]++;
+}
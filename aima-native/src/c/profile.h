@@ -0,0 +1,163 @@
+/* Defines the execution profile counters that the native machines keep, when built with NATIVE_PROFILE. */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Profiling is only compiled in when building with NATIVE_PROFILE defined; otherwise the profile macros expand to
+ * nothing, and cost nothing on the hot path. When compiled in, each machine holds a block of 64 bit counters, which
+ * it makes active on the executing thread for the duration of each query, in the same way as the data area is made
+ * active for overflow detection. The dereference and unification core counts into whichever block is active, so
+ * that it need not be passed the machine.
+ *
+ * The counters are laid out at fixed positions, so that they can be read from Java through a direct buffer:
+ *
+ * <pre>
+ * PROFILE_OPCODES      The number of executions of each opcode, indexed by opcode. The resolving machines count
+ *                      the stack forms of the instructions on registers separately, at opcode + STACK_FORM.
+ * PROFILE_UNIFY        The number of calls to the unifier.
+ * PROFILE_PDL_PEAK     The deepest that the unification stack has been, in cells.
+ * PROFILE_HP_PEAK      The most heap cells in use at once.
+ * PROFILE_ESP_PEAK     The most stack cells in use at once.
+ * PROFILE_CALLS_LOST   The number of calls not counted by target, because the call table was full.
+ * PROFILE_DEREF_CHAIN  The number of dereferences by the length of reference chain followed, the last bucket
+ *                      counting all of the longer chains.
+ * PROFILE_CALL_TABLE   The number of calls to each target, as an open addressed table of target + 1 and count
+ *                      pairs, where a zero target is an empty slot.
+ * PROFILE_PAIRS        The number of times each opcode was executed straight after each other, indexed by the
+ *                      earlier opcode times PROFILE_PAIR_OPCODES plus the later one, taking the opcodes modulo
+ *                      PROFILE_PAIR_OPCODES. This is the data that the sequences to fuse into superinstructions are
+ *                      chosen from.
+ * </pre>
+ */
+
+/* Defines the positions of the profile counters. */
+#define PROFILE_OPCODES 0
+#define PROFILE_UNIFY 256
+#define PROFILE_PDL_PEAK 257
+#define PROFILE_HP_PEAK 258
+#define PROFILE_ESP_PEAK 259
+#define PROFILE_CALLS_LOST 260
+#define PROFILE_DEREF_CHAIN 264
+#define PROFILE_CALL_TABLE 280
+
+/* Defines the number of buckets that dereferences are counted in by chain length. */
+#define PROFILE_DEREF_BUCKETS 16
+
+/* Defines the number of slots in the table of calls by target, as a power of two. */
+#define PROFILE_CALL_BITS 12
+#define PROFILE_CALL_SLOTS (1 << PROFILE_CALL_BITS)
+
+/* Defines the position of the counts of opcode pairs, after the table of calls by target. */
+#define PROFILE_PAIRS (PROFILE_CALL_TABLE + 2 * PROFILE_CALL_SLOTS)
+
+/* Defines the number of opcodes that pairs are counted over, as a power of two. */
+#define PROFILE_PAIR_BITS 6
+#define PROFILE_PAIR_OPCODES (1 << PROFILE_PAIR_BITS)
+
+/* Defines the number of counters in a profile. */
+#define PROFILE_SIZE (PROFILE_PAIRS + PROFILE_PAIR_OPCODES * PROFILE_PAIR_OPCODES)
+
+/*
+ * Creates a block of profile counters, all zeroed.
+ *
+ * @return The profile counters, or <tt>NULL</tt> if they could not be allocated.
+ */
+jlong *profileCreate(void);
+
+/*
+ * Releases a block of profile counters. Releasing <tt>NULL</tt> does nothing.
+ *
+ * @param counters The profile counters.
+ */
+void profileRelease(jlong *counters);
+
+/*
+ * Zeroes all of a block of profile counters.
+ *
+ * @param counters The profile counters.
+ */
+void profileClear(jlong *counters);
+
+/*
+ * Counts a call to a target in the table of calls by target.
+ *
+ * @param counters The profile counters.
+ * @param target   The entry point that was called.
+ */
+void profileCall(jlong *counters, jint target);
+
+#ifdef NATIVE_PROFILE
+
+/* Holds the profile counters of the machine executing on the current thread, if any. */
+extern __thread jlong *profileActive;
+
+/* Holds the opcode last executed on the current thread, modulo PROFILE_PAIR_OPCODES, for counting opcode pairs. */
+extern __thread int profilePrevious;
+
+/* Used to check if profiling is compiled in. */
+#define PROFILE_ENABLED 1
+
+/* Starts counting into a block of profile counters, on the current thread. */
+#define PROFILE_BEGIN(counters) (profileActive = (counters), profilePrevious = 0)
+
+/* Stops counting on the current thread. */
+#define PROFILE_END() (profileActive = NULL)
+
+/* Counts one occurrence of a counter. */
+#define PROFILE_COUNT(i) do { if (profileActive != NULL) profileActive[i]++; } while (0)
+
+/* Raises a peak counter to a value, if it is higher. */
+#define PROFILE_PEAK(i, v) \
+     do { if ((profileActive != NULL) && ((jlong)(v) > profileActive[i])) profileActive[i] = (jlong)(v); } while (0)
+
+/* Counts one execution of an opcode, and of the pair that it makes with the opcode executed before it. */
+#define PROFILE_OPCODE(op) \
+     do \
+     { \
+          if (profileActive != NULL) \
+          { \
+               int next = (unsigned char)(op) & (PROFILE_PAIR_OPCODES - 1); \
+               profileActive[PROFILE_OPCODES + (unsigned char)(op)]++; \
+               profileActive[PROFILE_PAIRS + (profilePrevious << PROFILE_PAIR_BITS) + next]++; \
+               profilePrevious = next; \
+          } \
+     } while (0)
+
+/* Counts one dereference by the length of the reference chain that it followed. */
+#define PROFILE_DEREF(links) \
+     PROFILE_COUNT(PROFILE_DEREF_CHAIN + (((links) < PROFILE_DEREF_BUCKETS) ? (links) : (PROFILE_DEREF_BUCKETS - 1)))
+
+/* Counts one call to a target. */
+#define PROFILE_CALL(target) do { if (profileActive != NULL) profileCall(profileActive, (target)); } while (0)
+
+#else
+
+#define PROFILE_ENABLED 0
+
+#define PROFILE_BEGIN(counters)
+
+#define PROFILE_END()
+
+#define PROFILE_COUNT(i)
+
+#define PROFILE_PEAK(i, v)
+
+#define PROFILE_OPCODE(op)
+
+#define PROFILE_DEREF(links)
+
+#define PROFILE_CALL(target)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _PROFILE_H */
@@ -0,0 +1,85 @@
+/* Defines a plain C API onto the L2 and L3 resolving machines, for running them without a JVM. */
+#ifndef _RESOLVINGAPI_H
+#define _RESOLVINGAPI_H
+
+#include <jni.h>
+#include "cell.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * This is the interface that the native methods of L2ResolvingNativeMachine and L3ResolvingNativeMachine are built
+ * on, so a machine driven through it behaves exactly as it does from Java. It only uses the JNI scalar types, so the
+ * native library and the runner need the JNI headers to build, but nothing calls into a JVM.
+ *
+ * A machine is created, then reset to reserve its data area, before any code is added to it. The byte code is held
+ * by the caller, in the format that the Java compilers produce, and is passed in again on each execution; it must
+ * stay in place for as long as the machine runs it, and any code added to it is announced through CodeAdded. The
+ * results of a query are read out by dereferencing its variables from the stack frame it leaves behind, and encoding
+ * the terms they are bound to, in the format of the batch results.
+ *
+ * When profiling is compiled in, each machine counts its executions into a block of counters laid out as in
+ * profile.h, which GetProfile hands back; otherwise GetProfile returns NULL.
+ *
+ * ExecuteBudget runs a query for at most a number of calls, suspending it if it has not completed by then, or if it is
+ * interrupted from another thread through Interrupt. Resume carries on with a suspended query, so that a scheduler can
+ * time slice many machines across a few threads.
+ *
+ * With rollback turned on through SetRollback, each query starts from the heap and stacks that the machine had when
+ * rollback was turned on, so that a long lived machine does not fill up with what earlier queries left behind.
+ *
+ * Each level has its own set of functions, prefixed with l2 or l3. A machine of one level must only be passed to the
+ * functions of that level.
+ */
+
+/* Holds the state of a resolving machine. */
+typedef struct rmMachineState rmMachineState;
+
+/* Defines the outcomes of a budgeted execution. */
+#define RM_FAILED 0
+#define RM_SUCCEEDED 1
+#define RM_SUSPENDED 2
+
+rmMachineState *l2Create(void);
+jboolean l2Reset(rmMachineState *rmstate, jint regSize, jint heapSize, jint stackSize, jint pdlSize);
+void l2Release(rmMachineState *rmstate);
+void l2CodeAdded(rmMachineState *rmstate, jbyte *code, jint offset, jint length);
+jboolean l2Execute(rmMachineState *rmstate, jbyte *code, jint length, jint offset);
+jint l2ExecuteBudget(rmMachineState *rmstate, jbyte *code, jint length, jint offset, jlong budget);
+jint l2Resume(rmMachineState *rmstate, jlong budget);
+void l2Interrupt(rmMachineState *rmstate);
+void l2SetRollback(rmMachineState *rmstate, jboolean enabled);
+jint l2ExecuteBatch(rmMachineState *rmstate, jbyte *code, jint length, const jint *queries, jint queryCount,
+                    jint *out, jint limit);
+jint l2DerefStack(rmMachineState *rmstate, jint a);
+jint l2EncodeTerm(rmMachineState *rmstate, jint addr, jint *out, jint limit);
+jcell *l2GetDataArea(rmMachineState *rmstate, jint *top);
+jint l2GetHeapPeak(rmMachineState *rmstate);
+jlong *l2GetProfile(rmMachineState *rmstate);
+void l2ClearProfile(rmMachineState *rmstate);
+
+rmMachineState *l3Create(void);
+jboolean l3Reset(rmMachineState *rmstate, jint regSize, jint heapSize, jint stackSize, jint pdlSize);
+void l3Release(rmMachineState *rmstate);
+void l3CodeAdded(rmMachineState *rmstate, jbyte *code, jint offset, jint length);
+jboolean l3Execute(rmMachineState *rmstate, jbyte *code, jint length, jint offset);
+jint l3ExecuteBudget(rmMachineState *rmstate, jbyte *code, jint length, jint offset, jlong budget);
+jint l3Resume(rmMachineState *rmstate, jlong budget);
+void l3Interrupt(rmMachineState *rmstate);
+void l3SetRollback(rmMachineState *rmstate, jboolean enabled);
+jint l3ExecuteBatch(rmMachineState *rmstate, jbyte *code, jint length, const jint *queries, jint queryCount,
+                    jint *out, jint limit);
+jint l3DerefStack(rmMachineState *rmstate, jint a);
+jint l3EncodeTerm(rmMachineState *rmstate, jint addr, jint *out, jint limit);
+jcell *l3GetDataArea(rmMachineState *rmstate, jint *top);
+jint l3GetHeapPeak(rmMachineState *rmstate);
+jlong *l3GetProfile(rmMachineState *rmstate);
+void l3ClearProfile(rmMachineState *rmstate);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RESOLVINGAPI_H */
@@ -0,0 +1,2721 @@
+/*
+ * Implements the resolving machine that L2 and L3 run on natively. This is included once by each of l2machine.c and
+ * l3machine.c, which define RM_JNI to name the native methods of their Java machine and RM_LEVEL to name the level
+ * in trace output, so that every level shares one interpreter, garbage collector and native interface. Dereferencing
+ * and unification come from the core shared with the other machines, in machinecore.h.
+ *
+ * The machine is driven through a plain C API, declared in resolvingapi.h, whose functions are named by RM_API with
+ * the level as a prefix. The native methods of the Java machine are a thin layer over it, that only unwraps direct
+ * buffers and raises exceptions, so the machines may also be embedded without a JVM.
+ *
+ * The interpreter does not run on the byte code as it is laid out in the code buffer. As code is added, it is
+ * decoded into fixed width instructions that hold the address of their handler, with their addressing modes and call
+ * targets already worked out, and it is these that are run. Each instruction on a structure is fused with the
+ * instructions on its arguments into a superinstruction, unless built with NO_SUPERINSTRUCTIONS. The byte code seen
+ * from Java is left as it is.
+ *
+ * When built with NATIVE_PROFILE, each machine keeps a profile of its executions, as described in profile.h. The
+ * profile accumulates over all queries and resets, until it is cleared.
+ */
+#ifndef _RESOLVINGMACHINE_H
+#define _RESOLVINGMACHINE_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "trace.h"
+
+/* The interpreter runs on decoded instructions, rather than on the byte code directly. */
+#define DECODED_DISPATCH
+#include "dispatch.h"
+#include "dataarea.h"
+#include "cell.h"
+#include "machinecore.h"
+#include "profile.h"
+#include "resolvingapi.h"
+
+/* Defines the regions of the data area, in the order in which they are laid out. */
+#define REG_REGION 0
+#define HEAP_REGION 1
+#define STACK_REGION 2
+#define PDL_REGION 3
+#define REGION_COUNT 4
+
+/* Defines the limit of the data area, as far as heap cells can address. */
+#define ADDR_LIMIT CELL_ADDR_LIMIT
+
+/* Defines the offset of the first register in the data area. */
+#define REG_BASE (rmstate->area.base[REG_REGION])
+
+/* Defines the offset of the base of the heap in the data area. */
+#define HEAP_BASE (rmstate->area.base[HEAP_REGION])
+
+/* Defines the offset of the base of the stack in the data area. */
+#define STACK_BASE (rmstate->area.base[STACK_REGION])
+
+/* Defines the offset of the base of the PDL in the data area. */
+#define PDL_BASE (rmstate->area.base[PDL_REGION])
+
+/* Defines the highest address in the data area of the virtual machine. */
+#define TOP (rmstate->area.top)
+
+/* Defines the end of the heap in the data area. */
+#define HEAP_END (rmstate->area.base[HEAP_REGION] + rmstate->area.size[HEAP_REGION])
+
+/* Defines the percentage of the free heap that may be used up before the heap is next collected. */
+#define GC_TRIGGER_PERCENT 75
+
+/* Defines the number of heap cells covered by each word of the garbage collectors bitmaps. */
+#define GC_BLOCK_BITS 64
+
+/* Defines how to count the set bits in a word of the garbage collectors bitmaps. */
+#ifdef __GNUC__
+#define GC_POPCOUNT(bits) __builtin_popcountll(bits)
+#else
+#define GC_POPCOUNT(bits) rmgcPopcount(bits)
+#endif
+
+/* Defines the flag that the decoder adds to the opcode of an instruction on a register, for its stack form. */
+#define STACK_FORM 0x10
+
+/* Defines the opcodes of the stack forms of the instructions on registers, in the decoded instructions. */
+#define PUT_STRUC_Y (PUT_STRUC | STACK_FORM)
+#define SET_VAR_Y (SET_VAR | STACK_FORM)
+#define SET_VAL_Y (SET_VAL | STACK_FORM)
+#define GET_STRUC_Y (GET_STRUC | STACK_FORM)
+#define UNIFY_VAR_Y (UNIFY_VAR | STACK_FORM)
+#define UNIFY_VAL_Y (UNIFY_VAL | STACK_FORM)
+#define PUT_VAR_Y (PUT_VAR | STACK_FORM)
+#define PUT_VAL_Y (PUT_VAL | STACK_FORM)
+#define GET_VAR_Y (GET_VAR | STACK_FORM)
+#define GET_VAL_Y (GET_VAL | STACK_FORM)
+
+/* Defines the flag that the decoder adds to the opcode of an instruction, for a superinstruction that runs it
+ * together with the instructions on its arguments that follow it. */
+#define SUPER_FORM 0x20
+
+/* Defines the opcodes of the superinstructions, in the decoded instructions. */
+#define PUT_STRUC_ARGS (PUT_STRUC | SUPER_FORM)
+#define PUT_STRUC_ARGS_Y (PUT_STRUC_Y | SUPER_FORM)
+#define GET_STRUC_ARGS (GET_STRUC | SUPER_FORM)
+#define GET_STRUC_ARGS_Y (GET_STRUC_Y | SUPER_FORM)
+
+/* Defines the number of decoded opcodes. */
+#define DECODED_OPCODES (2 * SUPER_FORM)
+
+/* Defines the flags marking the kind of an argument instruction run by a superinstruction, held in its arg. */
+#define ARG_VAL 0x01
+#define ARG_STACK 0x02
+
+/*
+ * Holds one decoded instruction. The interpreter does not run on the byte code directly, but on a decoded form of
+ * it that is worked out as code is added. Every decoded instruction is the same size, so that they can be indexed,
+ * and they are aligned so that no operand is read unaligned.
+ */
+typedef struct
+{
+     /* Holds the handler for the instruction, as given by DISPATCH_HANDLER for its decoded opcode. */
+     const void *handler;
+
+     /* Holds the register or stack variable operand, before the frame base is added for a stack variable. */
+     jint xi;
+
+     /* Holds the f/n, argument register, frame size, or decoded call target operand, or the ARG flags of an
+      * argument instruction run by a superinstruction. */
+     jint arg;
+} rmInstr;
+
+/* Holds the state of a resolving machine. Its type is declared in resolvingapi.h, so that it is opaque to the C API. */
+struct rmMachineState
+{
+     /* Holds the current instruction pointer into the decoded code. */
+     jint ip;
+
+     /* Holds the current continuation point, into the decoded code. */
+     jint cp;
+
+     /* Holds the byte code that the decoded instructions were decoded from. */
+     jbyte *decodedCode;
+
+     /* Holds the length of the byte code that has been decoded. */
+     jint decodedLength;
+
+     /* Holds the decoded instructions. */
+     rmInstr *instr;
+
+     /* Holds the number of decoded instructions. */
+     jint instrCount;
+
+     /* Holds the number of decoded instructions that there is space for. */
+     jint instrCapacity;
+
+     /* Holds the byte code offset of each decoded instruction. */
+     jint *instrAt;
+
+     /* Holds the index of the decoded instruction at each byte code offset, or -1 where none starts. */
+     jint *indexOf;
+
+     /* Holds the number of byte code offsets that there is space for in the index. */
+     jint indexCapacity;
+
+     /* Holds the enire data segment of the machine. All registers, heaps and stacks are held in here. */
+     jcell *data;
+
+     /* Holds the layout and memory reservation of the data segment. */
+     dataArea area;
+
+     /* Holds the heap pointer. */
+     jint hp;
+
+     /* Holds the secondary heap pointer, used for the heap address of the next term to match. */
+     jint sp;
+
+     /* Holds the unification stack pointer. */
+     jint up;
+
+     /** Holds the environment base pointer. */
+     jint ep;
+
+     /** Holds the environment, top-of-stack pointer. */
+     jint esp;
+
+     /* Used to record whether the machine is in structure read or write mode. */
+     jboolean writeMode;
+
+     /* Holds the heap cell tag from the most recent dereference. */
+     jbyte derefTag;
+
+     /* Holds the heap call value from the most recent dereference. */
+     jint derefVal;
+
+     /* Holds the heap pointer value, at or above which the heap is garbage collected on the next call. */
+     jint gcTrigger;
+
+     /* Holds the highest heap pointer value reached before a garbage collection, since the last reset. */
+     jint hpPeak;
+
+     /* Flags when an execution has overflowed the data area since the last reset, leaving it written to anywhere. */
+     jboolean overflowed;
+
+     /* Holds the number of calls that the current execution may make before it is suspended, or -1 for no limit. */
+     jlong budget;
+
+     /* Flags a request, made from any thread, for the current execution to suspend itself at its next call. */
+     volatile jboolean interrupted;
+
+     /* Flags that the last execution was suspended before it completed, so that it can be resumed. */
+     jboolean suspended;
+
+     /* Flags that each top-level query is started from the watermark, so that it leaves nothing behind. */
+     jboolean rollback;
+
+     /* Holds the watermark, as the heap, stack and unification stack pointers that top-level queries start from. */
+     jint markHp;
+     jint markSp;
+     jint markUp;
+     jint markEp;
+     jint markEsp;
+
+     /* Holds the profile counters, when profiling is compiled in. */
+     jlong *profile;
+};
+
+/* Holds the working state of a garbage collection. */
+typedef struct
+{
+     /* Holds the live cell bitmap, one bit per heap cell. */
+     unsigned long long *marked;
+
+     /* Holds the functor cell bitmap, one bit per heap cell. */
+     unsigned long long *functor;
+
+     /* Holds the number of live cells before each block of the bitmap. */
+     jint *before;
+
+     /* Holds the stack of heap addresses still to be marked. */
+     jint *stack;
+
+     /* Holds the number of addresses on the mark stack. */
+     jint depth;
+
+     /* Holds the capacity of the mark stack. */
+     jint capacity;
+
+     /* Holds the top of the heap being collected. */
+     jint hp;
+} rmGCState;
+
+/*
+ * Clears the unification stack.
+ *
+ * @param rmstate The machine state.
+ */
+static void rmuClear(rmMachineState *rmstate)
+{
+     rmstate->up = TOP;
+}
+
+/*
+ * Dereferences a heap pointer (or register), returning the address that it refers to after following all
+ * reference chains to their conclusion. This method is also side effecting, in that the contents of the
+ * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
+ *
+ * @param rmstate The machine state.
+ * @param a       The address to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+static jint rmderef(rmMachineState *rmstate, jint a)
+{
+     jcell cell;
+     jint addr = coreDeref(rmstate->data, a, &cell);
+
+     rmstate->derefTag = CELL_TAG(cell);
+     rmstate->derefVal = CELL_VAL(cell);
+
+     return addr;
+}
+
+/*
+ * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
+ * element by element, free references become bound. The unification stack is held at the top of the data area.
+ *
+ * @param rmstate The machine state.
+ * @param a1      The address of the first structure or reference.
+ * @param a2      The address of the second structure or reference.
+ *
+ * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
+ */
+static jboolean rmunify(rmMachineState *rmstate, jint a1, jint a2)
+{
+     return coreUnify(rmstate->data, rmstate->data, rmstate->up, a1, a2);
+}
+
+#ifndef __GNUC__
+/*
+ * Counts the set bits in a word, for compilers without a built in to do so.
+ *
+ * @param bits The word to count the bits of.
+ *
+ * @return The number of set bits.
+ */
+static int rmgcPopcount(unsigned long long bits)
+{
+     int count = 0;
+
+     for (; bits != 0; bits &= bits - 1)
+     {
+          count++;
+     }
+
+     return count;
+}
+#endif
+
+/*
+ * Pushes a heap address onto the garbage collectors mark stack, growing the stack as needed.
+ *
+ * @param gc   The collection state.
+ * @param addr The heap address to be marked.
+ *
+ * @return <tt>true</tt> if the address was pushed, <tt>false</tt> if the stack could not be grown, in which case it
+ *         is left as it was.
+ */
+static jboolean rmgcPush(rmGCState *gc, jint addr)
+{
+     if (gc->depth == gc->capacity)
+     {
+          jint *stack = realloc(gc->stack, gc->capacity * 2 * sizeof(jint));
+
+          if (stack == NULL)
+          {
+               return JNI_FALSE;
+          }
+
+          gc->stack = stack;
+          gc->capacity = gc->capacity * 2;
+     }
+
+     gc->stack[(gc->depth)++] = addr;
+
+     return JNI_TRUE;
+}
+
+/*
+ * Checks if a heap cell value is a reference into the part of the heap being collected.
+ *
+ * @param rmstate The machine state.
+ * @param gc      The collection state.
+ * @param cell    The heap cell value.
+ *
+ * @return <tt>true</tt> if the cell is a REF or STR into the heap, <tt>false</tt> otherwise.
+ */
+static jboolean rmgcIsHeapPointer(rmMachineState *rmstate, rmGCState *gc, jcell cell)
+{
+     jint tag = CELL_TAG(cell);
+     jint addr = CELL_VAL(cell);
+
+     return ((tag == REF) || (tag == STR)) && (addr >= HEAP_BASE) && (addr < gc->hp) ? JNI_TRUE : JNI_FALSE;
+}
+
+/*
+ * Marks everything on the heap that is reachable from a cell value. A REF marks the cell it refers to. A STR marks
+ * the functor cell it points to, and all of the arguments that follow it. Functor cells are recorded separately, as
+ * their contents are not cell references, and must not be rewritten when the heap is compacted.
+ *
+ * @param rmstate The machine state.
+ * @param gc      The collection state.
+ * @param cell    The cell value to mark from.
+ *
+ * @return <tt>true</tt> if everything reachable was marked, <tt>false</tt> if the mark stack ran out of memory.
+ */
+static jboolean rmgcMark(rmMachineState *rmstate, rmGCState *gc, jcell cell)
+{
+     jint a;
+     jint bit;
+
+     while (JNI_TRUE)
+     {
+          if (rmgcIsHeapPointer(rmstate, gc, cell) == JNI_TRUE)
+          {
+               a = CELL_VAL(cell) - HEAP_BASE;
+
+               if (CELL_TAG(cell) == REF)
+               {
+                    // Mark the referenced cell, and follow it later.
+                    if (rmgcPush(gc, a + HEAP_BASE) == JNI_FALSE)
+                    {
+                         return JNI_FALSE;
+                    }
+               }
+               else if ((gc->marked[a / GC_BLOCK_BITS] & (1ULL << (a % GC_BLOCK_BITS))) == 0)
+               {
+                    // Mark the functor, and queue its arguments, so that the first is followed next. This keeps the
+                    // mark stack shallow on lists and other right recursive structures.
+                    jint n = rmstate->data[a + HEAP_BASE] & 0xFF;
+                    jint i;
+
+                    gc->marked[a / GC_BLOCK_BITS] |= 1ULL << (a % GC_BLOCK_BITS);
+                    gc->functor[a / GC_BLOCK_BITS] |= 1ULL << (a % GC_BLOCK_BITS);
+
+                    for (i = n; i >= 1; i--)
+                    {
+                         if (rmgcPush(gc, a + HEAP_BASE + i) == JNI_FALSE)
+                         {
+                              return JNI_FALSE;
+                         }
+                    }
+               }
+          }
+
+          // Take the next cell to mark, skipping any that are already marked or outside of the heap.
+          do
+          {
+               if (gc->depth == 0)
+               {
+                    return JNI_TRUE;
+               }
+
+               a = gc->stack[--(gc->depth)];
+          }
+          while ((a < HEAP_BASE) || (a >= gc->hp) ||
+                 (gc->marked[(a - HEAP_BASE) / GC_BLOCK_BITS] & (1ULL << ((a - HEAP_BASE) % GC_BLOCK_BITS))));
+
+          bit = a - HEAP_BASE;
+          gc->marked[bit / GC_BLOCK_BITS] |= 1ULL << (bit % GC_BLOCK_BITS);
+          cell = rmstate->data[a];
+     }
+}
+
+/*
+ * Computes the address that a live heap cell moves to, when the heap is compacted. Live cells keep their order and
+ * slide down to the base of the heap, so this is the base of the heap plus the number of live cells below it.
+ *
+ * @param rmstate The machine state.
+ * @param gc      The collection state.
+ * @param addr    The heap address of a live cell.
+ *
+ * @return The address of the cell after compaction.
+ */
+static jint rmgcForward(rmMachineState *rmstate, rmGCState *gc, jint addr)
+{
+     jint a = addr - HEAP_BASE;
+     unsigned long long below = gc->marked[a / GC_BLOCK_BITS] & ((1ULL << (a % GC_BLOCK_BITS)) - 1);
+
+     return HEAP_BASE + gc->before[a / GC_BLOCK_BITS] + GC_POPCOUNT(below);
+}
+
+/*
+ * Rewrites a cell value that refers into the heap, to refer to where its target moves to on compaction.
+ *
+ * @param rmstate The machine state.
+ * @param gc      The collection state.
+ * @param cell    The cell value.
+ *
+ * @return The rewritten cell value.
+ */
+static jcell rmgcForwardCell(rmMachineState *rmstate, rmGCState *gc, jcell cell)
+{
+     if (rmgcIsHeapPointer(rmstate, gc, cell) == JNI_TRUE)
+     {
+          return CELL_MAKE(CELL_TAG(cell), rmgcForward(rmstate, gc, CELL_VAL(cell)));
+     }
+
+     return cell;
+}
+
+/*
+ * Frees the working memory of a garbage collection, any part of which may not have been allocated.
+ *
+ * @param gc The collection state.
+ */
+static void rmgcFree(rmGCState *gc)
+{
+     free(gc->marked);
+     free(gc->functor);
+     free(gc->before);
+     free(gc->stack);
+}
+
+/*
+ * Marks everything on the heap that is reachable from the roots. The roots are the registers, and the permanent
+ * variables of the environment frames chained from the current environment.
+ *
+ * @param rmstate The machine state.
+ * @param gc      The collection state.
+ * @param ep      The environment base pointer.
+ * @param esp     The environment, top-of-stack pointer.
+ *
+ * @return <tt>true</tt> if everything reachable was marked, <tt>false</tt> if the mark stack ran out of memory.
+ */
+static jboolean rmgcMarkRoots(rmMachineState *rmstate, rmGCState *gc, jint ep, jint esp)
+{
+     jcell *data = rmstate->data;
+     jint frame;
+     jint i;
+
+     // Mark from the registers.
+     for (i = REG_BASE; i < REG_BASE + rmstate->area.size[REG_REGION]; i++)
+     {
+          if (rmgcMark(rmstate, gc, data[i]) == JNI_FALSE)
+          {
+               return JNI_FALSE;
+          }
+     }
+
+     // Mark from the permanent variables of every environment frame. There are no frames unless the stack is in use.
+     if (esp > STACK_BASE)
+     {
+          for (frame = ep; JNI_TRUE; frame = data[frame])
+          {
+               for (i = frame + 3; i < frame + 3 + data[frame + 2]; i++)
+               {
+                    if (rmgcMark(rmstate, gc, data[i]) == JNI_FALSE)
+                    {
+                         return JNI_FALSE;
+                    }
+               }
+
+               if (frame == STACK_BASE)
+               {
+                    break;
+               }
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Garbage collects the heap, using a sliding mark-compact collector. The roots are the registers, and the permanent
+ * variables of the environment frames chained from the current environment. Live cells are marked into a bitmap,
+ * then slid down to the base of the heap in order, with every REF and STR cell, in the roots or on the heap, being
+ * rewritten in place to the new address of its target. This can only be done between instructions, when no
+ * unification is in progress. Nothing is moved until marking is complete, so if the working memory of the collection
+ * cannot be allocated, the collection is skipped, and the heap is left as it was to be collected on a later call.
+ *
+ * @param rmstate The machine state.
+ * @param hp      The heap pointer.
+ * @param ep      The environment base pointer.
+ * @param esp     The environment, top-of-stack pointer.
+ *
+ * @return The heap pointer after collection.
+ */
+static jint rmcollectGarbage(rmMachineState *rmstate, jint hp, jint ep, jint esp)
+{
+     rmGCState gc;
+     jint blocks = (hp - HEAP_BASE + GC_BLOCK_BITS - 1) / GC_BLOCK_BITS;
+     jcell *data = rmstate->data;
+     jint frame;
+     jint live;
+     jint a;
+     jint i;
+
+     traceConst("GC", 0, hp - HEAP_BASE);
+
+     // Record the extent of the heap before it is collected, as the peak heap use.
+     if (hp > rmstate->hpPeak)
+     {
+          rmstate->hpPeak = hp;
+     }
+
+     gc.marked = calloc(blocks + 1, sizeof(unsigned long long));
+     gc.functor = calloc(blocks + 1, sizeof(unsigned long long));
+     gc.before = malloc((blocks + 1) * sizeof(jint));
+     gc.capacity = 1024;
+     gc.stack = malloc(gc.capacity * sizeof(jint));
+     gc.depth = 0;
+     gc.hp = hp;
+
+     if ((gc.marked == NULL) || (gc.functor == NULL) || (gc.before == NULL) || (gc.stack == NULL) ||
+         (rmgcMarkRoots(rmstate, &gc, ep, esp) == JNI_FALSE))
+     {
+          traceIt("GC out of memory (Skipped)");
+          rmgcFree(&gc);
+
+          return hp;
+     }
+
+     // Count the live cells before each block of the bitmap.
+     live = 0;
+
+     for (i = 0; i < blocks; i++)
+     {
+          gc.before[i] = live;
+          live += GC_POPCOUNT(gc.marked[i]);
+     }
+
+     // Rewrite the roots.
+     for (i = REG_BASE; i < REG_BASE + rmstate->area.size[REG_REGION]; i++)
+     {
+          data[i] = rmgcForwardCell(rmstate, &gc, data[i]);
+     }
+
+     if (esp > STACK_BASE)
+     {
+          for (frame = ep; JNI_TRUE; frame = data[frame])
+          {
+               for (i = frame + 3; i < frame + 3 + data[frame + 2]; i++)
+               {
+                    data[i] = rmgcForwardCell(rmstate, &gc, data[i]);
+               }
+
+               if (frame == STACK_BASE)
+               {
+                    break;
+               }
+          }
+     }
+
+     // Slide the live cells down, rewriting their references. Cells only move down, so a cell is always read before
+     // anything is written over it.
+     for (a = 0; a < hp - HEAP_BASE; a++)
+     {
+          unsigned long long bit = 1ULL << (a % GC_BLOCK_BITS);
+
+          if (gc.marked[a / GC_BLOCK_BITS] & bit)
+          {
+               jcell cell = data[a + HEAP_BASE];
+
+               if ((gc.functor[a / GC_BLOCK_BITS] & bit) == 0)
+               {
+                    cell = rmgcForwardCell(rmstate, &gc, cell);
+               }
+
+               data[rmgcForward(rmstate, &gc, a + HEAP_BASE)] = cell;
+          }
+     }
+
+     rmgcFree(&gc);
+
+     // Leave the next collection until a proportion of the remaining free heap has been used.
+     hp = HEAP_BASE + live;
+     rmstate->gcTrigger = hp + (jint)(((jlong)(HEAP_END - hp) * GC_TRIGGER_PERCENT) / 100);
+
+     traceConst("GC live", 0, live);
+
+     return hp;
+}
+
+/*
+ * Forgets all of the decoded instructions of a machine, keeping the space allocated for them.
+ *
+ * @param rmstate The machine state.
+ */
+static void rmdecodeDiscard(rmMachineState *rmstate)
+{
+     rmstate->decodedCode = NULL;
+     rmstate->decodedLength = 0;
+     rmstate->instrCount = 0;
+}
+
+/*
+ * Clears the registers of a machine. This is done whenever the heap is cut back, so that no register is left referring
+ * to heap cells that are to be written over, which the garbage collector would otherwise take to be live.
+ *
+ * @param rmstate The machine state.
+ */
+static void rmclearRegisters(rmMachineState *rmstate)
+{
+     memset(rmstate->data + REG_BASE, 0, rmstate->area.size[REG_REGION] * sizeof(jcell));
+}
+
+/*
+ * Records the present heap and stack pointers of a machine as its watermark.
+ *
+ * @param rmstate The machine state.
+ */
+static void rmmark(rmMachineState *rmstate)
+{
+     rmstate->markHp = rmstate->hp;
+     rmstate->markSp = rmstate->sp;
+     rmstate->markUp = rmstate->up;
+     rmstate->markEp = rmstate->ep;
+     rmstate->markEsp = rmstate->esp;
+}
+
+/*
+ * Puts the heap and stack pointers of a machine back to its watermark, dropping everything that the queries run since
+ * it was recorded left behind, but remembering how far the heap went. The registers are cleared too, as they may refer
+ * to the part of the heap that is dropped.
+ *
+ * @param rmstate The machine state.
+ */
+static void rmrollback(rmMachineState *rmstate)
+{
+     if (rmstate->hp > rmstate->hpPeak)
+     {
+          rmstate->hpPeak = rmstate->hp;
+     }
+
+     rmclearRegisters(rmstate);
+     rmstate->hp = rmstate->markHp;
+     rmstate->sp = rmstate->markSp;
+     rmstate->up = rmstate->markUp;
+     rmstate->ep = rmstate->markEp;
+     rmstate->esp = rmstate->markEsp;
+     rmstate->writeMode = JNI_FALSE;
+}
+
+/*
+ * Creates the state of a machine. The machine must be reset before it is used.
+ *
+ * @return The machine state, or <tt>NULL</tt> if it could not be allocated.
+ */
+rmMachineState *RM_API(Create)(void)
+{
+     rmMachineState *rmstate = calloc(1, sizeof(rmMachineState));
+
+#ifdef NATIVE_PROFILE
+     if ((rmstate != NULL) && ((rmstate->profile = profileCreate()) == NULL))
+     {
+          free(rmstate);
+          rmstate = NULL;
+     }
+#endif
+
+     return rmstate;
+}
+
+/*
+ * Resets the machine to its initial state. This clears any programs from the machine, and clears all of its stacks
+ * and heaps. The data area of the previous reset is kept if it has the same region sizes, and only the parts of it
+ * that were used are cleared; otherwise it is reserved afresh with the requested sizes. Separate machines may run
+ * queries on separate threads at the same time, but a single machine must not be used from more than one thread at
+ * once.
+ *
+ * @param rmstate   The machine state.
+ * @param regSize   The number of registers.
+ * @param heapSize  The size of the heap in cells.
+ * @param stackSize The size of the stack in cells.
+ * @param pdlSize   The size of the unification stack in cells.
+ *
+ * @return <tt>true</tt> if the machine was reset, <tt>false</tt> if its data area could not be created with the
+ *         requested sizes, in which case it must be reset again before it is used.
+ */
+jboolean RM_API(Reset)(rmMachineState *rmstate, jint regSize, jint heapSize, jint stackSize, jint pdlSize)
+{
+     jint sizes[REGION_COUNT];
+     jint used[REGION_COUNT];
+
+     // The heap has been written to no further than its peak, unless an overflow may have left it written anywhere.
+     // The other regions are cleared in full, which costs little as large ones are handed back a page at a time.
+     used[REG_REGION] = -1;
+     used[HEAP_REGION] = ((rmstate->data != NULL) && !rmstate->overflowed) ? RM_API(GetHeapPeak)(rmstate) : -1;
+     used[STACK_REGION] = -1;
+     used[PDL_REGION] = -1;
+
+     // Clear the heaps and stacks, keeping the previous ones if they are the same size. These start out zeroed.
+     sizes[REG_REGION] = regSize;
+     sizes[HEAP_REGION] = heapSize;
+     sizes[STACK_REGION] = stackSize;
+     sizes[PDL_REGION] = pdlSize;
+
+     if (dataAreaReset(&rmstate->area, sizes, REGION_COUNT, ADDR_LIMIT, sizeof(jcell), used) == JNI_FALSE)
+     {
+          rmstate->data = NULL;
+
+          return JNI_FALSE;
+     }
+
+     rmstate->data = rmstate->area.data;
+     rmstate->overflowed = JNI_FALSE;
+
+     // Collect the heap once most of it has been used.
+     rmstate->gcTrigger = HEAP_BASE + (jint)(((jlong)(HEAP_END - HEAP_BASE) * GC_TRIGGER_PERCENT) / 100);
+
+     // Registers are on the top of the heap, so initialize the heap pointers to the heap area.
+     rmstate->hp = HEAP_BASE;
+     rmstate->sp = HEAP_BASE;
+     rmstate->hpPeak = HEAP_BASE;
+
+     // The stack comes after the heap.
+     rmstate->ep = STACK_BASE;
+     rmstate->esp = rmstate->ep;
+
+     // The unification stack is a push down stack at the end of the data area.
+     rmstate->up = TOP;
+
+     // Turn off write mode.
+     rmstate->writeMode = JNI_FALSE;
+
+     // Reset the instruction pointer to that start of the code area, and forget the decoded code.
+     rmstate->ip = 0;
+     rmstate->cp = 0;
+     rmdecodeDiscard(rmstate);
+
+     // Could probably not bother resetting these, but will do it anyway just to be sure.
+     rmstate->derefTag = 0;
+     rmstate->derefVal = 0;
+
+     // Abandon any suspended execution.
+     rmstate->suspended = JNI_FALSE;
+     rmstate->interrupted = JNI_FALSE;
+
+     // Queries are rolled back to the empty heap and stacks, if rollback is on.
+     rmmark(rmstate);
+
+     return JNI_TRUE;
+}
+
+/*
+ * Resets the machine to its initial state, creating the machine state on the first reset. Each machine instance has
+ * its own state, so separate instances may run queries on separate threads at the same time.
+ *
+ * Class:     com_thesett_aima_logic_fol_lN_LNResolvingNativeMachine
+ * Method:    nativeReset
+ * Signature: (JIIII)J
+ *
+ * @param env       The native code execution environment.
+ * @param obj       The object that is the context to this native method.
+ * @param state     A handle onto the machine state, or zero if it has not been created yet.
+ * @param regSize   The number of registers.
+ * @param heapSize  The size of the heap in cells.
+ * @param stackSize The size of the stack in cells.
+ * @param pdlSize   The size of the unification stack in cells.
+ *
+ * @return A handle onto the machine state.
+ */
+JNIEXPORT jlong JNICALL RM_JNI(nativeReset)
+(JNIEnv * env, jobject obj, jlong state, jint regSize, jint heapSize, jint stackSize, jint pdlSize)
+{
+     rmMachineState *rmstate = (rmMachineState *)(intptr_t)state;
+
+     // printf("nativeReset: called\n");
+
+     if (rmstate == NULL)
+     {
+          rmstate = RM_API(Create)();
+     }
+
+     if (RM_API(Reset)(rmstate, regSize, heapSize, stackSize, pdlSize) == JNI_FALSE)
+     {
+          (*env)->ThrowNew(env, (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                           "The data area could not be created with the requested sizes.");
+     }
+
+     return (jlong)(intptr_t)rmstate;
+}
+
+/*
+ * Releases the machine state, and the data area that it holds. Releasing <tt>NULL</tt> does nothing.
+ *
+ * @param rmstate The machine state.
+ */
+void RM_API(Release)(rmMachineState *rmstate)
+{
+     if (rmstate != NULL)
+     {
+          if (rmstate->data != NULL)
+          {
+               dataAreaRelease(&rmstate->area);
+          }
+
+          profileRelease(rmstate->profile);
+          free(rmstate->instr);
+          free(rmstate->instrAt);
+          free(rmstate->indexOf);
+          free(rmstate);
+     }
+}
+
+/*
+ * Releases the machine state, and the data area that it holds. Releasing a zero handle does nothing.
+ *
+ * Class:     com_thesett_aima_logic_fol_lN_LNResolvingNativeMachine
+ * Method:    nativeRelease
+ * Signature: (J)V
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL RM_JNI(nativeRelease)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     RM_API(Release)((rmMachineState *)(intptr_t)state);
+}
+
+
+/*
+ * Runs the interpreter over the decoded instructions, from the specified instruction until the query completes or
+ * fails. The instruction pointer and continuation point index the decoded instructions, rather than the byte code.
+ *
+ * Every call counts against the budget held in the machine state. Once it is used up, or another thread has flagged
+ * an interrupt, the execution is suspended at the call, before entering the called predicate. All of the registers
+ * are written back to the machine state, and the suspended flag is raised, so that a later execution from a negative
+ * offset can carry on from exactly where it stopped. Every loop in a program runs through a call, so no query can
+ * run on without reaching one of these points.
+ *
+ * When passed an array of handlers, nothing is run. Instead the handler for each decoded opcode is written out to
+ * it, for the decoder to place in the instructions that it decodes, as the handler addresses are only known inside
+ * this function.
+ *
+ * @param rmstate  The machine state.
+ * @param code     The decoded instructions to execute.
+ * @param length   The number of decoded instructions.
+ * @param offset   The instruction to start executing at, or a negative offset to resume a suspended execution.
+ * @param handlers The array to write the handlers for each decoded opcode out to, or <tt>NULL</tt> to execute.
+ *
+ * @return <tt>true</tt> if a unification was found or the execution was suspended, <tt>false</tt> if the search for
+ *         one failed.
+ */
+static jboolean rmexecute(rmMachineState *rmstate, const rmInstr *code, jint length, jint offset,
+                          const void **handlers)
+{
+     jint addr;
+     jbyte tag;
+     jint a;
+     jint xi;
+
+     jint hp = rmstate->hp;
+     jint sp = rmstate->sp;
+     jboolean writeMode = rmstate->writeMode;
+     jint ip;
+     jint cp;
+     jint ep = rmstate->ep;
+     jint esp = rmstate->esp;
+     jlong budget = rmstate->budget;
+
+     jboolean failed = JNI_FALSE;
+     jboolean suspended = JNI_FALSE;
+
+     DISPATCH_TABLE(DISPATCH_ENTRY(PUT_STRUC), DISPATCH_ENTRY(SET_VAR), DISPATCH_ENTRY(SET_VAL),
+                    DISPATCH_ENTRY(GET_STRUC), DISPATCH_ENTRY(UNIFY_VAR), DISPATCH_ENTRY(UNIFY_VAL),
+                    DISPATCH_ENTRY(PUT_VAR), DISPATCH_ENTRY(PUT_VAL), DISPATCH_ENTRY(GET_VAR),
+                    DISPATCH_ENTRY(GET_VAL), DISPATCH_ENTRY(CALL), DISPATCH_ENTRY(PROCEED),
+                    DISPATCH_ENTRY(ALLOCATE), DISPATCH_ENTRY(DEALLOCATE),
+                    DISPATCH_ENTRY(PUT_STRUC_Y), DISPATCH_ENTRY(SET_VAR_Y), DISPATCH_ENTRY(SET_VAL_Y),
+                    DISPATCH_ENTRY(GET_STRUC_Y), DISPATCH_ENTRY(UNIFY_VAR_Y), DISPATCH_ENTRY(UNIFY_VAL_Y),
+                    DISPATCH_ENTRY(PUT_VAR_Y), DISPATCH_ENTRY(PUT_VAL_Y), DISPATCH_ENTRY(GET_VAR_Y),
+                    DISPATCH_ENTRY(GET_VAL_Y), DISPATCH_ENTRY(PUT_STRUC_ARGS), DISPATCH_ENTRY(PUT_STRUC_ARGS_Y),
+                    DISPATCH_ENTRY(GET_STRUC_ARGS), DISPATCH_ENTRY(GET_STRUC_ARGS_Y));
+
+     // Hand out the handlers to the decoder, when asked for them.
+     if (handlers != NULL)
+     {
+          for (a = 0; a < DECODED_OPCODES; a++)
+          {
+               handlers[a] = DISPATCH_HANDLER(a);
+          }
+
+          return JNI_TRUE;
+     }
+
+     traceIt("\n" RM_LEVEL " Execute\n");
+
+     if (offset < 0)
+     {
+          // Carry on from where the suspended execution stopped.
+          ip = rmstate->ip;
+          cp = rmstate->cp;
+     }
+     else
+     {
+          // Start execution at the requested instruction.
+          ip = offset;
+
+          // Set the initial CP to point to the end of the code, used as a termination condition.
+          cp = length;
+          rmuClear(rmstate);
+     }
+
+     INTERP_LOOP_BEGIN(failed == JNI_FALSE && (ip < length) && (suspended == JNI_FALSE))
+     {
+          // Each instruction that takes a register has a form for each addressing mode. The stack form works out the
+          // address of its variable in the current frame, then shares the handler of the register form.
+
+          // put_struc yi:
+          OP(PUT_STRUC_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto put_struc;
+          }
+
+          // put_struc xi:
+          OP(PUT_STRUC)
+          {
+               xi = code[ip].xi;
+          }
+     put_struc:
+          {
+               // grab f/n
+               jint f_n = code[ip].arg;
+
+               traceFn1("PUT_STRUC", rmstate->instrAt[ip], xi, f_n);
+
+               // heap[h] <- STR, h + 1
+               rmstate->data[hp] = CELL_MAKE(STR, hp + 1);
+
+               // heap[h+1] <- f/n
+               rmstate->data[hp + 1] = f_n;
+
+               // xi <- heap[h]
+               rmstate->data[xi] = rmstate->data[hp];
+
+               // h <- h + 2
+               hp += 2;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // set_var yi:
+          OP(SET_VAR_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto set_var;
+          }
+
+          // set_var xi:
+          OP(SET_VAR)
+          {
+               xi = code[ip].xi;
+          }
+     set_var:
+          {
+               trace1("SET_VAR", rmstate->instrAt[ip], xi);
+
+               // heap[h] <- REF, h
+               rmstate->data[hp] = CELL_MAKE(REF, hp);
+
+               // xi <- heap[h]
+               rmstate->data[xi] = rmstate->data[hp];
+
+               // h <- h + 1
+               hp++;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // set_val yi:
+          OP(SET_VAL_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto set_val;
+          }
+
+          // set_val xi:
+          OP(SET_VAL)
+          {
+               xi = code[ip].xi;
+          }
+     set_val:
+          {
+               trace1("SET_VAL", rmstate->instrAt[ip], xi);
+
+               // heap[h] <- xi
+               rmstate->data[hp] = rmstate->data[xi];
+
+               // h <- h + 1
+               hp++;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // get_struc yi,
+          OP(GET_STRUC_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto get_struc;
+          }
+
+          // get_struc xi,
+          OP(GET_STRUC)
+          {
+               xi = code[ip].xi;
+          }
+     get_struc:
+          {
+               // grab f/n
+               jint f_n = code[ip].arg;
+
+               traceFn1("GET_STRUC", rmstate->instrAt[ip], xi, f_n);
+
+               // addr <- deref(xi);
+               addr = rmderef(rmstate, xi);
+
+               // switch STORE[addr]
+               tag = rmstate->derefTag;
+               a = rmstate->derefVal;
+
+               switch (tag)
+               {
+                    // case REF:
+               case REF:
+               {
+                    // heap[h] <- STR, h + 1
+                    rmstate->data[hp] = CELL_MAKE(STR, hp + 1);
+
+                    // heap[h+1] <- f/n
+                    rmstate->data[hp + 1] = f_n;
+
+                    // bind(addr, h)
+                    rmstate->data[addr] = CELL_MAKE(REF, hp);
+
+                    // h <- h + 2
+                    hp += 2;
+
+                    // mode <- write
+                    writeMode = JNI_TRUE;
+
+                    break;
+               }
+
+               // case STR, a:
+               case STR:
+               {
+                    // if heap[a] = f/n
+                    if (rmstate->data[a] == f_n)
+                    {
+                         // s <- a + 1
+                         sp = a + 1;
+
+                         // mode <- read
+                         writeMode = JNI_FALSE;
+                    }
+                    else
+                    {
+                         // fail
+                         failed = JNI_TRUE;
+                    }
+
+                    break;
+               }
+               }
+
+               // P <- P + 1
+               ip++;
+
+               NEXT_UNLESS_FAILED;
+          }
+
+          // unify_var yi:
+          OP(UNIFY_VAR_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto unify_var;
+          }
+
+          // unify_var xi:
+          OP(UNIFY_VAR)
+          {
+               xi = code[ip].xi;
+          }
+     unify_var:
+          {
+               trace1("UNIFY_VAR", rmstate->instrAt[ip], xi);
+
+               // switch mode
+               if (writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // xi <- heap[s]
+                    rmstate->data[xi] = rmstate->data[sp];
+               }
+               else
+               {
+                    // case write:
+                    // heap[h] <- REF, h
+                    rmstate->data[hp] = CELL_MAKE(REF, hp);
+
+                    // xi <- heap[h]
+                    rmstate->data[xi] = rmstate->data[hp];
+
+                    // h <- h + 1
+                    hp++;
+               }
+
+               // s <- s + 1
+               sp++;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // unify_val yi:
+          OP(UNIFY_VAL_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto unify_val;
+          }
+
+          // unify_val xi:
+          OP(UNIFY_VAL)
+          {
+               xi = code[ip].xi;
+          }
+     unify_val:
+          {
+               trace1("UNIFY_VAL", rmstate->instrAt[ip], xi);
+
+               // switch mode
+               if (writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // unify (xi, s)
+                    failed = rmunify(rmstate, xi, sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               }
+               else
+               {
+                    // case write:
+                    // heap[h] <- xi
+                    rmstate->data[hp] = rmstate->data[xi];
+
+                    // h <- h + 1
+                    hp++;
+               }
+
+               // s <- s + 1
+               sp++;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT_UNLESS_FAILED;
+          }
+
+          // put_var Yn, Ai:
+          OP(PUT_VAR_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto put_var;
+          }
+
+          // put_var Xn, Ai:
+          OP(PUT_VAR)
+          {
+               xi = code[ip].xi;
+          }
+     put_var:
+          {
+               // grab Ai
+               jint ai = code[ip].arg;
+
+               trace2("PUT_VAR", rmstate->instrAt[ip], xi, (xi == code[ip].xi) ? REG_ADDR : STACK_ADDR, ai, ep);
+
+               // heap[h] <- REF, H
+               rmstate->data[hp] = CELL_MAKE(REF, hp);
+
+               // Xn <- heap[h]
+               rmstate->data[xi] = rmstate->data[hp];
+
+               // Ai <- heap[h]
+               rmstate->data[ai] = rmstate->data[hp];
+
+               // h <- h + 1
+               hp++;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // put_val Yn, Ai:
+          OP(PUT_VAL_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto put_val;
+          }
+
+          // put_val Xn, Ai:
+          OP(PUT_VAL)
+          {
+               xi = code[ip].xi;
+          }
+     put_val:
+          {
+               // grab Ai
+               jint ai = code[ip].arg;
+
+               trace2("PUT_VAL", rmstate->instrAt[ip], xi, (xi == code[ip].xi) ? REG_ADDR : STACK_ADDR, ai, ep);
+
+               // Ai <- Xn
+               rmstate->data[ai] = rmstate->data[xi];
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // get var Yn, Ai:
+          OP(GET_VAR_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto get_var;
+          }
+
+          // get var Xn, Ai:
+          OP(GET_VAR)
+          {
+               xi = code[ip].xi;
+          }
+     get_var:
+          {
+               // grab Ai
+               jint ai = code[ip].arg;
+
+               trace2("GET_VAR", rmstate->instrAt[ip], xi, (xi == code[ip].xi) ? REG_ADDR : STACK_ADDR, ai, ep);
+
+               // Xn <- Ai
+               rmstate->data[xi] = rmstate->data[ai];
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // get_val Yn, Ai:
+          OP(GET_VAL_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto get_val;
+          }
+
+          // get_val Xn, Ai:
+          OP(GET_VAL)
+          {
+               xi = code[ip].xi;
+          }
+     get_val:
+          {
+               // grab Ai
+               jint ai = code[ip].arg;
+
+               trace2("GET_VAL", rmstate->instrAt[ip], xi, (xi == code[ip].xi) ? REG_ADDR : STACK_ADDR, ai, ep);
+
+               // unify (Xn, Ai)
+               failed = rmunify(rmstate, xi, ai) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+
+               // P <- P + 1
+               ip++;
+
+               NEXT_UNLESS_FAILED;
+          }
+
+          // put_struc xi, followed by set_var or set_val on each argument, fused into one instruction.
+          OP(PUT_STRUC_ARGS_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto put_struc_args;
+          }
+
+          OP(PUT_STRUC_ARGS)
+          {
+               xi = code[ip].xi;
+          }
+     put_struc_args:
+          {
+               jint f_n = code[ip].arg;
+               jint n = f_n & 0xFF;
+               const rmInstr *args = code + ip + 1;
+               jint i;
+
+               traceFn1("PUT_STRUC_ARGS", rmstate->instrAt[ip], xi, f_n);
+
+               // heap[h] <- STR, h + 1
+               rmstate->data[hp] = CELL_MAKE(STR, hp + 1);
+
+               // heap[h+1] <- f/n
+               rmstate->data[hp + 1] = f_n;
+
+               // xi <- heap[h]
+               rmstate->data[xi] = rmstate->data[hp];
+
+               // h <- h + 2
+               hp += 2;
+
+               for (i = 0; i < n; i++)
+               {
+                    jint xj = args[i].xi + ((args[i].arg & ARG_STACK) ? ep + 3 : 0);
+
+                    if (args[i].arg & ARG_VAL)
+                    {
+                         // heap[h] <- xj
+                         rmstate->data[hp] = rmstate->data[xj];
+                    }
+                    else
+                    {
+                         // heap[h] <- REF, h
+                         rmstate->data[hp] = CELL_MAKE(REF, hp);
+
+                         // xj <- heap[h]
+                         rmstate->data[xj] = rmstate->data[hp];
+                    }
+
+                    // h <- h + 1
+                    hp++;
+               }
+
+               // P <- P + 1 + n
+               ip += 1 + n;
+
+               NEXT;
+          }
+
+          // get_struc xi, followed by unify_var or unify_val on each argument, fused into one instruction. The mode
+          // is only tested once for all of the arguments.
+          OP(GET_STRUC_ARGS_Y)
+          {
+               xi = code[ip].xi + ep + 3;
+               goto get_struc_args;
+          }
+
+          OP(GET_STRUC_ARGS)
+          {
+               xi = code[ip].xi;
+          }
+     get_struc_args:
+          {
+               jint f_n = code[ip].arg;
+               jint n = f_n & 0xFF;
+               const rmInstr *args = code + ip + 1;
+               jint i;
+
+               traceFn1("GET_STRUC_ARGS", rmstate->instrAt[ip], xi, f_n);
+
+               // addr <- deref(xi);
+               addr = rmderef(rmstate, xi);
+               tag = rmstate->derefTag;
+               a = rmstate->derefVal;
+
+               if (tag == REF)
+               {
+                    // heap[h] <- STR, h + 1
+                    rmstate->data[hp] = CELL_MAKE(STR, hp + 1);
+
+                    // heap[h+1] <- f/n
+                    rmstate->data[hp + 1] = f_n;
+
+                    // bind(addr, h)
+                    rmstate->data[addr] = CELL_MAKE(REF, hp);
+
+                    // h <- h + 2
+                    hp += 2;
+
+                    // mode <- write
+                    writeMode = JNI_TRUE;
+
+                    for (i = 0; i < n; i++)
+                    {
+                         jint xj = args[i].xi + ((args[i].arg & ARG_STACK) ? ep + 3 : 0);
+
+                         if (args[i].arg & ARG_VAL)
+                         {
+                              // heap[h] <- xj
+                              rmstate->data[hp] = rmstate->data[xj];
+                         }
+                         else
+                         {
+                              // heap[h] <- REF, h
+                              rmstate->data[hp] = CELL_MAKE(REF, hp);
+
+                              // xj <- heap[h]
+                              rmstate->data[xj] = rmstate->data[hp];
+                         }
+
+                         // h <- h + 1
+                         hp++;
+                    }
+
+                    // s <- s + n
+                    sp += n;
+               }
+               else if (tag == STR)
+               {
+                    // if heap[a] = f/n
+                    if (rmstate->data[a] != f_n)
+                    {
+                         FAIL;
+                    }
+
+                    // mode <- read
+                    writeMode = JNI_FALSE;
+
+                    for (i = 0, sp = a + 1; i < n; i++, sp++)
+                    {
+                         jint xj = args[i].xi + ((args[i].arg & ARG_STACK) ? ep + 3 : 0);
+
+                         if (args[i].arg & ARG_VAL)
+                         {
+                              // unify (xj, s)
+                              if (rmunify(rmstate, xj, sp) == JNI_FALSE)
+                              {
+                                   sp++;
+                                   FAIL;
+                              }
+                         }
+                         else
+                         {
+                              // xj <- heap[s]
+                              rmstate->data[xj] = rmstate->data[sp];
+                         }
+                    }
+               }
+               else
+               {
+                    // Anything else leaves the mode as it is, so run the argument instructions one at a time.
+                    ip++;
+
+                    NEXT;
+               }
+
+               // P <- P + 1 + n
+               ip += 1 + n;
+
+               NEXT;
+          }
+
+          // call @(p/n)
+          OP(CALL)
+          {
+               // grab @(p/n), already resolved to the instruction that it starts at.
+               jint p_n = code[ip].arg;
+
+               traceFn0("CALL", rmstate->instrAt[ip], (p_n >= 0) ? rmstate->instrAt[p_n] : -1);
+
+               // Ensure that the predicate to call is known and linked int, otherwise fail.
+               if (p_n == -1)
+               {
+                    FAIL;
+               }
+
+               PROFILE_CALL(rmstate->instrAt[p_n]);
+               PROFILE_PEAK(PROFILE_HP_PEAK, hp - HEAP_BASE);
+
+               // Collect the heap if it has grown past the trigger point.
+               if (hp >= rmstate->gcTrigger)
+               {
+                    hp = rmcollectGarbage(rmstate, hp, ep, esp);
+               }
+
+               // CP <- P + 1
+               cp = ip + 1;
+
+               // ip <- @(p/n)
+               ip = p_n;
+
+               // Suspend before entering the predicate, once the budget is used up or when interrupted.
+               if ((--budget == 0) || (rmstate->interrupted == JNI_TRUE))
+               {
+                    traceIt("Suspended");
+
+                    rmstate->interrupted = JNI_FALSE;
+                    suspended = JNI_TRUE;
+
+                    HALT;
+               }
+
+               JUMP;
+          }
+
+          // proceed:
+          OP(PROCEED)
+          {
+               trace0("PROCEED", rmstate->instrAt[ip]);
+
+               // P <- CP
+               ip = cp;
+
+               JUMP;
+          }
+
+          // allocate N:
+          OP(ALLOCATE)
+          {
+               // grab N
+               jint n = code[ip].arg;
+
+               // STACK[newE] <- E
+               rmstate->data[esp] = ep;
+
+               // STACK[E + 1] <- CP
+               rmstate->data[esp + 1] = cp;
+
+               // STACK[E + 2] <- N
+               rmstate->data[esp + 2] = n;
+
+               // Clear the permanent variables, so that the garbage collector never sees stale cells in them.
+               memset(rmstate->data + esp + 3, 0, n * sizeof(jcell));
+
+               // E <- newE
+               // newE <- E + n + 3
+               ep = esp;
+               esp = esp + n + 3;
+
+               PROFILE_PEAK(PROFILE_ESP_PEAK, esp - STACK_BASE);
+               traceConst("ALLOCATE", rmstate->instrAt[ip], n);
+
+               // P <- P + 1
+               ip++;
+
+               NEXT;
+          }
+
+          // deallocate:
+          OP(DEALLOCATE)
+          {
+               // E <- STACK[E]
+               esp = ep;
+               ep = rmstate->data[ep];
+
+               trace0("DEALLOCATE", rmstate->instrAt[ip]);
+
+               // P <- STACK[E + 1]
+               ip = rmstate->data[ep + 1];
+
+               JUMP;
+          }
+
+          // An unknown instruction was encountered. Something has gone wrong, so fail.
+          OP_UNKNOWN
+          {
+               trace0("UNKNOWN (Fail)", rmstate->instrAt[ip]);
+
+               FAIL;
+          }
+     }
+     INTERP_LOOP_END
+
+     PROFILE_PEAK(PROFILE_HP_PEAK, hp - HEAP_BASE);
+
+     // Preserve the current state of the machine.
+     rmstate->hp = hp;
+     rmstate->sp = sp;
+     rmstate->ip = ip;
+     rmstate->cp = cp;
+     rmstate->ep = ep;
+     rmstate->esp = esp;
+     rmstate->writeMode = writeMode;
+     rmstate->suspended = suspended;
+
+     return failed == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+}
+
+/*
+ * Reads a jint operand out of the byte code, where it need not be aligned.
+ *
+ * @param code The byte code.
+ * @param at   The offset of the operand.
+ *
+ * @return The operand.
+ */
+static jint rmdecodeInt(const jbyte *code, jint at)
+{
+     jint value;
+
+     memcpy(&value, code + at, sizeof(jint));
+
+     return value;
+}
+
+/*
+ * Works out the size of a byte code instruction from its opcode.
+ *
+ * @param opcode The opcode.
+ *
+ * @return The size of the instruction in bytes, or 0 if the opcode is not known.
+ */
+static jint rmdecodeSize(jbyte opcode)
+{
+     switch (opcode)
+     {
+     case PUT_STRUC:
+     case GET_STRUC:
+          return 7;
+
+     case SET_VAR:
+     case SET_VAL:
+     case UNIFY_VAR:
+     case UNIFY_VAL:
+          return 3;
+
+     case PUT_VAR:
+     case PUT_VAL:
+     case GET_VAR:
+     case GET_VAL:
+          return 4;
+
+     case CALL:
+          return 5;
+
+     case ALLOCATE:
+          return 2;
+
+     case PROCEED:
+     case DEALLOCATE:
+          return 1;
+
+     default:
+          return 0;
+     }
+}
+
+/*
+ * Ensures that there is space for a number of decoded instructions in all, and for the decoded instruction index of
+ * every byte code offset up to an end.
+ *
+ * @param rmstate The machine state.
+ * @param count   The number of decoded instructions to make space for.
+ * @param end     The byte code offset to make space for the indexes of the instructions up to.
+ *
+ * @return <tt>true</tt> if there is space, <tt>false</tt> if it could not be allocated.
+ */
+static jboolean rmdecodeReserve(rmMachineState *rmstate, jint count, jint end)
+{
+     if (count > rmstate->instrCapacity)
+     {
+          jint capacity = (count > 2 * rmstate->instrCapacity) ? count : 2 * rmstate->instrCapacity;
+          rmInstr *instr = realloc(rmstate->instr, capacity * sizeof(rmInstr));
+          jint *instrAt = realloc(rmstate->instrAt, capacity * sizeof(jint));
+
+          if (instr != NULL)
+          {
+               rmstate->instr = instr;
+          }
+
+          if (instrAt != NULL)
+          {
+               rmstate->instrAt = instrAt;
+          }
+
+          if ((instr == NULL) || (instrAt == NULL))
+          {
+               return JNI_FALSE;
+          }
+
+          rmstate->instrCapacity = capacity;
+     }
+
+     if (end > rmstate->indexCapacity)
+     {
+          jint capacity = (end > 2 * rmstate->indexCapacity) ? end : 2 * rmstate->indexCapacity;
+          jint *indexOf = realloc(rmstate->indexOf, capacity * sizeof(jint));
+
+          if (indexOf == NULL)
+          {
+               return JNI_FALSE;
+          }
+
+          rmstate->indexOf = indexOf;
+          rmstate->indexCapacity = capacity;
+     }
+
+     return JNI_TRUE;
+}
+
+#ifndef NO_SUPERINSTRUCTIONS
+/*
+ * Looks for the argument instructions that may be fused into a superinstruction, following an instruction on a
+ * structure, and works out the ARG flags for each of them.
+ *
+ * @param rmstate  The machine state.
+ * @param at       The decoded instruction on a structure.
+ * @param var      The handlers of the var form of the argument instruction, in register and stack form.
+ * @param val      The handlers of the val form of the argument instruction, in register and stack form.
+ * @param flags    The array to write out the ARG flags for each argument of the structure to.
+ *
+ * @return <tt>true</tt> if every argument of the structure is set up by a following argument instruction.
+ */
+static jboolean rmdecodeArgs(rmMachineState *rmstate, jint at, const void **var, const void **val, jint *flags)
+{
+     jint n = rmstate->instr[at].arg & 0xFF;
+     jint i;
+
+     if ((n == 0) || (n > rmstate->instrCount - at - 1))
+     {
+          return JNI_FALSE;
+     }
+
+     for (i = 0; i < n; i++)
+     {
+          const void *handler = rmstate->instr[at + 1 + i].handler;
+
+          if (handler == var[0])
+          {
+               flags[i] = 0;
+          }
+          else if (handler == var[1])
+          {
+               flags[i] = ARG_STACK;
+          }
+          else if (handler == val[0])
+          {
+               flags[i] = ARG_VAL;
+          }
+          else if (handler == val[1])
+          {
+               flags[i] = ARG_VAL | ARG_STACK;
+          }
+          else
+          {
+               return JNI_FALSE;
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Fuses each instruction that builds or matches a structure, with the run of instructions that set or unify each of
+ * its arguments following it, into a superinstruction. Most of the instructions in compiled clauses are in such
+ * runs. Running them as one saves a dispatch on every argument, and the mode of unification is only tested once.
+ *
+ * The argument instructions are left in place, holding their ARG flags, and the superinstruction skips over them.
+ * Should matching a structure find something other than a variable or structure, the superinstruction leaves them to
+ * run one at a time as they would have unfused.
+ *
+ * @param rmstate  The machine state.
+ * @param first    The first decoded instruction to look for runs to fuse from.
+ * @param handlers The handlers for each decoded opcode.
+ */
+static void rmdecodeFuse(rmMachineState *rmstate, jint first, const void **handlers)
+{
+     const void *setVar[2] = { handlers[SET_VAR], handlers[SET_VAR_Y] };
+     const void *setVal[2] = { handlers[SET_VAL], handlers[SET_VAL_Y] };
+     const void *unifyVar[2] = { handlers[UNIFY_VAR], handlers[UNIFY_VAR_Y] };
+     const void *unifyVal[2] = { handlers[UNIFY_VAL], handlers[UNIFY_VAL_Y] };
+     jint flags[256];
+     jint fused;
+     jint i;
+     jint j;
+
+     for (i = first; i < rmstate->instrCount; i++)
+     {
+          rmInstr *instr = &rmstate->instr[i];
+
+          if ((instr->handler == handlers[PUT_STRUC]) || (instr->handler == handlers[PUT_STRUC_Y]))
+          {
+               if (rmdecodeArgs(rmstate, i, setVar, setVal, flags) == JNI_FALSE)
+               {
+                    continue;
+               }
+
+               fused = (instr->handler == handlers[PUT_STRUC]) ? PUT_STRUC_ARGS : PUT_STRUC_ARGS_Y;
+          }
+          else if ((instr->handler == handlers[GET_STRUC]) || (instr->handler == handlers[GET_STRUC_Y]))
+          {
+               if (rmdecodeArgs(rmstate, i, unifyVar, unifyVal, flags) == JNI_FALSE)
+               {
+                    continue;
+               }
+
+               fused = (instr->handler == handlers[GET_STRUC]) ? GET_STRUC_ARGS : GET_STRUC_ARGS_Y;
+          }
+          else
+          {
+               continue;
+          }
+
+          instr->handler = handlers[fused];
+
+          for (j = 0; j < (instr->arg & 0xFF); j++)
+          {
+               rmstate->instr[i + 1 + j].arg = flags[j];
+          }
+     }
+}
+#endif
+
+/*
+ * Decodes a range of byte code into instructions for the interpreter, appending them to the decoded instructions of
+ * the machine. Each instruction is decoded into a fixed width, aligned form holding the address of its handler and
+ * its operands. Instructions on registers are decoded to a separate opcode for each addressing mode, and call
+ * targets are resolved to the decoded instruction that they start at, so that none of this is worked out as the
+ * code runs. Opcodes that are not known decode to a single byte instruction that fails. Unless built with
+ * NO_SUPERINSTRUCTIONS, runs of instructions on structures and their arguments are then fused.
+ *
+ * Byte code is expected to be added in increasing order of offset, and not to change once added. Code added over
+ * code already decoded, or from a different buffer, causes the code to be decoded again from scratch.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code.
+ * @param offset  The start offset of the code to decode.
+ * @param length  The length of the code to decode.
+ *
+ * @return <tt>true</tt> if the code was decoded, <tt>false</tt> if there was not the memory to do so, in which case
+ *         all decoded instructions are discarded.
+ */
+static jboolean rmdecode(rmMachineState *rmstate, jbyte *code, jint offset, jint length)
+{
+     const void *handlers[DECODED_OPCODES];
+     jint end = offset + length;
+     jint first;
+     jint size;
+     jint at;
+     jint i;
+
+     if ((offset < 0) || (length <= 0))
+     {
+          return JNI_TRUE;
+     }
+
+     // Code from a different buffer replaces whatever was decoded before. Code added over the top of code already
+     // decoded from the same buffer means the buffer was rewritten, so it is all decoded again.
+     if (code != rmstate->decodedCode)
+     {
+          rmdecodeDiscard(rmstate);
+          rmstate->decodedCode = code;
+     }
+     else if (offset < rmstate->decodedLength)
+     {
+          rmdecodeDiscard(rmstate);
+          rmstate->decodedCode = code;
+          offset = 0;
+     }
+
+     // There can be no more instructions than there are bytes.
+     if (rmdecodeReserve(rmstate, rmstate->instrCount + (end - offset), end) == JNI_FALSE)
+     {
+          rmdecodeDiscard(rmstate);
+
+          return JNI_FALSE;
+     }
+
+     rmexecute(rmstate, NULL, 0, 0, handlers);
+
+     // No instructions start in any gap before the new code, or anywhere but at the instructions within it.
+     for (at = rmstate->decodedLength; at < end; at++)
+     {
+          rmstate->indexOf[at] = -1;
+     }
+
+     // Decode each instruction, leaving call targets as byte code offsets.
+     first = rmstate->instrCount;
+
+     for (at = offset; at < end; at += size)
+     {
+          rmInstr *instr = &rmstate->instr[rmstate->instrCount];
+          jbyte opcode = code[at];
+          jint decoded = opcode;
+
+          size = rmdecodeSize(opcode);
+
+          if ((size == 0) || (size > end - at))
+          {
+               decoded = 0;
+               size = 1;
+          }
+
+          instr->xi = 0;
+          instr->arg = 0;
+
+          switch (decoded)
+          {
+          case PUT_STRUC:
+          case GET_STRUC:
+               instr->xi = (jint)code[at + 2];
+               instr->arg = rmdecodeInt(code, at + 3);
+               break;
+
+          case SET_VAR:
+          case SET_VAL:
+          case UNIFY_VAR:
+          case UNIFY_VAL:
+               instr->xi = (jint)code[at + 2];
+               break;
+
+          case PUT_VAR:
+          case PUT_VAL:
+          case GET_VAR:
+          case GET_VAL:
+               instr->xi = (jint)code[at + 2];
+               instr->arg = (jint)code[at + 3];
+               break;
+
+          case CALL:
+               instr->arg = rmdecodeInt(code, at + 1);
+               break;
+
+          case ALLOCATE:
+               instr->arg = (jint)code[at + 1];
+               break;
+          }
+
+          // Instructions on registers are split by addressing mode.
+          if ((decoded >= PUT_STRUC) && (decoded <= GET_VAL) && (code[at + 1] == STACK_ADDR))
+          {
+               decoded |= STACK_FORM;
+          }
+
+          instr->handler = handlers[decoded];
+          rmstate->indexOf[at] = rmstate->instrCount;
+          rmstate->instrAt[rmstate->instrCount] = at;
+          rmstate->instrCount++;
+     }
+
+     rmstate->decodedLength = end;
+
+#ifndef NO_SUPERINSTRUCTIONS
+     // Fuse instructions on structures with the instructions on their arguments. Tracing shows each instruction
+     // as it was compiled, so leave them alone then.
+     if (!TRACE_ENABLED)
+     {
+          rmdecodeFuse(rmstate, first, handlers);
+     }
+#endif
+
+     // Resolve the call targets, now that the instructions of the new code are known.
+     for (i = first; i < rmstate->instrCount; i++)
+     {
+          rmInstr *instr = &rmstate->instr[i];
+
+          if (instr->handler == handlers[CALL])
+          {
+               jint target = instr->arg;
+
+               instr->arg = ((target >= 0) && (target < rmstate->decodedLength)) ? rmstate->indexOf[target] : -1;
+          }
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Notified whenever code is added to the machine. The new code is decoded into the instructions that the
+ * interpreter runs on, straight away, so that this is not done as it runs.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code.
+ * @param offset  The start offset of the new code.
+ * @param length  The length of the new code.
+ */
+void RM_API(CodeAdded)(rmMachineState *rmstate, jbyte *code, jint offset, jint length)
+{
+     rmdecode(rmstate, code, offset, length);
+}
+
+/*
+ * Notified whenever code is added to the machine, as for the C API.
+ *
+ * @param state      A handle onto the machine state.
+ * @param codeBuffer The code buffer.
+ * @param codeOffset The start offset of the new code.
+ * @param length     The length of the new code.
+ */
+JNIEXPORT void JNICALL RM_JNI(codeAdded)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset, jint length)
+{
+     RM_API(CodeAdded)((rmMachineState *)(intptr_t)state, (*env)->GetDirectBufferAddress(env, codeBuf), offset, length);
+}
+
+/*
+ * Names the predicate at an entry point, for the JIT compiled machine to publish the symbols of its compiled code
+ * under. The interpreter compiles no code, so it has nothing to publish and keeps no names.
+ *
+ * @param state  A handle onto the machine state.
+ * @param offset The entry point of the predicate.
+ * @param name   The name of the predicate, as name/arity.
+ */
+JNIEXPORT void JNICALL RM_JNI(nameEntryPoint)
+(JNIEnv * env, jobject object, jlong state, jint offset, jstring name)
+{
+}
+
+/*
+ * Runs the interpreter on the decoded instructions, failing if a region of the data area overflows. The machine state
+ * is only written back on completion or suspension, so it is left as it was before the execution on overflow.
+ *
+ * @param rmstate The machine state.
+ * @param entry   The decoded instruction to start executing at, or a negative one to resume a suspended execution.
+ * @param budget  The number of calls that may be made before the execution is suspended, or -1 for no limit.
+ *
+ * @return <tt>true</tt> if a unification was found or the execution was suspended, <tt>false</tt> if the search for
+ *         one failed.
+ */
+static jboolean rmrunGuarded(rmMachineState *rmstate, jint entry, jlong budget)
+{
+     jboolean result;
+     dataAreaJmpBuf overflow;
+
+     rmstate->budget = budget;
+
+     PROFILE_BEGIN(rmstate->profile);
+
+     if (DATA_AREA_GUARD(&rmstate->area, overflow))
+     {
+          DATA_AREA_UNGUARD();
+          PROFILE_END();
+          traceIt("Data area overflow (Fail)");
+
+          rmstate->overflowed = JNI_TRUE;
+          rmstate->suspended = JNI_FALSE;
+
+          return JNI_FALSE;
+     }
+
+     result = rmexecute(rmstate, rmstate->instr, rmstate->instrCount, entry, NULL);
+
+     DATA_AREA_UNGUARD();
+     PROFILE_END();
+
+     return result;
+}
+
+/*
+ * Runs the interpreter on the decoded form of the byte code, as for rmrunGuarded. Byte code that was not added to the
+ * machine through CodeAdded is decoded in full before it is run.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code to execute.
+ * @param length  The length of the byte code.
+ * @param offset  The offset within the byte code to start executing at.
+ * @param budget  The number of calls that may be made before the execution is suspended, or -1 for no limit.
+ *
+ * @return <tt>true</tt> if a unification was found or the execution was suspended, <tt>false</tt> if the search for
+ *         one failed.
+ */
+static jboolean rmexecuteGuarded(rmMachineState *rmstate, jbyte *code, jsize length, jint offset, jlong budget)
+{
+     jint entry;
+
+     // Start from the watermark, if rollback is on, as the answer to the query before this one has been read out.
+     if (rmstate->rollback == JNI_TRUE)
+     {
+          rmrollback(rmstate);
+     }
+
+     // Find the decoded instruction to start at, decoding the code first if it has not been already. Starting
+     // outside of the code runs nothing, and starting part way through an instruction fails.
+     if ((offset < 0) || (offset >= length))
+     {
+          entry = rmstate->instrCount;
+     }
+     else
+     {
+          if ((code != rmstate->decodedCode) || (offset >= rmstate->decodedLength) ||
+              (rmstate->indexOf[offset] < 0))
+          {
+               rmdecode(rmstate, code, 0, length);
+          }
+
+          if ((code != rmstate->decodedCode) || (offset >= rmstate->decodedLength) ||
+              ((entry = rmstate->indexOf[offset]) < 0))
+          {
+               traceIt("No instruction at the entry point (Fail)");
+               rmstate->suspended = JNI_FALSE;
+
+               return JNI_FALSE;
+          }
+     }
+
+     return rmrunGuarded(rmstate, entry, budget);
+}
+
+/*
+ * Runs the interpreter on the decoded form of the byte code with no budget, as for rmexecuteGuarded. Such an
+ * execution can only be suspended by an interrupt, and as it cannot be resumed, it fails instead.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code to execute.
+ * @param length  The length of the byte code.
+ * @param offset  The offset within the byte code to start executing at.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed or was interrupted.
+ */
+static jboolean rmexecuteUnbudgeted(rmMachineState *rmstate, jbyte *code, jsize length, jint offset)
+{
+     jboolean result = rmexecuteGuarded(rmstate, code, length, offset, -1);
+
+     if (rmstate->suspended == JNI_TRUE)
+     {
+          traceIt("Interrupted (Fail)");
+          rmstate->suspended = JNI_FALSE;
+
+          return JNI_FALSE;
+     }
+
+     return result;
+}
+
+/*
+ * Executes a compiled functor returning an indication of whether or not a unification was found. A data area overflow
+ * or an interrupt fails the query.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code to execute.
+ * @param length  The length of the byte code.
+ * @param offset  The offset within the byte code to start executing at.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
+ */
+jboolean RM_API(Execute)(rmMachineState *rmstate, jbyte *code, jint length, jint offset)
+{
+     return rmexecuteUnbudgeted(rmstate, code, length, offset);
+}
+
+/*
+ * Executes a compiled functor returning an indication of whether or not a unification was found.
+ *
+ * @param env     The native code execution environment.
+ * @param obj     The object that is the context to this native method.
+ * @param state   A handle onto the machine state.
+ * @param codeBuf A direct buffer containing the byte code to execute.
+ * @param offset  The offset within the code buffer of the byte code to execute.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
+ */
+JNIEXPORT jboolean JNICALL RM_JNI(execute)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset)
+{
+     rmMachineState *rmstate = (rmMachineState *)(intptr_t)state;
+
+     jsize length = (*env)->GetDirectBufferCapacity(env, codeBuf);
+     jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
+
+     return RM_API(Execute)(rmstate, code, length, offset);
+}
+
+/*
+ * Works out the outcome of a budgeted execution from the result of running it.
+ *
+ * @param rmstate The machine state.
+ * @param result  The result of running the execution.
+ *
+ * @return RM_SUSPENDED if the execution was suspended, otherwise RM_SUCCEEDED or RM_FAILED.
+ */
+static jint rmoutcome(rmMachineState *rmstate, jboolean result)
+{
+     if (rmstate->suspended == JNI_TRUE)
+     {
+          return RM_SUSPENDED;
+     }
+
+     return (result == JNI_TRUE) ? RM_SUCCEEDED : RM_FAILED;
+}
+
+/*
+ * Executes a compiled functor for at most a budget of calls. If the query has not completed by the time the budget
+ * is used up, or if it is interrupted, it is suspended, and can be carried on with by Resume. Starting an execution
+ * abandons any that was suspended.
+ *
+ * @param rmstate The machine state.
+ * @param code    The byte code to execute.
+ * @param length  The length of the byte code.
+ * @param offset  The offset within the byte code to start executing at.
+ * @param budget  The number of calls that may be made before the execution is suspended, or zero or less for no
+ *                limit, so that only an interrupt suspends it.
+ *
+ * @return RM_SUCCEEDED if a unification was found, RM_FAILED if the search for one failed, or RM_SUSPENDED if the
+ *         execution was suspended before it completed.
+ */
+jint RM_API(ExecuteBudget)(rmMachineState *rmstate, jbyte *code, jint length, jint offset, jlong budget)
+{
+     return rmoutcome(rmstate, rmexecuteGuarded(rmstate, code, length, offset, (budget > 0) ? budget : -1));
+}
+
+/*
+ * Carries on with a suspended execution, for at most a further budget of calls. No code may be added to the machine
+ * while it has an execution suspended. A data area overflow fails the query, as it would have done had it not been
+ * suspended.
+ *
+ * @param rmstate The machine state.
+ * @param budget  The number of calls that may be made before the execution is suspended again, or zero or less for
+ *                no limit.
+ *
+ * @return As for ExecuteBudget, or RM_FAILED if there is no suspended execution to resume.
+ */
+jint RM_API(Resume)(rmMachineState *rmstate, jlong budget)
+{
+     if (rmstate->suspended == JNI_FALSE)
+     {
+          return RM_FAILED;
+     }
+
+     return rmoutcome(rmstate, rmrunGuarded(rmstate, -1, (budget > 0) ? budget : -1));
+}
+
+/*
+ * Asks the execution running on the machine to suspend itself at its next call. This is the one function that may be
+ * called on a machine from another thread while it runs. If no execution is running, the next one to be run is
+ * suspended at its first call. Executions run through Execute or ExecuteBatch cannot be resumed, so an interrupt fails
+ * them instead.
+ *
+ * @param rmstate The machine state.
+ */
+void RM_API(Interrupt)(rmMachineState *rmstate)
+{
+     rmstate->interrupted = JNI_TRUE;
+}
+
+/*
+ * Executes a compiled functor for at most a budget of calls, as for the C API.
+ *
+ * @param env     The native code execution environment.
+ * @param obj     The object that is the context to this native method.
+ * @param state   A handle onto the machine state.
+ * @param codeBuf A direct buffer containing the byte code to execute.
+ * @param offset  The offset within the code buffer of the byte code to execute.
+ * @param budget  The number of calls that may be made before the execution is suspended, or zero or less for no
+ *                limit.
+ *
+ * @return RM_SUCCEEDED, RM_FAILED or RM_SUSPENDED.
+ */
+JNIEXPORT jint JNICALL RM_JNI(executeBudget)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset, jlong budget)
+{
+     rmMachineState *rmstate = (rmMachineState *)(intptr_t)state;
+
+     jsize length = (*env)->GetDirectBufferCapacity(env, codeBuf);
+     jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
+
+     return RM_API(ExecuteBudget)(rmstate, code, length, offset, budget);
+}
+
+/*
+ * Carries on with a suspended execution, as for the C API.
+ *
+ * @param env    The native code execution environment.
+ * @param obj    The object that is the context to this native method.
+ * @param state  A handle onto the machine state.
+ * @param budget The number of calls that may be made before the execution is suspended again, or zero or less for
+ *               no limit.
+ *
+ * @return RM_SUCCEEDED, RM_FAILED or RM_SUSPENDED.
+ */
+JNIEXPORT jint JNICALL RM_JNI(resume)
+(JNIEnv * env, jobject object, jlong state, jlong budget)
+{
+     return RM_API(Resume)((rmMachineState *)(intptr_t)state, budget);
+}
+
+/*
+ * Asks the execution running on the machine to suspend itself at its next call, as for the C API.
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL RM_JNI(interrupt)
+(JNIEnv * env, jobject object, jlong state)
+{
+     RM_API(Interrupt)((rmMachineState *)(intptr_t)state);
+}
+
+/*
+ * Turns rollback on or off. With rollback on, each top-level query is started from the watermark, so that the heap
+ * cells and environment frames that the query before it left behind are reused, and a long lived machine runs in flat
+ * memory without being reset. Nothing survives from one query to the next on these machines, other than the bindings
+ * that are read out of the last one, so rolling back loses nothing once they have been read. Turning rollback on
+ * records the present heap and stack pointers as the watermark; a reset records the empty heap and stacks as the
+ * watermark, and leaves rollback as it was.
+ *
+ * @param rmstate The machine state.
+ * @param enabled <tt>true</tt> to roll back to the watermark before each query, <tt>false</tt> not to.
+ */
+void RM_API(SetRollback)(rmMachineState *rmstate, jboolean enabled)
+{
+     if ((enabled == JNI_TRUE) && (rmstate->rollback == JNI_FALSE))
+     {
+          rmmark(rmstate);
+     }
+
+     rmstate->rollback = enabled;
+}
+
+/*
+ * Turns rollback on or off, as for the C API.
+ *
+ * @param env     The native code execution environment.
+ * @param obj     The object that is the context to this native method.
+ * @param state   A handle onto the machine state.
+ * @param enabled <tt>true</tt> to roll back to the watermark before each query, <tt>false</tt> not to.
+ */
+JNIEXPORT void JNICALL RM_JNI(setRollback)
+(JNIEnv * env, jobject obj, jlong state, jboolean enabled)
+{
+     RM_API(SetRollback)((rmMachineState *)(intptr_t)state, enabled);
+}
+
+/*
+ * Encodes a term on the heap into the result buffer of a batch, in prefix order. Each term is written as its tag
+ * followed by its address, which for a structure is followed by its f/n cell and then each of its arguments. The tag
+ * and address are written out separately, so that the format does not depend on the layout of the cells. The last
+ * argument of each structure is encoded by going round again rather than by recursing, so that lists and other right
+ * recursive terms of any length are encoded in constant stack.
+ *
+ * @param rmstate The machine state.
+ * @param addr    The address of the term to encode.
+ * @param out     The result buffer.
+ * @param pos     The position in the result buffer to write the term at.
+ * @param limit   The size of the result buffer.
+ *
+ * @return The position in the result buffer after the term, or -1 if the term does not fit.
+ */
+static jint rmencodeTerm(rmMachineState *rmstate, jint addr, jint *out, jint pos, jint limit)
+{
+     jint val;
+     jint arity;
+     jint i;
+
+     while (JNI_TRUE)
+     {
+          rmderef(rmstate, addr);
+          val = rmstate->derefVal;
+
+          if (rmstate->derefTag == REF)
+          {
+               if (pos + 2 > limit)
+               {
+                    return -1;
+               }
+
+               out[pos++] = REF;
+               out[pos++] = val;
+
+               return pos;
+          }
+
+          if (pos + 3 > limit)
+          {
+               return -1;
+          }
+
+          out[pos++] = STR;
+          out[pos++] = val;
+          out[pos++] = (jint)rmstate->data[val];
+          arity = (jint)(rmstate->data[val] & 0xFF);
+
+          if (arity == 0)
+          {
+               return pos;
+          }
+
+          for (i = 0; (i < arity - 1) && (pos >= 0); i++)
+          {
+               pos = rmencodeTerm(rmstate, val + 1 + i, out, pos, limit);
+          }
+
+          if (pos < 0)
+          {
+               return -1;
+          }
+
+          // Carry on with the last argument.
+          addr = val + arity;
+     }
+}
+
+/*
+ * Reads out a term on the heap, such as the binding of a query variable, encoded in prefix order as by
+ * {@link #rmencodeTerm}.
+ *
+ * @param rmstate The machine state.
+ * @param addr    The address of the term to read.
+ * @param out     The buffer to write the encoded term to.
+ * @param limit   The size of the buffer.
+ *
+ * @return The length of the encoded term, or -1 if it does not fit in the buffer.
+ */
+jint RM_API(EncodeTerm)(rmMachineState *rmstate, jint addr, jint *out, jint limit)
+{
+     return rmencodeTerm(rmstate, addr, out, 0, limit);
+}
+
+/*
+ * Executes a batch of queries one after the other, writing out whether each succeeded and the bindings of its
+ * variables into a result buffer. Each query is run from the state that the machine was in at the start of the
+ * batch, so the heap is reset between queries. The batch stops early if the result buffer fills up.
+ *
+ * The query buffer holds, for each query, its entry point, the number of variables to report, and the stack offset
+ * of each variable. The result buffer receives, for each query, 1 if it succeeded or 0 if it failed, followed on
+ * success by each variable binding encoded as by {@link #rmencodeTerm}.
+ *
+ * @param rmstate    The machine state.
+ * @param code       The byte code to execute.
+ * @param length     The length of the byte code.
+ * @param queries    The queries to run.
+ * @param queryCount The number of queries to run.
+ * @param out        The buffer to write the results to.
+ * @param limit      The size of the result buffer.
+ *
+ * @return The number of queries that were run and had their results written out.
+ */
+jint RM_API(ExecuteBatch)(rmMachineState *rmstate, jbyte *code, jint length, const jint *queries, jint queryCount,
+                          jint *out, jint limit)
+{
+     rmMachineState start = *rmstate;
+     jint q;
+     jint v;
+     jint at = 0;
+     jint pos = 0;
+
+     for (q = 0; (q < queryCount) && (pos < limit); q++)
+     {
+          jint offset = queries[at];
+          jint varCount = queries[at + 1];
+          const jint *vars = queries + at + 2;
+
+          jboolean result = rmexecuteUnbudgeted(rmstate, code, length, offset);
+          out[pos++] = (result == JNI_TRUE) ? 1 : 0;
+
+          for (v = 0; (result == JNI_TRUE) && (v < varCount) && (pos >= 0); v++)
+          {
+               pos = rmencodeTerm(rmstate, vars[v] + rmstate->ep + 3, out, pos, limit);
+          }
+
+          // Put the machine back to how it was at the start of the batch, remembering how far the heap went. The
+          // registers are cleared, as they may refer to the part of the heap that the next query writes over.
+          if (rmstate->hp > rmstate->hpPeak)
+          {
+               rmstate->hpPeak = rmstate->hp;
+          }
+
+          rmclearRegisters(rmstate);
+          rmstate->hp = start.hp;
+          rmstate->sp = start.sp;
+          rmstate->up = start.up;
+          rmstate->ep = start.ep;
+          rmstate->esp = start.esp;
+          rmstate->ip = start.ip;
+          rmstate->cp = start.cp;
+          rmstate->writeMode = start.writeMode;
+
+          if (pos < 0)
+          {
+               break;
+          }
+
+          at += 2 + varCount;
+     }
+
+     return q;
+}
+
+/*
+ * Executes a batch of queries one after the other, as for the C API.
+ *
+ * @param state      A handle onto the machine state.
+ * @param codeBuf    A direct buffer containing the byte code to execute.
+ * @param queryBuf   A direct buffer of the queries to run.
+ * @param queryCount The number of queries in the query buffer.
+ * @param resultBuf  A direct buffer to write the results to.
+ *
+ * @return The number of queries that were run and had their results written out.
+ */
+JNIEXPORT jint JNICALL RM_JNI(executeBatch)
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jobject queryBuf, jint queryCount, jobject resultBuf)
+{
+     rmMachineState *rmstate = (rmMachineState *)(intptr_t)state;
+
+     jsize length = (*env)->GetDirectBufferCapacity(env, codeBuf);
+     jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
+     jint * queries = (*env)->GetDirectBufferAddress(env, queryBuf);
+     jint * out = (*env)->GetDirectBufferAddress(env, resultBuf);
+     jint limit = (jint)((*env)->GetDirectBufferCapacity(env, resultBuf) / sizeof(jint));
+
+     return RM_API(ExecuteBatch)(rmstate, code, length, queries, queryCount, out, limit);
+}
+
+/*
+ * Dereferences an offset from the current environment frame on the stack. Storage slots in the current environment
+ * may point to other environment frames, but should not contain unbound variables, so ultimately this dereferencing
+ * should resolve onto a structure or variable on the heap.
+ *
+ * @param  rmstate The machine state.
+ * @param  a       The offset into the current environment stack frame to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+jint RM_API(DerefStack)(rmMachineState *rmstate, jint a)
+{
+     return rmderef(rmstate, a + rmstate->ep + 3);
+}
+
+/*
+ * Dereferences an offset from the current environment frame on the stack, as for the C API.
+ *
+ * @param  state A handle onto the machine state.
+ * @param  a     The offset into the current environment stack frame to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+JNIEXPORT jint JNICALL RM_JNI(derefStack)
+(JNIEnv * env, jobject obj, jlong state, jint a)
+{
+     return RM_API(DerefStack)((rmMachineState *)(intptr_t)state, a);
+}
+
+/*
+ * Provides the data area that the registers, heap and stacks are held in, so that the heap can be read directly.
+ * The data area is only valid until the machine is next reset.
+ *
+ * @param rmstate The machine state.
+ * @param top     Receives the number of cells in the data area.
+ *
+ * @return The cells of the data area.
+ */
+jcell *RM_API(GetDataArea)(rmMachineState *rmstate, jint *top)
+{
+     *top = TOP;
+
+     return rmstate->data;
+}
+
+/*
+ * Creates a direct byte buffer onto the data area that the registers, heap and stacks are held in, so that the
+ * heap can be read from Java without calling into the native machine for each cell. The buffer is only valid until
+ * the machine is next reset.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return A direct byte buffer onto the data area.
+ */
+JNIEXPORT jobject JNICALL RM_JNI(getDataArea)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     rmMachineState *rmstate = (rmMachineState *)(intptr_t)state;
+     jint top;
+     jcell *data = RM_API(GetDataArea)(rmstate, &top);
+
+     return (*env)->NewDirectByteBuffer(env, data, (jlong)top * sizeof(jcell));
+}
+
+/*
+ * Reports the size in bytes of the heap cells that this machine was built with, so that the data area can be read
+ * from Java with the matching cell layout.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return The size of a heap cell in bytes.
+ */
+JNIEXPORT jint JNICALL RM_JNI(getCellSize)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     return (jint)sizeof(jcell);
+}
+
+/*
+ * Reports the most heap cells that have been in use at once, since the machine was last reset. This is the larger of
+ * the current extent of the heap, and its extent before any garbage collection.
+ *
+ * @param rmstate The machine state.
+ *
+ * @return The peak number of heap cells in use.
+ */
+jint RM_API(GetHeapPeak)(rmMachineState *rmstate)
+{
+     return ((rmstate->hp > rmstate->hpPeak) ? rmstate->hp : rmstate->hpPeak) - HEAP_BASE;
+}
+
+/*
+ * Reports the most heap cells that have been in use at once, as for the C API.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return The peak number of heap cells in use.
+ */
+JNIEXPORT jint JNICALL RM_JNI(getHeapPeak)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     return RM_API(GetHeapPeak)((rmMachineState *)(intptr_t)state);
+}
+
+/*
+ * Provides the profile counters of the machine, laid out as described in profile.h. These stay in place for as long
+ * as the machine does, and are updated in place as it runs.
+ *
+ * @param rmstate The machine state.
+ *
+ * @return The profile counters, or <tt>NULL</tt> if profiling was not compiled in.
+ */
+jlong *RM_API(GetProfile)(rmMachineState *rmstate)
+{
+     return rmstate->profile;
+}
+
+/*
+ * Zeroes the profile counters of the machine. This does nothing if profiling was not compiled in.
+ *
+ * @param rmstate The machine state.
+ */
+void RM_API(ClearProfile)(rmMachineState *rmstate)
+{
+     if (rmstate->profile != NULL)
+     {
+          profileClear(rmstate->profile);
+     }
+}
+
+/*
+ * Creates a direct byte buffer onto the profile counters of the machine, so that they can be read from Java as they
+ * are updated, without calling into the native machine.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return A direct byte buffer onto the profile counters, or <tt>null</tt> if profiling was not compiled in.
+ */
+JNIEXPORT jobject JNICALL RM_JNI(getProfile)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     jlong *profile = RM_API(GetProfile)((rmMachineState *)(intptr_t)state);
+
+     return (profile != NULL) ? (*env)->NewDirectByteBuffer(env, profile, PROFILE_SIZE * sizeof(jlong)) : NULL;
+}
+
+/*
+ * Zeroes the profile counters of the machine, as for the C API.
+ *
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL RM_JNI(clearProfile)
+(JNIEnv * env, jobject obj, jlong state)
+{
+     RM_API(ClearProfile)((rmMachineState *)(intptr_t)state);
+}
+
+#endif /* _RESOLVINGMACHINE_H */
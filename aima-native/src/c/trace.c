@@ -1,12 +1,23 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "trace.h"
 
 /* Defines the addressing modes. */
 #define REG_ADDR 0x01
 #define STACK_ADDR 0x02
 
-/* A buffer to hold formatted trace statements in. */
-char traceBuffer[250];
+/* Defines the size of the buffer to format a trace statement in. */
+#define TRACE_LINE_SIZE 250
+
+/* Holds the current trace mode. */
+int traceMode = TRACE_UNSET;
+
+/* Holds the trace ring buffer, allocated when ring mode is first selected. */
+static traceEvent *traceRing;
+
+/* Holds the total number of events recorded into the ring buffer. */
+static unsigned int traceRingCount;
 
 /* A printf function that outputs to stderr instead of stdout. */
 void stderrPrintf(__const char *__restrict __format, ...)
@@ -14,61 +25,207 @@ void stderrPrintf(__const char *__restrict __format, ...)
      fprintf(stderr, __format);
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceIt(char* buffer)
+/*
+ * Formats a trace event as a line of text.
+ *
+ * @param event  The event to format.
+ * @param buffer The buffer to format the event into, at least TRACE_LINE_SIZE long.
+ */
+static void traceFormat(const traceEvent *event, char *buffer)
+{
+     switch (event->kind)
+     {
+     case TRACE_OP0:
+          snprintf(buffer, TRACE_LINE_SIZE, "%i: %s", event->ip, event->mnemonic);
+          break;
+
+     case TRACE_OP1:
+          snprintf(buffer, TRACE_LINE_SIZE, "%i: %s X%i", event->ip, event->mnemonic, event->arg1);
+          break;
+
+     case TRACE_OP2:
+          if (event->mode == REG_ADDR)
+          {
+               snprintf(buffer, TRACE_LINE_SIZE, "%i: %s X%i, A%i", event->ip, event->mnemonic, event->arg1,
+                        event->arg2);
+          }
+          else
+          {
+               snprintf(buffer, TRACE_LINE_SIZE, "%i: %s Y%i, A%i", event->ip, event->mnemonic,
+                        event->arg1 - event->arg3 - 3, event->arg2);
+          }
+          break;
+
+     case TRACE_FN0:
+     case TRACE_CONST:
+          snprintf(buffer, TRACE_LINE_SIZE, "%i: %s %i", event->ip, event->mnemonic, event->arg1);
+          break;
+
+     case TRACE_FN1:
+          snprintf(buffer, TRACE_LINE_SIZE, "%i: %s X%i,%i", event->ip, event->mnemonic, event->arg1, event->arg2);
+          break;
+
+     default:
+          snprintf(buffer, TRACE_LINE_SIZE, "%s", event->mnemonic);
+          break;
+     }
+}
+
+/* Dumps the ring buffer on exit, so that a trace of the last events is available after a run. */
+static void traceDumpAtExit()
 {
-     fprintf(stderr, "%s\n", buffer);
+     traceDump();
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace0(char* mnemonic, int ip)
+/* Sets the trace mode, allocating the ring buffer if it is needed. */
+void traceSetMode(int mode)
 {
-     sprintf(traceBuffer, "%i: %s", ip, mnemonic);
-     traceIt(traceBuffer);
+     if ((mode == TRACE_RING) && (traceRing == NULL))
+     {
+          traceRing = calloc(TRACE_RING_SIZE, sizeof(traceEvent));
+
+          if (traceRing == NULL)
+          {
+               mode = TRACE_OFF;
+          }
+          else
+          {
+               atexit(traceDumpAtExit);
+          }
+     }
+
+     traceMode = mode;
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace1(char* mnemonic, int ip, int reg1)
+/* Checks if tracing is enabled, resolving the trace mode from the environment the first time it is called. */
+int traceEnabled()
 {
-     sprintf(traceBuffer, "%i: %s X%i", ip, mnemonic, reg1);
-     traceIt(traceBuffer);
+     if (traceMode == TRACE_UNSET)
+     {
+          const char *mode = getenv("AIMA_NATIVE_TRACE");
+
+          if ((mode != NULL) && (strcmp(mode, "ring") == 0))
+          {
+               traceSetMode(TRACE_RING);
+          }
+          else if ((mode != NULL) && (strcmp(mode, "text") == 0))
+          {
+               traceSetMode(TRACE_TEXT);
+          }
+          else
+          {
+               traceSetMode(TRACE_OFF);
+          }
+     }
+
+     return traceMode != TRACE_OFF;
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace2(char* mnemonic, int ip, int reg1, signed char mode, int reg2, int ep)
+/* Writes out the events in the trace ring buffer to stderr, oldest first, and empties it. */
+void traceDump()
 {
-     int reg;
+     char buffer[TRACE_LINE_SIZE];
+     unsigned int i;
 
-     if (mode == REG_ADDR)
+     if (traceRing == NULL)
      {
-          sprintf(traceBuffer, "%i: %s X%i, A%i", ip, mnemonic, reg1, reg2);
+          return;
+     }
+
+     i = traceRingCount > TRACE_RING_SIZE ? traceRingCount - TRACE_RING_SIZE : 0;
+
+     for (; i < traceRingCount; i++)
+     {
+          traceFormat(&traceRing[i & (TRACE_RING_SIZE - 1)], buffer);
+          fprintf(stderr, "%s\n", buffer);
+     }
+
+     traceRingCount = 0;
+}
+
+/*
+ * Records a trace event, either into the ring buffer, or by writing it out as text.
+ *
+ * @param kind     The kind of the event.
+ * @param mnemonic The mnemonic or message of the event.
+ * @param ip       The instruction pointer at the event.
+ * @param arg1     The first argument of the event.
+ * @param arg2     The second argument of the event.
+ * @param arg3     The third argument of the event.
+ * @param mode     The addressing mode of the event.
+ */
+static void traceRecord(int kind, const char *mnemonic, int ip, int arg1, int arg2, int arg3, signed char mode)
+{
+     traceEvent event;
+     char buffer[TRACE_LINE_SIZE];
+
+     if (traceEnabled() == 0)
+     {
+          return;
+     }
+
+     event.kind = (unsigned char)kind;
+     event.mnemonic = mnemonic;
+     event.ip = ip;
+     event.arg1 = arg1;
+     event.arg2 = arg2;
+     event.arg3 = arg3;
+     event.mode = mode;
+
+     if (traceMode == TRACE_RING)
+     {
+#ifdef __GNUC__
+          unsigned int slot = __sync_fetch_and_add(&traceRingCount, 1);
+#else
+          unsigned int slot = traceRingCount++;
+#endif
+          traceRing[slot & (TRACE_RING_SIZE - 1)] = event;
      }
      else
      {
-          reg = (reg1 - ep - 3);
-          sprintf(traceBuffer, "%i: %s Y%i, A%i", ip, mnemonic, reg, reg2);
+          traceFormat(&event, buffer);
+          fprintf(stderr, "%s\n", buffer);
      }
+}
+
+/* Traces a message. */
+void traceMessage(char* buffer)
+{
+     traceRecord(TRACE_MESSAGE, buffer, 0, 0, 0, 0, 0);
+}
 
-     traceIt(traceBuffer);
+/* Traces an instruction with no arguments. */
+void traceEvent0(char* mnemonic, int ip)
+{
+     traceRecord(TRACE_OP0, mnemonic, ip, 0, 0, 0, 0);
+}
+
+/* Traces an instruction with a register argument. */
+void traceEvent1(char* mnemonic, int ip, int reg1)
+{
+     traceRecord(TRACE_OP1, mnemonic, ip, reg1, 0, 0, 0);
+}
+
+/* Traces an instruction with a register or stack variable argument and an argument register. */
+void traceEvent2(char* mnemonic, int ip, int reg1, signed char mode, int reg2, int ep)
+{
+     traceRecord(TRACE_OP2, mnemonic, ip, reg1, reg2, ep, mode);
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceFn0(char* mnemonic, int ip, int fn)
+/* Traces an instruction with a functor argument. */
+void traceEventFn0(char* mnemonic, int ip, int fn)
 {
-     sprintf(traceBuffer, "%i: %s %i", ip, mnemonic, fn);
-     traceIt(traceBuffer);
+     traceRecord(TRACE_FN0, mnemonic, ip, fn, 0, 0, 0);
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceFn1(char* mnemonic, int ip, int reg1, int fn)
+/* Traces an instruction with a register and a functor argument. */
+void traceEventFn1(char* mnemonic, int ip, int reg1, int fn)
 {
-     sprintf(traceBuffer, "%i: %s X%i,%i", ip, mnemonic, reg1, fn);
-     traceIt(traceBuffer);
+     traceRecord(TRACE_FN1, mnemonic, ip, reg1, fn, 0, 0);
 }
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceConst(char* mnemonic, int ip, int val)
+/* Traces an instruction with a constant argument. */
+void traceEventConst(char* mnemonic, int ip, int val)
 {
-     sprintf(traceBuffer, "%i: %s %i", ip, mnemonic, val);
-     traceIt(traceBuffer);
+     traceRecord(TRACE_CONST, mnemonic, ip, val, 0, 0, 0);
 }
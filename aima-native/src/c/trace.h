@@ -6,29 +6,117 @@
 extern "C" {
 #endif
 
+/*
+ * Tracing is only compiled in when building with NATIVE_TRACE defined; otherwise the trace macros expand to
+ * nothing, and cost nothing on the hot path. When compiled in, the mode is selected at runtime by the
+ * AIMA_NATIVE_TRACE environment variable, which may be 'ring' or 'text', or by calling traceSetMode. In ring mode
+ * each trace records a compact binary event into a preallocated ring buffer, which is formatted as text only when
+ * dumped. In text mode each trace is formatted and written to stderr immediately.
+ */
+
+/* Defines the trace modes. */
+#define TRACE_UNSET -1
+#define TRACE_OFF 0
+#define TRACE_RING 1
+#define TRACE_TEXT 2
+
+/* Defines the kinds of trace event, which determine how the event arguments are formatted. */
+#define TRACE_MESSAGE 0
+#define TRACE_OP0 1
+#define TRACE_OP1 2
+#define TRACE_OP2 3
+#define TRACE_FN0 4
+#define TRACE_FN1 5
+#define TRACE_CONST 6
+
+/* Defines the number of events held in the trace ring buffer. This must be a power of two. */
+#define TRACE_RING_SIZE 65536
+
+typedef struct
+{
+     /* Holds the mnemonic or message of the event. This must be a string constant. */
+     const char *mnemonic;
+
+     /* Holds the instruction pointer at the event. */
+     int ip;
+
+     /* Holds the arguments of the event. */
+     int arg1;
+     int arg2;
+     int arg3;
+
+     /* Holds the addressing mode of the event. */
+     signed char mode;
+
+     /* Holds the kind of the event. */
+     unsigned char kind;
+} traceEvent;
+
+/* Holds the current trace mode. */
+extern int traceMode;
+
 /* A printf function that outputs to stderr instead of stdout. */
 void stderrPrintf(__const char *__restrict __format, ...);
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceIt(char* buffer);
+/* Sets the trace mode, allocating the ring buffer if it is needed. */
+void traceSetMode(int mode);
+
+/* Checks if tracing is enabled, resolving the trace mode from the environment the first time it is called. */
+int traceEnabled();
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace0(char* mnemonic, int ip);
+/* Writes out the events in the trace ring buffer to stderr, oldest first, and empties it. */
+void traceDump();
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace1(char* mnemonic, int ip, int reg1);
+/* Traces a message. */
+void traceMessage(char* buffer);
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void trace2(char* mnemonic, int ip, int reg1, signed char mode, int reg2, int ep);
+/* Traces an instruction with no arguments. */
+void traceEvent0(char* mnemonic, int ip);
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceFn0(char* mnemonic, int ip, int fn);
+/* Traces an instruction with a register argument. */
+void traceEvent1(char* mnemonic, int ip, int reg1);
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceFn1(char* mnemonic, int ip, int reg1, int fn);
+/* Traces an instruction with a register or stack variable argument and an argument register. */
+void traceEvent2(char* mnemonic, int ip, int reg1, signed char mode, int reg2, int ep);
 
-/* Callback onto to 'trace' method of obj, for debugging purposes only. */
-void traceConst(char* mnemonic, int ip, int val);
+/* Traces an instruction with a functor argument. */
+void traceEventFn0(char* mnemonic, int ip, int fn);
+
+/* Traces an instruction with a register and a functor argument. */
+void traceEventFn1(char* mnemonic, int ip, int reg1, int fn);
+
+/* Traces an instruction with a constant argument. */
+void traceEventConst(char* mnemonic, int ip, int val);
+
+#ifdef NATIVE_TRACE
+
+/* Checks if tracing is enabled. */
+#define TRACE_ENABLED (traceEnabled())
+
+/* Defines the trace macros, which test the mode before making any call. */
+#define traceIt(buffer) do { if (traceMode != TRACE_OFF) traceMessage(buffer); } while (0)
+#define trace0(mnemonic, ip) do { if (traceMode != TRACE_OFF) traceEvent0(mnemonic, ip); } while (0)
+#define trace1(mnemonic, ip, reg1) do { if (traceMode != TRACE_OFF) traceEvent1(mnemonic, ip, reg1); } while (0)
+#define trace2(mnemonic, ip, reg1, mode, reg2, ep) \
+     do { if (traceMode != TRACE_OFF) traceEvent2(mnemonic, ip, reg1, mode, reg2, ep); } while (0)
+#define traceFn0(mnemonic, ip, fn) do { if (traceMode != TRACE_OFF) traceEventFn0(mnemonic, ip, fn); } while (0)
+#define traceFn1(mnemonic, ip, reg1, fn) \
+     do { if (traceMode != TRACE_OFF) traceEventFn1(mnemonic, ip, reg1, fn); } while (0)
+#define traceConst(mnemonic, ip, val) do { if (traceMode != TRACE_OFF) traceEventConst(mnemonic, ip, val); } while (0)
+
+#else
+
+#define TRACE_ENABLED 0
+
+#define traceIt(buffer) ((void)0)
+#define trace0(mnemonic, ip) ((void)0)
+#define trace1(mnemonic, ip, reg1) ((void)0)
+#define trace2(mnemonic, ip, reg1, mode, reg2, ep) ((void)0)
+#define traceFn0(mnemonic, ip, fn) ((void)0)
+#define traceFn1(mnemonic, ip, reg1, fn) ((void)0)
+#define traceConst(mnemonic, ip, val) ((void)0)
+
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,2955 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine.h"
+#include "trace.h"
+#include "dispatch.h"
+#include "dataarea.h"
+
+#ifdef DATA_AREA_GUARDED
+#include <pthread.h>
+#include <sched.h>
+
+/* Used to check if the OR-parallel search is compiled in. It needs threads, which come with the guarded data areas. */
+#define WAM_PARALLEL
+#endif
+
+/* Defines the machine instruction types. */
+#define PUT_STRUC 0x01
+#define SET_VAR 0x02
+#define SET_VAL 0x03
+#define GET_STRUC 0x04
+#define UNIFY_VAR 0x05
+#define UNIFY_VAL 0x06
+#define PUT_VAR 0x07
+#define PUT_VAL 0x08
+#define GET_VAR 0x09
+#define GET_VAL 0x0a
+#define CALL 0x0b
+#define PROCEED 0x0c
+#define ALLOCATE_N 0x0d
+#define DEALLOCATE 0x0e
+#define TRY_ME_ELSE 0x0f
+#define RETRY_ME_ELSE 0x10
+#define TRUST_ME 0x11
+#define PUT_CONST 0x12
+#define GET_CONST 0x13
+#define SET_CONST 0x14
+#define UNIFY_CONST 0x15
+#define PUT_LIST 0x16
+#define GET_LIST 0x17
+#define SET_VOID 0x18
+#define UNIFY_VOID 0x19
+#define EXECUTE 0x1a
+#define ALLOCATE 0x1b
+#define PUT_UNSAFE_VAL 0x1c
+#define SET_LOCAL_VAL 0x1d
+#define UNIFY_LOCAL_VAL 0x1e
+#define TRY 0x1f
+#define RETRY 0x20
+#define TRUST 0x21
+#define SWITCH_ON_TERM 0x22
+#define SWITCH_ON_CONST 0x23
+#define SWITCH_ON_STRUC 0x24
+#define NECK_CUT 0x25
+#define GET_LEVEL 0x26
+#define CUT 0x27
+#define CONTINUE 0x28
+#define NO_OP 0x29
+#define CALL_INTERNAL 0x2a
+#define SUSPEND 0x7f
+
+/* Defines the addressing modes. */
+#define REG_ADDR 0x01
+#define STACK_ADDR 0x02
+
+/* Defines the heap cell marker types. */
+#define REF 0x00
+#define STR 0x01
+#define CON 0x02
+#define LIS 0x03
+
+/* Defines the ids of the internal functions. These must match the ids registered in the call table by Java. */
+#define CALL_1_ID 1
+#define EXECUTE_1_ID 2
+
+/* Defines the shift to apply to a heap cell to extract its tag. */
+#define TSHIFT 30
+
+/* Defines the mask to apply to a heap cell to extract its address. */
+#define AMASK 0x3FFFFFFF
+
+/* Defines the mask to apply to a heap cell to extract the constant it holds. */
+#define CMASK 0xFFFFFFF
+
+/* Defines the regions of the data area, in the order in which they are laid out. */
+#define REG_REGION 0
+#define HEAP_REGION 1
+#define STACK_REGION 2
+#define TRAIL_REGION 3
+#define PDL_REGION 4
+#define REGION_COUNT 5
+
+/* Defines the limit of the data area, as heap cells hold 30 bit addresses. */
+#define ADDR_LIMIT (AMASK + 1)
+
+/* Defines the offset of the first register in the data area. */
+#define REG_BASE (wamstate->area.base[REG_REGION])
+
+/* Defines the offset of the base of the heap in the data area. */
+#define HEAP_BASE (wamstate->area.base[HEAP_REGION])
+
+/* Defines the offset of the base of the stack in the data area. */
+#define STACK_BASE (wamstate->area.base[STACK_REGION])
+
+/* Defines the offset of the base of the trail in the data area. */
+#define TRAIL_BASE (wamstate->area.base[TRAIL_REGION])
+
+/* Defines the offset of the base of the PDL in the data area. */
+#define PDL_BASE (wamstate->area.base[PDL_REGION])
+
+/* Defines the highest address in the data area of the virtual machine. */
+#define TOP (wamstate->area.top)
+
+/* Defines the alternative held in a choice point once all of its alternatives have been given to other workers. */
+#define NO_ALTERNATIVE -1
+
+/* Defines the most worker threads that a parallel search may use. */
+#define WAM_MAX_WORKERS 64
+
+/* Defines the number of solutions that a parallel search holds, before its workers wait for them to be taken. */
+#define WAM_SOLUTION_QUEUE 64
+
+/* Holds a worker thread of a parallel search. */
+typedef struct wamWorker wamWorker;
+
+/* Holds a parallel search in progress. */
+typedef struct wamSearch wamSearch;
+
+typedef struct
+{
+     /* Holds the current instruction pointer into the code. */
+     jint ip;
+
+     /* Holds the current continuation point. */
+     jint cp;
+
+     /* Holds the enire data segment of the machine. All registers, heaps and stacks are held in here. */
+     jint *data;
+
+     /* Holds the layout and memory reservation of the data segment. */
+     dataArea area;
+
+     /* Holds the heap pointer. */
+     jint hp;
+
+     /* Holds the top of heap at the latest choice point. */
+     jint hbp;
+
+     /* Holds the secondary heap pointer, used for the heap address of the next term to match. */
+     jint sp;
+
+     /* Holds the unification stack pointer. */
+     jint up;
+
+     /* Holds the environment base pointer. */
+     jint ep;
+
+     /* Holds the choice point base pointer. */
+     jint bp;
+
+     /* Holds the last call choice point pointer. */
+     jint b0;
+
+     /* Holds the trail pointer. */
+     jint trp;
+
+     /* Used to record whether the machine is in structure read or write mode. */
+     jboolean writeMode;
+
+     /* Holds the heap cell tag from the most recent dereference. */
+     jbyte derefTag;
+
+     /* Holds the heap call value from the most recent dereference. */
+     jint derefVal;
+
+     /* Indicates that the machine has been suspended, upon finding a solution. */
+     jboolean suspended;
+
+     /* Holds the number of worker threads to search with, or zero or one to search sequentially. */
+     jint workers;
+
+     /* Holds the parallel search in progress on the machine, if any. */
+     wamSearch *search;
+
+     /* Holds the worker that this state belongs to, when it is one of the workers of a parallel search. */
+     wamWorker *worker;
+} wamMachineState;
+
+/*
+ * Creates a heap cell contents containing a reference.
+ *
+ * @param addr The references address.
+ *
+ * @return The heap cell contents containing the reference.
+ */
+jint wamRefTo(jint addr)
+{
+     return (jint)(((unsigned int)REF << TSHIFT) | (addr & AMASK));
+}
+
+/*
+ * Creates a heap cell contents containing a structure tag, and the address of the structure.
+ *
+ * @param addr The address of the structure.
+ *
+ * @return The heap cell contents referencing the structure.
+ */
+jint wamStructureAt(jint addr)
+{
+     return (jint)(((unsigned int)STR << TSHIFT) | (addr & AMASK));
+}
+
+/*
+ * Creates a heap cell contents containing a constant.
+ *
+ * @param fn The functor name and arity of the constant. Arity should always be zero.
+ *
+ * @return The heap cell contents containing the constant.
+ */
+jint wamConstantCell(jint fn)
+{
+     return (jint)(((unsigned int)CON << TSHIFT) | (fn & CMASK));
+}
+
+/*
+ * Creates a heap cell contents containing a list pointer.
+ *
+ * @param addr The address of the list contents.
+ *
+ * @return The heap cell contents containing the list pointer.
+ */
+jint wamListCell(jint addr)
+{
+     return (jint)(((unsigned int)LIS << TSHIFT) | (addr & AMASK));
+}
+
+/*
+ * Extracts the tag from a heap cell.
+ *
+ * @param cell The heap cell contents.
+ *
+ * @return The tag of the heap cell.
+ */
+jbyte wamTagOf(jint cell)
+{
+     return (jbyte)(((unsigned int)cell) >> TSHIFT);
+}
+
+/*
+ * Pushes a value onto the unification stack.
+ *
+ * @param wamstate The machine state.
+ * @param val      The value to push onto the stack.
+ */
+void wamuPush(wamMachineState *wamstate, jint val)
+{
+     wamstate->data[--(wamstate->up)] = val;
+}
+
+/*
+ * Pops a value from the unification stack.
+ *
+ * @param wamstate The machine state.
+ *
+ * @return The top value from the unification stack.
+ */
+jint wamuPop(wamMachineState *wamstate)
+{
+     return wamstate->data[(wamstate->up)++];
+}
+
+/*
+ * Clears the unification stack.
+ *
+ * @param wamstate The machine state.
+ */
+void wamuClear(wamMachineState *wamstate)
+{
+     wamstate->up = TOP;
+}
+
+/*
+ * Checks if the unification stack is empty.
+ *
+ * @param wamstate The machine state.
+ *
+ * @return <tt>true</tt> if the unification stack is empty, <tt>false</tt> otherwise.
+ */
+jboolean wamuEmpty(wamMachineState *wamstate)
+{
+     return wamstate->up >= TOP ? JNI_TRUE : JNI_FALSE;
+}
+
+/*
+ * Dereferences a heap pointer (or register), returning the address that it refers to after following all
+ * reference chains to their conclusion. This method is also side effecting, in that the contents of the
+ * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
+ *
+ * @param wamstate The machine state.
+ * @param a        The address to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+jint wamderef(wamMachineState *wamstate, jint a)
+{
+     jint addr;
+     jint tmp;
+     jbyte derefTag;
+     jint derefVal;
+
+     // tag, value <- STORE[a]
+     addr = a;
+     tmp = wamstate->data[a];
+     derefTag = wamTagOf(tmp);
+     derefVal = tmp & AMASK;
+
+     // while tag = REF and value != a
+     while ((derefTag == REF))
+     {
+          // tag, value <- STORE[a]
+          addr = derefVal;
+          tmp = wamstate->data[derefVal];
+          derefTag = wamTagOf(tmp);
+          tmp = tmp & AMASK;
+
+          // Break on free var.
+          if (derefVal == tmp)
+          {
+               break;
+          }
+
+          derefVal = tmp;
+     }
+
+     wamstate->derefTag = derefTag;
+     wamstate->derefVal = derefVal;
+
+     return addr;
+}
+
+/*
+ * Computes the start of the next stack frame. This depends on whether the most recent stack frame is an environment
+ * frame or a choice point frame, as these have different sizes. The size of the most recent type of frame is
+ * computed and added to the current frame pointer to give the start of the next frame.
+ *
+ * @param wamstate The machine state.
+ *
+ * @return The start of the next stack frame.
+ */
+jint wamNextStackFrame(wamMachineState *wamstate)
+{
+     jint ep = wamstate->ep;
+     jint bp = wamstate->bp;
+
+     // if E > B
+     // then newB <- E + STACK[E + 2] + 3
+     // else newB <- B + STACK[B] + 7
+     if (ep == bp)
+     {
+          return STACK_BASE;
+     }
+     else if (ep > bp)
+     {
+          return ep + wamstate->data[ep + 2] + 3;
+     }
+     else
+     {
+          return bp + wamstate->data[bp] + 8;
+     }
+}
+
+/*
+ * Records the address of a binding onto the 'trail'. The trail pointer is advanced by one as part of this
+ * operation.
+ *
+ * @param wamstate The machine state.
+ * @param addr     The binding address to add to the trail.
+ */
+void wamTrail(wamMachineState *wamstate, jint addr)
+{
+     // if (a < HB) \/ ((H < a) /\ (a < B))
+     if ((addr < wamstate->hbp) || ((wamstate->hp < addr) && (addr < wamstate->bp)))
+     {
+          //  TRAIL[TR] <- a
+          wamstate->data[wamstate->trp] = addr;
+
+          //  TR <- TR + 1
+          wamstate->trp++;
+     }
+}
+
+/*
+ * Undoes variable bindings that have been recorded on the 'trail'. Addresses recorded on the trail are reset to
+ * REF to self.
+ *
+ * @param wamstate The machine state.
+ * @param a1       The start address within the trail to get the first binding address to clear.
+ * @param a2       The end address within the trail, this is one higher than the last address to clear.
+ */
+void wamUnwindTrail(wamMachineState *wamstate, jint a1, jint a2)
+{
+     jint addr;
+
+     // for i <- a1 to a2 - 1 do
+     for (addr = a1; addr < a2; addr++)
+     {
+          //  STORE[TRAIL[i]] <- <REF, TRAIL[i]>
+          jint tmp = wamstate->data[addr];
+          wamstate->data[tmp] = wamRefTo(tmp);
+     }
+}
+
+/*
+ * Tidies trail when a choice point is being discarded, and a previous choice point it being made the current
+ * one.
+ *
+ * Copies trail bindings created since the choice point, into the trail as known to the previous choice point.
+ * That is bindings on the heap created during the choice point (between HB and H).
+ *
+ * @param wamstate The machine state.
+ */
+void wamTidyTrail(wamMachineState *wamstate)
+{
+     jint i;
+     jint bp = wamstate->bp;
+
+     // Check that there is a current choice point to tidy down to, otherwise tidy down to the root of the trail.
+     if (bp == 0)
+     {
+          i = TRAIL_BASE;
+     }
+     else
+     {
+          i = wamstate->data[bp + wamstate->data[bp] + 5];
+     }
+
+     while (i < wamstate->trp)
+     {
+          jint addr = wamstate->data[i];
+
+          if ((addr < wamstate->hbp) || ((wamstate->hp < addr) && (addr < bp)))
+          {
+               i++;
+          }
+          else
+          {
+               wamstate->data[i] = wamstate->data[wamstate->trp - 1];
+               wamstate->trp--;
+          }
+     }
+}
+
+/*
+ * Creates a binding of one variable onto another. One of the supplied addresses must be an unbound variable. If
+ * both are unbound variables, the higher (newer) address is bound to the lower (older) one.
+ *
+ * @param wamstate The machine state.
+ * @param a1       The address of the first potential unbound variable to bind.
+ * @param a2       The address of the second potential unbound variable to bind.
+ */
+void wamBind(wamMachineState *wamstate, jint a1, jint a2)
+{
+     // <t1, _> <- STORE[a1]
+     jbyte t1 = wamTagOf(wamstate->data[a1]);
+
+     // <t2, _> <- STORE[a2]
+     jbyte t2 = wamTagOf(wamstate->data[a2]);
+
+     // if (t1 = REF) /\ ((t2 != REF) \/ (a2 < a1))
+     if ((t1 == REF) && ((t2 != REF) || (a2 < a1)))
+     {
+          //  STORE[a1] <- STORE[a2]
+          wamstate->data[a1] = wamstate->data[a2];
+
+          //  trail(a1)
+          wamTrail(wamstate, a1);
+     }
+     else if (t2 == REF)
+     {
+          //  STORE[a2] <- STORE[a1]
+          wamstate->data[a2] = wamstate->data[a1];
+
+          //  tail(a2)
+          wamTrail(wamstate, a2);
+     }
+}
+
+/*
+ * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
+ * element by element, free references become bound.
+ *
+ * @param wamstate The machine state.
+ * @param a1       The address of the first structure or reference.
+ * @param a2       The address of the second structure or reference.
+ *
+ * @return <tt>true</tt> if the two structures unify, <tt>false</tt> otherwise.
+ */
+jboolean wamunify(wamMachineState *wamstate, jint a1, jint a2)
+{
+     jboolean fail;
+
+     // pdl.push(a1)
+     // pdl.push(a2)
+     wamuPush(wamstate, a1);
+     wamuPush(wamstate, a2);
+
+     // fail <- false
+     fail = JNI_FALSE;
+
+     // while !empty(PDL) and not failed
+     while (wamuEmpty(wamstate) == JNI_FALSE && !fail)
+     {
+          // d1 <- deref(pdl.pop())
+          // d2 <- deref(pdl.pop())
+          // t1, v1 <- STORE[d1]
+          // t2, v2 <- STORE[d2]
+          jint d1 = wamderef(wamstate, wamuPop(wamstate));
+          jint t1 = wamstate->derefTag;
+          jint v1 = wamstate->derefVal;
+
+          jint d2 = wamderef(wamstate, wamuPop(wamstate));
+          jint t2 = wamstate->derefTag;
+          jint v2 = wamstate->derefVal;
+
+          // if (d1 != d2)
+          if (d1 != d2)
+          {
+               // if (t1 = REF or t2 = REF)
+               // bind(d1, d2)
+               if ((t1 == REF) || (t2 == REF))
+               {
+                    wamBind(wamstate, d1, d2);
+               }
+               else if (t2 == STR)
+               {
+                    // f1/n1 <- STORE[v1]
+                    // f2/n2 <- STORE[v2]
+                    jint fn1 = wamstate->data[v1];
+                    jint fn2 = wamstate->data[v2];
+                    jint n1 = (jint)(((unsigned int)fn1) >> 24);
+
+                    // if f1 = f2 and n1 = n2
+                    if ((t1 == STR) && (fn1 == fn2))
+                    {
+                         // for i <- 1 to n1
+                         jint i;
+                         for (i = 1; i <= n1; i++)
+                         {
+                              // pdl.push(v1 + i)
+                              // pdl.push(v2 + i)
+                              wamuPush(wamstate, v1 + i);
+                              wamuPush(wamstate, v2 + i);
+                         }
+                    }
+                    else
+                    {
+                         // fail <- true
+                         fail = JNI_TRUE;
+                    }
+               }
+               else if (t2 == CON)
+               {
+                    if ((t1 != CON) || (v1 != v2))
+                    {
+                         fail = JNI_TRUE;
+                    }
+               }
+               else if (t2 == LIS)
+               {
+                    if (t1 != LIS)
+                    {
+                         fail = JNI_TRUE;
+                    }
+                    else
+                    {
+                         wamuPush(wamstate, v1);
+                         wamuPush(wamstate, v2);
+                         wamuPush(wamstate, v1 + 1);
+                         wamuPush(wamstate, v2 + 1);
+                    }
+               }
+          }
+     }
+
+     return fail == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+}
+
+/*
+ * A simplified unification algorithm, for unifying against a constant.
+ *
+ * Attempts to unify a constant or references on the heap, with a constant. If the address leads to a free
+ * variable on dereferencing, the variable is bound to the constant. If the address leads to a constant it is
+ * compared with the passed in constant for equality, and unification succeeds when they are equal.
+ *
+ * @param wamstate The machine state.
+ * @param fn       The constant to unify with.
+ * @param addr     The address of the first constant or reference.
+ *
+ * @return <tt>true</tt> if the two constant unify, <tt>false</tt> otherwise.
+ */
+jboolean wamunifyConst(wamMachineState *wamstate, jint fn, jint addr)
+{
+     jint deref = wamderef(wamstate, addr);
+
+     // case STORE[addr] of
+     switch (wamstate->derefTag)
+     {
+     case REF:
+     {
+          // <REF, _> :
+          // STORE[addr] <- <CON, c>
+          wamstate->data[deref] = wamConstantCell(fn);
+
+          // trail(addr)
+          wamTrail(wamstate, deref);
+
+          return JNI_TRUE;
+     }
+     case CON:
+     {
+          // <CON, c'> :
+          // fail <- (c != c');
+          return (wamstate->derefVal == fn) ? JNI_TRUE : JNI_FALSE;
+     }
+     default:
+     {
+          // other: fail <- true;
+          return JNI_FALSE;
+     }
+     }
+}
+
+/*
+ * Backtracks to the continuation label stored in the current choice point frame, if there is one. Otherwise
+ * returns a fail to indicate that there are no more choice points, so no backtracking can be done.
+ *
+ * @param wamstate The machine state.
+ *
+ * @return <tt>true</tt> iff this is the final failure, and there are no more choice points.
+ */
+jboolean wamBacktrack(wamMachineState *wamstate)
+{
+     jint bp = wamstate->bp;
+
+     // Skip over any choice points whose alternatives have all been given to other workers of a parallel search.
+     while ((bp != 0) && (wamstate->data[bp + wamstate->data[bp] + 4] == NO_ALTERNATIVE))
+     {
+          // B <- STACK[B + n + 3]
+          bp = wamstate->data[bp + wamstate->data[bp] + 3];
+          wamstate->bp = bp;
+     }
+
+     // if B = bottom_of_stack
+     if (bp == 0)
+     {
+          //  then fail_and_exit_program
+          return JNI_TRUE;
+     }
+     else
+     {
+          // B0 <- STACK[B + STACK[B} + 7]
+          wamstate->b0 = wamstate->data[bp + wamstate->data[bp] + 7];
+
+          // P <- STACK[B + STACK[B] + 4]
+          wamstate->ip = wamstate->data[bp + wamstate->data[bp] + 4];
+
+          return JNI_FALSE;
+     }
+}
+
+/*
+ * Builds a choice point frame on the stack, for the TRY_ME_ELSE and TRY instructions.
+ *
+ * @param wamstate The machine state.
+ * @param n        The number of argument registers to save in the choice point.
+ * @param l        The address of the next clause to try on backtracking.
+ */
+void wamPushChoicePoint(wamMachineState *wamstate, jint n, jint l)
+{
+     jint i;
+     jint *data = wamstate->data;
+
+     // if E > B
+     //  then newB <- E + STACK[E + 2] + 3
+     // else newB <- B + STACK[B] + 7
+     jint esp = wamNextStackFrame(wamstate);
+
+     // STACK[newB] <- num_of_args
+     // n <- STACK[newB]
+     data[esp] = n;
+
+     // for i <- 1 to n do STACK[newB + i] <- Ai
+     for (i = 0; i < n; i++)
+     {
+          data[esp + i + 1] = data[i];
+     }
+
+     // STACK[newB + n + 1] <- E
+     data[esp + n + 1] = wamstate->ep;
+
+     // STACK[newB + n + 2] <- CP
+     data[esp + n + 2] = wamstate->cp;
+
+     // STACK[newB + n + 3] <- B
+     data[esp + n + 3] = wamstate->bp;
+
+     // STACK[newB + n + 4] <- L
+     data[esp + n + 4] = l;
+
+     // STACK[newB + n + 5] <- TR
+     data[esp + n + 5] = wamstate->trp;
+
+     // STACK[newB + n + 6] <- H
+     data[esp + n + 6] = wamstate->hp;
+
+     // STACK[newB + n + 7] <- B0
+     data[esp + n + 7] = wamstate->b0;
+
+     // B <- new B
+     wamstate->bp = esp;
+
+     // HB <- H
+     wamstate->hbp = wamstate->hp;
+}
+
+/*
+ * Restores the machine registers from the current choice point frame, for the RETRY_ME_ELSE, TRUST_ME, RETRY and
+ * TRUST instructions. The trail is unwound back to the choice point, and the heap discarded back to it.
+ *
+ * @param wamstate The machine state.
+ */
+void wamRestoreChoicePoint(wamMachineState *wamstate)
+{
+     jint i;
+     jint *data = wamstate->data;
+     jint bp = wamstate->bp;
+
+     // n <- STACK[B]
+     jint n = data[bp];
+
+     // for i <- 1 to n do Ai <- STACK[B + i]
+     for (i = 0; i < n; i++)
+     {
+          data[i] = data[bp + i + 1];
+     }
+
+     // E <- STACK[B + n + 1]
+     wamstate->ep = data[bp + n + 1];
+
+     // CP <- STACK[B + n + 2]
+     wamstate->cp = data[bp + n + 2];
+
+     // unwind_trail(STACK[B + n + 5], TR)
+     wamUnwindTrail(wamstate, data[bp + n + 5], wamstate->trp);
+
+     // TR <- STACK[B + n + 5]
+     wamstate->trp = data[bp + n + 5];
+
+     // H <- STACK[B + n + 6]
+     wamstate->hp = data[bp + n + 6];
+
+     // HB <- H
+     wamstate->hbp = wamstate->hp;
+}
+
+/*
+ * Reads a jint out of the code buffer, where it need not be aligned.
+ *
+ * @param code The code buffer.
+ * @param at   The offset of the jint.
+ *
+ * @return The jint.
+ */
+static jint wamGetInt(jbyte *code, jint at)
+{
+     jint value;
+
+     memcpy(&value, code + at, sizeof(jint));
+
+     return value;
+}
+
+/*
+ * Looks up a value (an interned name referring to a constant or structure), in the hash table of size n referred
+ * to.
+ *
+ * The table is laid out in the code buffer by IntIntOpenLinearTable, and this must probe it in the same way. It holds
+ * the largest power of two number of entries that fits in n bytes, each entry being a key followed by the address of
+ * its branch, and a key of zero marks an empty entry. Keys are hashed by the golden ratio and reduced to an entry by
+ * masking, and a collision moves on to the next entry, wrapping around the end of the table.
+ *
+ * @param code The code buffer holding the hash table.
+ * @param val  The value to look up.
+ * @param t    The offset of the start of the hash table.
+ * @param n    The size of the hash table in bytes.
+ *
+ * @return <tt>0</tt> iff no match is found, or a pointer into the code area of the matching branch.
+ */
+jint wamGetHash(jbyte *code, jint val, jint t, jint n)
+{
+     jint size = n >> 3;
+     jint mask;
+     jint probes;
+     unsigned int h;
+
+     if (size <= 0)
+     {
+          return 0;
+     }
+
+     // mask <- highest one bit of size - 1
+     mask = size;
+     mask |= mask >> 1;
+     mask |= mask >> 2;
+     mask |= mask >> 4;
+     mask |= mask >> 8;
+     mask |= mask >> 16;
+     mask >>= 1;
+
+     h = (unsigned int)val * 0x9E3779B9u;
+     h ^= h >> 16;
+
+     for (probes = 0; probes <= mask; probes++)
+     {
+          jint entry = t + ((h & mask) << 3);
+          jint key = wamGetInt(code, entry);
+
+          if (key == val)
+          {
+               return wamGetInt(code, entry + 4);
+          }
+
+          if (key == 0)
+          {
+               return 0;
+          }
+
+          h++;
+     }
+
+     return 0;
+}
+
+/*
+ * Sets up the registers to make a call, for implementing call/1. The first register should reference a structure
+ * to be turned into a predicate call. The arguments of this structure will be set up in the registers, and the
+ * entry point of the predicate to call will be returned.
+ *
+ * The entry point is resolved by calling back onto the Java machine, which holds the call table.
+ *
+ * @param wamstate The machine state.
+ * @param env      The native code execution environment.
+ * @param obj      The object that is the context to this native method.
+ *
+ * @return The entry address of the predicate to call, or <tt>-1</tt> if the call cannot be resolved to a known
+ *         predicate.
+ */
+jint wamSetupCall_1(wamMachineState *wamstate, JNIEnv * env, jobject obj)
+{
+     jint fn;
+     jint f;
+     jint pn;
+     jint arity;
+     jint i;
+     jint val;
+     jclass cls;
+     jmethodID mid;
+
+     // Get X0.
+     wamderef(wamstate, 0);
+     val = wamstate->derefVal;
+
+     // Check it points to a structure.
+     if (wamstate->derefTag == STR)
+     {
+          fn = wamstate->data[val];
+     }
+     else if (wamstate->derefTag == CON)
+     {
+          fn = val;
+     }
+     else
+     {
+          return -1;
+     }
+
+     // Look up the call point of the matching functor.
+     f = fn & 0x00ffffff;
+
+     cls = (*env)->GetObjectClass(env, obj);
+     mid = (*env)->GetMethodID(env, cls, "resolveCallPointEntry", "(I)I");
+
+     if (mid == NULL)
+     {
+          return -1;
+     }
+
+     pn = (*env)->CallIntMethod(env, obj, mid, f);
+
+     if (pn == -1)
+     {
+          return -1;
+     }
+
+     // Set registers X0... to ref to args...
+     arity = (jint)(((unsigned int)fn) >> 24);
+
+     for (i = 0; i < arity; i++)
+     {
+          wamstate->data[i] = wamRefTo(val + 1 + i);
+     }
+
+     return pn;
+}
+
+/*
+ * Puts the machines registers into their initial state, with empty heap, stacks and trail.
+ *
+ * @param wamstate The machine state.
+ */
+void wamInitRegisters(wamMachineState *wamstate)
+{
+     // Registers are on the top of the data area, the heap comes next.
+     wamstate->hp = HEAP_BASE;
+     wamstate->hbp = HEAP_BASE;
+     wamstate->sp = HEAP_BASE;
+
+     // The stack comes after the heap. Pointers are zero initially, since no stack frames exist yet.
+     wamstate->ep = 0;
+     wamstate->bp = 0;
+     wamstate->b0 = 0;
+
+     // The trail comes after the stack.
+     wamstate->trp = TRAIL_BASE;
+
+     // The unification stack (PDL) is a push down stack at the end of the data area.
+     wamstate->up = TOP;
+
+     // Turn off write mode.
+     wamstate->writeMode = JNI_FALSE;
+
+     // Reset the instruction pointer to that start of the code area.
+     wamstate->ip = 0;
+     wamstate->cp = 0;
+
+     // Could probably not bother resetting these, but will do it anyway just to be sure.
+     wamstate->derefTag = 0;
+     wamstate->derefVal = 0;
+
+     // The machine is initially not suspended.
+     wamstate->suspended = JNI_FALSE;
+}
+
+/*
+ * Notified whenever code is added to the machine. This provides a hook in point at which the machine may,
+ * if required, compile the code down below the byte code level.
+ *
+ * @param state      A handle onto the machine state.
+ * @param codeBuffer The code buffer.
+ * @param codeOffset The start offset of the new code.
+ * @param length     The length of the new code.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_codeAdded
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset, jint length)
+{
+}
+
+#ifdef WAM_PARALLEL
+
+/*
+ * A parallel search runs a query on a number of worker threads at once, exploring the alternative clauses of its
+ * choice points side by side. Each worker has its own data area, laid out the same way as the machines, so that a
+ * copy of the cells of one worker means the same thing on any other. The first worker starts on a copy of the
+ * machine, and the others start out idle.
+ *
+ * An idle worker asks a busy one for work, and the busy one gives it away at its next call. It finds its oldest
+ * choice point that still has an alternative left, copies the cells that the choice point depends on over to the
+ * idle worker, and gives it the next alternative in the choice point, moving its own choice point on past that
+ * alternative. The oldest choice point is chosen, as the alternatives closest to the root of the search tend to hold
+ * the most work. The idle worker undoes the bindings made since the choice point from the trail, as it would on
+ * backtracking, and runs the alternative that it was given as if it were the last one. Choice points with no
+ * alternatives left after being shared out are skipped over on backtracking.
+ *
+ * Solutions are copied out of the worker that finds them into a queue, and taken from it by the machine on each
+ * execution, which copies the solution into its own heap and stack to be read back from there. Solutions arrive in
+ * no particular order. Cuts only prune the choice points of the worker that executes them, so alternatives that
+ * have already been given to other workers are still explored. The search is meant for pure search over alternative
+ * clauses, where every solution is wanted.
+ *
+ * Work is asked for and given under a single lock per search, rather than through lock free deques of choice
+ * points; the choice points live in the stack of the worker that made them, and only that worker can safely read its
+ * stack while it runs, so it has to hand them out itself at a point between instructions anyway.
+ */
+
+/* Defines the states of a request for work made by an idle worker. */
+#define SHARE_PENDING 0
+#define SHARE_GIVEN 1
+#define SHARE_REFUSED 2
+
+typedef struct
+{
+     /* Holds the number of heap cells in the solution, copied from the base of the heap. */
+     jint heapCells;
+
+     /* Holds the number of stack cells in the solution, copied from the base of the stack. */
+     jint stackCells;
+
+     /* Holds the environment frame of the query, through which the variables of the query are read. */
+     jint ep;
+
+     /* Holds the heap cells, followed by the stack cells. */
+     jint cells[];
+} wamSolution;
+
+struct wamWorker
+{
+     /* Holds the machine state that the worker searches on, with its own data area. */
+     wamMachineState state;
+
+     /* Holds the search that the worker belongs to. */
+     wamSearch *search;
+
+     /* Holds the thread that the worker runs on. */
+     pthread_t thread;
+
+     /* Holds the index of the worker in the search. */
+     int index;
+
+     /* Indicates that the worker has run out of work, and is looking for more. */
+     jboolean idle;
+
+     /* Holds one plus the index of an idle worker that has asked this one for work, or zero if none has. */
+     volatile int request;
+
+     /* Holds the state of the latest request for work made by this worker. */
+     int share;
+};
+
+struct wamSearch
+{
+     /* Holds the virtual machine that the workers attach to, to resolve call/1 through the Java machine. */
+     JavaVM *vm;
+
+     /* Holds a global reference to the Java machine. */
+     jobject object;
+
+     /* Holds the byte code being searched. */
+     jbyte *code;
+
+     /* Holds the length of the byte code. */
+     jsize length;
+
+     /* Holds the offset within the byte code that the query starts at. */
+     jint offset;
+
+     /* Holds the workers. */
+     wamWorker *workers;
+
+     /* Holds the number of workers. */
+     int count;
+
+     /* Holds the number of workers that were started on threads. */
+     int started;
+
+     /* Holds the number of idle workers. */
+     int idle;
+
+     /* Indicates that every worker has run out of work, so the search is complete. */
+     jboolean done;
+
+     /* Indicates that a worker could not carry on, having run out of space, which fails the whole search. */
+     jboolean failed;
+
+     /* Indicates that the search is being stopped. */
+     volatile jboolean cancelled;
+
+     /* Holds the solutions found and not yet taken, as a circular queue. */
+     wamSolution *queue[WAM_SOLUTION_QUEUE];
+
+     /* Holds the position of the first solution in the queue. */
+     int head;
+
+     /* Holds the number of solutions in the queue. */
+     int size;
+
+     /* Used to guard all of the above, and the idle and request state of the workers. */
+     pthread_mutex_t lock;
+
+     /* Used to signal any change in the state of the search. */
+     pthread_cond_t changed;
+};
+
+/*
+ * Copies the cells from the base of a region of one machine up to an offset, into the same place in another
+ * machine with the same layout.
+ *
+ * @param to     The machine state to copy to.
+ * @param from   The machine state to copy from.
+ * @param region The region to copy.
+ * @param end    The offset one past the last cell to copy.
+ */
+static void wamCopyRegion(wamMachineState *to, wamMachineState *from, int region, jint end)
+{
+     jint start = from->area.base[region];
+
+     if (end > start)
+     {
+          memcpy(to->data + start, from->data + start, (end - start) * sizeof(jint));
+     }
+}
+
+/*
+ * Answers a request for work from an idle worker, giving it the next alternative of the oldest choice point that
+ * still has one, or refusing it if there are none.
+ *
+ * @param victim The worker asked for work, which must be the one calling this.
+ * @param thief  The idle worker asking for work.
+ * @param code   The byte code being searched.
+ */
+static void wamShare(wamWorker *victim, wamWorker *thief, jbyte *code)
+{
+     wamMachineState *wamstate = &victim->state;
+     wamMachineState *to = &thief->state;
+     wamSearch *search = victim->search;
+     jint *data = wamstate->data;
+     jint oldest = 0;
+     jint b;
+     jint n = 0;
+     jint l;
+     jint next = NO_ALTERNATIVE;
+     jint body = -1;
+
+     // Find the oldest choice point that still has an alternative to try.
+     for (b = wamstate->bp; b != 0; b = data[b + data[b] + 3])
+     {
+          if (data[b + data[b] + 4] != NO_ALTERNATIVE)
+          {
+               oldest = b;
+          }
+     }
+
+     // Work out where the body of the alternative starts, and which alternative follows it.
+     if (oldest != 0)
+     {
+          n = data[oldest];
+          l = data[oldest + n + 4];
+
+          switch (code[l])
+          {
+          case RETRY_ME_ELSE:
+               next = *(jint*)(code + l + 1);
+               body = l + 5;
+               break;
+          case TRUST_ME:
+               body = l + 1;
+               break;
+          case RETRY:
+               next = l + 5;
+               body = *(jint*)(code + l + 1);
+               break;
+          case TRUST:
+               body = *(jint*)(code + l + 1);
+               break;
+          }
+     }
+
+     if (body != -1)
+     {
+          // Copy the machine as it was at the choice point. The trail is copied in full, so that the bindings made
+          // since the choice point can be undone.
+          wamCopyRegion(to, wamstate, REG_REGION, REG_BASE + wamstate->area.size[REG_REGION]);
+          wamCopyRegion(to, wamstate, HEAP_REGION, data[oldest + n + 6]);
+          wamCopyRegion(to, wamstate, STACK_REGION, oldest + n + 8);
+          wamCopyRegion(to, wamstate, TRAIL_REGION, wamstate->trp);
+
+          to->hp = wamstate->hp;
+          to->sp = wamstate->sp;
+          to->trp = wamstate->trp;
+          to->bp = oldest;
+          to->up = to->area.top;
+          to->writeMode = JNI_FALSE;
+          to->suspended = JNI_FALSE;
+
+          // Take the alternative in the copy as trust would, using up the choice point.
+          // B0 <- STACK[B + n + 7]
+          to->b0 = data[oldest + n + 7];
+          wamRestoreChoicePoint(to);
+          // B <- STACK[B + n + 3]
+          to->bp = data[oldest + n + 3];
+          // P <- body of the alternative
+          to->ip = body;
+
+          // STACK[B + n + 4] <- the alternative after the one given away
+          data[oldest + n + 4] = next;
+     }
+
+     pthread_mutex_lock(&search->lock);
+
+     if (body != -1)
+     {
+          thief->share = SHARE_GIVEN;
+          thief->idle = JNI_FALSE;
+          search->idle--;
+     }
+     else
+     {
+          thief->share = SHARE_REFUSED;
+     }
+
+     victim->request = 0;
+     pthread_cond_broadcast(&search->changed);
+     pthread_mutex_unlock(&search->lock);
+}
+
+/*
+ * Checks in with the search that a worker belongs to, from a point between instructions. Any request for work is
+ * answered. The request is read without taking the lock, as it is only ever cleared by the worker itself.
+ *
+ * @param wamstate The machine state of the worker.
+ * @param code     The byte code being searched.
+ *
+ * @return <tt>true</tt> if the search has been cancelled, and the worker should stop.
+ */
+static jboolean wamPoll(wamMachineState *wamstate, jbyte *code)
+{
+     wamWorker *worker = wamstate->worker;
+     wamSearch *search = worker->search;
+     int request = worker->request;
+
+     if (search->cancelled == JNI_TRUE)
+     {
+          return JNI_TRUE;
+     }
+
+     if (request != 0)
+     {
+          wamShare(worker, &search->workers[request - 1], code);
+     }
+
+     return JNI_FALSE;
+}
+
+/* Checks in with the search, when running on a worker of a parallel search, and stops if it has been cancelled. */
+#define WAM_POLL \
+     do \
+     { \
+          if ((wamstate->worker != NULL) && (wamPoll(wamstate, code) == JNI_TRUE)) \
+          { \
+               return JNI_FALSE; \
+          } \
+     } while (0)
+
+#else
+
+#define WAM_POLL
+
+#endif
+
+/*
+ * Runs the byte code interpreter, from the specified offset until the query completes, suspends or fails.
+ *
+ * @param wamstate The machine state.
+ * @param env      The native code execution environment.
+ * @param object   The object that is the context to this native method.
+ * @param code     The byte code to execute.
+ * @param length   The length of the byte code.
+ * @param offset   The offset within the byte code to start executing at, or <tt>-1</tt> to carry on from the
+ *                 instruction pointer held in the machine state, for a worker that has been given work.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
+ */
+static jboolean wamexecute(wamMachineState *wamstate, JNIEnv * env, jobject object, jbyte *code, jsize length,
+                           jint offset)
+{
+     jint *data = wamstate->data;
+     jint numOfArgs = 0;
+     jint ip = 0;
+     jboolean failed;
+
+     traceIt("\nWAM Execute\n");
+
+     // Check if the machine is being woken up from being suspended, in which case immediately fail in order to
+     // trigger back-tracking to find more solutions.
+     if (wamstate->suspended == JNI_TRUE)
+     {
+          failed = JNI_TRUE;
+          wamstate->suspended = JNI_FALSE;
+     }
+     else if (offset < 0)
+     {
+          // A worker given work by another carries on from the registers that it was given.
+          ip = wamstate->ip;
+          failed = JNI_FALSE;
+     }
+     else
+     {
+          ip = offset;
+          wamuClear(wamstate);
+          failed = JNI_FALSE;
+
+          // Set the initial CP to point to the end of the code, used as a termination condition.
+          wamstate->cp = length;
+     }
+
+     DISPATCH_TABLE(DISPATCH_ENTRY(PUT_STRUC), DISPATCH_ENTRY(SET_VAR), DISPATCH_ENTRY(SET_VAL),
+                    DISPATCH_ENTRY(GET_STRUC), DISPATCH_ENTRY(UNIFY_VAR), DISPATCH_ENTRY(UNIFY_VAL),
+                    DISPATCH_ENTRY(PUT_VAR), DISPATCH_ENTRY(PUT_VAL), DISPATCH_ENTRY(GET_VAR),
+                    DISPATCH_ENTRY(GET_VAL), DISPATCH_ENTRY(CALL), DISPATCH_ENTRY(PROCEED),
+                    DISPATCH_ENTRY(ALLOCATE_N), DISPATCH_ENTRY(DEALLOCATE), DISPATCH_ENTRY(TRY_ME_ELSE),
+                    DISPATCH_ENTRY(RETRY_ME_ELSE), DISPATCH_ENTRY(TRUST_ME), DISPATCH_ENTRY(PUT_CONST),
+                    DISPATCH_ENTRY(GET_CONST), DISPATCH_ENTRY(SET_CONST), DISPATCH_ENTRY(UNIFY_CONST),
+                    DISPATCH_ENTRY(PUT_LIST), DISPATCH_ENTRY(GET_LIST), DISPATCH_ENTRY(SET_VOID),
+                    DISPATCH_ENTRY(UNIFY_VOID), DISPATCH_ENTRY(EXECUTE), DISPATCH_ENTRY(ALLOCATE),
+                    DISPATCH_ENTRY(PUT_UNSAFE_VAL), DISPATCH_ENTRY(SET_LOCAL_VAL), DISPATCH_ENTRY(UNIFY_LOCAL_VAL),
+                    DISPATCH_ENTRY(TRY), DISPATCH_ENTRY(RETRY), DISPATCH_ENTRY(TRUST),
+                    DISPATCH_ENTRY(SWITCH_ON_TERM), DISPATCH_ENTRY(SWITCH_ON_CONST), DISPATCH_ENTRY(SWITCH_ON_STRUC),
+                    DISPATCH_ENTRY(NECK_CUT), DISPATCH_ENTRY(GET_LEVEL), DISPATCH_ENTRY(CUT),
+                    DISPATCH_ENTRY(CONTINUE), DISPATCH_ENTRY(NO_OP), DISPATCH_ENTRY(CALL_INTERNAL),
+                    DISPATCH_ENTRY(SUSPEND));
+
+#ifdef THREADED_DISPATCH
+     if (failed == JNI_TRUE)
+     {
+          goto failure;
+     }
+
+     JUMP;
+#else
+     while (JNI_TRUE)
+     {
+          // Attempt to backtrack on failure.
+          if (failed == JNI_TRUE)
+          {
+               failed = wamBacktrack(wamstate);
+
+               if (failed == JNI_TRUE)
+               {
+                    break;
+               }
+
+               ip = wamstate->ip;
+          }
+
+          // Running off the end of the code, through the initial continuation point, terminates execution.
+          if (ip >= length)
+          {
+               break;
+          }
+
+          switch (FETCH_OPCODE)
+          {
+#endif
+               // put_struc Xi, f/n:
+          OP(PUT_STRUC)
+          {
+               // grab addr, f/n
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint fn = *(jint*)(code + ip + 3);
+               traceFn1("PUT_STRUC", ip, xi, fn);
+               // heap[h] <- f/n
+               data[wamstate->hp] = fn;
+               // Xi <- STR, h
+               data[xi] = wamStructureAt(wamstate->hp);
+               // h <- h + 1
+               wamstate->hp += 1;
+               // P <- instruction_size(P)
+               ip += 7;
+               NEXT;
+          }
+          // set_var Xi:
+          OP(SET_VAR)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("SET_VAR", ip, xi);
+               // heap[h] <- REF, h
+               data[wamstate->hp] = wamRefTo(wamstate->hp);
+               // Xi <- heap[h]
+               data[xi] = data[wamstate->hp];
+               // h <- h + 1
+               wamstate->hp++;
+               // P <- instruction_size(P)
+               ip += 3;
+               NEXT;
+          }
+          // set_val Xi:
+          OP(SET_VAL)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("SET_VAL", ip, xi);
+               // heap[h] <- Xi
+               data[wamstate->hp] = data[xi];
+               // h <- h + 1
+               wamstate->hp++;
+               // P <- instruction_size(P)
+               ip += 3;
+               NEXT;
+          }
+          // get_struc Xi,
+          OP(GET_STRUC)
+          {
+               // grab addr, f/n
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint fn = *(jint*)(code + ip + 3);
+               jint addr;
+               jint a;
+               traceFn1("GET_STRUC", ip, xi, fn);
+               // addr <- deref(Xi);
+               addr = wamderef(wamstate, xi);
+               a = wamstate->derefVal;
+               // switch STORE[addr]
+               switch (wamstate->derefTag)
+               {
+                    // case REF:
+               case REF:
+               {
+                    jint hp = wamstate->hp;
+                    // heap[h] <- STR, h + 1
+                    data[hp] = wamStructureAt(hp + 1);
+                    // heap[h+1] <- f/n
+                    data[hp + 1] = fn;
+                    // bind(addr, h)
+                    wamBind(wamstate, addr, hp);
+                    // h <- h + 2
+                    wamstate->hp += 2;
+                    // mode <- write
+                    wamstate->writeMode = JNI_TRUE;
+                    break;
+               }
+               // case STR, a:
+               case STR:
+               {
+                    // if heap[a] = f/n
+                    if (data[a] == fn)
+                    {
+                         // s <- a + 1
+                         wamstate->sp = a + 1;
+                         // mode <- read
+                         wamstate->writeMode = JNI_FALSE;
+                    }
+                    else
+                    {
+                         // fail
+                         failed = JNI_TRUE;
+                    }
+                    break;
+               }
+               default:
+               {
+                    // fail
+                    failed = JNI_TRUE;
+               }
+               }
+               // P <- instruction_size(P)
+               ip += 7;
+               NEXT_UNLESS_FAILED;
+          }
+          // unify_var Xi:
+          OP(UNIFY_VAR)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("UNIFY_VAR", ip, xi);
+               // switch mode
+               if (wamstate->writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // Xi <- heap[s]
+                    data[xi] = data[wamstate->sp];
+               }
+               else
+               {
+                    // case write:
+                    // heap[h] <- REF, h
+                    data[wamstate->hp] = wamRefTo(wamstate->hp);
+                    // Xi <- heap[h]
+                    data[xi] = data[wamstate->hp];
+                    // h <- h + 1
+                    wamstate->hp++;
+               }
+               // s <- s + 1
+               wamstate->sp++;
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT;
+          }
+          // unify_val Xi:
+          OP(UNIFY_VAL)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("UNIFY_VAL", ip, xi);
+               // switch mode
+               if (wamstate->writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // unify (Xi, s)
+                    failed = wamunify(wamstate, xi, wamstate->sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               }
+               else
+               {
+                    // case write:
+                    // heap[h] <- Xi
+                    data[wamstate->hp] = data[xi];
+                    // h <- h + 1
+                    wamstate->hp++;
+               }
+               // s <- s + 1
+               wamstate->sp++;
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT_UNLESS_FAILED;
+          }
+          // put_var Xn, Ai:
+          OP(PUT_VAR)
+          {
+               // grab addr, Ai
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jbyte ai = code[ip + 3];
+               trace2("PUT_VAR", ip, xi, mode, ai, wamstate->ep);
+               if (mode == REG_ADDR)
+               {
+                    // heap[h] <- REF, H
+                    data[wamstate->hp] = wamRefTo(wamstate->hp);
+                    // Xn <- heap[h]
+                    data[xi] = data[wamstate->hp];
+                    // Ai <- heap[h]
+                    data[ai] = data[wamstate->hp];
+               }
+               else
+               {
+                    // STACK[addr] <- REF, addr
+                    data[xi] = wamRefTo(xi);
+                    // Ai <- STACK[addr]
+                    data[ai] = data[xi];
+               }
+               // h <- h + 1
+               wamstate->hp++;
+               // P <- P + instruction_size(P)
+               ip += 4;
+               NEXT;
+          }
+          // put_val Xn, Ai:
+          OP(PUT_VAL)
+          {
+               // grab addr, Ai
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jbyte ai = code[ip + 3];
+               trace2("PUT_VAL", ip, xi, mode, ai, wamstate->ep);
+               // Ai <- Xn
+               data[ai] = data[xi];
+               // P <- P + instruction_size(P)
+               ip += 4;
+               NEXT;
+          }
+          // get var Xn, Ai:
+          OP(GET_VAR)
+          {
+               // grab addr, Ai
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jbyte ai = code[ip + 3];
+               trace2("GET_VAR", ip, xi, mode, ai, wamstate->ep);
+               // Xn <- Ai
+               data[xi] = data[ai];
+               // P <- P + instruction_size(P)
+               ip += 4;
+               NEXT;
+          }
+          // get_val Xn, Ai:
+          OP(GET_VAL)
+          {
+               // grab addr, Ai
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jbyte ai = code[ip + 3];
+               trace2("GET_VAL", ip, xi, mode, ai, wamstate->ep);
+               // unify (Xn, Ai)
+               failed = wamunify(wamstate, xi, ai) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               // P <- P + instruction_size(P)
+               ip += 4;
+               NEXT_UNLESS_FAILED;
+          }
+          // put_const Xi, c:
+          OP(PUT_CONST)
+          {
+               // grab addr, f/n
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint fn = *(jint*)(code + ip + 3);
+               traceFn1("PUT_CONST", ip, xi, fn);
+               // Xi <- <CON, c>
+               data[xi] = wamConstantCell(fn);
+               // P <- instruction_size(P)
+               ip += 7;
+               NEXT;
+          }
+          // get_const Xi, c:
+          OP(GET_CONST)
+          {
+               // grab addr, f/n
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint fn = *(jint*)(code + ip + 3);
+               traceFn1("GET_CONST", ip, xi, fn);
+               // unifyConst(fn, Xi)
+               failed = wamunifyConst(wamstate, fn, xi) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               // P <- P + instruction_size(P)
+               ip += 7;
+               NEXT_UNLESS_FAILED;
+          }
+          // set_const c:
+          OP(SET_CONST)
+          {
+               jint fn = *(jint*)(code + ip + 1);
+               traceConst("SET_CONST", ip, fn);
+               // heap[h] <- <CON, c>
+               data[wamstate->hp] = wamConstantCell(fn);
+               // h <- h + 1
+               wamstate->hp++;
+               // P <- instruction_size(P)
+               ip += 5;
+               NEXT;
+          }
+          // unify_const c:
+          OP(UNIFY_CONST)
+          {
+               jint fn = *(jint*)(code + ip + 1);
+               traceConst("UNIFY_CONST", ip, fn);
+               // switch mode
+               if (wamstate->writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // addr <- deref(S)
+                    // unifyConst(fn, addr)
+                    failed = wamunifyConst(wamstate, fn, wamstate->sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               }
+               else
+               {
+                    // case write:
+                    // heap[h] <- <CON, c>
+                    data[wamstate->hp] = wamConstantCell(fn);
+                    // h <- h + 1
+                    wamstate->hp++;
+               }
+               // s <- s + 1
+               wamstate->sp++;
+               // P <- P + instruction_size(P)
+               ip += 5;
+               NEXT_UNLESS_FAILED;
+          }
+          // put_list Xi:
+          OP(PUT_LIST)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("PUT_LIST", ip, xi);
+               // Xi <- <LIS, H>
+               data[xi] = wamListCell(wamstate->hp);
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT;
+          }
+          // get_list Xi:
+          OP(GET_LIST)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint addr;
+               trace1("GET_LIST", ip, xi);
+               addr = wamderef(wamstate, xi);
+               // case STORE[addr] of
+               switch (wamstate->derefTag)
+               {
+               case REF:
+               {
+                    jint hp = wamstate->hp;
+                    // <REF, _> :
+                    // HEAP[H] <- <LIS, H+1>
+                    data[hp] = wamListCell(hp + 1);
+                    // bind(addr, H)
+                    wamBind(wamstate, addr, hp);
+                    // H <- H + 1
+                    wamstate->hp += 1;
+                    // mode <- write
+                    wamstate->writeMode = JNI_TRUE;
+                    break;
+               }
+               case LIS:
+               {
+                    // <LIS, a> :
+                    // S <- a
+                    wamstate->sp = wamstate->derefVal;
+                    // mode <- read
+                    wamstate->writeMode = JNI_FALSE;
+                    break;
+               }
+               default:
+               {
+                    // other: fail <- true;
+                    failed = JNI_TRUE;
+               }
+               }
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT_UNLESS_FAILED;
+          }
+          // set_void n:
+          OP(SET_VOID)
+          {
+               // grab N
+               jint n = (jint)code[ip + 1];
+               jint addr;
+               jint hp = wamstate->hp;
+               traceConst("SET_VOID", ip, n);
+               // for i <- H to H + n - 1 do
+               //  HEAP[i] <- <REF, i>
+               for (addr = hp; addr < (hp + n); addr++)
+               {
+                    data[addr] = wamRefTo(addr);
+               }
+               // H <- H + n
+               wamstate->hp += n;
+               // P <- P + instruction_size(P)
+               ip += 2;
+               NEXT;
+          }
+          // unify_void n:
+          OP(UNIFY_VOID)
+          {
+               // grab N
+               jint n = (jint)code[ip + 1];
+               traceConst("UNIFY_VOID", ip, n);
+               // case mode of
+               if (wamstate->writeMode == JNI_FALSE)
+               {
+                    //  read: S <- S + n
+                    wamstate->sp += n;
+               }
+               else
+               {
+                    jint addr;
+                    jint hp = wamstate->hp;
+                    //  write:
+                    //   for i <- H to H + n -1 do
+                    //    HEAP[i] <- <REF, i>
+                    for (addr = hp; addr < (hp + n); addr++)
+                    {
+                         data[addr] = wamRefTo(addr);
+                    }
+                    //   H <- H + n
+                    wamstate->hp += n;
+               }
+               // P <- P + instruction_size(P)
+               ip += 2;
+               NEXT;
+          }
+          // put_unsafe_val Yn, Ai:
+          OP(PUT_UNSAFE_VAL)
+          {
+               // grab addr, Ai
+               jbyte mode = code[ip + 1];
+               jint yi = (jint)code[ip + 2] + (wamstate->ep + 3);
+               jbyte ai = code[ip + 3];
+               jint addr;
+               trace2("PUT_UNSAFE_VAL", ip, yi, STACK_ADDR, ai, wamstate->ep);
+               addr = wamderef(wamstate, yi);
+               if (addr < wamstate->ep)
+               {
+                    // Ai <- Xn
+                    data[ai] = data[addr];
+               }
+               else
+               {
+                    jint hp = wamstate->hp;
+                    data[hp] = wamRefTo(hp);
+                    wamBind(wamstate, addr, hp);
+                    data[ai] = data[hp];
+                    wamstate->hp++;
+               }
+               // P <- P + instruction_size(P)
+               ip += 4;
+               NEXT;
+          }
+          // set_local_val Xi:
+          OP(SET_LOCAL_VAL)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               jint addr;
+               trace1("SET_LOCAL_VAL", ip, xi);
+               addr = wamderef(wamstate, xi);
+               if (addr < wamstate->ep)
+               {
+                    data[wamstate->hp] = data[addr];
+               }
+               else
+               {
+                    data[wamstate->hp] = wamRefTo(wamstate->hp);
+                    wamBind(wamstate, addr, wamstate->hp);
+               }
+               // h <- h + 1
+               wamstate->hp++;
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT;
+          }
+          // unify_local_val Xi:
+          OP(UNIFY_LOCAL_VAL)
+          {
+               // grab addr
+               jbyte mode = code[ip + 1];
+               jint xi = (jint)code[ip + 2] + ((mode == STACK_ADDR) ? (wamstate->ep + 3) : 0);
+               trace1("UNIFY_LOCAL_VAL", ip, xi);
+               // switch mode
+               if (wamstate->writeMode == JNI_FALSE)
+               {
+                    // case read:
+                    // unify (Xi, s)
+                    failed = wamunify(wamstate, xi, wamstate->sp) == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+               }
+               else
+               {
+                    // case write:
+                    jint addr = wamderef(wamstate, xi);
+                    if (addr < wamstate->ep)
+                    {
+                         data[wamstate->hp] = data[addr];
+                    }
+                    else
+                    {
+                         data[wamstate->hp] = wamRefTo(wamstate->hp);
+                         wamBind(wamstate, addr, wamstate->hp);
+                    }
+                    // h <- h + 1
+                    wamstate->hp++;
+               }
+               // s <- s + 1
+               wamstate->sp++;
+               // P <- P + instruction_size(P)
+               ip += 3;
+               NEXT_UNLESS_FAILED;
+          }
+          // call @(p/n), perms:
+          OP(CALL)
+          {
+               // grab @(p/n), perms
+               jint pn = *(jint*)(code + ip + 1);
+               jint n = (jint)code[ip + 5];
+               jint numPerms = (jint)code[ip + 6];
+               traceFn0("CALL", ip, pn);
+               WAM_POLL;
+               // num_of_args <- n
+               numOfArgs = n;
+               // Ensure that the predicate to call is known and linked in, otherwise fail.
+               if (pn == -1)
+               {
+                    FAIL;
+               }
+               // STACK[E + 2] <- numPerms
+               data[wamstate->ep + 2] = numPerms;
+               // CP <- P + instruction_size(P)
+               wamstate->cp = ip + 7;
+               // B0 <- B
+               wamstate->b0 = wamstate->bp;
+               // P <- @(p/n)
+               ip = pn;
+               JUMP;
+          }
+          // execute @(p/n):
+          OP(EXECUTE)
+          {
+               // grab @(p/n)
+               jint pn = *(jint*)(code + ip + 1);
+               jint n = (jint)code[ip + 5];
+               traceFn0("EXECUTE", ip, pn);
+               WAM_POLL;
+               // num_of_args <- n
+               numOfArgs = n;
+               // Ensure that the predicate to call is known and linked in, otherwise fail.
+               if (pn == -1)
+               {
+                    FAIL;
+               }
+               // B0 <- B
+               wamstate->b0 = wamstate->bp;
+               // P <- @(p/n)
+               ip = pn;
+               JUMP;
+          }
+          // proceed:
+          OP(PROCEED)
+          {
+               trace0("PROCEED", ip);
+               // P <- CP
+               ip = wamstate->cp;
+               JUMP;
+          }
+          // allocate:
+          OP(ALLOCATE)
+          {
+               // if E > B
+               //  then newB <- E + STACK[E + 2] + 3
+               // else newB <- B + STACK[B] + 7
+               jint esp = wamNextStackFrame(wamstate);
+               trace0("ALLOCATE", ip);
+               // STACK[newE] <- E
+               data[esp] = wamstate->ep;
+               // STACK[E + 1] <- CP
+               data[esp + 1] = wamstate->cp;
+               // STACK[E + 2] <- N
+               data[esp + 2] = 0;
+               // E <- newE
+               wamstate->ep = esp;
+               // P <- P + instruction_size(P)
+               ip += 1;
+               NEXT;
+          }
+          // allocate N:
+          OP(ALLOCATE_N)
+          {
+               // grab N
+               jint n = (jint)code[ip + 1];
+               // if E > B
+               //  then newB <- E + STACK[E + 2] + 3
+               // else newB <- B + STACK[B] + 7
+               jint esp = wamNextStackFrame(wamstate);
+               traceConst("ALLOCATE_N", ip, n);
+               // STACK[newE] <- E
+               data[esp] = wamstate->ep;
+               // STACK[E + 1] <- CP
+               data[esp + 1] = wamstate->cp;
+               // STACK[E + 2] <- N
+               data[esp + 2] = n;
+               // E <- newE
+               wamstate->ep = esp;
+               // P <- P + instruction_size(P)
+               ip += 2;
+               NEXT;
+          }
+          // deallocate:
+          OP(DEALLOCATE)
+          {
+               jint newip = data[wamstate->ep + 1];
+               trace0("DEALLOCATE", ip);
+               // E <- STACK[E]
+               wamstate->ep = data[wamstate->ep];
+               // CP <- STACK[E + 1]
+               wamstate->cp = newip;
+               // P <- P + instruction_size(P)
+               ip += 1;
+               NEXT;
+          }
+          // try me else L:
+          OP(TRY_ME_ELSE)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("TRY_ME_ELSE", ip, l);
+               wamPushChoicePoint(wamstate, numOfArgs, l);
+               // P <- P + instruction_size(P)
+               ip += 5;
+               NEXT;
+          }
+          // retry me else L:
+          OP(RETRY_ME_ELSE)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("RETRY_ME_ELSE", ip, l);
+               wamRestoreChoicePoint(wamstate);
+               // STACK[B + n + 4] <- L
+               data[wamstate->bp + data[wamstate->bp] + 4] = l;
+               // P <- P + instruction_size(P)
+               ip += 5;
+               NEXT;
+          }
+          // trust me (else fail):
+          OP(TRUST_ME)
+          {
+               trace0("TRUST_ME", ip);
+               wamRestoreChoicePoint(wamstate);
+               // B <- STACK[B + n + 3]
+               wamstate->bp = data[wamstate->bp + data[wamstate->bp] + 3];
+               // P <- P + instruction_size(P)
+               ip += 1;
+               NEXT;
+          }
+          // switch_on_term V, C, L, S:
+          OP(SWITCH_ON_TERM)
+          {
+               // grab labels
+               jint v = *(jint*)(code + ip + 1);
+               jint c = *(jint*)(code + ip + 5);
+               jint l = *(jint*)(code + ip + 9);
+               jint s = *(jint*)(code + ip + 13);
+               trace0("SWITCH_ON_TERM", ip);
+               wamderef(wamstate, 1);
+               // case STORE[deref(A1)] of
+               switch (wamstate->derefTag)
+               {
+               case REF:
+                    // <REF, _> : P <- V
+                    ip = v;
+                    break;
+               case CON:
+                    // <CON, _> : P <- C
+                    ip = c;
+                    break;
+               case LIS:
+                    // <LIS, _> : P <- L
+                    ip = l;
+                    break;
+               case STR:
+                    // <STR, _> : P <- S
+                    ip = s;
+                    break;
+               }
+               JUMP;
+          }
+          // switch_on_const T, N:
+          // switch_on_struc T, N:
+          OP(SWITCH_ON_CONST)
+          OP(SWITCH_ON_STRUC)
+          {
+               // grab labels
+               jint t = wamGetInt(code, ip + 1);
+               jint n = wamGetInt(code, ip + 5);
+               jint inst;
+               trace0(code[ip] == SWITCH_ON_CONST ? "SWITCH_ON_CONST" : "SWITCH_ON_STRUC", ip);
+               // <tag, val> <- STORE[deref(A1)]
+               wamderef(wamstate, 1);
+               // Structures are switched on their functor, f/n <- STORE[val]
+               // <found, inst> <- get_hash(val, T, N)
+               inst = wamGetHash(code, (code[ip] == SWITCH_ON_STRUC) ? data[wamstate->derefVal] : wamstate->derefVal,
+                                 t, n);
+               // if found
+               if (inst > 0)
+               {
+                    // then P <- inst
+                    ip = inst;
+                    JUMP;
+               }
+               else
+               {
+                    // else backtrack
+                    FAIL;
+               }
+          }
+          // try L:
+          OP(TRY)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("TRY", ip, l);
+               wamPushChoicePoint(wamstate, numOfArgs, ip + 5);
+               // P <- L
+               ip = l;
+               JUMP;
+          }
+          // retry L:
+          OP(RETRY)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("RETRY", ip, l);
+               wamRestoreChoicePoint(wamstate);
+               // STACK[B + n + 4] <- L
+               data[wamstate->bp + data[wamstate->bp] + 4] = ip + 5;
+               // P <- L
+               ip = l;
+               JUMP;
+          }
+          // trust L:
+          OP(TRUST)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("TRUST", ip, l);
+               wamRestoreChoicePoint(wamstate);
+               // B <- STACK[B + n + 3]
+               wamstate->bp = data[wamstate->bp + data[wamstate->bp] + 3];
+               // P <- L
+               ip = l;
+               JUMP;
+          }
+          // neck_cut:
+          OP(NECK_CUT)
+          {
+               trace0("NECK_CUT", ip);
+               if (wamstate->bp > wamstate->b0)
+               {
+                    wamstate->bp = wamstate->b0;
+                    wamTidyTrail(wamstate);
+               }
+               ip += 1;
+               NEXT;
+          }
+          // get_level Yn:
+          OP(GET_LEVEL)
+          {
+               jint yn = (jint)code[ip + 1] + (wamstate->ep + 3);
+               traceConst("GET_LEVEL", ip, yn);
+               data[yn] = wamstate->b0;
+               ip += 2;
+               NEXT;
+          }
+          // cut Yn:
+          OP(CUT)
+          {
+               jint yn = (jint)code[ip + 1] + (wamstate->ep + 3);
+               jint cbp = data[yn];
+               traceConst("CUT", ip, yn);
+               if (wamstate->bp > cbp)
+               {
+                    wamstate->bp = cbp;
+                    wamTidyTrail(wamstate);
+               }
+               ip += 2;
+               NEXT;
+          }
+          // continue L:
+          OP(CONTINUE)
+          {
+               // grab L
+               jint l = *(jint*)(code + ip + 1);
+               traceConst("CONTINUE", ip, l);
+               ip = l;
+               JUMP;
+          }
+          // no_op:
+          OP(NO_OP)
+          {
+               trace0("NO_OP", ip);
+               ip += 1;
+               NEXT;
+          }
+          // call_internal @(p/n), perms:
+          OP(CALL_INTERNAL)
+          {
+               // grab @(p/n), perms
+               jint pn = *(jint*)(code + ip + 1);
+               jint n = (jint)code[ip + 5];
+               jint numPerms = (jint)code[ip + 6];
+               jint entry;
+               traceFn0("CALL_INTERNAL", ip, pn);
+               // num_of_args <- n
+               numOfArgs = n;
+               // Only call/1 and its execute variant are known internal functions, anything else fails.
+               if ((pn != CALL_1_ID) && (pn != EXECUTE_1_ID))
+               {
+                    FAIL;
+               }
+               entry = wamSetupCall_1(wamstate, env, object);
+               if (entry == -1)
+               {
+                    FAIL;
+               }
+               if (pn == CALL_1_ID)
+               {
+                    // STACK[E + 2] <- numPerms
+                    data[wamstate->ep + 2] = numPerms;
+                    // CP <- P + instruction_size(P)
+                    wamstate->cp = ip + 7;
+               }
+               // B0 <- B
+               wamstate->b0 = wamstate->bp;
+               // P <- @(p/n)
+               ip = entry;
+               JUMP;
+          }
+          // suspend on success:
+          OP(SUSPEND)
+          {
+               trace0("SUSPEND", ip);
+               wamstate->ip = ip + 1;
+               wamstate->suspended = JNI_TRUE;
+               return JNI_TRUE;
+          }
+          // An unknown instruction was encountered. Something has gone wrong, so fail.
+          OP_UNKNOWN
+          {
+               trace0("UNKNOWN (Fail)", ip);
+               FAIL;
+          }
+#ifdef THREADED_DISPATCH
+failure:
+     // Attempt to backtrack on failure.
+     failed = wamBacktrack(wamstate);
+
+     if (failed == JNI_FALSE)
+     {
+          ip = wamstate->ip;
+          JUMP;
+     }
+
+halt:
+     ;
+#else
+          }
+     }
+#endif
+
+     return failed == JNI_TRUE ? JNI_FALSE : JNI_TRUE;
+}
+
+#ifdef WAM_PARALLEL
+
+/*
+ * Copies a solution out of the worker that found it, and queues it to be taken by the machine. The worker waits
+ * while the queue is full.
+ *
+ * @param worker The worker that found the solution.
+ *
+ * @return <tt>true</tt> if the solution was queued, <tt>false</tt> if the search was cancelled, or the solution
+ *         could not be copied, in which case the worker should stop.
+ */
+static jboolean wamPutSolution(wamWorker *worker)
+{
+     wamMachineState *wamstate = &worker->state;
+     wamSearch *search = worker->search;
+     jint heapCells = wamstate->hp - HEAP_BASE;
+     jint stackCells = wamNextStackFrame(wamstate) - STACK_BASE;
+     wamSolution *solution = malloc(sizeof(wamSolution) + (heapCells + stackCells) * sizeof(jint));
+
+     pthread_mutex_lock(&search->lock);
+
+     // Running out of memory fails the search, as running out of space in a data area does.
+     if (solution == NULL)
+     {
+          search->failed = JNI_TRUE;
+          search->cancelled = JNI_TRUE;
+          pthread_cond_broadcast(&search->changed);
+          pthread_mutex_unlock(&search->lock);
+
+          return JNI_FALSE;
+     }
+
+     solution->heapCells = heapCells;
+     solution->stackCells = stackCells;
+     solution->ep = wamstate->ep;
+     memcpy(solution->cells, wamstate->data + HEAP_BASE, heapCells * sizeof(jint));
+     memcpy(solution->cells + heapCells, wamstate->data + STACK_BASE, stackCells * sizeof(jint));
+
+     while ((search->size == WAM_SOLUTION_QUEUE) && (search->cancelled == JNI_FALSE))
+     {
+          pthread_cond_wait(&search->changed, &search->lock);
+     }
+
+     if (search->cancelled == JNI_TRUE)
+     {
+          pthread_mutex_unlock(&search->lock);
+          free(solution);
+
+          return JNI_FALSE;
+     }
+
+     search->queue[(search->head + search->size) % WAM_SOLUTION_QUEUE] = solution;
+     search->size++;
+     pthread_cond_broadcast(&search->changed);
+     pthread_mutex_unlock(&search->lock);
+
+     return JNI_TRUE;
+}
+
+/*
+ * Finds more work for a worker that has run out, by asking each of the busy workers in turn until one gives it
+ * some. The search is complete once every worker is idle.
+ *
+ * @param worker The worker that has run out of work.
+ *
+ * @return <tt>true</tt> if the worker was given work, <tt>false</tt> if the search is complete or cancelled.
+ */
+static jboolean wamFindWork(wamWorker *worker)
+{
+     wamSearch *search = worker->search;
+     int victim = worker->index;
+     int i;
+
+     pthread_mutex_lock(&search->lock);
+
+     if (worker->idle == JNI_FALSE)
+     {
+          worker->idle = JNI_TRUE;
+          search->idle++;
+     }
+
+     // A worker with no work left cannot give any away.
+     if (worker->request != 0)
+     {
+          search->workers[worker->request - 1].share = SHARE_REFUSED;
+          worker->request = 0;
+     }
+
+     pthread_cond_broadcast(&search->changed);
+
+     while (JNI_TRUE)
+     {
+          if (search->cancelled == JNI_TRUE)
+          {
+               break;
+          }
+
+          if (search->idle == search->count)
+          {
+               search->done = JNI_TRUE;
+               pthread_cond_broadcast(&search->changed);
+               break;
+          }
+
+          // Ask the next busy worker that has not already been asked.
+          for (i = 1; i < search->count; i++)
+          {
+               wamWorker *candidate = &search->workers[(victim + i) % search->count];
+
+               if ((candidate->idle == JNI_FALSE) && (candidate->request == 0))
+               {
+                    break;
+               }
+          }
+
+          if (i == search->count)
+          {
+               pthread_cond_wait(&search->changed, &search->lock);
+               continue;
+          }
+
+          victim = (victim + i) % search->count;
+          worker->share = SHARE_PENDING;
+          search->workers[victim].request = worker->index + 1;
+
+          while ((worker->share == SHARE_PENDING) && (search->cancelled == JNI_FALSE))
+          {
+               pthread_cond_wait(&search->changed, &search->lock);
+          }
+
+          if (worker->share == SHARE_GIVEN)
+          {
+               pthread_mutex_unlock(&search->lock);
+
+               return JNI_TRUE;
+          }
+
+          // Let the busy workers run a little before asking again, rather than contending for the lock.
+          pthread_mutex_unlock(&search->lock);
+          sched_yield();
+          pthread_mutex_lock(&search->lock);
+     }
+
+     pthread_mutex_unlock(&search->lock);
+
+     return JNI_FALSE;
+}
+
+/*
+ * Runs a worker of a parallel search, searching for solutions on the work that it has, and queueing them, until it
+ * runs out and has to find more. The worker attaches to the virtual machine, in order to resolve call/1 through the
+ * Java machine.
+ *
+ * @param arg The worker.
+ *
+ * @return Nothing.
+ */
+static void *wamWorkerRun(void *arg)
+{
+     wamWorker *worker = (wamWorker *)arg;
+     wamSearch *search = worker->search;
+     wamMachineState *wamstate = &worker->state;
+     JNIEnv *env;
+     dataAreaJmpBuf overflow;
+     jboolean working;
+
+     // The entry point is changed after the guard is set, so it must not be held in a register across it.
+     volatile jint offset = (worker->index == 0) ? search->offset : -1;
+
+     if ((*search->vm)->AttachCurrentThread(search->vm, (void **)&env, NULL) != 0)
+     {
+          pthread_mutex_lock(&search->lock);
+          search->failed = JNI_TRUE;
+          search->cancelled = JNI_TRUE;
+          pthread_cond_broadcast(&search->changed);
+          pthread_mutex_unlock(&search->lock);
+
+          return NULL;
+     }
+
+     working = (worker->idle == JNI_TRUE) ? wamFindWork(worker) : JNI_TRUE;
+
+     // Running out of space fails the whole search, as it would fail the query when searching sequentially.
+     if (DATA_AREA_GUARD(&wamstate->area, overflow))
+     {
+          DATA_AREA_UNGUARD();
+          traceIt("Data area overflow (Fail)");
+
+          pthread_mutex_lock(&search->lock);
+          search->failed = JNI_TRUE;
+          search->cancelled = JNI_TRUE;
+          pthread_cond_broadcast(&search->changed);
+          pthread_mutex_unlock(&search->lock);
+     }
+     else
+     {
+          while (working == JNI_TRUE)
+          {
+               while (wamexecute(wamstate, env, search->object, search->code, search->length, offset) == JNI_TRUE)
+               {
+                    if (wamPutSolution(worker) == JNI_FALSE)
+                    {
+                         break;
+                    }
+               }
+
+               offset = -1;
+               working = wamFindWork(worker);
+          }
+
+          DATA_AREA_UNGUARD();
+     }
+
+     (*search->vm)->DetachCurrentThread(search->vm);
+
+     return NULL;
+}
+
+/*
+ * Stops the parallel search in progress on a machine, if there is one, and releases it.
+ *
+ * @param wamstate The machine state.
+ * @param env      The native code execution environment.
+ */
+static void wamStopSearch(wamMachineState *wamstate, JNIEnv * env)
+{
+     wamSearch *search = wamstate->search;
+     int i;
+
+     if (search == NULL)
+     {
+          return;
+     }
+
+     pthread_mutex_lock(&search->lock);
+     search->cancelled = JNI_TRUE;
+     pthread_cond_broadcast(&search->changed);
+     pthread_mutex_unlock(&search->lock);
+
+     for (i = 0; i < search->started; i++)
+     {
+          pthread_join(search->workers[i].thread, NULL);
+     }
+
+     for (i = 0; (search->workers != NULL) && (i < search->count); i++)
+     {
+          dataAreaRelease(&search->workers[i].state.area);
+     }
+
+     for (i = 0; i < search->size; i++)
+     {
+          free(search->queue[(search->head + i) % WAM_SOLUTION_QUEUE]);
+     }
+
+     if (search->object != NULL)
+     {
+          (*env)->DeleteGlobalRef(env, search->object);
+     }
+
+     pthread_cond_destroy(&search->changed);
+     pthread_mutex_destroy(&search->lock);
+     free(search->workers);
+     free(search);
+
+     wamstate->search = NULL;
+}
+
+/*
+ * Starts a parallel search for the solutions to a query, with as many workers as the machine is set to use. The
+ * first worker starts on a copy of the machine.
+ *
+ * @param wamstate The machine state.
+ * @param env      The native code execution environment.
+ * @param object   The object that is the context to this native method.
+ * @param code     The byte code to execute.
+ * @param length   The length of the byte code.
+ * @param offset   The offset within the byte code to start executing at.
+ *
+ * @return <tt>true</tt> if the search was started, <tt>false</tt> if it could not be, and the query should be run
+ *         sequentially instead.
+ */
+static jboolean wamStartSearch(wamMachineState *wamstate, JNIEnv * env, jobject object, jbyte *code, jsize length,
+                               jint offset)
+{
+     wamSearch *search = calloc(1, sizeof(wamSearch));
+     wamMachineState *first;
+     int i;
+
+     if (search == NULL)
+     {
+          return JNI_FALSE;
+     }
+
+     search->count = wamstate->workers;
+     search->workers = calloc(search->count, sizeof(wamWorker));
+     search->code = code;
+     search->length = length;
+     search->offset = offset;
+     search->idle = search->count - 1;
+     pthread_mutex_init(&search->lock, NULL);
+     pthread_cond_init(&search->changed, NULL);
+     wamstate->search = search;
+
+     if ((search->workers == NULL) || ((*env)->GetJavaVM(env, &search->vm) != 0))
+     {
+          wamStopSearch(wamstate, env);
+
+          return JNI_FALSE;
+     }
+
+     search->object = (*env)->NewGlobalRef(env, object);
+
+     // Give every worker a data area laid out the same way as the machines.
+     for (i = 0; i < search->count; i++)
+     {
+          wamWorker *worker = &search->workers[i];
+
+          if (dataAreaCreate(&worker->state.area, wamstate->area.size, REGION_COUNT, ADDR_LIMIT, sizeof(jint))
+              == JNI_FALSE)
+          {
+               wamStopSearch(wamstate, env);
+
+               return JNI_FALSE;
+          }
+
+          worker->state.data = worker->state.area.data;
+          worker->state.worker = worker;
+          worker->search = search;
+          worker->index = i;
+          worker->idle = (i == 0) ? JNI_FALSE : JNI_TRUE;
+     }
+
+     // Start the first worker on a copy of the machine.
+     first = &search->workers[0].state;
+     wamCopyRegion(first, wamstate, REG_REGION, REG_BASE + wamstate->area.size[REG_REGION]);
+     wamCopyRegion(first, wamstate, HEAP_REGION, wamstate->hp);
+     wamCopyRegion(first, wamstate, STACK_REGION, wamNextStackFrame(wamstate));
+     wamCopyRegion(first, wamstate, TRAIL_REGION, wamstate->trp);
+     first->hp = wamstate->hp;
+     first->hbp = wamstate->hbp;
+     first->sp = wamstate->sp;
+     first->up = first->area.top;
+     first->ep = wamstate->ep;
+     first->bp = wamstate->bp;
+     first->b0 = wamstate->b0;
+     first->trp = wamstate->trp;
+
+     for (i = 0; i < search->count; i++)
+     {
+          if (pthread_create(&search->workers[i].thread, NULL, wamWorkerRun, &search->workers[i]) != 0)
+          {
+               break;
+          }
+
+          search->started++;
+     }
+
+     // Workers that could not be started stay idle, and are never asked for work.
+     if (search->started == 0)
+     {
+          wamStopSearch(wamstate, env);
+
+          return JNI_FALSE;
+     }
+
+     return JNI_TRUE;
+}
+
+/*
+ * Takes the next solution found by the parallel search in progress on a machine, waiting for one if need be. The
+ * solution is copied into the heap and stack of the machine, from which its bindings are read in the same way as
+ * for a sequential search.
+ *
+ * @param wamstate The machine state.
+ *
+ * @return <tt>true</tt> if a solution was taken, <tt>false</tt> if the search is complete, and there are no more.
+ */
+static jboolean wamNextSolution(wamMachineState *wamstate)
+{
+     wamSearch *search = wamstate->search;
+     wamSolution *solution;
+
+     pthread_mutex_lock(&search->lock);
+
+     while ((search->size == 0) && (search->done == JNI_FALSE) && (search->cancelled == JNI_FALSE))
+     {
+          pthread_cond_wait(&search->changed, &search->lock);
+     }
+
+     if ((search->size == 0) || (search->failed == JNI_TRUE))
+     {
+          pthread_mutex_unlock(&search->lock);
+
+          return JNI_FALSE;
+     }
+
+     solution = search->queue[search->head];
+     search->head = (search->head + 1) % WAM_SOLUTION_QUEUE;
+     search->size--;
+     pthread_cond_broadcast(&search->changed);
+     pthread_mutex_unlock(&search->lock);
+
+     memcpy(wamstate->data + HEAP_BASE, solution->cells, solution->heapCells * sizeof(jint));
+     memcpy(wamstate->data + STACK_BASE, solution->cells + solution->heapCells, solution->stackCells * sizeof(jint));
+
+     // The machine holds no choice points of its own, as the workers hold them all.
+     wamstate->hp = HEAP_BASE + solution->heapCells;
+     wamstate->hbp = wamstate->hp;
+     wamstate->ep = solution->ep;
+     wamstate->bp = 0;
+     wamstate->b0 = 0;
+     wamstate->trp = TRAIL_BASE;
+
+     free(solution);
+
+     return JNI_TRUE;
+}
+
+#endif
+
+/*
+ * Resets the machine to its initial state. This clears any programs from the machine, and clears all of its stacks
+ * and heaps. The data area is reserved afresh with the requested region sizes. Each machine instance has its own
+ * state, created on its first reset, so separate instances may run queries on separate threads at the same time.
+ * A single instance must not be used from more than one thread at once.
+ *
+ * Class:     com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine
+ * Method:    nativeReset
+ * Signature: (JIIIII)J
+ *
+ * @param env       The native code execution environment.
+ * @param obj       The object that is the context to this native method.
+ * @param state     A handle onto the machine state, or zero if it has not been created yet.
+ * @param regSize   The number of registers.
+ * @param heapSize  The size of the heap in cells.
+ * @param stackSize The size of the stack in cells.
+ * @param trailSize The size of the trail in cells.
+ * @param pdlSize   The size of the unification stack in cells.
+ *
+ * @return A handle onto the machine state.
+ */
+JNIEXPORT jlong JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_nativeReset
+(JNIEnv * env, jobject obj, jlong state, jint regSize, jint heapSize, jint stackSize, jint trailSize, jint pdlSize)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+     jint sizes[REGION_COUNT];
+
+     // Allocate space for the machines state on the first reset.
+     if (wamstate == NULL)
+     {
+          wamstate = calloc(1, sizeof(wamMachineState));
+     }
+
+#ifdef WAM_PARALLEL
+     // Abandon any parallel search still in progress.
+     wamStopSearch(wamstate, env);
+#endif
+
+     // Clear the heaps and stacks, keeping the previous ones if they are the same size. These start out zeroed.
+     sizes[REG_REGION] = regSize;
+     sizes[HEAP_REGION] = heapSize;
+     sizes[STACK_REGION] = stackSize;
+     sizes[TRAIL_REGION] = trailSize;
+     sizes[PDL_REGION] = pdlSize;
+
+     if (dataAreaReset(&wamstate->area, sizes, REGION_COUNT, ADDR_LIMIT, sizeof(jint), NULL) == JNI_FALSE)
+     {
+          wamstate->data = NULL;
+          (*env)->ThrowNew(env, (*env)->FindClass(env, "java/lang/IllegalArgumentException"),
+                           "The data area could not be created with the requested sizes.");
+
+          return (jlong)(intptr_t)wamstate;
+     }
+
+     wamstate->data = wamstate->area.data;
+
+     wamInitRegisters(wamstate);
+
+     return (jlong)(intptr_t)wamstate;
+}
+
+/*
+ * Releases the machine state, and the data area that it holds. Releasing a zero handle does nothing.
+ *
+ * Class:     com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine
+ * Method:    nativeRelease
+ * Signature: (J)V
+ *
+ * @param env   The native code execution environment.
+ * @param obj   The object that is the context to this native method.
+ * @param state A handle onto the machine state.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_nativeRelease
+(JNIEnv * env, jobject obj, jlong state)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     if (wamstate != NULL)
+     {
+#ifdef WAM_PARALLEL
+          wamStopSearch(wamstate, env);
+#endif
+          dataAreaRelease(&wamstate->area);
+          free(wamstate);
+     }
+}
+
+/*
+ * Sets the number of worker threads that queries are searched with. With more than one, each query is searched in
+ * parallel across the workers, and its solutions are found in no particular order. Cuts only prune the choice points
+ * of the worker that executes them. Where threads are not available, queries are always searched sequentially.
+ *
+ * Class:     com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine
+ * Method:    setParallelWorkers
+ * Signature: (JI)V
+ *
+ * @param env     The native code execution environment.
+ * @param obj     The object that is the context to this native method.
+ * @param state   A handle onto the machine state.
+ * @param workers The number of worker threads, or zero or one to search sequentially.
+ */
+JNIEXPORT void JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_setParallelWorkers
+(JNIEnv * env, jobject obj, jlong state, jint workers)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     wamstate->workers = (workers < WAM_MAX_WORKERS) ? workers : WAM_MAX_WORKERS;
+}
+
+/*
+ * Executes a compiled functor returning an indication of whether or not a unification was found.
+ *
+ * @param env     The native code execution environment.
+ * @param obj     The object that is the context to this native method.
+ * @param state   A handle onto the machine state.
+ * @param codeBuf A direct buffer containing the byte code to execute.
+ * @param offset  The offset within the code buffer of the byte code to execute.
+ *
+ * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
+ */
+JNIEXPORT jboolean JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_execute
+(JNIEnv * env, jobject object, jlong state, jobject codeBuf, jint offset)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+     jboolean result;
+     dataAreaJmpBuf overflow;
+
+     jsize length = (*env)->GetDirectBufferCapacity(env, codeBuf);
+     jbyte * code = (*env)->GetDirectBufferAddress(env, codeBuf);
+
+#ifdef WAM_PARALLEL
+     // Search in parallel when set to, or carry on with a parallel search already in progress to find more solutions.
+     if ((wamstate->search == NULL) && (wamstate->workers > 1) && (wamstate->suspended == JNI_FALSE))
+     {
+          wamStartSearch(wamstate, env, object, code, length, offset);
+     }
+
+     if (wamstate->search != NULL)
+     {
+          result = wamNextSolution(wamstate);
+
+          if (result == JNI_FALSE)
+          {
+               // The machine is emptied if the search failed part way through, as it is on an overflow when sequential.
+               if (wamstate->search->failed == JNI_TRUE)
+               {
+                    wamInitRegisters(wamstate);
+               }
+
+               wamStopSearch(wamstate, env);
+          }
+
+          return result;
+     }
+#endif
+
+     // Fail if a region of the data area overflows. The choice points and trail may be part way through being
+     // updated, so no further solutions can be searched for, and the machine is emptied.
+     if (DATA_AREA_GUARD(&wamstate->area, overflow))
+     {
+          DATA_AREA_UNGUARD();
+          traceIt("Data area overflow (Fail)");
+          wamInitRegisters(wamstate);
+
+          return JNI_FALSE;
+     }
+
+     result = wamexecute(wamstate, env, object, code, length, offset);
+
+     DATA_AREA_UNGUARD();
+
+     return result;
+}
+
+/*
+ * Dereferences a heap pointer (or register), returning the address that it refers to after following all
+ * reference chains to their conclusion. This method is also side effecting, in that the contents of the
+ * refered to heap cell are also loaded into the fields {@link #derefTag} and {@link #derefVal}.
+ *
+ * @param state A handle onto the machine state.
+ * @param a     The address to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_deref
+(JNIEnv * env, jobject obj, jlong state, jint a)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     return wamderef(wamstate, a);
+}
+
+/*
+ * Dereferences an offset from the current environment frame on the stack. Storage slots in the current environment
+ * may point to other environment frames, but should not contain unbound variables, so ultimately this dereferencing
+ * should resolve onto a structure or variable on the heap.
+ *
+ * @param  state A handle onto the machine state.
+ * @param  a     The offset into the current environment stack frame to dereference.
+ *
+ * @return The address that the reference refers to.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_derefStack
+(JNIEnv * env, jobject obj, jlong state, jint a)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     return wamderef(wamstate, a + wamstate->ep + 3);
+}
+
+/*
+ * Gets the heap cell tag for the most recent dereference operation.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return The heap cell tag for the most recent dereference operation.
+ */
+JNIEXPORT jbyte JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_getDerefTag
+(JNIEnv * env, jobject obj, jlong state)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     return wamstate->derefTag;
+}
+
+/*
+ * Gets the heap cell value for the most recent dereference operation.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return The heap cell value for the most recent dereference operation.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_getDerefVal
+(JNIEnv * env, jobject obj, jlong state)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     return wamstate->derefVal;
+}
+
+/*
+ * Gets the value of the heap cell at the specified location.
+ *
+ * @param state A handle onto the machine state.
+ * @param addr  The address to fetch from the heap.
+ * @return The heap cell at the specified location.
+ */
+JNIEXPORT jint JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_getHeap
+(JNIEnv * env, jobject obj, jlong state, jint addr)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+
+     return wamstate->data[addr];
+}
+
+/*
+ * Gets the current values of the machines internal registers.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return An array holding ip, hp, hbp, sp, up, ep, bp, b0, trp and write mode, in that order.
+ */
+JNIEXPORT jintArray JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_getNativeRegisters
+(JNIEnv * env, jobject obj, jlong state)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+     jint regs[10];
+     jintArray result = (*env)->NewIntArray(env, 10);
+
+     regs[0] = wamstate->ip;
+     regs[1] = wamstate->hp;
+     regs[2] = wamstate->hbp;
+     regs[3] = wamstate->sp;
+     regs[4] = wamstate->up;
+     regs[5] = wamstate->ep;
+     regs[6] = wamstate->bp;
+     regs[7] = wamstate->b0;
+     regs[8] = wamstate->trp;
+     regs[9] = wamstate->writeMode == JNI_TRUE ? 1 : 0;
+
+     if (result != NULL)
+     {
+          (*env)->SetIntArrayRegion(env, result, 0, 10, regs);
+     }
+
+     return result;
+}
+
+/*
+ * Gets the layout of the machines data area.
+ *
+ * @param state A handle onto the machine state.
+ *
+ * @return An array holding the base and size of the registers, heap, stack, trail and PDL, in that order.
+ */
+JNIEXPORT jintArray JNICALL Java_com_thesett_aima_logic_fol_wam_nativemachine_WAMResolvingNativeMachine_getNativeMemoryLayout
+(JNIEnv * env, jobject obj, jlong state)
+{
+     wamMachineState *wamstate = (wamMachineState *)(intptr_t)state;
+     jint layout[2 * REGION_COUNT];
+     jintArray result = (*env)->NewIntArray(env, 2 * REGION_COUNT);
+     int i;
+
+     for (i = 0; i < REGION_COUNT; i++)
+     {
+          layout[2 * i] = wamstate->area.base[i];
+          layout[2 * i + 1] = wamstate->area.size[i];
+     }
+
+     if (result != NULL)
+     {
+          (*env)->SetIntArrayRegion(env, result, 0, 2 * REGION_COUNT, layout);
+     }
+
+     return result;
+}
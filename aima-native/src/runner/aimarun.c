@@ -0,0 +1,498 @@
+/*
+ * Runs a query from a byte code image file on a native L2 or L3 resolving machine, through the C API, without a JVM.
+ *
+ * The image file is either a code image, as described in codeimage.h, or raw byte code exactly as the Java compilers
+ * lay it out in the code buffer of a machine, so the call targets in it are absolute offsets into the file. The query
+ * to run is given by its entry point, and by the stack offsets of the variables to report the bindings of, as held in
+ * the batch query format. A code image is executed in place, at the level it was compiled for, and its entry point
+ * may also be given as a name/arity of a predicate in its call table, which is run on its own as the query. Functor
+ * names are interned by the Java machine, so they are printed by their interned ids, except where a code image names
+ * them.
+ *
+ * Usage: aimarun [-l2|-l3] [-heap cells] [-stack cells] [-profile] [-budget calls] [-repeat count] [-rollback] image
+ *                entry|name/arity [slot ...]
+ *
+ * With -profile, the execution profile of the query is written out to stderr after it is run, when the machines were
+ * built with NATIVE_PROFILE. With -budget, the query is run in slices of at most that many calls, resuming it after
+ * each slice until it completes, and the number of times that it was suspended is written out to stderr. With -repeat,
+ * the query is run that many times on the same machine, the bindings of the last run are printed, and the peak heap
+ * use is written out to stderr; with -rollback as well, each run starts from the watermark left by the reset, so the
+ * heap use stays that of a single run.
+ *
+ * The exit status is 0 if the query succeeds, 1 if it fails, and 2 on a usage or loading error.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "resolvingapi.h"
+#include "codeimage.h"
+#include "profile.h"
+
+/* Defines the heap cell marker types, as written out in encoded terms. */
+#define REF 0x01
+#define STR 0x02
+
+/* Defines the default region sizes, matching the defaults of the Java native machines. */
+#define DEFAULT_REG_SIZE 10
+#define DEFAULT_HEAP_SIZE 4000000
+#define DEFAULT_STACK_SIZE 1000000
+#define DEFAULT_PDL_SIZE 100000
+
+/* Defines the size of the buffer to encode a variable binding into, in jints. */
+#define RESULT_LIMIT 1048576
+
+/*
+ * Holds the functions of the C API of one machine level, so that the runner can drive either level.
+ */
+typedef struct
+{
+     rmMachineState *(*create)(void);
+     jboolean (*reset)(rmMachineState *rmstate, jint regSize, jint heapSize, jint stackSize, jint pdlSize);
+     void (*release)(rmMachineState *rmstate);
+     void (*codeAdded)(rmMachineState *rmstate, jbyte *code, jint offset, jint length);
+     jboolean (*execute)(rmMachineState *rmstate, jbyte *code, jint length, jint offset);
+     jint (*executeBudget)(rmMachineState *rmstate, jbyte *code, jint length, jint offset, jlong budget);
+     jint (*resume)(rmMachineState *rmstate, jlong budget);
+     void (*setRollback)(rmMachineState *rmstate, jboolean enabled);
+     jint (*derefStack)(rmMachineState *rmstate, jint a);
+     jint (*encodeTerm)(rmMachineState *rmstate, jint addr, jint *out, jint limit);
+     jint (*getHeapPeak)(rmMachineState *rmstate);
+     jlong *(*getProfile)(rmMachineState *rmstate);
+} runnerLevel;
+
+/* Holds the L2 machine functions. */
+static const runnerLevel l2Level = { l2Create, l2Reset, l2Release, l2CodeAdded, l2Execute, l2ExecuteBudget, l2Resume,
+                                     l2SetRollback, l2DerefStack, l2EncodeTerm, l2GetHeapPeak, l2GetProfile };
+
+/* Holds the L3 machine functions. */
+static const runnerLevel l3Level = { l3Create, l3Reset, l3Release, l3CodeAdded, l3Execute, l3ExecuteBudget, l3Resume,
+                                     l3SetRollback, l3DerefStack, l3EncodeTerm, l3GetHeapPeak, l3GetProfile };
+
+/*
+ * Reads the whole of a file into memory.
+ *
+ * @param path   The path of the file to read.
+ * @param length Receives the length of the file in bytes.
+ *
+ * @return The contents of the file, to be freed by the caller, or <tt>NULL</tt> if it could not be read.
+ */
+static jbyte *readImage(const char *path, jint *length)
+{
+     FILE *file = fopen(path, "rb");
+     jbyte *code;
+     long size;
+
+     if (file == NULL)
+     {
+          return NULL;
+     }
+
+     if ((fseek(file, 0, SEEK_END) != 0) || ((size = ftell(file)) < 0) || (fseek(file, 0, SEEK_SET) != 0))
+     {
+          fclose(file);
+          return NULL;
+     }
+
+     code = malloc(size > 0 ? size : 1);
+
+     if ((code != NULL) && (fread(code, 1, size, file) != (size_t)size))
+     {
+          free(code);
+          code = NULL;
+     }
+
+     fclose(file);
+     *length = (jint)size;
+
+     return code;
+}
+
+/*
+ * Checks whether a file is a code image, from the magic number that it starts with.
+ *
+ * @param path The path of the file to check.
+ *
+ * @return Non-zero if the file is a code image.
+ */
+static int isCodeImage(const char *path)
+{
+     FILE *file = fopen(path, "rb");
+     jint magic = 0;
+     size_t read;
+
+     if (file == NULL)
+     {
+          return 0;
+     }
+
+     read = fread(&magic, sizeof(magic), 1, file);
+     fclose(file);
+
+     return (read == 1) && (magic == CODE_IMAGE_MAGIC);
+}
+
+/*
+ * Prints a functor name. The name is taken from the call table of the code image when a predicate of the image has
+ * it, or otherwise printed by its interned id.
+ *
+ * @param image The code image being run, or <tt>NULL</tt> when running raw byte code.
+ * @param fn    The interned functor name and arity.
+ */
+static void printFunctor(const codeImage *image, jint fn)
+{
+     jint i;
+
+     for (i = 0; (image != NULL) && (i < image->callCount); i++)
+     {
+          if ((image->calls[i].name == (fn >> 8)) && (image->calls[i].arity == (fn & 0xFF)))
+          {
+               printf("%s", codeImageCallName(image, &image->calls[i]));
+               return;
+          }
+     }
+
+     printf("f%d", (int)(fn >> 8));
+}
+
+/*
+ * Prints a term encoded in prefix order, as written out by EncodeTerm. Free variables are printed by their heap
+ * address, and functors by their name and arity. The last argument of each structure is printed by going round again
+ * rather than by recursing, as it is encoded, so that long lists print in constant stack.
+ *
+ * @param image The code image being run, or <tt>NULL</tt> when running raw byte code.
+ * @param out   The encoded term.
+ * @param pos   The position of the term to print.
+ *
+ * @return The position after the printed term.
+ */
+static jint printTerm(const codeImage *image, const jint *out, jint pos)
+{
+     jint tag;
+     jint addr;
+     jint fn;
+     jint arity;
+     jint depth = 0;
+     jint i;
+
+     while (JNI_TRUE)
+     {
+          tag = out[pos++];
+          addr = out[pos++];
+
+          if (tag == REF)
+          {
+               printf("_G%d", (int)addr);
+               break;
+          }
+
+          fn = out[pos++];
+          arity = fn & 0xFF;
+          printFunctor(image, fn);
+
+          if (arity == 0)
+          {
+               break;
+          }
+
+          printf("(");
+
+          for (i = 0; i < arity - 1; i++)
+          {
+               pos = printTerm(image, out, pos);
+               printf(", ");
+          }
+
+          // Carry on with the last argument, closing the structure after it.
+          depth++;
+     }
+
+     for (; depth > 0; depth--)
+     {
+          printf(")");
+     }
+
+     return pos;
+}
+
+/*
+ * Writes out the non-zero counters of an execution profile to stderr. Calls are listed by their entry points, with
+ * the names of the predicates that a code image has for them.
+ *
+ * @param image   The code image being run, or <tt>NULL</tt> when running raw byte code.
+ * @param profile The profile counters.
+ */
+static void printProfile(const codeImage *image, const jlong *profile)
+{
+     jint i;
+     jint j;
+
+     fprintf(stderr, "unify %lld, pdl peak %lld, hp peak %lld, esp peak %lld\n", (long long)profile[PROFILE_UNIFY],
+             (long long)profile[PROFILE_PDL_PEAK], (long long)profile[PROFILE_HP_PEAK],
+             (long long)profile[PROFILE_ESP_PEAK]);
+
+     for (i = 0; i < 256; i++)
+     {
+          if (profile[PROFILE_OPCODES + i] != 0)
+          {
+               fprintf(stderr, "opcode 0x%02x %lld\n", (int)i, (long long)profile[PROFILE_OPCODES + i]);
+          }
+     }
+
+     for (i = 0; i < PROFILE_PAIR_OPCODES * PROFILE_PAIR_OPCODES; i++)
+     {
+          if (profile[PROFILE_PAIRS + i] != 0)
+          {
+               fprintf(stderr, "pair 0x%02x 0x%02x %lld\n", (int)(i >> PROFILE_PAIR_BITS),
+                       (int)(i & (PROFILE_PAIR_OPCODES - 1)), (long long)profile[PROFILE_PAIRS + i]);
+          }
+     }
+
+     for (i = 0; i < PROFILE_DEREF_BUCKETS; i++)
+     {
+          if (profile[PROFILE_DEREF_CHAIN + i] != 0)
+          {
+               fprintf(stderr, "deref chain %d%s %lld\n", (int)i, (i == PROFILE_DEREF_BUCKETS - 1) ? "+" : "",
+                       (long long)profile[PROFILE_DEREF_CHAIN + i]);
+          }
+     }
+
+     for (i = 0; i < PROFILE_CALL_SLOTS; i++)
+     {
+          const jlong *entry = profile + PROFILE_CALL_TABLE + 2 * i;
+          const char *name = "";
+
+          if (entry[0] == 0)
+          {
+               continue;
+          }
+
+          for (j = 0; (image != NULL) && (j < image->callCount); j++)
+          {
+               if (image->calls[j].entry == (jint)(entry[0] - 1))
+               {
+                    name = codeImageCallName(image, &image->calls[j]);
+               }
+          }
+
+          fprintf(stderr, "call %d %s %lld\n", (int)(entry[0] - 1), name, (long long)entry[1]);
+     }
+
+     if (profile[PROFILE_CALLS_LOST] != 0)
+     {
+          fprintf(stderr, "calls not counted by target %lld\n", (long long)profile[PROFILE_CALLS_LOST]);
+     }
+}
+
+/*
+ * Releases the code being run, whether mapped from a code image or read in raw.
+ *
+ * @param image The code image being run, or <tt>NULL</tt> when running raw byte code.
+ * @param code  The raw byte code, when no code image is being run.
+ */
+static void closeImage(codeImage *image, jbyte *code)
+{
+     if (image != NULL)
+     {
+          codeImageClose(image);
+     }
+     else
+     {
+          free(code);
+     }
+}
+
+/*
+ * Prints out how to run the runner.
+ */
+static void usage(void)
+{
+     fprintf(stderr, "Usage: aimarun [-l2|-l3] [-heap cells] [-stack cells] [-profile] [-budget calls] "
+             "[-repeat count] [-rollback] image entry|name/arity [slot ...]\n");
+}
+
+int main(int argc, char *argv[])
+{
+     const runnerLevel *level = &l2Level;
+     jint heapSize = DEFAULT_HEAP_SIZE;
+     jint stackSize = DEFAULT_STACK_SIZE;
+     rmMachineState *machine;
+     codeImage image;
+     codeImage *mapped = NULL;
+     jbyte *code;
+     jint length;
+     jint entry;
+     jint *out;
+     jboolean result;
+     jlong budget = 0;
+     long slices = 0;
+     int repeat = 1;
+     int rollback = 0;
+     int run;
+     int profile = 0;
+     int arg = 1;
+     int i;
+
+     // Parse the options.
+     for (; (arg < argc) && (argv[arg][0] == '-'); arg++)
+     {
+          if (strcmp(argv[arg], "-l2") == 0)
+          {
+               level = &l2Level;
+          }
+          else if (strcmp(argv[arg], "-l3") == 0)
+          {
+               level = &l3Level;
+          }
+          else if (strcmp(argv[arg], "-profile") == 0)
+          {
+               profile = 1;
+          }
+          else if ((strcmp(argv[arg], "-heap") == 0) && (arg + 1 < argc))
+          {
+               heapSize = atoi(argv[++arg]);
+          }
+          else if ((strcmp(argv[arg], "-stack") == 0) && (arg + 1 < argc))
+          {
+               stackSize = atoi(argv[++arg]);
+          }
+          else if ((strcmp(argv[arg], "-budget") == 0) && (arg + 1 < argc))
+          {
+               budget = atol(argv[++arg]);
+          }
+          else if ((strcmp(argv[arg], "-repeat") == 0) && (arg + 1 < argc))
+          {
+               repeat = atoi(argv[++arg]);
+          }
+          else if (strcmp(argv[arg], "-rollback") == 0)
+          {
+               rollback = 1;
+          }
+          else
+          {
+               usage();
+               return 2;
+          }
+     }
+
+     if (argc - arg < 2)
+     {
+          usage();
+          return 2;
+     }
+
+     // Map a code image in place, or read in raw byte code.
+     if (isCodeImage(argv[arg]))
+     {
+          if (codeImageOpen(&image, argv[arg]) == JNI_FALSE)
+          {
+               fprintf(stderr, "aimarun: the code image %s is not valid.\n", argv[arg]);
+               return 2;
+          }
+
+          mapped = &image;
+          level = (image.level == 3) ? &l3Level : &l2Level;
+          code = image.code;
+          length = image.codeLength;
+     }
+     else if ((code = readImage(argv[arg], &length)) == NULL)
+     {
+          fprintf(stderr, "aimarun: cannot read the image %s.\n", argv[arg]);
+          return 2;
+     }
+
+     entry = atoi(argv[arg + 1]);
+
+     if ((mapped != NULL) && (strchr(argv[arg + 1], '/') != NULL))
+     {
+          char *slash = strrchr(argv[arg + 1], '/');
+          const codeImageCall *call;
+
+          *slash = '\0';
+          call = codeImageFindCall(mapped, argv[arg + 1], atoi(slash + 1));
+          *slash = '/';
+          entry = (call != NULL) ? call->entry : -1;
+     }
+
+     if ((entry < 0) || (entry >= length))
+     {
+          fprintf(stderr, "aimarun: the entry point %s is not in the image.\n", argv[arg + 1]);
+          closeImage(mapped, code);
+          return 2;
+     }
+
+     // Create the machine, and load the image into it.
+     machine = level->create();
+
+     if ((machine == NULL) ||
+         (level->reset(machine, DEFAULT_REG_SIZE, heapSize, stackSize, DEFAULT_PDL_SIZE) == JNI_FALSE))
+     {
+          fprintf(stderr, "aimarun: the machine could not be created with the requested sizes.\n");
+          level->release(machine);
+          closeImage(mapped, code);
+          return 2;
+     }
+
+     level->codeAdded(machine, code, 0, length);
+     level->setRollback(machine, rollback ? JNI_TRUE : JNI_FALSE);
+
+     // Run the query, in slices when given a budget, and print the bindings of its variables from the last run.
+     for (run = 0, result = JNI_FALSE; run < repeat; run++)
+     {
+          if (budget > 0)
+          {
+               jint outcome = level->executeBudget(machine, code, length, entry, budget);
+
+               for (; outcome == RM_SUSPENDED; slices++)
+               {
+                    outcome = level->resume(machine, budget);
+               }
+
+               result = (outcome == RM_SUCCEEDED) ? JNI_TRUE : JNI_FALSE;
+          }
+          else
+          {
+               result = level->execute(machine, code, length, entry);
+          }
+     }
+
+     if (budget > 0)
+     {
+          fprintf(stderr, "suspended %ld\n", slices);
+     }
+
+     if (repeat > 1)
+     {
+          fprintf(stderr, "heap peak %d\n", (int)level->getHeapPeak(machine));
+     }
+
+     printf(result == JNI_TRUE ? "yes\n" : "no\n");
+
+     out = malloc(RESULT_LIMIT * sizeof(jint));
+
+     for (i = arg + 2; (result == JNI_TRUE) && (out != NULL) && (i < argc); i++)
+     {
+          jint slot = atoi(argv[i]);
+
+          printf("%d = ", (int)slot);
+
+          if (level->encodeTerm(machine, level->derefStack(machine, slot), out, RESULT_LIMIT) < 0)
+          {
+               printf("...\n");
+               continue;
+          }
+
+          printTerm(mapped, out, 0);
+          printf("\n");
+     }
+
+     if (profile && (level->getProfile(machine) != NULL))
+     {
+          printProfile(mapped, level->getProfile(machine));
+     }
+
+     free(out);
+     level->release(machine);
+     closeImage(mapped, code);
+
+     return (result == JNI_TRUE) ? 0 : 1;
+}
@@ -47,6 +47,16 @@ public class L0UnifyingNativeMachine extends L0UnifyingMachine
     /** Used to record whether an attempt to load the native library has been made. */
     private static boolean libraryLoadAttempted;
 
+    /** Holds a handle onto the state of the native machine, created when the machine is first reset. */
+    private long nativeState;
+
+    /** Creates a unifying virtual machine for L0. */
+    public L0UnifyingNativeMachine()
+    {
+        // Create the native part of the machine.
+        nativeState = nativeReset(nativeState);
+    }
+
     /**
      * Creates an instance of this machine, loading and checking for availability of the native implementation library
      * as required.
@@ -85,6 +95,41 @@ public class L0UnifyingNativeMachine extends L0UnifyingMachine
         }
     }
 
+    /**
+     * Releases the state of the native machine, once this machine is no longer referenced.
+     *
+     * @throws Throwable Any exception from the superclass finalizer is passed up.
+     */
+    protected void finalize() throws Throwable
+    {
+        try
+        {
+            nativeRelease(nativeState);
+            nativeState = 0;
+        }
+        finally
+        {
+            super.finalize();
+        }
+    }
+
+    /**
+     * Resets the native part of the machine, to its initial state. This clears all of its stacks and heaps. The native
+     * state is created on the first reset, and reused by later ones.
+     *
+     * @param  state A handle onto the native machine state, or zero if it has not been created yet.
+     *
+     * @return A handle onto the native machine state.
+     */
+    private native long nativeReset(long state);
+
+    /**
+     * Releases the state of the native machine. Releasing a zero handle does nothing.
+     *
+     * @param state A handle onto the native machine state.
+     */
+    private native void nativeRelease(long state);
+
     /**
      * Executes a compiled functor returning an indication of whether or not a unification was found.
      *
@@ -107,7 +152,20 @@ public class L0UnifyingNativeMachine extends L0UnifyingMachine
      *
      * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
      */
-    protected native boolean execute(ByteBuffer code);
+    protected boolean execute(ByteBuffer code)
+    {
+        return execute(nativeState, code);
+    }
+
+    /**
+     * Implements {@link #execute(ByteBuffer)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  code  As for {@link #execute(ByteBuffer)}.
+     *
+     * @return As for {@link #execute(ByteBuffer)}.
+     */
+    private native boolean execute(long state, ByteBuffer code);
 
     /**
      * Dereferences a heap pointer (or register), returning the address that it refers to after following all reference
@@ -119,21 +177,58 @@ public class L0UnifyingNativeMachine extends L0UnifyingMachine
      *
      * @return The address that the reference refers to.
      */
-    protected native int deref(int a);
+    protected int deref(int a)
+    {
+        return deref(nativeState, a);
+    }
+
+    /**
+     * Implements {@link #deref(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  a     As for {@link #deref(int)}.
+     *
+     * @return As for {@link #deref(int)}.
+     */
+    private native int deref(long state, int a);
 
     /**
      * Gets the heap cell tag for the most recent dereference operation.
      *
      * @return The heap cell tag for the most recent dereference operation.
      */
-    protected native byte getDerefTag();
+    protected byte getDerefTag()
+    {
+        return getDerefTag(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefTag()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefTag()}.
+     */
+    private native byte getDerefTag(long state);
 
     /**
      * Gets the heap call value for the most recent dereference operation.
      *
      * @return The heap call value for the most recent dereference operation.
      */
-    protected native int getDerefVal();
+    protected int getDerefVal()
+    {
+        return getDerefVal(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefVal()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefVal()}.
+     */
+    private native int getDerefVal(long state);
 
     /**
      * Gets the value of the heap cell at the specified location.
@@ -142,6 +237,19 @@ public class L0UnifyingNativeMachine extends L0UnifyingMachine
      *
      * @return The heap cell at the specified location.
      */
-    protected native int getHeap(int addr);
+    protected int getHeap(int addr)
+    {
+        return getHeap(nativeState, addr);
+    }
+
+    /**
+     * Implements {@link #getHeap(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  addr  As for {@link #getHeap(int)}.
+     *
+     * @return As for {@link #getHeap(int)}.
+     */
+    private native int getHeap(long state, int addr);
 
 }
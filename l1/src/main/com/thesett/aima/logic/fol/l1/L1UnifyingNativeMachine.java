@@ -53,6 +53,9 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
      */
     ByteBuffer codeBuffer;
 
+    /** Holds a handle onto the state of the native machine, created when the machine is first reset. */
+    private long nativeState;
+
     /** Creates a unifying virtual machine for L1 with default heap sizes. */
     public L1UnifyingNativeMachine()
     {
@@ -158,7 +161,7 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
         codeBuffer = ByteBuffer.allocateDirect(CODE_SIZE);
 
         // Reset the native part of the machine.
-        nativeReset();
+        nativeState = nativeReset(nativeState);
 
         // Ensure that the overridden reset method of L1BaseMachine is run too, to clear the call table.
         super.reset();
@@ -166,9 +169,38 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
 
     /**
      * Resets the machine, to its initial state. This clears any programs from the machine, and clears all of its stacks
-     * and heaps.
+     * and heaps. The native state is created on the first reset, and reused by later ones.
+     *
+     * @param  state A handle onto the native machine state, or zero if it has not been created yet.
+     *
+     * @return A handle onto the native machine state.
+     */
+    private native long nativeReset(long state);
+
+    /**
+     * Releases the state of the native machine. Releasing a zero handle does nothing.
+     *
+     * @param state A handle onto the native machine state.
      */
-    public native void nativeReset();
+    private native void nativeRelease(long state);
+
+    /**
+     * Releases the state of the native machine, once this machine is no longer referenced.
+     *
+     * @throws Throwable Any exception from the superclass finalizer is passed up.
+     */
+    protected void finalize() throws Throwable
+    {
+        try
+        {
+            nativeRelease(nativeState);
+            nativeState = 0;
+        }
+        finally
+        {
+            super.finalize();
+        }
+    }
 
     /**
      * Executes a compiled functor returning an indication of whether or not a unification was found.
@@ -190,7 +222,21 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
      *
      * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
      */
-    protected native boolean execute(ByteBuffer codeBuffer, int codeOffset);
+    protected boolean execute(ByteBuffer codeBuffer, int codeOffset)
+    {
+        return execute(nativeState, codeBuffer, codeOffset);
+    }
+
+    /**
+     * Implements {@link #execute(ByteBuffer, int)} on the state of the native machine.
+     *
+     * @param  state      A handle onto the native machine state.
+     * @param  codeBuffer As for {@link #execute(ByteBuffer, int)}.
+     * @param  codeOffset As for {@link #execute(ByteBuffer, int)}.
+     *
+     * @return As for {@link #execute(ByteBuffer, int)}.
+     */
+    private native boolean execute(long state, ByteBuffer codeBuffer, int codeOffset);
 
     /**
      * Dereferences a heap pointer (or register), returning the address that it refers to after following all reference
@@ -202,21 +248,58 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
      *
      * @return The address that the reference refers to.
      */
-    protected native int deref(int a);
+    protected int deref(int a)
+    {
+        return deref(nativeState, a);
+    }
+
+    /**
+     * Implements {@link #deref(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  a     As for {@link #deref(int)}.
+     *
+     * @return As for {@link #deref(int)}.
+     */
+    private native int deref(long state, int a);
 
     /**
      * Gets the heap cell tag for the most recent dereference operation.
      *
      * @return The heap cell tag for the most recent dereference operation.
      */
-    protected native byte getDerefTag();
+    protected byte getDerefTag()
+    {
+        return getDerefTag(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefTag()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefTag()}.
+     */
+    private native byte getDerefTag(long state);
 
     /**
      * Gets the heap call value for the most recent dereference operation.
      *
      * @return The heap call value for the most recent dereference operation.
      */
-    protected native int getDerefVal();
+    protected int getDerefVal()
+    {
+        return getDerefVal(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefVal()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefVal()}.
+     */
+    private native int getDerefVal(long state);
 
     /**
      * Gets the value of the heap cell at the specified location.
@@ -225,5 +308,18 @@ public class L1UnifyingNativeMachine extends L1UnifyingMachine
      *
      * @return The heap cell at the specified location.
      */
-    protected native int getHeap(int addr);
+    protected int getHeap(int addr)
+    {
+        return getHeap(nativeState, addr);
+    }
+
+    /**
+     * Implements {@link #getHeap(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  addr  As for {@link #getHeap(int)}.
+     *
+     * @return As for {@link #getHeap(int)}.
+     */
+    private native int getHeap(long state, int addr);
 }
@@ -15,9 +15,14 @@
  */
 package com.thesett.aima.logic.fol.l2;
 
+import java.io.IOException;
+import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.util.HashMap;
 import java.util.Map;
 
+import com.thesett.aima.logic.fol.FunctorName;
 import com.thesett.aima.logic.fol.LinkageException;
 import com.thesett.aima.logic.fol.VariableAndFunctorInternerImpl;
 
@@ -30,6 +35,7 @@ import com.thesett.aima.logic.fol.VariableAndFunctorInternerImpl;
  * <tr><td> Provide symbol table for functors names.
  * <tr><td> Provide symbol table for variable names.
  * <tr><td> Store and retrieve the entry points to byte code procedures.
+ * <tr><td> Write out the byte code of all procedures as a code image.
  * </table></pre>
  *
  * @author Rupert Smith
@@ -56,6 +62,21 @@ public abstract class L2BaseMachine extends VariableAndFunctorInternerImpl imple
     /** Used for debugging. */
     /* private static final Logger log = Logger.getLogger(L2BaseMachine.class.getName()); */
 
+    /** Defines the magic number that a code image starts with. */
+    public static final int CODE_IMAGE_MAGIC = 0x494D4941;
+
+    /** Defines the version of the code image format. */
+    public static final int CODE_IMAGE_VERSION = 1;
+
+    /** Defines the machine level that code images from this machine are compiled for. */
+    private static final int CODE_IMAGE_LEVEL = 2;
+
+    /** Defines the size of the code image header in bytes. */
+    private static final int CODE_IMAGE_HEADER_SIZE = 64;
+
+    /** Defines the alignment of the byte code within a code image, in bytes. */
+    private static final int CODE_IMAGE_CODE_ALIGN = 4096;
+
     /** Used to hold the addresses of the functors code. */
     private Map<Integer, L2CallPoint> callTable = new HashMap<Integer, L2CallPoint>();
 
@@ -109,6 +130,77 @@ public abstract class L2BaseMachine extends VariableAndFunctorInternerImpl imple
         callTable = new HashMap<Integer, L2CallPoint>();
     }
 
+    /**
+     * Writes out the byte code of all the procedures in the machine as a code image, in the format that the native
+     * machines map into memory and execute in place (see codeimage.h in aima-native). The code is written out exactly
+     * as it is laid out in the machine, from its start to the end of the last procedure, so that the call addresses
+     * in it stay valid, along with the call table naming every procedure in it. Any queries held in the code area are
+     * not written out, other than where they fall between procedures.
+     *
+     * <p/>Functors are written out by their interned ids, and the names of the procedures alongside them, but the
+     * interned names of other functors are not. An image can therefore only be run by name, and its results read by
+     * the names of the procedures in it; it cannot be loaded back into a Java machine.
+     *
+     * @param  out The stream to write the code image to.
+     *
+     * @throws IOException If the image cannot be written to the stream.
+     */
+    public void writeCodeImage(OutputStream out) throws IOException
+    {
+        // Work out the extent of the code, and gather up the names of the procedures.
+        int codeLength = 0;
+        int symbolLength = 0;
+        int callCount = callTable.size();
+        byte[][] symbols = new byte[callCount][];
+        int i = 0;
+
+        for (L2CallPoint callPoint : callTable.values())
+        {
+            FunctorName functorName = getDeinternedFunctorName(callPoint.name);
+
+            codeLength = Math.max(codeLength, callPoint.entryPoint + callPoint.length);
+            symbols[i] = functorName.getName().getBytes("UTF-8");
+            symbolLength += symbols[i].length + 1;
+            i++;
+        }
+
+        // Lay out the sections of the image.
+        int callOffset = CODE_IMAGE_HEADER_SIZE;
+        int symbolOffset = callOffset + (callCount * 5 * 4);
+        int switchOffset = (symbolOffset + symbolLength + 3) & ~3;
+        int codeOffset = ((switchOffset + CODE_IMAGE_CODE_ALIGN - 1) / CODE_IMAGE_CODE_ALIGN) * CODE_IMAGE_CODE_ALIGN;
+
+        ByteBuffer image = ByteBuffer.allocate(codeOffset).order(ByteOrder.nativeOrder());
+
+        image.putInt(CODE_IMAGE_MAGIC).putInt(CODE_IMAGE_VERSION).putInt(CODE_IMAGE_LEVEL);
+        image.putInt(codeOffset).putInt(codeLength);
+        image.putInt(callOffset).putInt(callCount);
+        image.putInt(symbolOffset).putInt(symbolLength);
+        image.putInt(switchOffset).putInt(0);
+
+        // Write out the call table, followed by the procedure names that it refers to.
+        image.position(callOffset);
+
+        int symbol = 0;
+        i = 0;
+
+        for (L2CallPoint callPoint : callTable.values())
+        {
+            image.putInt(callPoint.name).putInt(getDeinternedFunctorName(callPoint.name).getArity());
+            image.putInt(callPoint.entryPoint).putInt(callPoint.length).putInt(symbol);
+            symbol += symbols[i++].length + 1;
+        }
+
+        for (byte[] name : symbols)
+        {
+            image.put(name).put((byte) 0);
+        }
+
+        out.write(image.array());
+        out.write(retrieveCode(new L2CallPoint(0, codeLength, -1)));
+        out.flush();
+    }
+
     /**
      * Records the offset of the start of the code for the named functor.
      *
@@ -761,6 +761,13 @@ public class L2ResolvingJavaMachine extends L2ResolvingMachine
         return data[addr];
     }
 
+    /** {@inheritDoc} */
+    public int getHeapPeak()
+    {
+        // The heap is never collected, so it is at its peak.
+        return hp - HEAP_BASE;
+    }
+
     /**
      * Attempts to unify structures or references on the heap, given two references to them. Structures are matched
      * element by element, free references become bound.
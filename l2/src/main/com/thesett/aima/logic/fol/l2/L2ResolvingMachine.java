@@ -15,8 +15,11 @@
  */
 package com.thesett.aima.logic.fol.l2;
 
+import java.nio.IntBuffer;
+import java.util.ArrayList;
 import java.util.HashMap;
 import java.util.HashSet;
+import java.util.List;
 import java.util.Map;
 import java.util.Set;
 import java.util.concurrent.atomic.AtomicInteger;
@@ -103,6 +106,46 @@ public abstract class L2ResolvingMachine extends L2BaseMachine implements Resolv
         return executeAndExtractBindings(currentQuery);
     }
 
+    /**
+     * Provides the most recently set query, to run when the resolution search is invoked.
+     *
+     * @return The most recently set query, or <tt>null</tt> if none has been set.
+     */
+    protected L2CompiledClause getCurrentQuery()
+    {
+        return currentQuery;
+    }
+
+    /** Forgets the most recently set query, once its code has been dropped from the machine, so that it is not run. */
+    protected void clearCurrentQuery()
+    {
+        currentQuery = null;
+    }
+
+    /**
+     * Resolves a batch of queries, returning the variable bindings of the first solution to each query in order, or
+     * <tt>null</tt> for each query that fails. This runs the queries one after the other; machines that can run a whole
+     * batch in one go override it.
+     *
+     * @param  queries The queries to resolve.
+     *
+     * @return The variable bindings of the first solution to each query, or <tt>null</tt> for each failed query.
+     *
+     * @throws LinkageException If any of the queries cannot be added to the machine because of a linkage error.
+     */
+    public List<Set<Variable>> resolveBatch(List<L2CompiledClause> queries) throws LinkageException
+    {
+        List<Set<Variable>> results = new ArrayList<Set<Variable>>();
+
+        for (L2CompiledClause query : queries)
+        {
+            setQuery(query);
+            results.add(resolve());
+        }
+
+        return results;
+    }
+
     /**
      * Dereferences an offset from the current environment frame on the stack. Storage slots in the current environment
      * may point to other environment frames, but should not contain unbound variables, so ultimately this dereferencing
@@ -159,6 +202,13 @@ public abstract class L2ResolvingMachine extends L2BaseMachine implements Resolv
      */
     protected abstract int getHeap(int addr);
 
+    /**
+     * Reports the most heap cells that have been in use at once, since the machine was last reset.
+     *
+     * @return The peak number of heap cells in use.
+     */
+    public abstract int getHeapPeak();
+
     /**
      * Runs a query, and for every non-anonymous variable in the query, decodes its binding value from the heap and
      * returns it in a set of variable bindings.
@@ -173,39 +223,174 @@ public abstract class L2ResolvingMachine extends L2BaseMachine implements Resolv
         // body, this will follow on to the subsequent functors and make calls to functors in the compiled programs.
         boolean success = execute(query.callPoint);
 
-        // Used to collect the results in.
-        Set<Variable> results = null;
-
         // Collect the results only if the resolution was successfull.
-        if (success)
+        return success ? extractBindings(query) : null;
+    }
+
+    /**
+     * Decodes the binding value from the heap of every non-anonymous variable in a query that has just been run
+     * successfully, and returns them in a set of variable bindings.
+     *
+     * @param  query The query that was run.
+     *
+     * @return A set of variable bindings resulting from the query.
+     */
+    protected Set<Variable> extractBindings(L2CompiledClause query)
+    {
+        Set<Variable> results = new HashSet<Variable>();
+
+        // The same variable context is used accross all of the results, for common use of variables in the
+        // results.
+        Map<Integer, Variable> varContext = new HashMap<Integer, Variable>();
+
+        // For each of the free variables in the query, extract its value from the location on the heap pointed to
+        // by the register that holds the variable.
+        /*log.fine("query.getVarNames().size() =  " + query.getVarNames().size());*/
+
+        for (byte reg : query.getVarNames().keySet())
         {
-            results = new HashSet<Variable>();
+            int varName = query.getVarNames().get(reg);
 
-            // The same variable context is used accross all of the results, for common use of variables in the
-            // results.
-            Map<Integer, Variable> varContext = new HashMap<Integer, Variable>();
+            if (query.getNonAnonymousFreeVariables().contains(varName))
+            {
+                int addr = derefStack(reg);
+                Term term = decodeHeap(addr, varContext);
 
-            // For each of the free variables in the query, extract its value from the location on the heap pointed to
-            // by the register that holds the variable.
-            /*log.fine("query.getVarNames().size() =  " + query.getVarNames().size());*/
+                results.add(new Variable(varName, term, false));
+            }
+        }
 
-            for (byte reg : query.getVarNames().keySet())
+        return results;
+    }
+
+    /**
+     * Writes a query out to a batch of queries to run, as its entry point, the number of its non-anonymous variables,
+     * and the stack offset of each of those variables.
+     *
+     * @param query       The query to write out.
+     * @param queryBuffer The buffer to write the query to.
+     */
+    protected void encodeBatchQuery(L2CompiledClause query, IntBuffer queryBuffer)
+    {
+        List<Byte> regs = new ArrayList<Byte>();
+
+        for (byte reg : query.getVarNames().keySet())
+        {
+            if (query.getNonAnonymousFreeVariables().contains(query.getVarNames().get(reg)))
             {
-                int varName = query.getVarNames().get(reg);
+                regs.add(reg);
+            }
+        }
 
-                if (query.getNonAnonymousFreeVariables().contains(varName))
-                {
-                    int addr = derefStack(reg);
-                    Term term = decodeHeap(addr, varContext);
+        queryBuffer.put(query.callPoint.entryPoint);
+        queryBuffer.put(regs.size());
 
-                    results.add(new Variable(varName, term, false));
-                }
+        for (byte reg : regs)
+        {
+            queryBuffer.put(reg);
+        }
+    }
+
+    /**
+     * Gets the number of ints that a query takes up when written out to a batch by
+     * {@link #encodeBatchQuery(L2CompiledClause, IntBuffer)}.
+     *
+     * @param  query The query to size.
+     *
+     * @return The number of ints that the query takes up in a batch.
+     */
+    protected int sizeofBatchQuery(L2CompiledClause query)
+    {
+        int size = 2;
+
+        for (byte reg : query.getVarNames().keySet())
+        {
+            if (query.getNonAnonymousFreeVariables().contains(query.getVarNames().get(reg)))
+            {
+                size++;
+            }
+        }
+
+        return size;
+    }
+
+    /**
+     * Reads the result of a query in a batch, written out by the native machine. This is 1 if the query succeeded or 0
+     * if it failed, followed on success by the binding of each of the variables written out by
+     * {@link #encodeBatchQuery(L2CompiledClause, IntBuffer)}, in the same order.
+     *
+     * @param  query        The query that the result is for.
+     * @param  resultBuffer The buffer to read the result from.
+     *
+     * @return A set of variable bindings for the query, or <tt>null</tt> if it failed.
+     */
+    protected Set<Variable> decodeBatchResult(L2CompiledClause query, IntBuffer resultBuffer)
+    {
+        if (resultBuffer.get() == 0)
+        {
+            return null;
+        }
+
+        Set<Variable> results = new HashSet<Variable>();
+        Map<Integer, Variable> varContext = new HashMap<Integer, Variable>();
+
+        for (byte reg : query.getVarNames().keySet())
+        {
+            int varName = query.getVarNames().get(reg);
+
+            if (query.getNonAnonymousFreeVariables().contains(varName))
+            {
+                results.add(new Variable(varName, decodeBatchTerm(resultBuffer, varContext), false));
             }
         }
 
         return results;
     }
 
+    /**
+     * Decodes a term from a batch result, where it is written out in prefix order, into an abstract syntax tree. Each
+     * term is written out as its tag and address, which for a structure are followed by its f/n cell and arguments.
+     *
+     * @param  resultBuffer    The buffer to read the term from.
+     * @param  variableContext The variable context for the decoded variables.
+     *
+     * @return The term decoded from the batch result.
+     */
+    private Term decodeBatchTerm(IntBuffer resultBuffer, Map<Integer, Variable> variableContext)
+    {
+        byte tag = (byte) resultBuffer.get();
+        int val = resultBuffer.get();
+
+        if (tag == REF)
+        {
+            Variable var = variableContext.get(val);
+
+            if (var == null)
+            {
+                var = new Variable(varNameId.decrementAndGet(), null, false);
+
+                variableContext.put(val, var);
+            }
+
+            return var;
+        }
+
+        // Decode f/n from the cell following the address of the structure, then each of the arguments in turn.
+        int fn = resultBuffer.get();
+        int f = (fn & 0xFFFFFF00) >> 8;
+
+        FunctorName functorName = getDeinternedFunctorName(f);
+        int arity = functorName.getArity();
+        Term[] arguments = new Term[arity];
+
+        for (int i = 0; i < arity; i++)
+        {
+            arguments[i] = decodeBatchTerm(resultBuffer, variableContext);
+        }
+
+        return new Functor(f, arguments);
+    }
+
     /**
      * Decodes a term from the raw byte representation on the machines heap, into an abstract syntax tree.
      *
@@ -0,0 +1,500 @@
+/*
+ * Copyright The Sett Ltd, 2005 to 2014.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.thesett.aima.logic.fol.l2;
+
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Set;
+
+import com.thesett.aima.logic.fol.Clause;
+import com.thesett.aima.logic.fol.LogicCompiler;
+import com.thesett.aima.logic.fol.Parser;
+import com.thesett.aima.logic.fol.Sentence;
+import com.thesett.aima.logic.fol.Variable;
+import com.thesett.aima.logic.fol.interpreter.ResolutionEngine;
+import com.thesett.aima.logic.fol.isoprologparser.ClauseParser;
+import com.thesett.aima.logic.fol.isoprologparser.Token;
+import com.thesett.aima.logic.fol.isoprologparser.TokenSource;
+import com.thesett.common.error.ImplementationUnavailableException;
+import com.thesett.common.parsing.SourceCodeException;
+import com.thesett.common.util.doublemaps.SymbolTableImpl;
+
+/**
+ * L2EngineTestPerf is a standalone benchmark harness for the L2 machines. It runs a fixed suite of programs through one
+ * of the L2 engines, outside of the unit tests so that no tracing or test framework is timed, and reports for each the
+ * time to compile it into the machine, the time to run it in logical inferences per second (LIPS), and its peak heap
+ * use. The suite covers naive reverse, deep recursion through environment frames, a large table of facts, and deep
+ * unification.
+ *
+ * <p/>The engine to run is named on the command line, as <tt>java</tt> for {@link L2ResolvingJavaMachine}, or
+ * <tt>native</tt> for {@link L2ResolvingNativeMachine}. The byte code interpreter and the LLVM JIT both provide the
+ * native machine, so they are compared by running the native engine with each build of the <tt>aima_native</tt>
+ * library on the <tt>java.library.path</tt>. The compile time of the JIT includes the generation of its native code,
+ * which happens as code is added to the machine.
+ *
+ * <p/>L2 has no backtracking, so every predicate has exactly one clause, and calls are linked as code is added, so
+ * callees must be added before their callers. The programs are therefore generated unrolled, with one predicate for
+ * each list length or level of recursion, and terms are built up by chains of predicates rather than written out in
+ * full, as the registers that a clause can use are limited. At a scale of 1 the programs fit in the fixed code, heap
+ * and stack areas of the Java machine; larger scales are for the native machines.
+ *
+ * <pre><p/><table id="crc"><caption>CRC Card</caption>
+ * <tr><th> Responsibilities <th> Collaborations
+ * <tr><td> Run a suite of benchmark programs through an L2 engine.
+ *     <td> {@link L2Compiler}, {@link L2ResolvingMachine}
+ * <tr><td> Report compile time, LIPS and peak heap use.
+ * </table></pre>
+ *
+ * @author Rupert Smith
+ */
+public class L2EngineTestPerf
+{
+    /** Defines the default number of times to run each benchmark. */
+    public static final int DEFAULT_RUNS = 20;
+
+    /** Defines the default scale of the benchmark programs. */
+    public static final int DEFAULT_SCALE = 1;
+
+    /** Holds the machine to run the benchmarks on. */
+    private final L2ResolvingMachine machine;
+
+    /** Holds the resolution engine to compile the benchmarks with. */
+    private final ResolutionEngine<Clause, L2CompiledClause, L2CompiledClause> engine;
+
+    /** Holds the parser to read the benchmark clauses with. */
+    private final Parser<Clause, Token> parser;
+
+    /**
+     * Creates a benchmark harness for a machine.
+     *
+     * @param machine The machine to run the benchmarks on.
+     */
+    public L2EngineTestPerf(L2ResolvingMachine machine)
+    {
+        this.machine = machine;
+
+        LogicCompiler<Clause, L2CompiledClause, L2CompiledClause> compiler =
+            new L2Compiler(new SymbolTableImpl<Integer, String, Object>(), machine);
+        parser = new ClauseParser(machine);
+
+        engine =
+            new ResolutionEngine<Clause, L2CompiledClause, L2CompiledClause>(parser, machine, compiler, machine)
+            {
+                public void reset()
+                {
+                    L2EngineTestPerf.this.machine.reset();
+                }
+            };
+    }
+
+    /**
+     * Runs the benchmark suite on the engine named on the command line.
+     *
+     * @param args The command line arguments, the engine to run (<tt>java</tt> or <tt>native</tt>), and optionally the
+     *             number of runs of each benchmark and the scale of the benchmark programs.
+     */
+    public static void main(String[] args)
+    {
+        if (args.length < 1)
+        {
+            System.err.println("Usage: L2EngineTestPerf java|native [runs] [scale]");
+            System.exit(-1);
+        }
+
+        try
+        {
+            int runs = (args.length > 1) ? Integer.parseInt(args[1]) : DEFAULT_RUNS;
+            int scale = (args.length > 2) ? Integer.parseInt(args[2]) : DEFAULT_SCALE;
+
+            L2EngineTestPerf perf = new L2EngineTestPerf(createMachine(args[0]));
+
+            System.out.println("Engine: " + args[0] + ", java.library.path: " +
+                System.getProperty("java.library.path") + ", runs: " + runs + ", scale: " + scale);
+            System.out.println(String.format("%-16s %12s %12s %12s %14s %12s", "benchmark", "inferences",
+                    "compile ms", "run ms", "LIPS", "heap cells"));
+
+            perf.runBenchmark(new NRevBenchmark(30 * scale), runs);
+            perf.runBenchmark(new DeepRecursionBenchmark(300 * scale), runs);
+            perf.runBenchmark(new FactTableBenchmark(200 * scale), runs);
+            perf.runBenchmark(new DeepUnificationBenchmark(300 * scale, 20), runs);
+        }
+        catch (Exception e)
+        {
+            e.printStackTrace();
+            System.exit(-1);
+        }
+    }
+
+    /**
+     * Creates the machine for a named engine.
+     *
+     * @param  engineName The name of the engine, <tt>java</tt> or <tt>native</tt>.
+     *
+     * @return The machine for the engine.
+     *
+     * @throws ImplementationUnavailableException If the native library cannot be loaded and linked.
+     */
+    private static L2ResolvingMachine createMachine(String engineName) throws ImplementationUnavailableException
+    {
+        if ("java".equals(engineName))
+        {
+            return new L2ResolvingJavaMachine();
+        }
+        else if ("native".equals(engineName))
+        {
+            return L2ResolvingNativeMachine.getInstance();
+        }
+        else
+        {
+            throw new IllegalArgumentException("Unknown engine " + engineName + ", expected java or native.");
+        }
+    }
+
+    /**
+     * Runs a benchmark a number of times, each time on a freshly reset machine, and prints out the best compile and run
+     * times, and the peak heap use.
+     *
+     * @param  benchmark The benchmark to run.
+     * @param  runs      The number of times to run it.
+     *
+     * @throws SourceCodeException If the benchmark program will not parse or compile.
+     */
+    public void runBenchmark(Benchmark benchmark, int runs) throws SourceCodeException
+    {
+        long bestCompile = Long.MAX_VALUE;
+        long bestRun = Long.MAX_VALUE;
+        int heapPeak = 0;
+
+        for (int i = 0; i < runs; i++)
+        {
+            engine.reset();
+
+            long start = System.nanoTime();
+
+            for (String clause : benchmark.program())
+            {
+                addClause(clause);
+            }
+
+            engine.endScope();
+            setQuery(benchmark.query());
+
+            long compiled = System.nanoTime();
+
+            Set<Variable> solution = machine.resolve();
+
+            long end = System.nanoTime();
+
+            if (solution == null)
+            {
+                throw new IllegalStateException("The benchmark " + benchmark.name() + " failed to resolve.");
+            }
+
+            bestCompile = Math.min(bestCompile, compiled - start);
+            bestRun = Math.min(bestRun, end - compiled);
+            heapPeak = Math.max(heapPeak, machine.getHeapPeak());
+        }
+
+        long lips = (benchmark.inferences() * 1000000000L) / Math.max(bestRun, 1);
+
+        System.out.println(String.format("%-16s %12d %12.3f %12.3f %14d %12d", benchmark.name(),
+                benchmark.inferences(), bestCompile / 1000000.0, bestRun / 1000000.0, lips, heapPeak));
+    }
+
+    /**
+     * Parses and sets the current query on the resolution engine.
+     *
+     * @param  queryString The query to set.
+     *
+     * @throws SourceCodeException If the query will not parse or compile.
+     */
+    private void setQuery(String queryString) throws SourceCodeException
+    {
+        engine.setTokenSource(TokenSource.getTokenSourceForString(queryString));
+
+        engine.compile(engine.parse());
+    }
+
+    /**
+     * Parses and adds a clause to the resolution engine.
+     *
+     * @param  termText The clause to add.
+     *
+     * @throws SourceCodeException If the clause will not parse or compile.
+     */
+    private void addClause(String termText) throws SourceCodeException
+    {
+        parser.setTokenSource(TokenSource.getTokenSourceForString(termText));
+
+        Sentence<Clause> sentence = parser.parse();
+        engine.compile(sentence);
+    }
+
+    /**
+     * A Benchmark is a generated program, with a query to run against it and the number of logical inferences (calls)
+     * that the query makes. The query calls a single <tt>bench</tt> predicate, so that it has no variable bindings to
+     * decode and only the resolution is timed.
+     */
+    public abstract static class Benchmark
+    {
+        /**
+         * Provides the name of the benchmark.
+         *
+         * @return The name of the benchmark.
+         */
+        public abstract String name();
+
+        /**
+         * Generates the clauses of the benchmark program, with every callee before its callers.
+         *
+         * @return The clauses of the benchmark program.
+         */
+        public abstract List<String> program();
+
+        /**
+         * Provides the number of logical inferences that running the benchmark query makes, including the call to
+         * <tt>bench</tt>.
+         *
+         * @return The number of logical inferences that the query makes.
+         */
+        public abstract long inferences();
+
+        /**
+         * Provides the query that runs the benchmark.
+         *
+         * @return The query that runs the benchmark.
+         */
+        public String query()
+        {
+            return "?- bench.";
+        }
+    }
+
+    /**
+     * Naive reverse of a list of n elements, unrolled into <tt>nrev_k/2</tt> and <tt>app_k/3</tt> for each list length
+     * k. The list is built by <tt>list_k/1</tt>. Reversing takes the classic (n + 1)(n + 2) / 2 inferences.
+     */
+    public static class NRevBenchmark extends Benchmark
+    {
+        /** Holds the length of the list to reverse. */
+        private final int n;
+
+        /**
+         * Creates a naive reverse benchmark.
+         *
+         * @param n The length of the list to reverse.
+         */
+        public NRevBenchmark(int n)
+        {
+            this.n = n;
+        }
+
+        /** {@inheritDoc} */
+        public String name()
+        {
+            return "nrev" + n;
+        }
+
+        /** {@inheritDoc} */
+        public List<String> program()
+        {
+            List<String> program = new ArrayList<String>();
+
+            program.add("list_0([])");
+            program.add("app_0([], L, L)");
+            program.add("nrev_0([], [])");
+
+            for (int k = 1; k <= n; k++)
+            {
+                program.add("list_" + k + "([a" + k + "|T]) :- list_" + (k - 1) + "(T)");
+                program.add("app_" + k + "([X|T], L, [X|R]) :- app_" + (k - 1) + "(T, L, R)");
+                program.add("nrev_" + k + "([X|R], A) :- nrev_" + (k - 1) + "(R, L), app_" + (k - 1) +
+                    "(L, [X], A)");
+            }
+
+            program.add("bench :- list_" + n + "(L), nrev_" + n + "(L, R)");
+
+            return program;
+        }
+
+        /** {@inheritDoc} */
+        public long inferences()
+        {
+            return 1 + (n + 1) + (((long) (n + 1) * (n + 2)) / 2);
+        }
+    }
+
+    /**
+     * Recursion d levels deep through <tt>deep_k/1</tt>, where each level calls the next and then a fact, so that
+     * every level keeps an environment frame on the stack until the recursion unwinds.
+     */
+    public static class DeepRecursionBenchmark extends Benchmark
+    {
+        /** Holds the depth of the recursion. */
+        private final int d;
+
+        /**
+         * Creates a deep recursion benchmark.
+         *
+         * @param d The depth of the recursion.
+         */
+        public DeepRecursionBenchmark(int d)
+        {
+            this.d = d;
+        }
+
+        /** {@inheritDoc} */
+        public String name()
+        {
+            return "recurse" + d;
+        }
+
+        /** {@inheritDoc} */
+        public List<String> program()
+        {
+            List<String> program = new ArrayList<String>();
+
+            program.add("leaf(_)");
+            program.add("deep_0(_)");
+
+            for (int k = 1; k <= d; k++)
+            {
+                program.add("deep_" + k + "(X) :- deep_" + (k - 1) + "(X), leaf(X)");
+            }
+
+            program.add("bench :- deep_" + d + "(X), leaf(X)");
+
+            return program;
+        }
+
+        /** {@inheritDoc} */
+        public long inferences()
+        {
+            return 1 + (d + 1) + d + 1;
+        }
+    }
+
+    /**
+     * A table of n facts <tt>fact_k/1</tt>, each called once with a matching constant from a single clause, so that
+     * the code area and the call table are large.
+     */
+    public static class FactTableBenchmark extends Benchmark
+    {
+        /** Holds the number of facts. */
+        private final int n;
+
+        /**
+         * Creates a fact table benchmark.
+         *
+         * @param n The number of facts.
+         */
+        public FactTableBenchmark(int n)
+        {
+            this.n = n;
+        }
+
+        /** {@inheritDoc} */
+        public String name()
+        {
+            return "facts" + n;
+        }
+
+        /** {@inheritDoc} */
+        public List<String> program()
+        {
+            List<String> program = new ArrayList<String>();
+            StringBuilder bench = new StringBuilder("bench :- ");
+
+            for (int k = 1; k <= n; k++)
+            {
+                program.add("fact_" + k + "(c" + k + ")");
+                bench.append((k > 1) ? ", " : "").append("fact_").append(k).append("(c").append(k).append(")");
+            }
+
+            program.add(bench.toString());
+
+            return program;
+        }
+
+        /** {@inheritDoc} */
+        public long inferences()
+        {
+            return 1 + n;
+        }
+    }
+
+    /**
+     * Unification of two separately built, but equal, terms d levels deep, u times over. The terms are built by
+     * <tt>term_k/1</tt>, and unified by <tt>eq/2</tt>; as they are ground, each unification walks the full depth of
+     * both.
+     */
+    public static class DeepUnificationBenchmark extends Benchmark
+    {
+        /** Holds the depth of the terms. */
+        private final int d;
+
+        /** Holds the number of times to unify the terms. */
+        private final int u;
+
+        /**
+         * Creates a deep unification benchmark.
+         *
+         * @param d The depth of the terms.
+         * @param u The number of times to unify the terms.
+         */
+        public DeepUnificationBenchmark(int d, int u)
+        {
+            this.d = d;
+            this.u = u;
+        }
+
+        /** {@inheritDoc} */
+        public String name()
+        {
+            return "unify" + d + "x" + u;
+        }
+
+        /** {@inheritDoc} */
+        public List<String> program()
+        {
+            List<String> program = new ArrayList<String>();
+            StringBuilder bench = new StringBuilder("bench :- term_" + d + "(X), term_" + d + "(Y)");
+
+            program.add("eq(X, X)");
+            program.add("term_0(z)");
+
+            for (int k = 1; k <= d; k++)
+            {
+                program.add("term_" + k + "(s(X)) :- term_" + (k - 1) + "(X)");
+            }
+
+            for (int i = 0; i < u; i++)
+            {
+                bench.append(", eq(X, Y)");
+            }
+
+            program.add(bench.toString());
+
+            return program;
+        }
+
+        /** {@inheritDoc} */
+        public long inferences()
+        {
+            return 1 + (2 * (d + 1)) + u;
+        }
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright The Sett Ltd, 2005 to 2014.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.thesett.aima.logic.fol.l2;
+
+import java.util.Set;
+import java.util.TreeSet;
+
+import junit.framework.Assert;
+
+import com.thesett.aima.logic.fol.Clause;
+import com.thesett.aima.logic.fol.Functor;
+import com.thesett.aima.logic.fol.LogicCompiler;
+import com.thesett.aima.logic.fol.Parser;
+import com.thesett.aima.logic.fol.Term;
+import com.thesett.aima.logic.fol.Variable;
+import com.thesett.aima.logic.fol.interpreter.ResolutionEngine;
+import com.thesett.aima.logic.fol.isoprologparser.ClauseParser;
+import com.thesett.aima.logic.fol.isoprologparser.Token;
+import com.thesett.aima.logic.fol.isoprologparser.TokenSource;
+import com.thesett.common.parsing.SourceCodeException;
+import com.thesett.common.util.doublemaps.SymbolTableImpl;
+
+/**
+ * L2ResolvingNativeMachineFixture is a fresh native L2 machine and a resolution engine onto it, for tests that need a
+ * machine of their own, with a program on it that runs a long chain of calls and leaves garbage on the heap as it
+ * goes.
+ *
+ * <pre><p/><table id="crc"><caption>CRC Card</caption>
+ * <tr><th> Responsibilities <th> Collaborations
+ * <tr><td> Create a native machine with a given heap size. <td> {@link L2ResolvingNativeMachine}.
+ * <tr><td> Compile clauses and queries onto the machine. <td> {@link ResolutionEngine}.
+ * <tr><td> Add the chain program, and check the bindings of queries on it.
+ * </table></pre>
+ *
+ * @author Rupert Smith
+ */
+public class L2ResolvingNativeMachineFixture
+{
+    /**
+     * Defines the number of calls in the chain program, each of which leaves 13 cells on the heap, of which only 3 are
+     * still live once the chain has been run.
+     */
+    public static final int CHAIN_DEPTH = 100;
+
+    /** Defines a heap size that the chain program overflows, unless the heap is collected as it runs. */
+    public static final int SMALL_HEAP_SIZE = 1024;
+
+    /** Holds the native machine. */
+    private final L2ResolvingNativeMachine machine;
+
+    /** Holds the resolution engine onto the native machine. */
+    private final ResolutionEngine<Clause, L2CompiledClause, L2CompiledClause> engine;
+
+    /**
+     * Creates a fresh native machine with the specified heap size, and a resolution engine onto it. The native library
+     * must already have been loaded, through {@link L2ResolvingNativeMachine#getInstance()}.
+     *
+     * @param heapSize The size of the heap in cells.
+     */
+    public L2ResolvingNativeMachineFixture(int heapSize)
+    {
+        machine =
+            new L2ResolvingNativeMachine(L2ResolvingNativeMachine.DEFAULT_REG_SIZE, heapSize,
+                L2ResolvingNativeMachine.DEFAULT_STACK_SIZE, L2ResolvingNativeMachine.DEFAULT_PDL_SIZE);
+
+        LogicCompiler<Clause, L2CompiledClause, L2CompiledClause> compiler =
+            new L2Compiler(new SymbolTableImpl<Integer, String, Object>(), machine);
+        Parser<Clause, Token> parser = new ClauseParser(machine);
+
+        engine =
+            new ResolutionEngine<Clause, L2CompiledClause, L2CompiledClause>(parser, machine, compiler, machine)
+            {
+                public void reset()
+                {
+                    machine.reset();
+                }
+            };
+    }
+
+    /**
+     * Provides the native machine.
+     *
+     * @return The native machine.
+     */
+    public L2ResolvingNativeMachine getMachine()
+    {
+        return machine;
+    }
+
+    /**
+     * Adds the chain program to the machine, such that <tt>p1(L, R)</tt> binds R to L wrapped in {@link #CHAIN_DEPTH}
+     * k/1 functors. Every predicate in the chain also passes a new h/8 functor to q/1, that is garbage as soon as q/1
+     * returns. The predicates are added from the end of the chain back, so that every call is to a predicate that has
+     * already been added.
+     *
+     * @throws SourceCodeException If the program will not parse or compile.
+     */
+    public void addChainProgram() throws SourceCodeException
+    {
+        compile("q(_).");
+        compile("p" + (CHAIN_DEPTH + 1) + "(L, L).");
+
+        for (int i = CHAIN_DEPTH; i > 0; i--)
+        {
+            compile("p" + i + "(L, R) :- q(h(_, _, _, _, _, _, _, _)), p" + (i + 1) + "(k(L), R).");
+        }
+
+        engine.endScope();
+    }
+
+    /**
+     * Parses and compiles a clause or query on the engine. A compiled query becomes the current query of the machine.
+     *
+     * @param  text The clause or query to compile.
+     *
+     * @throws SourceCodeException If the clause will not parse or compile.
+     */
+    public void compile(String text) throws SourceCodeException
+    {
+        engine.setTokenSource(TokenSource.getTokenSourceForString(text));
+        engine.compile(engine.parse());
+    }
+
+    /**
+     * Checks that the bindings of a query on the chain program bind its one variable to an atom wrapped in
+     * {@link #CHAIN_DEPTH} k/1 functors.
+     *
+     * @param bindings The bindings of the query.
+     * @param atom     The name of the atom that should be innermost.
+     */
+    public void assertChain(Set<Variable> bindings, String atom)
+    {
+        Assert.assertNotNull("The query should have resolved.", bindings);
+        Assert.assertEquals("The query should have one binding.", 1, bindings.size());
+
+        Term term = bindings.iterator().next().getValue();
+
+        for (int i = 0; i <= CHAIN_DEPTH; i++)
+        {
+            Assert.assertTrue("The binding should be a functor at depth " + i + ".", term instanceof Functor);
+
+            Functor functor = (Functor) term;
+
+            if (i == CHAIN_DEPTH)
+            {
+                Assert.assertEquals("The innermost functor should be the atom.", atom, machine.getFunctorName(functor));
+            }
+            else
+            {
+                Assert.assertEquals("The functor at depth " + i + " should be k/1.", "k",
+                    machine.getFunctorName(functor));
+                term = functor.getArgument(0);
+            }
+        }
+    }
+
+    /**
+     * Prints out the bindings of a query, in order of the variable names, so that bindings can be compared.
+     *
+     * @param  bindings The bindings of a query, or <tt>null</tt> if it failed.
+     *
+     * @return The bindings printed as text, or <tt>null</tt> if the query failed.
+     */
+    public String bindingsToString(Set<Variable> bindings)
+    {
+        if (bindings == null)
+        {
+            return null;
+        }
+
+        Set<String> printed = new TreeSet<String>();
+
+        for (Variable variable : bindings)
+        {
+            printed.add(machine.getVariableName(variable.getName()) + " = " +
+                variable.getValue().toString(machine, true, false));
+        }
+
+        return printed.toString();
+    }
+}
@@ -15,6 +15,10 @@
  */
 package com.thesett.aima.logic.fol.l2;
 
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Set;
+
 import junit.framework.Test;
 import junit.framework.TestCase;
 import junit.framework.TestSuite;
@@ -25,8 +29,10 @@ import com.thesett.aima.logic.fol.BasicResolverUnitTestBase;
 import com.thesett.aima.logic.fol.BasicUnificationUnitTestBase;
 import com.thesett.aima.logic.fol.Clause;
 import com.thesett.aima.logic.fol.ConjunctionResolverUnitTestBase;
+import com.thesett.aima.logic.fol.Functor;
 import com.thesett.aima.logic.fol.LogicCompiler;
 import com.thesett.aima.logic.fol.Parser;
+import com.thesett.aima.logic.fol.Variable;
 import com.thesett.aima.logic.fol.interpreter.ResolutionEngine;
 import com.thesett.aima.logic.fol.isoprologparser.ClauseParser;
 import com.thesett.aima.logic.fol.isoprologparser.Token;
@@ -214,10 +220,232 @@ public class L2ResolvingNativeMachineTestBase extends TestCase
                 "testSuccesiveConjunctiveTermsOk", engine));
 
         // Add all the tests defined in this class.
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testBindingsSurviveGarbageCollection"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testBatchResolvesAsQueriesOneByOne"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testBatchLargerThanCodeBufferResolves"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testBudgetedResolutionCompletesInSlices"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testInterruptSuspendsQueryAtFirstCall"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testInterruptSuspendsRunningQuery"));
+        suite.addTest(new L2ResolvingNativeMachineTestBase("testQueriesInARowResolveWithRollback"));
 
         return suite;
     }
 
+    /**
+     * Checks that a query that leaves more on the heap than it can hold is run to completion by collecting the heap
+     * as it goes, and that the bindings that it builds survive the collections.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testBindingsSurviveGarbageCollection() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachineFixture.SMALL_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        fixture.compile("?- p1(a, R).");
+
+        fixture.assertChain(fixture.getMachine().resolve(), "a");
+    }
+
+    /**
+     * Checks that a batch of queries, both succeeding and failing, and each collecting the heap as it runs, resolves to
+     * the same bindings as the same queries resolved one by one.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testBatchResolvesAsQueriesOneByOne() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachineFixture.SMALL_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        String[] queryTexts =
+            new String[]
+            {
+                "?- p1(a, R).", "?- p1(b, R).", "?- q(c).",
+                "?- p" + (L2ResolvingNativeMachineFixture.CHAIN_DEPTH + 1) + "(a, b).", "?- p1(c, R)."
+            };
+        List<L2CompiledClause> queries = new ArrayList<L2CompiledClause>();
+        List<String> expected = new ArrayList<String>();
+
+        for (String queryText : queryTexts)
+        {
+            fixture.compile(queryText);
+            queries.add(nativeMachine.getCurrentQuery());
+
+            expected.add(fixture.bindingsToString(nativeMachine.resolve()));
+        }
+
+        List<String> actual = new ArrayList<String>();
+
+        for (Set<Variable> bindings : nativeMachine.resolveBatch(queries))
+        {
+            actual.add(fixture.bindingsToString(bindings));
+        }
+
+        assertNull("The query that cannot resolve should fail.", expected.get(3));
+        assertEquals("The batch should resolve the same as the queries one by one.", expected, actual);
+    }
+
+    /**
+     * Checks that a batch of queries with far more code than fits in the initial code buffer resolves, that the same
+     * batch can be run again, and that the program can still be queried once the batches are done.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testBatchLargerThanCodeBufferResolves() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachine.DEFAULT_HEAP_SIZE);
+        fixture.compile("r(X, X).");
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        List<L2CompiledClause> queries = new ArrayList<L2CompiledClause>();
+
+        for (int i = 0; i < 2000; i++)
+        {
+            fixture.compile("?- r(c" + i + ", R).");
+            queries.add(nativeMachine.getCurrentQuery());
+        }
+
+        for (int run = 0; run < 2; run++)
+        {
+            List<Set<Variable>> results = nativeMachine.resolveBatch(queries);
+
+            assertEquals("Every query in the batch should have a result.", queries.size(), results.size());
+
+            for (int i = 0; i < results.size(); i++)
+            {
+                Set<Variable> bindings = results.get(i);
+
+                assertNotNull("Query " + i + " should have resolved.", bindings);
+                assertEquals("Query " + i + " should have one binding.", 1, bindings.size());
+                assertEquals("Query " + i + " should bind R to its atom.", "c" + i,
+                    nativeMachine.getFunctorName((Functor) bindings.iterator().next().getValue()));
+            }
+        }
+
+        fixture.compile("?- p1(a, R).");
+
+        fixture.assertChain(nativeMachine.resolve(), "a");
+    }
+
+    /**
+     * Checks that a query run in slices of a small budget of calls suspends between them, and once resumed for long
+     * enough succeeds with the bindings that it builds across all of the slices.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testBudgetedResolutionCompletesInSlices() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachine.DEFAULT_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        fixture.compile("?- p1(a, R).");
+
+        int slices = 1;
+        int result = nativeMachine.resolveBudgeted(3);
+
+        while (result == L2ResolvingNativeMachine.SUSPENDED)
+        {
+            slices++;
+            result = nativeMachine.resumeBudgeted(3);
+        }
+
+        assertEquals("The query should have succeeded.", L2ResolvingNativeMachine.SUCCEEDED, result);
+        assertTrue("The query should have been suspended between slices.",
+            slices > (L2ResolvingNativeMachineFixture.CHAIN_DEPTH / 3));
+        fixture.assertChain(nativeMachine.getBindings(), "a");
+
+        assertEquals("There should be no suspended query left to resume.", L2ResolvingNativeMachine.FAILED,
+            nativeMachine.resumeBudgeted(3));
+    }
+
+    /**
+     * Checks that a query interrupted before it is run suspends at its first call, even without a budget, and can be
+     * resumed to success.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testInterruptSuspendsQueryAtFirstCall() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachine.DEFAULT_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        fixture.compile("?- p1(a, R).");
+
+        nativeMachine.interrupt();
+
+        assertEquals("The interrupted query should have suspended.", L2ResolvingNativeMachine.SUSPENDED,
+            nativeMachine.resolveBudgeted(0));
+        assertEquals("The resumed query should have succeeded.", L2ResolvingNativeMachine.SUCCEEDED,
+            nativeMachine.resumeBudgeted(0));
+        fixture.assertChain(nativeMachine.getBindings(), "a");
+    }
+
+    /**
+     * Checks that interrupting a query part way through stops it at its next call, when it would otherwise have run to
+     * completion, and that it can be resumed to success.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testInterruptSuspendsRunningQuery() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachine.DEFAULT_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        fixture.compile("?- p1(a, R).");
+
+        assertEquals("The query should have suspended when its budget ran out.", L2ResolvingNativeMachine.SUSPENDED,
+            nativeMachine.resolveBudgeted(2));
+
+        nativeMachine.interrupt();
+
+        assertEquals("The interrupted query should have suspended.", L2ResolvingNativeMachine.SUSPENDED,
+            nativeMachine.resumeBudgeted(0));
+        assertEquals("The resumed query should have succeeded.", L2ResolvingNativeMachine.SUCCEEDED,
+            nativeMachine.resumeBudgeted(0));
+        fixture.assertChain(nativeMachine.getBindings(), "a");
+    }
+
+    /**
+     * Checks that queries run one after another with rollback turned on, each starting from the watermark and each
+     * collecting the heap as it runs, all resolve to their own bindings, including after a query that fails.
+     *
+     * @throws Exception If the test program will not compile, or anything else goes wrong.
+     */
+    public void testQueriesInARowResolveWithRollback() throws Exception
+    {
+        L2ResolvingNativeMachineFixture fixture =
+            new L2ResolvingNativeMachineFixture(L2ResolvingNativeMachineFixture.SMALL_HEAP_SIZE);
+        fixture.addChainProgram();
+
+        L2ResolvingNativeMachine nativeMachine = fixture.getMachine();
+        nativeMachine.setRollback(true);
+
+        String[] atoms = new String[] { "a", "b", "c", "d", "e" };
+
+        for (String atom : atoms)
+        {
+            fixture.compile("?- p1(" + atom + ", R).");
+
+            fixture.assertChain(nativeMachine.resolve(), atom);
+
+            fixture.compile("?- p" + (L2ResolvingNativeMachineFixture.CHAIN_DEPTH + 1) + "(" + atom + ", z).");
+
+            assertNull("The query that cannot resolve should fail.", nativeMachine.resolve());
+        }
+    }
+
     protected void setUp()
     {
         NDC.push(getName());
@@ -16,7 +16,12 @@
 package com.thesett.aima.logic.fol.l3.nativemachine;
 
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.IntBuffer;
+import java.nio.LongBuffer;
+import java.util.ArrayList;
 import java.util.Iterator;
+import java.util.List;
 import java.util.Set;
 
 import com.thesett.aima.logic.fol.LinkageException;
@@ -24,6 +29,7 @@ import com.thesett.aima.logic.fol.Variable;
 import com.thesett.aima.logic.fol.l3.L3CallPoint;
 import com.thesett.aima.logic.fol.l3.L3CompiledPredicate;
 import com.thesett.aima.logic.fol.l3.L3CompiledQuery;
+import com.thesett.aima.logic.fol.l3.L3Instruction;
 import com.thesett.aima.logic.fol.l3.L3ResolvingMachine;
 import com.thesett.common.error.ImplementationUnavailableException;
 import com.thesett.common.error.NotImplementedException;
@@ -56,6 +62,36 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
     /** Defines the initial code area size for the virtual machine. */
     private static final int CODE_SIZE = 10000;
 
+    /** Defines the default register capacity for the virtual machine. */
+    public static final int DEFAULT_REG_SIZE = 10;
+
+    /** Defines the default heap size for the virtual machine. */
+    public static final int DEFAULT_HEAP_SIZE = 4000000;
+
+    /** Defines the default stack size for the virtual machine. */
+    public static final int DEFAULT_STACK_SIZE = 1000000;
+
+    /** Defines the default max unification stack depth for the virtual machine. */
+    public static final int DEFAULT_PDL_SIZE = 100000;
+
+    /** Defines the outcome of a budgeted execution that failed to find a unification. */
+    public static final int FAILED = 0;
+
+    /** Defines the outcome of a budgeted execution that found a unification. */
+    public static final int SUCCEEDED = 1;
+
+    /** Defines the outcome of a budgeted execution that ran out of budget, or was interrupted, and can be resumed. */
+    public static final int SUSPENDED = 2;
+
+    /** Defines the initial size, in ints, of the buffer that the results of a batch of queries are written to. */
+    private static final int BATCH_RESULT_SIZE = 10000;
+
+    /**
+     * Defines the largest size, in ints, that the batch result buffer is grown to. The bindings of a query that do not
+     * fit into this are taken to be cyclic, as they can be when built without the occurs check, and never to fit.
+     */
+    private static final int MAX_BATCH_RESULT_SIZE = 16000000;
+
     /** Used to record whether the native implementation library was successfully loaded. */
     private static boolean libraryFound;
 
@@ -68,15 +104,77 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
      */
     ByteBuffer codeBuffer;
 
+    /**
+     * Holds the entry point of each piece of code in the code buffer, in the order that they were added, so that they
+     * can be added to the native machine again when the code is moved into a larger buffer.
+     */
+    private final List<Integer> codeEntries = new ArrayList<Integer>();
+
+    /** Holds the register capacity of the native machine. */
+    private final int regSize;
+
+    /** Holds the heap size of the native machine. */
+    private final int heapSize;
+
+    /** Holds the stack size of the native machine. */
+    private final int stackSize;
+
+    /** Holds the max unification stack depth of the native machine. */
+    private final int pdlSize;
+
+    /** Holds a handle onto the state of the native machine, created when the machine is first reset. */
+    private long nativeState;
+
+    /**
+     * Holds a view onto the data area of the native machine, so that the heap can be read without calling into the
+     * native machine. This is fetched afresh whenever the machine is reset. This view is used when the native machine
+     * was built with compact 32 bit heap cells.
+     */
+    private IntBuffer heap;
+
+    /** Holds a view onto the data area of the native machine, used when it was built with 64 bit heap cells. */
+    private LongBuffer wideHeap;
+
+    /** Holds the heap cell tag from the most recent dereference. */
+    private byte derefTag;
+
+    /** Holds the heap cell value from the most recent dereference. */
+    private int derefVal;
+
+    /** Holds the entry point of the most recently added query, as queries do not expose their call points. */
+    private int queryEntryPoint;
+
     /**
      * Creates a unifying virtual machine for L3 with default heap sizes.
      *
      * @param symbolTable The symbol table for the machine.
      */
     public L3ResolvingNativeMachine(SymbolTable<Integer, String, Object> symbolTable)
+    {
+        this(symbolTable, DEFAULT_REG_SIZE, DEFAULT_HEAP_SIZE, DEFAULT_STACK_SIZE, DEFAULT_PDL_SIZE);
+    }
+
+    /**
+     * Creates a unifying virtual machine for L3 with the specified heap sizes. The native machine reserves its data
+     * area up front, but only uses memory as the heap and stacks grow into it, so generous sizes are cheap. Running out
+     * of space fails the query being executed.
+     *
+     * @param symbolTable The symbol table for the machine.
+     * @param regSize     The number of registers.
+     * @param heapSize    The size of the heap in cells.
+     * @param stackSize   The size of the stack in cells.
+     * @param pdlSize     The max unification stack depth in cells.
+     */
+    public L3ResolvingNativeMachine(SymbolTable<Integer, String, Object> symbolTable, int regSize, int heapSize,
+        int stackSize, int pdlSize)
     {
         super(symbolTable);
 
+        this.regSize = regSize;
+        this.heapSize = heapSize;
+        this.stackSize = stackSize;
+        this.pdlSize = pdlSize;
+
         // Reset the machine to its initial state.
         reset();
     }
@@ -125,9 +223,11 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
     /** {@inheritDoc} */
     public void emmitCode(L3CompiledPredicate predicate) throws LinkageException
     {
-        // Keep track of the offset into which the code was loaded.
-        int entryPoint = codeBuffer.position();
+        // Keep track of the offset into which the code was loaded, making room for it first.
         int length = (int) predicate.sizeof();
+        reserveCode(length);
+
+        int entryPoint = codeBuffer.position();
         byte[] code = new byte[length];
 
         // If the code is for a program clause, store the programs entry point in the call table.
@@ -138,25 +238,30 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
 
         // Notify the native machine of the addition of new code.
         codeBuffer.put(code, 0, length);
+        codeEntries.add(entryPoint);
         codeAdded(codeBuffer, entryPoint, length);
     }
 
     /** {@inheritDoc} */
     public void emmitCode(L3CompiledQuery query) throws LinkageException
     {
-        // Keep track of the offset into which the code was loaded.
-        int entryPoint = codeBuffer.position();
+        // Keep track of the offset into which the code was loaded, making room for it first.
         int length = (int) query.sizeof();
+        reserveCode(length);
+
+        int entryPoint = codeBuffer.position();
         byte[] code = new byte[length];
 
         // If the code is for a program clause, store the programs entry point in the call table.
         L3CallPoint callPoint = new L3CallPoint(entryPoint, length, -1);
+        queryEntryPoint = entryPoint;
 
         // Emmit code for the clause into this machine.
         query.emmitCode(0, code, this, callPoint);
 
         // Notify the native machine of the addition of new code.
         codeBuffer.put(code, 0, length);
+        codeEntries.add(entryPoint);
         codeAdded(codeBuffer, entryPoint, length);
     }
 
@@ -166,6 +271,52 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
         codeBuffer.putInt(offset, address);
     }
 
+    /**
+     * Makes room in the code buffer for more code, by moving the code into a buffer of twice the size if it does not
+     * fit. The native machine keeps track of the code by the buffer that it is in, so all of the code is added to it
+     * again, in the pieces that it was first added in.
+     *
+     * @param length The length of the code to make room for.
+     */
+    private void reserveCode(int length)
+    {
+        if (codeBuffer.remaining() >= length)
+        {
+            return;
+        }
+
+        int end = codeBuffer.position();
+        ByteBuffer grown = ByteBuffer.allocateDirect(Math.max(codeBuffer.capacity() * 2, end + length));
+
+        codeBuffer.flip();
+        grown.put(codeBuffer);
+        codeBuffer = grown;
+
+        for (int i = 0; i < codeEntries.size(); i++)
+        {
+            int entryPoint = codeEntries.get(i);
+            int next = (i < (codeEntries.size() - 1)) ? codeEntries.get(i + 1) : end;
+
+            codeAdded(codeBuffer, entryPoint, next - entryPoint);
+        }
+    }
+
+    /**
+     * Drops all of the code added to the code buffer from an offset on, so that the space it took up is used for the
+     * next code to be added.
+     *
+     * @param offset The offset to drop the code from.
+     */
+    private void rewindCode(int offset)
+    {
+        codeBuffer.position(offset);
+
+        while (!codeEntries.isEmpty() && (codeEntries.get(codeEntries.size() - 1) >= offset))
+        {
+            codeEntries.remove(codeEntries.size() - 1);
+        }
+    }
+
     /**
      * Extracts the raw byte code from the machine for a given call table entry.
      *
@@ -190,9 +341,16 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
     {
         // Clear the code buffer.
         codeBuffer = ByteBuffer.allocateDirect(CODE_SIZE);
+        codeEntries.clear();
 
         // Reset the native part of the machine.
-        nativeReset();
+        nativeState = nativeReset(nativeState, regSize, heapSize, stackSize, pdlSize);
+
+        // Take a view onto the data area that matches the cell layout that the native machine was built with.
+        ByteBuffer dataArea = getDataArea(nativeState).order(ByteOrder.nativeOrder());
+        boolean wideCells = getCellSize(nativeState) == 8;
+        heap = wideCells ? null : dataArea.asIntBuffer();
+        wideHeap = wideCells ? dataArea.asLongBuffer() : null;
 
         // Ensure that the overridden reset method of L3BaseMachine is run too, to clear the call table.
         super.reset();
@@ -200,9 +358,42 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
 
     /**
      * Resets the machine, to its initial state. This clears any programs from the machine, and clears all of its stacks
-     * and heaps.
+     * and heaps. The native state is created on the first reset, and reused by later ones.
+     *
+     * @param  state     A handle onto the native machine state, or zero if it has not been created yet.
+     * @param  regSize   The number of registers.
+     * @param  heapSize  The size of the heap in cells.
+     * @param  stackSize The size of the stack in cells.
+     * @param  pdlSize   The max unification stack depth in cells.
+     *
+     * @return A handle onto the native machine state.
      */
-    public native void nativeReset();
+    private native long nativeReset(long state, int regSize, int heapSize, int stackSize, int pdlSize);
+
+    /**
+     * Releases the state of the native machine. Releasing a zero handle does nothing.
+     *
+     * @param state A handle onto the native machine state.
+     */
+    private native void nativeRelease(long state);
+
+    /**
+     * Releases the state of the native machine, once this machine is no longer referenced.
+     *
+     * @throws Throwable Any exception from the superclass finalizer is passed up.
+     */
+    protected void finalize() throws Throwable
+    {
+        try
+        {
+            nativeRelease(nativeState);
+            nativeState = 0;
+        }
+        finally
+        {
+            super.finalize();
+        }
+    }
 
     /**
      * Provides an iterator that generates all solutions on demand as a sequence of variable bindings.
@@ -240,6 +431,112 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
         return execute(codeBuffer, callPoint.entryPoint);
     }
 
+    /**
+     * Resolves a batch of queries, returning the variable bindings of the first solution to each query in order, or
+     * <tt>null</tt> for each query that fails. The queries are all run by the native machine in one call, and their
+     * bindings written out to a result buffer and decoded from there. Each query is run from the state that the
+     * machine was in at the start of the batch. If the result buffer fills up, the batch is continued from the first
+     * query that did not fit, and the buffer is grown if not even one query fitted.
+     *
+     * <p/>The code of the queries is added after all of the code already in the machine, and dropped again once the
+     * batch is done, so that batches of any number of queries can be run one after another. This leaves no current
+     * query set.
+     *
+     * @param  queries The queries to resolve.
+     *
+     * @return The variable bindings of the first solution to each query, or <tt>null</tt> for each failed query.
+     *
+     * @throws LinkageException      If any of the queries cannot be added to the machine because of a linkage error.
+     * @throws IllegalStateException If the bindings of a query do not fit in the largest result buffer, as they may
+     *                               when they are cyclic.
+     */
+    public List<Set<Variable>> resolveBatch(List<L3CompiledQuery> queries) throws LinkageException
+    {
+        List<Set<Variable>> results = new ArrayList<Set<Variable>>();
+        int batchStart = codeBuffer.position();
+
+        try
+        {
+            for (L3CompiledQuery query : queries)
+            {
+                setQuery(query);
+            }
+
+            int resultSize = BATCH_RESULT_SIZE;
+            ByteBuffer resultBuffer = ByteBuffer.allocateDirect(resultSize * 4).order(ByteOrder.nativeOrder());
+
+            while (results.size() < queries.size())
+            {
+                List<L3CompiledQuery> remaining = queries.subList(results.size(), queries.size());
+
+                // Write out the queries still to run, in the byte order of the native machine.
+                int querySize = 0;
+
+                for (L3CompiledQuery query : remaining)
+                {
+                    querySize += sizeofBatchQuery(query);
+                }
+
+                ByteBuffer queryBuffer = ByteBuffer.allocateDirect(querySize * 4).order(ByteOrder.nativeOrder());
+                IntBuffer queryInts = queryBuffer.asIntBuffer();
+
+                for (L3CompiledQuery query : remaining)
+                {
+                    encodeBatchQuery(query, queryInts);
+                }
+
+                int completed = executeBatch(nativeState, codeBuffer, queryBuffer, remaining.size(), resultBuffer);
+
+                // Grow the result buffer if not even the first query fitted in it.
+                if (completed == 0)
+                {
+                    if (resultSize >= MAX_BATCH_RESULT_SIZE)
+                    {
+                        throw new IllegalStateException("The bindings of a query in the batch do not fit in " +
+                            MAX_BATCH_RESULT_SIZE + " ints, and may be cyclic.");
+                    }
+
+                    resultSize = Math.min(resultSize * 2, MAX_BATCH_RESULT_SIZE);
+                    resultBuffer = ByteBuffer.allocateDirect(resultSize * 4).order(ByteOrder.nativeOrder());
+
+                    continue;
+                }
+
+                IntBuffer resultInts = resultBuffer.asIntBuffer();
+
+                for (L3CompiledQuery query : remaining.subList(0, completed))
+                {
+                    results.add(decodeBatchResult(query, resultInts));
+                }
+            }
+
+            return results;
+        }
+        finally
+        {
+            // The code of the queries is only needed while they run, so its space is given back once they are done.
+            rewindCode(batchStart);
+            clearCurrentQuery();
+        }
+    }
+
+    /**
+     * Implements {@link #resolveBatch(List)} on the state of the native machine. The query buffer holds, for each
+     * query, its entry point, the number of its variables, and the stack offset of each variable. The result buffer
+     * receives, for each query, 1 or 0 for success or failure, followed on success by each variable binding in prefix
+     * order, as the tag and address of each term.
+     *
+     * @param  state        A handle onto the native machine state.
+     * @param  codeBuffer   The code buffer.
+     * @param  queryBuffer  The queries to run.
+     * @param  queryCount   The number of queries to run.
+     * @param  resultBuffer The buffer to write the results to.
+     *
+     * @return The number of queries that were run and had their results written out.
+     */
+    private native int executeBatch(long state, ByteBuffer codeBuffer, ByteBuffer queryBuffer, int queryCount,
+        ByteBuffer resultBuffer);
+
     /**
      * Notified whenever code is added to the machine. This provides a hook in point at which the machine may, if
      * required, compile the code down below the byte code level.
@@ -248,7 +545,20 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
      * @param codeOffset The start offset of the new code.
      * @param length     The length of the new code.
      */
-    protected native void codeAdded(ByteBuffer codeBuffer, int codeOffset, int length);
+    protected void codeAdded(ByteBuffer codeBuffer, int codeOffset, int length)
+    {
+        codeAdded(nativeState, codeBuffer, codeOffset, length);
+    }
+
+    /**
+     * Implements {@link #codeAdded(ByteBuffer, int, int)} on the state of the native machine.
+     *
+     * @param state      A handle onto the native machine state.
+     * @param codeBuffer As for {@link #codeAdded(ByteBuffer, int, int)}.
+     * @param codeOffset As for {@link #codeAdded(ByteBuffer, int, int)}.
+     * @param length     As for {@link #codeAdded(ByteBuffer, int, int)}.
+     */
+    private native void codeAdded(long state, ByteBuffer codeBuffer, int codeOffset, int length);
 
     /**
      * Executes a compiled byte code returning an indication of whether or not a unification was found.
@@ -258,27 +568,194 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
      *
      * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
      */
-    protected native boolean execute(ByteBuffer codeBuffer, int codeOffset);
+    protected boolean execute(ByteBuffer codeBuffer, int codeOffset)
+    {
+        return execute(nativeState, codeBuffer, codeOffset);
+    }
+
+    /**
+     * Implements {@link #execute(ByteBuffer, int)} on the state of the native machine.
+     *
+     * @param  state      A handle onto the native machine state.
+     * @param  codeBuffer As for {@link #execute(ByteBuffer, int)}.
+     * @param  codeOffset As for {@link #execute(ByteBuffer, int)}.
+     *
+     * @return As for {@link #execute(ByteBuffer, int)}.
+     */
+    private native boolean execute(long state, ByteBuffer codeBuffer, int codeOffset);
+
+    /**
+     * Starts resolving the current query, running it for at most a budget of calls before suspending it, so that a
+     * long running query can be time sliced with other work, or abandoned. A suspended query is continued with
+     * {@link #resumeBudgeted(long)}, and once it has succeeded its bindings are read with {@link #getBindings()}.
+     *
+     * @param  budget The most calls to make before suspending, or zero or less to run to completion.
+     *
+     * @return One of {@link #FAILED}, {@link #SUCCEEDED} or {@link #SUSPENDED}.
+     */
+    public int resolveBudgeted(long budget)
+    {
+        // Check that a query has been set to resolve.
+        L3CompiledQuery query = getCurrentQuery();
+
+        if (query == null)
+        {
+            throw new IllegalStateException("No query set to resolve.");
+        }
+
+        return executeBudget(nativeState, codeBuffer, queryEntryPoint, budget);
+    }
+
+    /**
+     * Continues resolving a suspended query, for at most a further budget of calls.
+     *
+     * @param  budget The most calls to make before suspending again, or zero or less to run to completion.
+     *
+     * @return One of {@link #FAILED}, {@link #SUCCEEDED} or {@link #SUSPENDED}. {@link #FAILED} is returned if there
+     *         is no suspended query to continue.
+     */
+    public int resumeBudgeted(long budget)
+    {
+        return resume(nativeState, budget);
+    }
+
+    /**
+     * Asks the query being run to suspend at its next call. This may be called from any thread, and the query
+     * reports {@link #SUSPENDED} when it stops, so that it can still be resumed. A query run with {@link #resolve()}
+     * fails when interrupted, as it cannot be resumed.
+     */
+    public void interrupt()
+    {
+        interrupt(nativeState);
+    }
+
+    /**
+     * Reads the variable bindings of the current query, once a budgeted resolution of it has succeeded.
+     *
+     * @return A set of variable bindings resulting from the query.
+     */
+    public Set<Variable> getBindings()
+    {
+        return extractBindings(getCurrentQuery());
+    }
+
+    /**
+     * Implements {@link #resolveBudgeted(long)} on the state of the native machine.
+     *
+     * @param  state      A handle onto the native machine state.
+     * @param  codeBuffer The code buffer.
+     * @param  codeOffset The start address of the query to execute.
+     * @param  budget     As for {@link #resolveBudgeted(long)}.
+     *
+     * @return As for {@link #resolveBudgeted(long)}.
+     */
+    private native int executeBudget(long state, ByteBuffer codeBuffer, int codeOffset, long budget);
+
+    /**
+     * Implements {@link #resumeBudgeted(long)} on the state of the native machine.
+     *
+     * @param  state  A handle onto the native machine state.
+     * @param  budget As for {@link #resumeBudgeted(long)}.
+     *
+     * @return As for {@link #resumeBudgeted(long)}.
+     */
+    private native int resume(long state, long budget);
+
+    /**
+     * Implements {@link #interrupt()} on the state of the native machine.
+     *
+     * @param state A handle onto the native machine state.
+     */
+    private native void interrupt(long state);
+
+    /**
+     * Turns rollback on or off. With rollback on, each query is started from the heap and stacks that the machine had
+     * when rollback was turned on, or when it was last reset, so that a long lived machine runs in flat memory without
+     * being reset between queries. The bindings of a query must be read before the next query is run, as they are
+     * written over by it.
+     *
+     * @param enabled <tt>true</tt> to start each query from the watermark, <tt>false</tt> not to.
+     */
+    public void setRollback(boolean enabled)
+    {
+        setRollback(nativeState, enabled);
+    }
+
+    /**
+     * Implements {@link #setRollback(boolean)} on the state of the native machine.
+     *
+     * @param state   A handle onto the native machine state.
+     * @param enabled As for {@link #setRollback(boolean)}.
+     */
+    private native void setRollback(long state, boolean enabled);
 
     /** {@inheritDoc} */
-    protected native int deref(int a);
+    protected int deref(int a)
+    {
+        // tag, value <- STORE[a]
+        int addr = a;
+        long tmp = getCell(a);
+        derefTag = getCellTag(tmp);
+        derefVal = getCellVal(tmp);
+
+        // while tag = REF and value != a
+        while ((derefTag == L3Instruction.REF))
+        {
+            // tag, value <- STORE[a]
+            addr = derefVal;
+            tmp = getCell(derefVal);
+            derefTag = getCellTag(tmp);
+            tmp = getCellVal(tmp);
+
+            // Break on free var.
+            if (derefVal == tmp)
+            {
+                break;
+            }
+
+            derefVal = (int) tmp;
+        }
+
+        return addr;
+    }
 
     /** {@inheritDoc} */
-    protected native int derefStack(int a);
+    protected int derefStack(int a)
+    {
+        // The environment frame is only known to the native machine, but the dereference is completed here so that
+        // the tag and value are available through getDerefTag and getDerefVal.
+        return deref(derefStack(nativeState, a));
+    }
+
+    /**
+     * Implements {@link #derefStack(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  a     As for {@link #derefStack(int)}.
+     *
+     * @return As for {@link #derefStack(int)}.
+     */
+    private native int derefStack(long state, int a);
 
     /**
      * Gets the heap cell tag for the most recent dereference operation.
      *
      * @return The heap cell tag for the most recent dereference operation.
      */
-    protected native byte getDerefTag();
+    protected byte getDerefTag()
+    {
+        return derefTag;
+    }
 
     /**
      * Gets the heap call value for the most recent dereference operation.
      *
      * @return The heap call value for the most recent dereference operation.
      */
-    protected native int getDerefVal();
+    protected int getDerefVal()
+    {
+        return derefVal;
+    }
 
     /**
      * Gets the value of the heap cell at the specified location.
@@ -287,7 +764,102 @@ public class L3ResolvingNativeMachine extends L3ResolvingMachine
      *
      * @return The heap cell at the specified location.
      */
-    protected native int getHeap(int addr);
+    protected int getHeap(int addr)
+    {
+        return (int) getCell(addr);
+    }
+
+    /**
+     * Reads a heap cell from the data area of the native machine, widened to a long whatever the cell layout.
+     *
+     * @param  addr The address to fetch from the heap.
+     *
+     * @return The heap cell at the specified location.
+     */
+    private long getCell(int addr)
+    {
+        return (wideHeap != null) ? wideHeap.get(addr) : heap.get(addr);
+    }
+
+    /**
+     * Extracts the tag from a heap cell. 64 bit cells hold a 3 bit tag below the value, compact cells an 8 bit tag
+     * above a 24 bit value.
+     *
+     * @param  cell The heap cell.
+     *
+     * @return The tag of the heap cell.
+     */
+    private byte getCellTag(long cell)
+    {
+        return (wideHeap != null) ? (byte) (cell & 0x7) : (byte) ((cell & 0xFF000000L) >> 24);
+    }
+
+    /**
+     * Extracts the value, or address, from a heap cell.
+     *
+     * @param  cell The heap cell.
+     *
+     * @return The value of the heap cell.
+     */
+    private int getCellVal(long cell)
+    {
+        return (wideHeap != null) ? (int) ((cell >>> 3) & 0x7FFFFFFF) : (int) (cell & 0x00FFFFFF);
+    }
+
+    /**
+     * Creates a direct byte buffer onto the data area of the native machine, that the registers, heap and stacks are
+     * held in. The buffer is only valid until the machine is next reset.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return A direct byte buffer onto the data area of the native machine.
+     */
+    private native ByteBuffer getDataArea(long state);
+
+    /**
+     * Reports the size in bytes of the heap cells that the native machine was built with.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return The size of a heap cell in bytes, 4 for compact cells or 8 for 64 bit cells.
+     */
+    private native int getCellSize(long state);
+
+    /**
+     * Provides a view onto the execution profile of the native machine, when it was built with NATIVE_PROFILE. The
+     * counters are laid out as described in profile.h of the native library, and as for the L2 native machine, and
+     * are updated in place as the machine runs. They accumulate over all queries and resets, until they are cleared.
+     *
+     * @return A view onto the profile counters, or <tt>null</tt> if profiling was not compiled into the native machine.
+     */
+    public LongBuffer getProfile()
+    {
+        ByteBuffer profile = getProfile(nativeState);
+
+        return (profile != null) ? profile.order(ByteOrder.nativeOrder()).asLongBuffer() : null;
+    }
+
+    /** Zeroes the execution profile of the native machine. This does nothing if profiling was not compiled in. */
+    public void clearProfile()
+    {
+        clearProfile(nativeState);
+    }
+
+    /**
+     * Creates a direct byte buffer onto the profile counters of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return A direct byte buffer onto the profile counters, or <tt>null</tt> if profiling was not compiled in.
+     */
+    private native ByteBuffer getProfile(long state);
+
+    /**
+     * Implements {@link #clearProfile()} on the state of the native machine.
+     *
+     * @param state A handle onto the native machine state.
+     */
+    private native void clearProfile(long state);
 
     /**
      * This is a call back onto the trace logger, that the native code can use to do any trace logging through Java,
@@ -21,6 +21,12 @@ import java.nio.ByteBuffer;
  * IntIntOpenLinearTable implements a {@link CodeBufferTable} using open addressing and linear probing with a step size
  * of one.
  *
+ * <p/>The table uses the largest power of two number of entries that fits in the area it is given, so that a hashed key
+ * is reduced to an entry by masking rather than division, and probing wraps around the end of the table. Each entry is
+ * a key followed by its address, so a successful lookup usually touches a single cache line. A key of zero marks an
+ * empty entry, so zero cannot be used as a key. The native WAM reads tables laid out by this class directly from the
+ * code buffer, in <tt>wamGetHash</tt>, and the two must be kept in step.
+ *
  * <pre><p/><table id="crc"><caption>CRC Card</caption>
  * <tr><th> Responsibilities <th> Collaborations
  * <tr><td> Establish a table on a ByteBuffer. </td></tr>
@@ -38,24 +44,33 @@ public class IntIntOpenLinearTable implements CodeBufferTable
     /** The offset of the base of the table within the byte buffer. */
     private int offset;
 
-    /** The size of the table in number of entries (not bytes or integers). */
-    private int size;
+    /** The mask to apply to an entry offset to keep it within the table, one less than the number of entries. */
+    private int mask;
 
     /** {@inheritDoc} */
     public void setup(ByteBuffer buffer, int t, int n)
     {
         this.buffer = buffer;
         this.offset = t;
-        this.size = (n >> 3); // Shift by 3 as key and value must be stored as a pair, making 8 bytes per entry.
+
+        // Shift by 3 as key and value must be stored as a pair, making 8 bytes per entry.
+        int size = (n >> 3);
+        this.mask = (size > 0) ? (Integer.highestOneBit(size) - 1) : -1;
     }
 
     /** {@inheritDoc} */
     public int get(int key)
     {
-        int addr = addr(hash(key));
+        if (mask < 0)
+        {
+            return 0;
+        }
+
+        int entry = hash(key);
 
-        while (true)
+        for (int probes = 0; probes <= mask; probes++)
         {
+            int addr = addr(entry);
             int tableKey = buffer.getInt(addr);
 
             if (key == tableKey)
@@ -68,34 +83,34 @@ public class IntIntOpenLinearTable implements CodeBufferTable
                 return 0;
             }
 
-            addr += 8;
+            entry++;
         }
+
+        return 0;
     }
 
     /** {@inheritDoc} */
     public void put(int key, int val)
     {
-        int addr = addr(hash(key));
+        int entry = hash(key);
 
-        while (true)
+        for (int probes = 0; probes <= mask; probes++)
         {
+            int addr = addr(entry);
             int tableKey = buffer.getInt(addr);
 
-            if (key == tableKey)
+            if ((key == tableKey) || (tableKey == 0))
             {
-                break;
-            }
+                buffer.putInt(addr, key);
+                buffer.putInt(addr + 4, val);
 
-            if (tableKey == 0)
-            {
-                break;
+                return;
             }
 
-            addr += 8;
+            entry++;
         }
 
-        buffer.putInt(addr, key);
-        buffer.putInt(addr + 4, val);
+        throw new IllegalStateException("The table is full.");
     }
 
     /**
@@ -108,11 +123,12 @@ public class IntIntOpenLinearTable implements CodeBufferTable
      */
     private int addr(int entry)
     {
-        return offset + ((entry % size) << 3);
+        return offset + ((entry & mask) << 3);
     }
 
     /**
-     * Computes a hash of the key.
+     * Computes a hash of the key. Interned names are allocated sequentially, so the key is multiplied by the golden
+     * ratio and its high bits folded down, to spread neighbouring keys over the table.
      *
      * @param  key The key to hash.
      *
@@ -120,6 +136,8 @@ public class IntIntOpenLinearTable implements CodeBufferTable
      */
     private int hash(int key)
     {
-        return key;
+        int h = key * 0x9E3779B9;
+
+        return h ^ (h >>> 16);
     }
 }
@@ -25,6 +25,8 @@ import com.thesett.aima.logic.fol.FunctorName;
 import com.thesett.aima.logic.fol.Variable;
 import com.thesett.aima.logic.fol.wam.compiler.WAMCallPoint;
 import com.thesett.aima.logic.fol.wam.compiler.WAMInstruction;
+import com.thesett.aima.logic.fol.wam.indexing.CodeBufferTable;
+import com.thesett.aima.logic.fol.wam.indexing.IntIntOpenLinearTable;
 import static com.thesett.aima.logic.fol.wam.compiler.WAMInstruction.ALLOCATE;
 import static com.thesett.aima.logic.fol.wam.compiler.WAMInstruction.ALLOCATE_N;
 import static com.thesett.aima.logic.fol.wam.compiler.WAMInstruction.CALL;
@@ -222,6 +224,9 @@ public class WAMResolvingJavaMachine extends WAMResolvingMachine
     /** Indicates that the machine has been suspended, upon finding a solution. */
     private boolean suspended;
 
+    /** Used to look up the branches of the switch tables held in the code buffer. */
+    private final CodeBufferTable switchTable = new IntIntOpenLinearTable();
+
     /**
      * Creates a unifying virtual machine for WAM with default heap sizes.
      *
@@ -1434,9 +1439,10 @@ public class WAMResolvingJavaMachine extends WAMResolvingMachine
                 // <tag, val> <- STORE[deref(A1)]
                 deref(1);
 
-                int val = derefVal;
+                // Structures are switched on their functor, f/n <- STORE[val]
+                int val = data.get(derefVal);
 
-                // <found, inst> <- get_hash(val, T, N)
+                // <found, inst> <- get_hash(f/n, T, N)
                 int inst = getHash(val, t, n);
 
                 // if found
@@ -1956,7 +1962,9 @@ public class WAMResolvingJavaMachine extends WAMResolvingMachine
      */
     private int getHash(int val, int t, int n)
     {
-        return 0;
+        switchTable.setup(codeBuffer, t, n);
+
+        return switchTable.get(val);
     }
 
     /**
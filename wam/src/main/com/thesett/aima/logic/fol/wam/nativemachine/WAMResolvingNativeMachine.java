@@ -16,6 +16,7 @@
 package com.thesett.aima.logic.fol.wam.nativemachine;
 
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.nio.IntBuffer;
 import java.util.Iterator;
 import java.util.Set;
@@ -24,6 +25,7 @@ import com.thesett.aima.logic.fol.Variable;
 import com.thesett.aima.logic.fol.wam.compiler.WAMCallPoint;
 import com.thesett.aima.logic.fol.wam.machine.WAMInternalRegisters;
 import com.thesett.aima.logic.fol.wam.machine.WAMMemoryLayout;
+import com.thesett.aima.logic.fol.wam.machine.WAMResolvingJavaMachine;
 import com.thesett.aima.logic.fol.wam.machine.WAMResolvingMachine;
 import com.thesett.common.error.ImplementationUnavailableException;
 import com.thesett.common.error.NotImplementedException;
@@ -53,8 +55,26 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
     /** Used for tracing instruction executions. */
     /* private static final Logger trace = Logger.getLogger("TRACE.WAMResolvingNativeMachine"); */
 
-    /** Defines the initial code area size for the virtual machine. */
-    private static final int CODE_SIZE = 10000;
+    /**
+     * Defines the default code area size of the native machine in bytes. This is the same as the Java machine uses. The
+     * code area does not grow, so it must be large enough to hold every program and query loaded into the machine.
+     */
+    public static final int DEFAULT_CODE_SIZE = 1000000;
+
+    /** Defines the default register capacity for the native machine. */
+    public static final int DEFAULT_REG_SIZE = 256;
+
+    /** Defines the default heap size of the native machine. */
+    public static final int DEFAULT_HEAP_SIZE = 10000000;
+
+    /** Defines the default stack size of the native machine. */
+    public static final int DEFAULT_STACK_SIZE = 1000000;
+
+    /** Defines the default trail size of the native machine. */
+    public static final int DEFAULT_TRAIL_SIZE = 10000;
+
+    /** Defines the default max unification stack depth of the native machine. */
+    public static final int DEFAULT_PDL_SIZE = 10000;
 
     /** Used to record whether the native implementation library was successfully loaded. */
     private static boolean libraryFound;
@@ -62,15 +82,64 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
     /** Used to record whether an attempt to load the native library has been made. */
     private static boolean libraryLoadAttempted;
 
+    /** Holds the code area size of the native machine. */
+    private final int codeSize;
+
+    /** Holds the register capacity of the native machine. */
+    private final int regSize;
+
+    /** Holds the heap size of the native machine. */
+    private final int heapSize;
+
+    /** Holds the stack size of the native machine. */
+    private final int stackSize;
+
+    /** Holds the trail size of the native machine. */
+    private final int trailSize;
+
+    /** Holds the max unification stack depth of the native machine. */
+    private final int pdlSize;
+
+    /** Holds a handle onto the state of the native machine, created when the machine is first reset. */
+    private long nativeState;
+
     /**
      * Creates a unifying virtual machine for WAM with default heap sizes.
      *
      * @param symbolTable The symbol table for the machine.
      */
     public WAMResolvingNativeMachine(SymbolTable<Integer, String, Object> symbolTable)
+    {
+        this(symbolTable, DEFAULT_CODE_SIZE, DEFAULT_REG_SIZE, DEFAULT_HEAP_SIZE, DEFAULT_STACK_SIZE,
+            DEFAULT_TRAIL_SIZE, DEFAULT_PDL_SIZE);
+    }
+
+    /**
+     * Creates a unifying virtual machine for WAM with the specified code area and heap sizes. The native machine
+     * reserves its data area up front, but only uses memory as the heap and stacks grow into it, so generous sizes are
+     * cheap. Running out of space fails the query being executed. The code area is a direct byte buffer allocated in
+     * full on every reset, so machines that only run small programs, such as one per thread, can use a smaller one.
+     *
+     * @param symbolTable The symbol table for the machine.
+     * @param codeSize    The size of the code area in bytes.
+     * @param regSize     The number of registers.
+     * @param heapSize    The size of the heap in cells.
+     * @param stackSize   The size of the stack in cells.
+     * @param trailSize   The size of the trail in cells.
+     * @param pdlSize     The max unification stack depth in cells.
+     */
+    public WAMResolvingNativeMachine(SymbolTable<Integer, String, Object> symbolTable, int codeSize, int regSize,
+        int heapSize, int stackSize, int trailSize, int pdlSize)
     {
         super(symbolTable);
 
+        this.codeSize = codeSize;
+        this.regSize = regSize;
+        this.heapSize = heapSize;
+        this.stackSize = stackSize;
+        this.trailSize = trailSize;
+        this.pdlSize = pdlSize;
+
         // Reset the machine to its initial state.
         reset();
     }
@@ -122,21 +191,61 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
      */
     public void reset()
     {
-        // Clear the code buffer.
-        codeBuffer = ByteBuffer.allocateDirect(CODE_SIZE);
+        // Clear the code buffer. The native code reads multi-byte operands in the platform byte order.
+        codeBuffer = ByteBuffer.allocateDirect(codeSize);
+        codeBuffer.order(ByteOrder.nativeOrder());
 
         // Reset the native part of the machine.
-        nativeReset();
+        nativeState = nativeReset(nativeState, regSize, heapSize, stackSize, trailSize, pdlSize);
 
         // Ensure that the overridden reset method of WAMBaseMachine is run too, to clear the call table.
         super.reset();
+
+        // Put the internal functions in the call table.
+        setInternalCodeAddress(internFunctorName("call", 1), WAMResolvingJavaMachine.CALL_1_ID);
+        setInternalCodeAddress(internFunctorName("execute", 1), WAMResolvingJavaMachine.EXECUTE_1_ID);
     }
 
     /**
      * Resets the machine, to its initial state. This clears any programs from the machine, and clears all of its stacks
-     * and heaps.
+     * and heaps. The native state is created on the first reset, and reused by later ones.
+     *
+     * @param  state     A handle onto the native machine state, or zero if it has not been created yet.
+     * @param  regSize   The number of registers.
+     * @param  heapSize  The size of the heap in cells.
+     * @param  stackSize The size of the stack in cells.
+     * @param  trailSize The size of the trail in cells.
+     * @param  pdlSize   The max unification stack depth in cells.
+     *
+     * @return A handle onto the native machine state.
+     */
+    private native long nativeReset(long state, int regSize, int heapSize, int stackSize, int trailSize,
+        int pdlSize);
+
+    /**
+     * Releases the state of the native machine. Releasing a zero handle does nothing.
+     *
+     * @param state A handle onto the native machine state.
+     */
+    private native void nativeRelease(long state);
+
+    /**
+     * Releases the state of the native machine, once this machine is no longer referenced.
+     *
+     * @throws Throwable Any exception from the superclass finalizer is passed up.
      */
-    public native void nativeReset();
+    protected void finalize() throws Throwable
+    {
+        try
+        {
+            nativeRelease(nativeState);
+            nativeState = 0;
+        }
+        finally
+        {
+            super.finalize();
+        }
+    }
 
     /**
      * Provides an iterator that generates all solutions on demand as a sequence of variable bindings.
@@ -168,6 +277,30 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
         throw new NotImplementedException();
     }
 
+    /**
+     * Sets the number of worker threads that queries are searched with. With more than one, the alternative clauses of
+     * a query are explored in parallel, with idle workers taking the oldest unexplored choice points from busy ones.
+     * This is intended for pure search over alternatives, where every solution is wanted; the solutions are produced
+     * in no particular order, and cuts only prune alternatives that have not already been handed to another worker.
+     * Predicates invoked through call/1 are resolved from the worker threads concurrently, so no code should be added
+     * to the machine while a query is being searched in parallel. Where the native library is built without thread
+     * support, queries are always searched sequentially.
+     *
+     * @param workers The number of worker threads, or zero or one to search sequentially.
+     */
+    public void setParallelWorkers(int workers)
+    {
+        setParallelWorkers(nativeState, workers);
+    }
+
+    /**
+     * Implements {@link #setParallelWorkers(int)} on the state of the native machine.
+     *
+     * @param state   A handle onto the native machine state.
+     * @param workers As for {@link #setParallelWorkers(int)}.
+     */
+    private native void setParallelWorkers(long state, int workers);
+
     /** {@inheritDoc} */
     public IntBuffer getDataBuffer()
     {
@@ -177,13 +310,19 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
     /** {@inheritDoc} */
     public WAMInternalRegisters getInternalRegisters()
     {
-        throw new UnsupportedOperationException();
+        int[] regs = getNativeRegisters();
+
+        return new WAMInternalRegisters(regs[0], regs[1], regs[2], regs[3], regs[4], regs[5], regs[6], regs[7],
+            regs[8], regs[9] != 0);
     }
 
     /** {@inheritDoc} */
     public WAMMemoryLayout getMemoryLayout()
     {
-        throw new UnsupportedOperationException();
+        int[] layout = getNativeMemoryLayout();
+
+        return new WAMMemoryLayout(layout[0], layout[1], layout[2], layout[3], layout[4], layout[5], layout[6],
+            layout[7], layout[8], layout[9]);
     }
 
     /** {@inheritDoc} */
@@ -198,7 +337,20 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
      * <p/>This provides a hook in point at which the machine may, if required, compile the code down below the byte
      * code level.
      */
-    protected native void codeAdded(ByteBuffer codeBuffer, int codeOffset, int length);
+    protected void codeAdded(ByteBuffer codeBuffer, int codeOffset, int length)
+    {
+        codeAdded(nativeState, codeBuffer, codeOffset, length);
+    }
+
+    /**
+     * Implements {@link #codeAdded(ByteBuffer, int, int)} on the state of the native machine.
+     *
+     * @param state      A handle onto the native machine state.
+     * @param codeBuffer As for {@link #codeAdded(ByteBuffer, int, int)}.
+     * @param codeOffset As for {@link #codeAdded(ByteBuffer, int, int)}.
+     * @param length     As for {@link #codeAdded(ByteBuffer, int, int)}.
+     */
+    private native void codeAdded(long state, ByteBuffer codeBuffer, int codeOffset, int length);
 
     /**
      * Executes a compiled byte code returning an indication of whether or not a unification was found.
@@ -208,27 +360,91 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
      *
      * @return <tt>true</tt> if a unification was found, <tt>false</tt> if the search for one failed.
      */
-    protected native boolean execute(ByteBuffer codeBuffer, int codeOffset);
+    protected boolean execute(ByteBuffer codeBuffer, int codeOffset)
+    {
+        return execute(nativeState, codeBuffer, codeOffset);
+    }
+
+    /**
+     * Implements {@link #execute(ByteBuffer, int)} on the state of the native machine.
+     *
+     * @param  state      A handle onto the native machine state.
+     * @param  codeBuffer As for {@link #execute(ByteBuffer, int)}.
+     * @param  codeOffset As for {@link #execute(ByteBuffer, int)}.
+     *
+     * @return As for {@link #execute(ByteBuffer, int)}.
+     */
+    private native boolean execute(long state, ByteBuffer codeBuffer, int codeOffset);
 
     /** {@inheritDoc} */
-    protected native int deref(int a);
+    protected int deref(int a)
+    {
+        return deref(nativeState, a);
+    }
+
+    /**
+     * Implements {@link #deref(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  a     As for {@link #deref(int)}.
+     *
+     * @return As for {@link #deref(int)}.
+     */
+    private native int deref(long state, int a);
 
     /** {@inheritDoc} */
-    protected native int derefStack(int a);
+    protected int derefStack(int a)
+    {
+        return derefStack(nativeState, a);
+    }
+
+    /**
+     * Implements {@link #derefStack(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  a     As for {@link #derefStack(int)}.
+     *
+     * @return As for {@link #derefStack(int)}.
+     */
+    private native int derefStack(long state, int a);
 
     /**
      * Gets the heap cell tag for the most recent dereference operation.
      *
      * @return The heap cell tag for the most recent dereference operation.
      */
-    protected native byte getDerefTag();
+    protected byte getDerefTag()
+    {
+        return getDerefTag(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefTag()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefTag()}.
+     */
+    private native byte getDerefTag(long state);
 
     /**
      * Gets the heap call value for the most recent dereference operation.
      *
      * @return The heap call value for the most recent dereference operation.
      */
-    protected native int getDerefVal();
+    protected int getDerefVal()
+    {
+        return getDerefVal(nativeState);
+    }
+
+    /**
+     * Implements {@link #getDerefVal()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getDerefVal()}.
+     */
+    private native int getDerefVal(long state);
 
     /**
      * Gets the value of the heap cell at the specified location.
@@ -237,7 +453,72 @@ public class WAMResolvingNativeMachine extends WAMResolvingMachine
      *
      * @return The heap cell at the specified location.
      */
-    protected native int getHeap(int addr);
+    protected int getHeap(int addr)
+    {
+        return getHeap(nativeState, addr);
+    }
+
+    /**
+     * Implements {@link #getHeap(int)} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     * @param  addr  As for {@link #getHeap(int)}.
+     *
+     * @return As for {@link #getHeap(int)}.
+     */
+    private native int getHeap(long state, int addr);
+
+    /**
+     * Gets the values of the native machines internal registers.
+     *
+     * @return An array holding ip, hp, hbp, sp, up, ep, bp, b0, trp and write mode (non-zero when set), in that order.
+     */
+    protected int[] getNativeRegisters()
+    {
+        return getNativeRegisters(nativeState);
+    }
+
+    /**
+     * Implements {@link #getNativeRegisters()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getNativeRegisters()}.
+     */
+    private native int[] getNativeRegisters(long state);
+
+    /**
+     * Gets the layout of the native machines data area. The regions may be larger than requested, as they are rounded
+     * up to whole pages of memory, and may have gaps between them.
+     *
+     * @return An array holding the base and size of the registers, heap, stack, trail and PDL, in that order.
+     */
+    protected int[] getNativeMemoryLayout()
+    {
+        return getNativeMemoryLayout(nativeState);
+    }
+
+    /**
+     * Implements {@link #getNativeMemoryLayout()} on the state of the native machine.
+     *
+     * @param  state A handle onto the native machine state.
+     *
+     * @return As for {@link #getNativeMemoryLayout()}.
+     */
+    private native int[] getNativeMemoryLayout(long state);
+
+    /**
+     * This is a call back onto the call table, that the native code uses to resolve the entry point of a predicate
+     * invoked through call/1.
+     *
+     * @param  f The interned name of the functor to call.
+     *
+     * @return The entry point of the functors code, or <tt>-1</tt> if the functor is not known to the machine.
+     */
+    private int resolveCallPointEntry(int f)
+    {
+        return resolveCallPoint(f).entryPoint;
+    }
 
     /**
      * This is a call back onto the trace logger, that the native code can use to do any trace logging through Java,
@@ -0,0 +1,319 @@
+/*
+ * Copyright The Sett Ltd, 2005 to 2014.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package com.thesett.aima.logic.fol.wam.machine;
+
+import java.util.Set;
+
+import junit.framework.TestCase;
+
+import org.apache.log4j.NDC;
+
+import com.thesett.aima.logic.fol.Clause;
+import com.thesett.aima.logic.fol.Functor;
+import com.thesett.aima.logic.fol.Term;
+import com.thesett.aima.logic.fol.Variable;
+import com.thesett.aima.logic.fol.interpreter.ResolutionEngine;
+import com.thesett.aima.logic.fol.isoprologparser.TokenSource;
+import com.thesett.aima.logic.fol.wam.compiler.WAMCompiledPredicate;
+import com.thesett.aima.logic.fol.wam.compiler.WAMCompiledQuery;
+import com.thesett.aima.logic.fol.wam.compiler.WAMInstruction;
+import com.thesett.aima.logic.fol.wam.indexing.IntIntOpenLinearTable;
+import com.thesett.common.parsing.SourceCodeException;
+
+/**
+ * SwitchInstructionUnitTestBase checks that the switch_on_const and switch_on_struc instructions of a WAM select their
+ * branch from a hash table laid out in the code buffer by {@link IntIntOpenLinearTable}.
+ *
+ * <p/>The compiler does not yet emit these instructions, so each test writes a switch instruction and its table into
+ * the code buffer by hand, and registers them as the code of a predicate. Each branch of the switch is the entry point
+ * of an ordinary compiled predicate of the same arity, that binds its second argument to a different atom. The tables
+ * are placed at offsets that are not a multiple of four, so that the machines must read them without assuming that
+ * they are aligned.
+ *
+ * <pre><p/><table id="crc"><caption>CRC Card</caption>
+ * <tr><th> Responsibilities <th> Collaborations
+ * <tr><td> Check that a switch on a constant jumps to the branch for the constant, or fails on a miss.
+ * <tr><td> Check that a switch on a structure jumps to the branch for its functor, or fails on a miss.
+ * <tr><td> Check that lookups probe past the end of a table and around to its start.
+ * </table></pre>
+ *
+ * @author Rupert Smith
+ */
+public class SwitchInstructionUnitTestBase extends TestCase
+{
+    /** The size of a switch_on_const or switch_on_struc instruction in bytes. */
+    private static final int SWITCH_SIZE = 9;
+
+    /** The size of an entry in a switch table in bytes, a key followed by an address. */
+    private static final int ENTRY_SIZE = 8;
+
+    /** Holds the machine to run the tests on. */
+    protected WAMResolvingMachine machine;
+
+    /** Holds the resolution engine onto the machine. */
+    protected ResolutionEngine<Clause, WAMCompiledPredicate, WAMCompiledQuery> engine;
+
+    /**
+     * Creates a test with the specified name, to run on the specified machine.
+     *
+     * @param name    The name of the test.
+     * @param engine  The resolution engine onto the machine.
+     * @param machine The machine to run the test on.
+     */
+    public SwitchInstructionUnitTestBase(String name,
+        ResolutionEngine<Clause, WAMCompiledPredicate, WAMCompiledQuery> engine, WAMResolvingMachine machine)
+    {
+        super(name);
+
+        this.engine = engine;
+        this.machine = machine;
+    }
+
+    /**
+     * Check that a switch on a constant jumps to the branch for each constant in its table, and fails for a constant
+     * that is not in it.
+     *
+     * @throws Exception If any exception goes uncaught, the test fails.
+     */
+    public void testSwitchOnConstSelectsBranch() throws Exception
+    {
+        addBranches();
+
+        int[] keys = new int[] { constKey("a"), constKey("b"), constKey("c") };
+        addSwitch("s", WAMInstruction.SWITCH_ON_CONST, 8, keys, new String[] { "one", "two", "three" });
+
+        assertBinding("?- s(a, R).", "one");
+        assertBinding("?- s(b, R).", "two");
+        assertBinding("?- s(c, R).", "three");
+        assertBinding("?- s(d, R).", null);
+    }
+
+    /**
+     * Check that a switch on a structure jumps to the branch for the functor of each structure in its table, and fails
+     * for a functor that is not in it, including one with a name in the table but a different arity.
+     *
+     * @throws Exception If any exception goes uncaught, the test fails.
+     */
+    public void testSwitchOnStrucSelectsBranch() throws Exception
+    {
+        addBranches();
+
+        int[] keys = new int[] { strucKey("f", 1), strucKey("g", 2) };
+        addSwitch("s", WAMInstruction.SWITCH_ON_STRUC, 8, keys, new String[] { "one", "two" });
+
+        assertBinding("?- s(f(z), R).", "one");
+        assertBinding("?- s(g(z, z), R).", "two");
+        assertBinding("?- s(f(z, z), R).", null);
+        assertBinding("?- s(h(z), R).", null);
+    }
+
+    /**
+     * Check that a switch finds a key that was placed past the end of its table and around at its start, because its
+     * entry was taken, and that a miss probes around the end of the table in the same way before failing.
+     *
+     * @throws Exception If any exception goes uncaught, the test fails.
+     */
+    public void testSwitchProbesAroundEndOfTable() throws Exception
+    {
+        addBranches();
+
+        // Find three atoms that all hash to the last entry of a table of four entries.
+        int entries = 4;
+        String[] atoms = new String[3];
+        int found = 0;
+
+        for (int i = 0; found < atoms.length; i++)
+        {
+            if (entryFor(constKey("w" + i), entries) == (entries - 1))
+            {
+                atoms[found++] = "w" + i;
+            }
+        }
+
+        int[] keys = new int[] { constKey(atoms[0]), constKey(atoms[1]) };
+        int t = addSwitch("s", WAMInstruction.SWITCH_ON_CONST, entries, keys, new String[] { "one", "two" });
+
+        assertEquals("The first key should be in the last entry.", keys[0],
+            machine.codeBuffer.getInt(t + ((entries - 1) * ENTRY_SIZE)));
+        assertEquals("The second key should have wrapped around to the first entry.", keys[1],
+            machine.codeBuffer.getInt(t));
+
+        assertBinding("?- s(" + atoms[0] + ", R).", "one");
+        assertBinding("?- s(" + atoms[1] + ", R).", "two");
+        assertBinding("?- s(" + atoms[2] + ", R).", null);
+    }
+
+    /**
+     * Adds the predicates that the switches branch to, each of which binds its second argument to a different atom.
+     *
+     * @throws SourceCodeException If the predicates will not parse or compile.
+     */
+    private void addBranches() throws SourceCodeException
+    {
+        compile("one(_, one).");
+        compile("two(_, two).");
+        compile("three(_, three).");
+        engine.endScope();
+    }
+
+    /**
+     * Writes a switch instruction and its table into the code buffer, and registers them as the code of a predicate of
+     * arity two. The table is placed at an offset that is not a multiple of four.
+     *
+     * @param  name     The name of the predicate to register the switch as.
+     * @param  opcode   The switch instruction, switch_on_const or switch_on_struc.
+     * @param  entries  The number of entries in the table.
+     * @param  keys     The keys to put in the table, in order.
+     * @param  branches The names of the branch predicates for the keys.
+     *
+     * @return The offset of the table in the code buffer.
+     */
+    private int addSwitch(String name, byte opcode, int entries, int[] keys, String[] branches)
+    {
+        int start = machine.codeBuffer.position();
+        int t = start + SWITCH_SIZE;
+
+        if ((t & 3) == 0)
+        {
+            t++;
+        }
+
+        int n = entries * ENTRY_SIZE;
+
+        machine.codeBuffer.put(start, opcode);
+        machine.codeBuffer.putInt(start + 1, t);
+        machine.codeBuffer.putInt(start + 5, n);
+
+        for (int i = t; i < (t + n); i++)
+        {
+            machine.codeBuffer.put(i, (byte) 0);
+        }
+
+        IntIntOpenLinearTable table = new IntIntOpenLinearTable();
+        table.setup(machine.codeBuffer, t, n);
+
+        for (int i = 0; i < keys.length; i++)
+        {
+            assertTrue("Zero marks an empty entry, so cannot be a key.", keys[i] != 0);
+
+            int branch = machine.resolveCallPoint(machine.internFunctorName(branches[i], 2)).entryPoint;
+            table.put(keys[i], branch);
+        }
+
+        int length = t + n - start;
+        machine.setCodeAddress(machine.internFunctorName(name, 2), start, length);
+        machine.codeBuffer.position(start + length);
+        machine.codeAdded(machine.codeBuffer, start, length);
+
+        return t;
+    }
+
+    /**
+     * Works out the switch table key for an atom, which is its interned name.
+     *
+     * @param  name The name of the atom.
+     *
+     * @return The switch table key for the atom.
+     */
+    private int constKey(String name)
+    {
+        return machine.internFunctorName(name, 0) & WAMResolvingJavaMachine.CMASK;
+    }
+
+    /**
+     * Works out the switch table key for a structure, which is its functor cell, the arity over the interned name.
+     *
+     * @param  name  The name of the structure.
+     * @param  arity The arity of the structure.
+     *
+     * @return The switch table key for the structure.
+     */
+    private int strucKey(String name, int arity)
+    {
+        return (arity << 24) | (machine.internFunctorName(name, arity) & 0x00ffffff);
+    }
+
+    /**
+     * Works out the entry that a key hashes to first in a table, in the same way as {@link IntIntOpenLinearTable}.
+     *
+     * @param  key     The key.
+     * @param  entries The number of entries in the table, a power of two.
+     *
+     * @return The entry the key is hashed to.
+     */
+    private int entryFor(int key, int entries)
+    {
+        int h = key * 0x9E3779B9;
+
+        return (h ^ (h >>> 16)) & (entries - 1);
+    }
+
+    /**
+     * Compiles a query of the form <tt>?- s(X, R).</tt> and checks that it binds R to the expected atom, or fails.
+     *
+     * @param  query The query to run.
+     * @param  atom  The name of the atom R should be bound to, or <tt>null</tt> if the query should fail.
+     *
+     * @throws SourceCodeException If the query will not parse or compile.
+     */
+    private void assertBinding(String query, String atom) throws SourceCodeException
+    {
+        compile(query);
+
+        Set<Variable> bindings = machine.resolve();
+
+        if (atom == null)
+        {
+            assertNull("The query " + query + " should fail.", bindings);
+
+            return;
+        }
+
+        assertNotNull("The query " + query + " should resolve.", bindings);
+        assertEquals("The query " + query + " should have one binding.", 1, bindings.size());
+
+        Term value = bindings.iterator().next().getValue();
+
+        assertTrue("The query " + query + " should bind R to an atom.", value instanceof Functor);
+        assertEquals("The query " + query + " bound R to the wrong atom.", atom,
+            machine.getFunctorName((Functor) value));
+    }
+
+    /**
+     * Parses and compiles a clause or query on the engine. A compiled query becomes the current query of the machine.
+     *
+     * @param  text The clause or query to compile.
+     *
+     * @throws SourceCodeException If the clause will not parse or compile.
+     */
+    private void compile(String text) throws SourceCodeException
+    {
+        engine.setTokenSource(TokenSource.getTokenSourceForString(text));
+        engine.compile(engine.parse());
+    }
+
+    protected void setUp()
+    {
+        NDC.push(getName());
+
+        engine.reset();
+    }
+
+    protected void tearDown()
+    {
+        NDC.pop();
+    }
+}
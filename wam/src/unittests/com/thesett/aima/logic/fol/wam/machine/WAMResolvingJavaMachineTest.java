@@ -405,6 +405,11 @@ public class WAMResolvingJavaMachineTest extends TestCase
         suite.addTest(new UnifyAndNonUnifyResolverUnitTestBase<Clause, WAMCompiledPredicate, WAMCompiledQuery>(
                 "testFunctorsDifferentNameSameArgsDoNotUnify", engine));
 
+        // Add all tests defined in the SwitchInstructionUnitTestBase class.
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchOnConstSelectsBranch", engine, machine));
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchOnStrucSelectsBranch", engine, machine));
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchProbesAroundEndOfTable", engine, machine));
+
         // Add all the tests defined in this class.
 
         return suite;
@@ -34,6 +34,7 @@ import com.thesett.aima.logic.fol.isoprologparser.Token;
 import com.thesett.aima.logic.fol.wam.compiler.WAMCompiledPredicate;
 import com.thesett.aima.logic.fol.wam.compiler.WAMCompiledQuery;
 import com.thesett.aima.logic.fol.wam.compiler.WAMCompiler;
+import com.thesett.aima.logic.fol.wam.machine.SwitchInstructionUnitTestBase;
 import com.thesett.aima.logic.fol.wam.machine.WAMResolvingJavaMachineTest;
 import com.thesett.aima.logic.fol.wam.machine.WAMResolvingMachine;
 import com.thesett.common.util.doublemaps.SymbolTableImpl;
@@ -238,6 +239,11 @@ public class WAMResolvingNativeMachineTestBase extends TestCase
         suite.addTest(new BacktrackingResolverUnitTestBase<Clause, WAMCompiledPredicate, WAMCompiledQuery>(
                 "testInstantiatingClausesSeveralTimesWithDifferentVariableAllowsIndependentBindings", engine));
 
+        // Add all tests defined in the SwitchInstructionUnitTestBase class.
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchOnConstSelectsBranch", engine, machine));
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchOnStrucSelectsBranch", engine, machine));
+        suite.addTest(new SwitchInstructionUnitTestBase("testSwitchProbesAroundEndOfTable", engine, machine));
+
         // Add all the tests defined in this class.
 
         return suite;